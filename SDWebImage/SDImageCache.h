@@ -13,6 +13,8 @@
 #import <Foundation/Foundation.h>
 #import "SDWebImageCompat.h"
 #import "SDImageCacheConfig.h"
+#import "SDImageCacheEntryMetadata.h"
+#import "SDMemoryCache.h"
 //获取图片的方式类别枚举
 typedef NS_ENUM(NSInteger, SDImageCacheType) {
     /**
@@ -44,6 +46,10 @@ typedef NS_OPTIONS(NSUInteger, SDImageCacheOptions) {
 };
 //查找缓存完成后的回调块
 typedef void(^SDCacheQueryCompletedBlock)(UIImage * _Nullable image, NSData * _Nullable data, SDImageCacheType cacheType);
+// Called for every key of a batch query, see `queryCacheOperationForKeys:options:progress:done:`
+typedef void(^SDCacheBatchQueryProgressBlock)(NSString * _Nonnull key, UIImage * _Nullable image, NSData * _Nullable data, SDImageCacheType cacheType);
+// Called once a batch query is done. `cacheTypes` has an entry for every key, `SDImageCacheTypeNone` for the misses
+typedef void(^SDCacheBatchQueryCompletedBlock)(NSDictionary<NSString *, UIImage *> * _Nonnull images, NSDictionary<NSString *, NSData *> * _Nonnull imageDatas, NSDictionary<NSString *, NSNumber *> * _Nonnull cacheTypes);
 //在缓存中根据指定key查找图片的回调块
 typedef void(^SDWebImageCheckCacheCompletionBlock)(BOOL isInCache);
 //计算磁盘缓存图片个数和占用内存大小的回调块
@@ -67,7 +73,8 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
 @property (nonatomic, nonnull, readonly) SDImageCacheConfig *config;
 
 /**
- * The maximum "total cost" of the in-memory image cache. The cost function is the number of pixels held in memory.
+ * The maximum "total cost" of the in-memory image cache. The cost function is the number of bytes of the decoded images held in memory, all frames of animated images included.
+ * The limit is strict. It holds for the whole memory cache: a store going over it evicts the least recently used images among all lock segments, so any single image up to the limit can be cached.
  //内存缓存的最大cost，以像素为单位，后面有具体计算方法  NSCache的totalCostLimit
  */
 @property (assign, nonatomic) NSUInteger maxMemoryCost;
@@ -78,6 +85,25 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
  */
 @property (assign, nonatomic) NSUInteger maxMemoryCountLimit;
 
+/**
+ * Which images the memory cache admits once it is full. Use `SDMemoryCacheAdmissionPolicyTinyLFU` so that prefetching or scrolling through many images seen once does not flush the frequently reused ones.
+ * Defaults to `SDMemoryCacheAdmissionPolicyLRU`.
+ */
+@property (assign, nonatomic) SDMemoryCacheAdmissionPolicy memoryCacheAdmissionPolicy;
+
+/**
+ * The maximum total size in bytes of the encoded image data kept in memory, when `config.shouldCacheImageDataInMemory` is YES. 0 means no limit.
+ * Defaults to 20MB.
+ */
+@property (assign, nonatomic) NSUInteger maxMemoryDataCost;
+
+/**
+ * A hidden sub directory of the disk cache path for files about to be moved into the disk cache, see `storeImage:imageFileAtPath:forKey:completion:`. Being on the same volume, such a file is moved with a rename.
+ * The files left there, by a download interrupted by a crash for example, are removed by `deleteOldFiles` once they are a day old.
+ * `clearDiskOnCompletion:` keeps this directory, the downloads in flight are still writing to it.
+ */
+@property (nonatomic, copy, readonly, nonnull) NSString *temporaryDirectoryPath;
+
 #pragma mark - Singleton and initialization
 
 /**
@@ -114,6 +140,9 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
 /**
  * Add a read-only cache path to search for images pre-cached by SDImageCache
  * Useful if you want to bundle pre-loaded images with your app
+ * A path with the `sdarchive` extension is opened as an `SDImageCacheArchive`: its table of contents is read at once, and lookups do not touch the file system.
+ * Prefer an archive for large sets of bundled images.
+ * A directory is listed once when added, so lookups only read the files it holds. Files added to it later are found after the next disk cleanup.
  *
  * @param path The path to use for this read-only cache path
  添加一个只读的缓存路径，以后在查找磁盘缓存时也会从这个路径中查找
@@ -185,6 +214,7 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
  * Synchronously store image NSData into disk cache at the given key.
  *
  * @warning This method is synchronous, make sure to call it from the ioQueue
+ * @note This always writes right away, whatever the `diskWritePolicy`
  *
  * @param imageData  The image data to store
  * @param key        The unique image cache key, usually it's image absolute URL
@@ -194,6 +224,28 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
  key 图片的唯一ID，一般使用URL
  */
 - (void)storeImageDataToDisk:(nullable NSData *)imageData forKey:(nullable NSString *)key;
+
+/**
+ * Asynchronously store an image into memory cache, and move the file of its data into the disk cache at the given key.
+ * The file is not read, so storing a large download neither loads it into memory nor writes it a second time. A query of the key sees either the previous data or the whole file.
+ * Small files still go to the pack store when `config.shouldUseDiskPackStore` is YES.
+ *
+ * @param image           The image to store in memory, or nil to only store the file
+ * @param path            The file of the image data as returned by the server. It is moved, so put it in `temporaryDirectoryPath`, otherwise it is copied across volumes
+ * @param key             The unique image cache key, usually it's image absolute URL
+ * @param completionBlock A block executed on the main queue after the file is moved
+ */
+- (void)storeImage:(nullable UIImage *)image
+   imageFileAtPath:(nonnull NSString *)path
+            forKey:(nullable NSString *)key
+        completion:(nullable SDWebImageNoParamsBlock)completionBlock;
+
+/**
+ * Asynchronously write the stores buffered by a write-behind `diskWritePolicy` to disk.
+ *
+ * @param completionBlock A block executed on the main queue after the buffered stores are written
+ */
+- (void)flushPendingDiskWritesWithCompletion:(nullable SDWebImageNoParamsBlock)completionBlock;
 /*
  提供了内存缓存和磁盘缓存的不同存储方式方法，提供了不同的接口，但真正执行的方法只有一个，这样的设计方式值得我们学习。
  */
@@ -239,6 +291,37 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
  */
 - (nullable NSOperation *)queryCacheOperationForKey:(nullable NSString *)key options:(SDImageCacheOptions)options done:(nullable SDCacheQueryCompletedBlock)doneBlock;
 
+/**
+ * Operation that queries the cache for many keys at once, and call the completion once when all of them are done.
+ * The memory cache is checked for all keys in one pass. The keys which need the disk are grouped by io queue, so each group costs a single dispatch and a single hop back to the main queue.
+ * This is much cheaper than one `queryCacheOperationForKey:options:done:` per key when a screen asks for dozens of images.
+ *
+ * @param keys          The unique keys used to store the wanted images. Duplicates are queried once
+ * @param options       A mask to specify options to use for this cache query
+ * @param progressBlock Called for every key as its result is known. The memory hits are reported before this method returns, the disk results group by group on the main queue (or inline with `SDImageCacheQueryDiskSync`)
+ * @param doneBlock     Called once with the results of all keys, after the last progress. Will not get called if the operation is cancelled
+ *
+ * @return a NSOperation instance to cancel the disk queries, or nil if all keys were answered from memory
+ */
+- (nullable NSOperation *)queryCacheOperationForKeys:(nonnull NSArray<NSString *> *)keys
+                                             options:(SDImageCacheOptions)options
+                                            progress:(nullable SDCacheBatchQueryProgressBlock)progressBlock
+                                                done:(nullable SDCacheBatchQueryCompletedBlock)doneBlock;
+
+/**
+ * Operation that queries the cache for an image to show at the given size in pixels, and call the completion when done.
+ * The image is scaled down to cover the size, keeping its aspect ratio, and kept in the memory cache as a variant of the key. So a thumbnail does not hold the full size bitmap.
+ * An image of the same size in memory is returned at once. A larger one in memory (another variant, or the full size image) is scaled down on a background queue. Otherwise the image data is decoded from disk straight at the target size.
+ * Animated images, and images not larger than the size, are returned at full size.
+ *
+ * @param key       The unique key used to store the wanted image
+ * @param pixelSize The size in pixels the image is shown at. An empty size queries the full size image
+ * @param doneBlock The completion block, called on the main queue. Will not get called if the operation is cancelled
+ *
+ * @return a NSOperation instance containing the cache op, or nil if the image was found in memory at this size
+ */
+- (nullable NSOperation *)queryCacheOperationForKey:(nullable NSString *)key pixelSize:(CGSize)pixelSize done:(nullable SDCacheQueryCompletedBlock)doneBlock;
+
 /**
  * Query the memory cache synchronously.
  *
@@ -248,6 +331,14 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
  */
 - (nullable UIImage *)imageFromMemoryCacheForKey:(nullable NSString *)key;
 
+/**
+ * Query the memory cache synchronously for the smallest image covering the given size in pixels: the variant of that size, a larger variant or the full size image. Nothing is scaled.
+ *
+ * @param key       The unique key used to store the image
+ * @param pixelSize The size in pixels the image is shown at
+ */
+- (nullable UIImage *)imageFromMemoryCacheForKey:(nullable NSString *)key pixelSize:(CGSize)pixelSize;
+
 /**
  * Query the disk cache synchronously.
  *
@@ -266,6 +357,53 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
  */
 - (nullable UIImage *)imageFromCacheForKey:(nullable NSString *)key;
 
+#pragma mark - Entry Metadata
+
+/**
+ * Asynchronously attach HTTP metadata (validators, freshness, content type) to the disk entry of the given key, or remove it when nil.
+ * The metadata is persisted in the disk index, it is dropped when the entry is removed or its data is stored again.
+ * Nothing is stored if the key has no disk entry, so call this from the completion of the image store.
+ *
+ * @param metadata        The metadata to attach
+ * @param key             The unique image cache key
+ * @param completionBlock A block executed after the operation is finished
+ */
+- (void)storeMetadata:(nullable SDImageCacheEntryMetadata *)metadata
+               forKey:(nullable NSString *)key
+           completion:(nullable SDWebImageNoParamsBlock)completionBlock;
+
+/**
+ * Return the HTTP metadata of the disk entry of the given key, or nil if there is none.
+ * This only reads the in-memory index, so it is cheap enough to call on the main queue.
+ *
+ * @param key The unique image cache key
+ */
+- (nullable SDImageCacheEntryMetadata *)metadataForKey:(nullable NSString *)key;
+
+#pragma mark - Memory Cache Warm-up
+
+/**
+ * The keys queried most often during this session, hottest first, at most `memoryCacheWarmUpMaxCount`.
+ * Queries are only counted when `shouldWarmMemoryCacheAtLaunch` is enabled.
+ */
+- (nonnull NSArray<NSString *> *)hotKeys;
+
+/**
+ * Synchronously save `hotKeys` to disk for the warm-up of the next launch. This is done automatically on the io queue when the app goes to the background or terminates, if `shouldWarmMemoryCacheAtLaunch` is enabled.
+ */
+- (void)saveHotKeySnapshot;
+
+/**
+ * Asynchronously load the images of the last saved hot keys into the memory cache, hottest first, on a background priority queue.
+ * It stops at `maxMemoryCost`. It is cancelled by the first query which reads the disk, or by starting another warm-up.
+ * This is done automatically at launch if `shouldWarmMemoryCacheAtLaunch` is enabled.
+ *
+ * @param completionBlock A block executed on the main queue once the warm-up is done. Will not get called if the warm-up is cancelled
+ *
+ * @return a NSOperation instance to cancel the warm-up
+ */
+- (nonnull NSOperation *)warmUpMemoryCacheWithCompletion:(nullable SDWebImageNoParamsBlock)completionBlock;
+
 #pragma mark - Remove Ops
 
 /**
@@ -300,6 +438,25 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
  */
 - (void)clearMemory;
 
+/**
+ * Trim the decoded images in memory as for a memory warning of the given level, which happens automatically on iOS and tvOS.
+ * Moderate releases the least recently used half, critical releases all but the images still retained elsewhere, such as by image views. The encoded data tier is not trimmed.
+ *
+ * @return The bytes released
+ */
+- (NSUInteger)trimMemoryForPressureLevel:(SDMemoryCachePressureLevel)level;
+
+/**
+ * The bytes released by the last memory pressure trim, and by all of them.
+ */
+@property (assign, nonatomic, readonly) NSUInteger lastMemoryPressureTrimReleasedCost;
+@property (assign, nonatomic, readonly) NSUInteger memoryPressureTrimReleasedCost;
+
+/**
+ * The bytes of the images decoded again after a memory pressure trim released them.
+ */
+@property (assign, nonatomic, readonly) NSUInteger memoryPressureTrimRedecodedCost;
+
 /**
  * Async clear all disk cached images. Non-blocking method - returns immediately.
  * @param completion    A block that should be executed after cache expiration completes (optional)
@@ -330,6 +487,32 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
  */
 - (NSUInteger)getDiskCount;
 
+/**
+ * Get the bytes of the decoded images held by the memory cache, the total cost compared to `maxMemoryCost`.
+ */
+- (NSUInteger)getMemorySize;
+
+/**
+ * Get the number of images in the memory cache
+ */
+- (NSUInteger)getMemoryCount;
+
+/**
+ * The number of disk lookups which the membership filter answered as a definite miss, without touching the file system.
+ * @see `SDImageCacheConfig.shouldUseDiskLookupFilter`
+ */
+- (NSUInteger)diskLookupFilterNegativeCount;
+
+/**
+ * The number of disk lookups which passed the membership filter and found the image.
+ */
+- (NSUInteger)diskLookupFilterHitCount;
+
+/**
+ * The number of disk lookups which passed the membership filter but did not find the image.
+ */
+- (NSUInteger)diskLookupFilterFalsePositiveCount;
+
 /**
  * Asynchronously calculate the disk cache's size.
  异步方式计算磁盘缓存占用的存储空间大小，单位是字节
@@ -337,6 +520,15 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
  */
 - (void)calculateSizeWithCompletionBlock:(nullable SDWebImageCalculateSizeBlock)completionBlock;
 
+/**
+ * Asynchronously write an archive of every image in the disk cache, to ship it with an app and open it with `addReadOnlyCachePath:`.
+ * The buffered stores are written first, and the entries of the pack store are included, under their file names.
+ *
+ * @param path            The path of the archive file to write, replaced if it exists
+ * @param completionBlock A block executed on the main queue when done, with the reason if the archive could not be written
+ */
+- (void)writeArchiveToFile:(nonnull NSString *)path completion:(nullable void (^)(NSError * _Nullable error))completionBlock;
+
 #pragma mark - Cache Paths
 
 /**
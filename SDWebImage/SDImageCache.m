@@ -8,129 +8,305 @@
 
 #import "SDImageCache.h"
 #import <CommonCrypto/CommonDigest.h>
+#import <ImageIO/ImageIO.h>
 #import "NSImage+WebCache.h"
 #import "SDWebImageCodersManager.h"
+#import "SDImageCachePackStore.h"
+#import "SDImageCacheDiskIndex.h"
+#import "SDImageCacheBloomFilter.h"
+#import "SDImageCacheBitmapStore.h"
+#import "SDImageCacheArchive.h"
+#import "SDMemoryCache.h"
 
 #define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
 #define UNLOCK(lock) dispatch_semaphore_signal(lock);
 
-FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
-#if SD_MAC
-    return image.size.height * image.size.width;
-#elif SD_UIKIT || SD_WATCH
-    return image.size.height * image.size.width * image.scale * image.scale;
-#endif
+// The pack store lives in a hidden sub directory of the disk cache path
+static NSString * const kSDImageCachePackDirectoryName = @".pack";
+// The journal of the disk index is a hidden file in the disk cache path
+static NSString * const kSDImageCacheDiskIndexJournalName = @".index";
+// Decoded bitmaps live in a hidden sub directory too, so the disk index never sees them
+static NSString * const kSDImageCacheBitmapDirectoryName = @".bitmap";
+// Written once the files present before the switch to the fast file name hash were listed
+static NSString * const kSDImageCacheFastFileNamesMarkerName = @".fastnames";
+// The MD5 file names which were not migrated yet
+static NSString * const kSDImageCacheLegacyFileNamesName = @".legacynames";
+// The hottest keys of the last session, hottest first
+static NSString * const kSDImageCacheHotKeysName = @".hotkeys";
+// The files about to be moved into the cache, such as streamed downloads. Hidden so the disk index never sees them
+static NSString * const kSDImageCacheTemporaryDirectoryName = @".downloads";
+// A temporary file untouched for this long was left behind
+static const NSTimeInterval kSDImageCacheStaleTemporaryFileAge = 60 * 60 * 24;
+// The memory cache is read from the main queue, the io queues and the decoding queues. With this many locks they rarely wait on each other
+static const NSUInteger kSDImageCacheMemoryCacheSegmentCount = 8;
+// The default budget of the encoded data kept in memory
+static const NSUInteger kSDImageCacheDefaultMaxMemoryDataCost = 20 * 1024 * 1024;
+// The query counts are halved once this many times more keys than the snapshot holds are tracked, so old favorites fade out
+static const NSUInteger kSDImageCacheHotKeyCountsSlack = 4;
+// A pack segment is rewritten once this much of it is taken by overwritten or removed entries
+static const double kSDImageCachePackCompactionDeadRatio = 0.5;
+
+// The access time of a pack segment is kept as metadata of the disk index, under a name no cache file can have
+static inline NSString *SDImageCachePackSegmentMetadataName(NSURL *segmentURL) {
+    return [kSDImageCachePackDirectoryName stringByAppendingPathComponent:segmentURL.lastPathComponent];
 }
 
-// A memory cache which auto purge the cache on memory warning and support weak cache.
-@interface SDMemoryCache <KeyType, ObjectType> : NSCache <KeyType, ObjectType>
-
-@end
-
-// Private
-@interface SDMemoryCache <KeyType, ObjectType> ()
+static inline uint64_t SDRotateLeft64(uint64_t x, int8_t r) {
+    return (x << r) | (x >> (64 - r));
+}
 
-@property (nonatomic, strong, nonnull) NSMapTable<KeyType, ObjectType> *weakCache; // strong-weak cache
-@property (nonatomic, strong, nonnull) dispatch_semaphore_t weakCacheLock; // a lock to keep the access to `weakCache` thread-safe
+static inline uint64_t SDFinalizeMix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
 
-@end
+// MurmurHash3_x64_128 by Austin Appleby (public domain), with a zero seed
+static void SDMurmurHash3_x64_128(const void *key, size_t length, uint8_t digest[16]) {
+    const uint8_t *data = key;
+    const size_t blockCount = length / 16;
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    uint64_t h1 = 0;
+    uint64_t h2 = 0;
+    
+    for (size_t i = 0; i < blockCount; i++) {
+        uint64_t k1, k2;
+        memcpy(&k1, data + i * 16, sizeof(k1));
+        memcpy(&k2, data + i * 16 + 8, sizeof(k2));
+        k1 = OSSwapLittleToHostInt64(k1);
+        k2 = OSSwapLittleToHostInt64(k2);
+        k1 *= c1; k1 = SDRotateLeft64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = SDRotateLeft64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+        k2 *= c2; k2 = SDRotateLeft64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = SDRotateLeft64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+    
+    const uint8_t *tail = data + blockCount * 16;
+    size_t tailLength = length & 15;
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+    for (size_t i = tailLength; i > 8; i--) {
+        k2 ^= (uint64_t)tail[i - 1] << ((i - 9) * 8);
+    }
+    if (tailLength > 8) {
+        k2 *= c2; k2 = SDRotateLeft64(k2, 33); k2 *= c1; h2 ^= k2;
+    }
+    for (size_t i = MIN(tailLength, (size_t)8); i > 0; i--) {
+        k1 ^= (uint64_t)tail[i - 1] << ((i - 1) * 8);
+    }
+    if (tailLength > 0) {
+        k1 *= c1; k1 = SDRotateLeft64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+    
+    h1 ^= length;
+    h2 ^= length;
+    h1 += h2;
+    h2 += h1;
+    h1 = SDFinalizeMix64(h1);
+    h2 = SDFinalizeMix64(h2);
+    h1 += h2;
+    h2 += h1;
+    h1 = OSSwapHostToLittleInt64(h1);
+    h2 = OSSwapHostToLittleInt64(h2);
+    memcpy(digest, &h1, sizeof(h1));
+    memcpy(digest + 8, &h2, sizeof(h2));
+}
 
-@implementation SDMemoryCache
+// Lowercase hex of the digest, then the extension if any. Same output as `%02x` per byte, without parsing a format string
+static NSString *SDCacheFileNameWithDigest(const uint8_t digest[16], NSString *ext) {
+    static const char hexDigits[] = "0123456789abcdef";
+    const char *extString = ext.length > 0 ? ext.UTF8String : NULL;
+    size_t extLength = extString ? strlen(extString) : 0;
+    size_t length = 32 + (extLength > 0 ? extLength + 1 : 0);
+    char stackBuffer[128];
+    char *buffer = length <= sizeof(stackBuffer) ? stackBuffer : malloc(length);
+    if (!buffer) {
+        return nil;
+    }
+    for (size_t i = 0; i < 16; i++) {
+        buffer[i * 2] = hexDigits[digest[i] >> 4];
+        buffer[i * 2 + 1] = hexDigits[digest[i] & 0x0F];
+    }
+    if (extLength > 0) {
+        buffer[32] = '.';
+        memcpy(buffer + 33, extString, extLength);
+    }
+    NSString *fileName = [[NSString alloc] initWithBytes:buffer length:length encoding:NSUTF8StringEncoding];
+    if (buffer != stackBuffer) {
+        free(buffer);
+    }
+    return fileName;
+}
 
-// Current this seems no use on macOS (macOS use virtual memory and do not clear cache when memory warning). So we only override on iOS/tvOS platform.
-// But in the future there may be more options and features for this subclass.
-#if SD_UIKIT
+// Variant keys start with a NUL character, which no URL holds, so they never collide with a key of the cache
+static const unichar kSDImageCacheVariantKeyPrefix = 0;
 
-- (void)dealloc {
-    [[NSNotificationCenter defaultCenter] removeObserver:self name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+// The memory cache key of the variant of an image scaled for a size in pixels
+static NSString *SDImageCacheVariantKey(NSString *key, CGSize pixelSize) {
+    return [NSString stringWithFormat:@"%C%@#%lux%lu", kSDImageCacheVariantKeyPrefix, key, (unsigned long)pixelSize.width, (unsigned long)pixelSize.height];
 }
 
-- (instancetype)init {
-    self = [super init];
-    if (self) {
-        // Use a strong-weak maptable storing the secondary cache. Follow the doc that NSCache does not copy keys
-        // This is useful when the memory warning, the cache was purged. However, the image instance can be retained by other instance such as imageViews and alive.
-        // At this case, we can sync weak cache back and do not need to load from disk cache
-        self.weakCache = [[NSMapTable alloc] initWithKeyOptions:NSPointerFunctionsStrongMemory valueOptions:NSPointerFunctionsWeakMemory capacity:0];
-        self.weakCacheLock = dispatch_semaphore_create(1);
-        [[NSNotificationCenter defaultCenter] addObserver:self
-                                                 selector:@selector(didReceiveMemoryWarning:)
-                                                     name:UIApplicationDidReceiveMemoryWarningNotification
-                                                   object:nil];
+// The key and the pixel size of a variant key, NO if it is not one
+static BOOL SDImageCacheParseVariantKey(NSString *variantKey, NSString **key, CGSize *pixelSize) {
+    if (variantKey.length == 0 || [variantKey characterAtIndex:0] != kSDImageCacheVariantKeyPrefix) {
+        return NO;
     }
-    return self;
+    NSRange separatorRange = [variantKey rangeOfString:@"#" options:NSBackwardsSearch];
+    if (separatorRange.location == NSNotFound) {
+        return NO;
+    }
+    NSScanner *scanner = [NSScanner scannerWithString:[variantKey substringFromIndex:NSMaxRange(separatorRange)]];
+    long long width, height;
+    if (![scanner scanLongLong:&width] || ![scanner scanString:@"x" intoString:nil] || ![scanner scanLongLong:&height]) {
+        return NO;
+    }
+    *key = [variantKey substringWithRange:NSMakeRange(1, separatorRange.location - 1)];
+    *pixelSize = CGSizeMake(width, height);
+    return YES;
 }
 
-- (void)didReceiveMemoryWarning:(NSNotification *)notification {
-    // Only remove cache, but keep weak cache
-    [super removeAllObjects];
+// Variants are kept for whole pixel sizes, the ones their keys can hold
+static inline CGSize SDImageCacheWholePixelSize(CGSize pixelSize) {
+    return CGSizeMake(ceil(pixelSize.width), ceil(pixelSize.height));
 }
 
-// `setObject:forKey:` just call this with 0 cost. Override this is enough
-- (void)setObject:(id)obj forKey:(id)key cost:(NSUInteger)g {
-    [super setObject:obj forKey:key cost:g];
-    if (key && obj) {
-        // Store weak cache
-        LOCK(self.weakCacheLock);
-        [self.weakCache setObject:obj forKey:key];
-        UNLOCK(self.weakCacheLock);
-    }
+static inline CGSize SDImageCachePixelSizeOfImage(UIImage *image) {
+    CGImageRef cgImage = image.CGImage;
+    return cgImage ? CGSizeMake(CGImageGetWidth(cgImage), CGImageGetHeight(cgImage)) : CGSizeZero;
 }
 
-- (id)objectForKey:(id)key {
-    id obj = [super objectForKey:key];
-    if (key && !obj) {
-        // Check weak cache
-        LOCK(self.weakCacheLock);
-        obj = [self.weakCache objectForKey:key];
-        UNLOCK(self.weakCacheLock);
-        if (obj) {
-            // Sync cache
-            NSUInteger cost = 0;
-            if ([obj isKindOfClass:[UIImage class]]) {
-                cost = SDCacheCostForImage(obj);
-            }
-            [super setObject:obj forKey:key cost:cost];
-        }
+// The factor which scales a bitmap to cover the target size while keeping its aspect ratio. Never above 1, images are not scaled up
+static inline CGFloat SDImageCacheScaleFactorToFill(CGSize pixelSize, CGSize targetPixelSize) {
+    if (pixelSize.width <= 0 || pixelSize.height <= 0) {
+        return 1;
     }
-    return obj;
+    CGFloat factor = MAX(targetPixelSize.width / pixelSize.width, targetPixelSize.height / pixelSize.height);
+    return MIN(factor, 1);
 }
 
-- (void)removeObjectForKey:(id)key {
-    [super removeObjectForKey:key];
-    if (key) {
-        // Remove weak cache
-        LOCK(self.weakCacheLock);
-        [self.weakCache removeObjectForKey:key];
-        UNLOCK(self.weakCacheLock);
+// Redraw a decoded image at the target size. The image itself if it is animated or not larger
+static UIImage *SDImageCacheScaledDownImage(UIImage *image, CGSize targetPixelSize) {
+    CGImageRef cgImage = image.CGImage;
+    CGFloat factor = SDImageCacheScaleFactorToFill(SDImageCachePixelSizeOfImage(image), targetPixelSize);
+    if (!cgImage || image.images.count > 0 || factor >= 1) {
+        return image;
     }
+    size_t width = MAX((size_t)round(CGImageGetWidth(cgImage) * factor), (size_t)1);
+    size_t height = MAX((size_t)round(CGImageGetHeight(cgImage) * factor), (size_t)1);
+    CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+    CGBitmapInfo bitmapInfo = kCGBitmapByteOrder32Host | (SDCGImageRefContainsAlpha(cgImage) ? kCGImageAlphaPremultipliedFirst : kCGImageAlphaNoneSkipFirst);
+    CGContextRef context = CGBitmapContextCreate(NULL, width, height, 8, 0, colorSpace, bitmapInfo);
+    CGColorSpaceRelease(colorSpace);
+    if (!context) {
+        return image;
+    }
+    CGContextSetInterpolationQuality(context, kCGInterpolationHigh);
+    CGContextDrawImage(context, CGRectMake(0, 0, width, height), cgImage);
+    CGImageRef scaledCGImage = CGBitmapContextCreateImage(context);
+    CGContextRelease(context);
+    if (!scaledCGImage) {
+        return image;
+    }
+#if SD_MAC
+    UIImage *scaledImage = [[NSImage alloc] initWithCGImage:scaledCGImage size:NSZeroSize];
+#else
+    UIImage *scaledImage = [UIImage imageWithCGImage:scaledCGImage scale:image.scale orientation:image.imageOrientation];
+#endif
+    CGImageRelease(scaledCGImage);
+    return scaledImage;
 }
 
-- (void)removeAllObjects {
-    [super removeAllObjects];
-    // Manually remove should also remove weak cache
-    LOCK(self.weakCacheLock);
-    [self.weakCache removeAllObjects];
-    UNLOCK(self.weakCacheLock);
-}
-
+// Decode image data straight at the target size with ImageIO, without the full size bitmap
+// nil if it is not larger than the target, animated, or in a format ImageIO can not read
+static UIImage *SDImageCacheScaledDownImageWithData(NSData *data, CGSize targetPixelSize) {
+    CGImageSourceRef source = CGImageSourceCreateWithData((__bridge CFDataRef)data, NULL);
+    if (!source) {
+        return nil;
+    }
+    UIImage *image = nil;
+    if (CGImageSourceGetCount(source) == 1) {
+        NSDictionary *properties = (__bridge_transfer NSDictionary *)CGImageSourceCopyPropertiesAtIndex(source, 0, NULL);
+        CGSize pixelSize = CGSizeMake([properties[(__bridge NSString *)kCGImagePropertyPixelWidth] doubleValue], [properties[(__bridge NSString *)kCGImagePropertyPixelHeight] doubleValue]);
+        CGFloat factor = SDImageCacheScaleFactorToFill(pixelSize, targetPixelSize);
+        if (factor < 1) {
+            NSDictionary *options = @{(__bridge NSString *)kCGImageSourceCreateThumbnailFromImageAlways : @YES,
+                                      (__bridge NSString *)kCGImageSourceCreateThumbnailWithTransform : @YES,
+                                      (__bridge NSString *)kCGImageSourceShouldCacheImmediately : @YES,
+                                      (__bridge NSString *)kCGImageSourceThumbnailMaxPixelSize : @(ceil(MAX(pixelSize.width, pixelSize.height) * factor))};
+            CGImageRef cgImage = CGImageSourceCreateThumbnailAtIndex(source, 0, (__bridge CFDictionaryRef)options);
+            if (cgImage) {
+                // The orientation is applied by the transform
+#if SD_MAC
+                image = [[NSImage alloc] initWithCGImage:cgImage size:NSZeroSize];
+#else
+                image = [UIImage imageWithCGImage:cgImage];
 #endif
-
-@end
+                CGImageRelease(cgImage);
+            }
+        }
+    }
+    CFRelease(source);
+    return image;
+}
 
 @interface SDImageCache ()
 
 #pragma mark - Properties
 //缓存对象
 @property (strong, nonatomic, nonnull) SDMemoryCache *memCache;//真正进行内存缓存的对象。
+// The encoded data of the images, see `shouldCacheImageDataInMemory`
+@property (strong, nonatomic, nonnull) SDMemoryCache<NSString *, NSData *> *memDataCache;
+// The pixel sizes of the variants of each key stored in the memory cache. Evicted variants are pruned as they are found missing
+@property (strong, nonatomic, nonnull) NSMutableDictionary<NSString *, NSMutableSet<NSValue *> *> *memoryVariantSizes;
+@property (strong, nonatomic, nonnull) dispatch_semaphore_t memoryVariantSizesLock; // a lock to keep the access to `memoryVariantSizes` thread-safe
 //磁盘缓存的路径
 @property (strong, nonatomic, nonnull) NSString *diskCachePath;
+@property (nonatomic, copy, readwrite, nonnull) NSString *temporaryDirectoryPath;
 //自定义缓存查询路径，即前面add*方法添加的路径，都添加到这个数组中
 @property (strong, nonatomic, nullable) NSMutableArray<NSString *> *customPaths;
-//专门用来执行IO操作的队列，这是一个串行队列
-//使用串行队列就解决了很多问题，串行队列依次执行就不需要加锁释放锁操作来防止多线程下的异常问题
+// Read-only archives added with `addReadOnlyCachePath:`. Replaced as a whole, so readers can take it without a lock
+@property (copy, atomic, nullable) NSArray<SDImageCacheArchive *> *customArchives;
+// The names of the files in `customPaths`, listed as they are added and when the lookup filter is rebuilt. Replaced as a whole, so readers can take it without a lock
+@property (copy, atomic, nullable) NSSet<NSString *> *customPathFileNames;
+//专门用来执行IO操作的队列，这是一个并发队列
+// Per-key operations run on the serial shard queues which target this queue, so different shards run concurrently. Cleanup runs as a barrier, exclusive of all shards.
 @property (strong, nonatomic, nullable) dispatch_queue_t ioQueue;
+// Created on the first disk operation, see `maxConcurrentDiskOperations`
+@property (strong, nonatomic, nullable) NSArray<dispatch_queue_t> *ioShardQueues;
+@property (strong, nonatomic, nonnull) dispatch_semaphore_t ioShardQueuesLock; // a lock to keep the access to `ioShardQueues` thread-safe
 @property (strong, nonatomic, nonnull) NSFileManager *fileManager;
+// Segment files holding small images when `shouldUseDiskPackStore` is enabled
+@property (strong, nonatomic, nonnull) SDImageCachePackStore *packStore;
+// Size and dates of every cache file, so cache info and cleanup do not enumerate the directory
+@property (strong, nonatomic, nonnull) SDImageCacheDiskIndex *diskIndex;
+// Names of every file in the pack store, the disk index and the read-only paths, so misses can skip the file system
+@property (strong, nonatomic, nonnull) SDImageCacheBloomFilter *diskLookupFilter;
+// Decoded bitmaps of images read from disk when `shouldUseDiskBitmapStore` is enabled
+@property (strong, nonatomic, nonnull) SDImageCacheBitmapStore *bitmapStore;
+// The bitmap writes queued after a disk read, by file name. A store or removal of the name drops its entry, so the write of the previous image is skipped
+@property (strong, nonatomic, nonnull) NSMutableDictionary<NSString *, id> *pendingBitmapWrites;
+@property (strong, nonatomic, nonnull) dispatch_semaphore_t pendingBitmapWritesLock; // a lock to keep the access to `pendingBitmapWrites` thread-safe
+// Set while an incremental cleanup started by a store is running, so stores do not start another one
+@property (assign, nonatomic) BOOL diskTrimScheduled;
+@property (strong, nonatomic, nonnull) dispatch_semaphore_t diskTrimLock; // a lock to keep the access to `diskTrimScheduled` thread-safe
+// MD5 file names still waiting to be migrated to the fast hash, nil until listed
+@property (strong, nonatomic, nullable) NSMutableSet<NSString *> *legacyFileNames;
+@property (strong, nonatomic, nonnull) dispatch_semaphore_t legacyFileNamesLock; // a lock to keep the access to `legacyFileNames` thread-safe
+// Stores waiting to be written with a write-behind `diskWritePolicy`, by key
+@property (strong, nonatomic, nonnull) NSMutableDictionary<NSString *, NSData *> *pendingDiskWrites;
+@property (assign, nonatomic) NSUInteger pendingDiskWritesSize;
+// Set while a timed flush of `pendingDiskWrites` is scheduled
+@property (assign, nonatomic) BOOL diskWriteFlushScheduled;
+@property (strong, nonatomic, nonnull) dispatch_semaphore_t pendingDiskWritesLock; // a lock to keep the access to `pendingDiskWrites` thread-safe
+// Query count of every key found in the cache this session, when `shouldWarmMemoryCacheAtLaunch` is enabled
+@property (strong, nonatomic, nonnull) NSMutableDictionary<NSString *, NSNumber *> *hotKeyCounts;
+@property (strong, nonatomic, nonnull) dispatch_semaphore_t hotKeyCountsLock; // a lock to keep the access to `hotKeyCounts` thread-safe
+// The running warm-up, cancelled by the first query which reads the disk
+@property (strong, atomic, nullable) NSOperation *memoryCacheWarmUpOperation;
 
 @end
 
@@ -176,17 +352,42 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
         //构造一个全限定名的namespace
         NSString *fullNamespace = [@"com.hackemist.SDWebImageCache." stringByAppendingString:ns];
         
-        // Create IO serial queue
-        //创建一个串行的专门执行IO操作的队列
-        _ioQueue = dispatch_queue_create("com.hackemist.SDWebImageCache", DISPATCH_QUEUE_SERIAL);
+        // Create IO concurrent queue
+        //创建一个并发的专门执行IO操作的队列
+        _ioQueue = dispatch_queue_create("com.hackemist.SDWebImageCache", DISPATCH_QUEUE_CONCURRENT);
+        _ioShardQueuesLock = dispatch_semaphore_create(1);
+        _diskTrimLock = dispatch_semaphore_create(1);
+        _legacyFileNamesLock = dispatch_semaphore_create(1);
+        _pendingDiskWrites = [NSMutableDictionary dictionary];
+        _pendingDiskWritesLock = dispatch_semaphore_create(1);
+        _pendingBitmapWrites = [NSMutableDictionary dictionary];
+        _pendingBitmapWritesLock = dispatch_semaphore_create(1);
+        _hotKeyCounts = [NSMutableDictionary dictionary];
+        _hotKeyCountsLock = dispatch_semaphore_create(1);
         //构造一个SDImageCacheConfig对象
         _config = [[SDImageCacheConfig alloc] init];
         
         // Init the memory cache
-        //创建一个AutoPurgeCache对象，即NSCache的子类
-        _memCache = [[SDMemoryCache alloc] init];
+        // A first-party LRU cache, which purges itself on memory warning
+        _memCache = [[SDMemoryCache alloc] initWithSegmentCount:kSDImageCacheMemoryCacheSegmentCount];
         //指定这个缓存对象的名称为前面的全限定名
         _memCache.name = fullNamespace;
+        _memDataCache = [[SDMemoryCache alloc] initWithSegmentCount:kSDImageCacheMemoryCacheSegmentCount];
+        _memDataCache.name = [fullNamespace stringByAppendingString:@".data"];
+        _memDataCache.totalCostLimit = kSDImageCacheDefaultMaxMemoryDataCost;
+        // The encoded data is what the decoded tier falls back to on memory warning
+        _memDataCache.shouldTrimOnMemoryWarning = NO;
+        _memoryVariantSizes = [NSMutableDictionary dictionary];
+        _memoryVariantSizesLock = dispatch_semaphore_create(1);
+        // The sizes of the variants are forgotten with them, whatever evicts them
+        __weak typeof(self) wself = self;
+        _memCache.removalBlock = ^(NSString * _Nonnull variantKey) {
+            NSString *key;
+            CGSize pixelSize;
+            if (SDImageCacheParseVariantKey(variantKey, &key, &pixelSize)) {
+                [wself _forgetMemoryVariantForKey:key pixelSize:pixelSize];
+            }
+        };
 
         // Init the disk cache
         //如果传入的磁盘缓存的文件夹路径不为空
@@ -198,11 +399,34 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
             NSString *path = [self makeDiskCachePath:ns];
             _diskCachePath = path;
         }
+        _temporaryDirectoryPath = [_diskCachePath stringByAppendingPathComponent:kSDImageCacheTemporaryDirectoryName];
         //同步方法在这个IO队列上进行fileManager的创建工作
         dispatch_sync(_ioQueue, ^{
             self.fileManager = [NSFileManager new];
         });
 
+        // The segments are indexed lazily, so creating the pack store does not touch the disk
+        _packStore = [[SDImageCachePackStore alloc] initWithDirectory:[_diskCachePath stringByAppendingPathComponent:kSDImageCachePackDirectoryName]
+                                                          segmentSize:_config.diskPackStoreSegmentSize];
+        // The index is loaded from its journal on first use, or rebuilt from a directory scan if the journal is missing or corrupt
+        _diskIndex = [[SDImageCacheDiskIndex alloc] initWithDirectory:_diskCachePath
+                                                          journalPath:[_diskCachePath stringByAppendingPathComponent:kSDImageCacheDiskIndexJournalName]];
+        _bitmapStore = [[SDImageCacheBitmapStore alloc] initWithDirectory:[_diskCachePath stringByAppendingPathComponent:kSDImageCacheBitmapDirectoryName]
+                                                                  maxSize:_config.diskBitmapStoreMaxSize];
+        // Lets everything through until it is built in the background
+        _diskLookupFilter = [SDImageCacheBloomFilter new];
+        dispatch_barrier_async(_ioQueue, ^{
+            [self _rebuildDiskLookupFilter];
+        });
+        // Started on the next main queue turn, so the config can still be changed right after init
+        __weak typeof(self) wself = self;
+        dispatch_async(dispatch_get_main_queue(), ^{
+            __strong typeof(wself) sself = wself;
+            if (sself.config.shouldWarmMemoryCacheAtLaunch) {
+                [sself warmUpMemoryCacheWithCompletion:nil];
+            }
+        });
+
 #if SD_UIKIT
         // Subscribe to app events
  //监听程序即将终止的通知，收到后执行deleteOldFiles方法
@@ -215,6 +439,14 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
                                                  selector:@selector(backgroundDeleteOldFiles)
                                                      name:UIApplicationDidEnterBackgroundNotification
                                                    object:nil];
+        [[NSNotificationCenter defaultCenter] addObserver:self
+                                                 selector:@selector(backgroundSaveHotKeySnapshot)
+                                                     name:UIApplicationWillTerminateNotification
+                                                   object:nil];
+        [[NSNotificationCenter defaultCenter] addObserver:self
+                                                 selector:@selector(backgroundSaveHotKeySnapshot)
+                                                     name:UIApplicationDidEnterBackgroundNotification
+                                                   object:nil];
 #endif
     }
 
@@ -229,6 +461,10 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 #pragma mark - Cache paths
 //添加只读的用户自行添加的缓存搜索路径
 - (void)addReadOnlyCachePath:(nonnull NSString *)path {
+    if ([path.pathExtension isEqualToString:SDImageCacheArchivePathExtension]) {
+        [self addReadOnlyCacheArchiveAtPath:path];
+        return;
+    }
     //如果这个路径集合为空就创建一个
     if (!self.customPaths) {
         self.customPaths = [NSMutableArray new];
@@ -236,7 +472,33 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     //如果路径集合中不包含这个新的路径就添加
     if (![self.customPaths containsObject:path]) {
         [self.customPaths addObject:path];
+        dispatch_barrier_async(self.ioQueue, ^{
+            NSArray<NSString *> *fileNames = [self.fileManager contentsOfDirectoryAtPath:path error:nil] ?: @[];
+            for (NSString *fileName in fileNames) {
+                [self.diskLookupFilter addName:fileName];
+            }
+            self.customPathFileNames = self.customPathFileNames ? [self.customPathFileNames setByAddingObjectsFromArray:fileNames] : [NSSet setWithArray:fileNames];
+        });
+    }
+}
+
+- (void)addReadOnlyCacheArchiveAtPath:(nonnull NSString *)path {
+    for (SDImageCacheArchive *archive in self.customArchives) {
+        if ([archive.path isEqualToString:path]) {
+            return;
+        }
     }
+    // Only the table of contents is read here, the payloads are paged in on access
+    SDImageCacheArchive *archive = [SDImageCacheArchive archiveWithContentsOfFile:path];
+    if (!archive) {
+        return;
+    }
+    self.customArchives = self.customArchives ? [self.customArchives arrayByAddingObject:archive] : @[archive];
+    dispatch_barrier_async(self.ioQueue, ^{
+        for (NSString *fileName in [archive allNames]) {
+            [self.diskLookupFilter addName:fileName];
+        }
+    });
 }
 /*
  根据指定的图片的key和指定文件夹路径获取图片存储的绝对路径
@@ -260,18 +522,23 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
  具体算法不在本篇博客的讲述范围，有兴趣的读者自行查阅
  */
 - (nullable NSString *)cachedFileNameForKey:(nullable NSString *)key {
+    return [self cachedFileNameForKey:key hashType:self.config.diskCacheFileNameHashType];
+}
+
+- (nullable NSString *)cachedFileNameForKey:(nullable NSString *)key hashType:(SDImageCacheConfigFileNameHashType)hashType {
     const char *str = key.UTF8String;
     if (str == NULL) {
         str = "";
     }
-    unsigned char r[CC_MD5_DIGEST_LENGTH];
-    CC_MD5(str, (CC_LONG)strlen(str), r);
+    uint8_t r[16];
+    if (hashType == SDImageCacheConfigFileNameHashTypeMD5) {
+        CC_MD5(str, (CC_LONG)strlen(str), r);
+    } else {
+        SDMurmurHash3_x64_128(str, strlen(str), r);
+    }
     NSURL *keyURL = [NSURL URLWithString:key];
     NSString *ext = keyURL ? keyURL.pathExtension : key.pathExtension;
-    NSString *filename = [NSString stringWithFormat:@"%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%@",
-                          r[0], r[1], r[2], r[3], r[4], r[5], r[6], r[7], r[8], r[9], r[10],
-                          r[11], r[12], r[13], r[14], r[15], ext.length == 0 ? @"" : [NSString stringWithFormat:@".%@", ext]];
-    return filename;
+    return SDCacheFileNameWithDigest(r, ext);
 }
 /*
  根据给定的fullNamespace构造一个磁盘缓存存储图片的路径
@@ -285,6 +552,235 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 /*
  上面的一系列方法提供了构造图片存储在磁盘中的绝对路径的功能，主要就是使用MD5算法散列图片的URL来创建图片存储在磁盘的文件名，并且根据namespace构造一个沙盒cache目录下的一个路径。
  */
+#pragma mark - IO queues
+
+// Operations on the same key always use the same serial queue, so they keep their order and never overlap
+- (nonnull dispatch_queue_t)ioQueueForKey:(nullable NSString *)key {
+    LOCK(self.ioShardQueuesLock);
+    if (!self.ioShardQueues) {
+        NSUInteger count = MAX(self.config.maxConcurrentDiskOperations, 1);
+        NSMutableArray<dispatch_queue_t> *queues = [NSMutableArray arrayWithCapacity:count];
+        for (NSUInteger i = 0; i < count; i++) {
+            dispatch_queue_t queue = dispatch_queue_create("com.hackemist.SDWebImageCache.shard", DISPATCH_QUEUE_SERIAL);
+            dispatch_set_target_queue(queue, self.ioQueue);
+            [queues addObject:queue];
+        }
+        self.ioShardQueues = [queues copy];
+    }
+    NSArray<dispatch_queue_t> *queues = self.ioShardQueues;
+    UNLOCK(self.ioShardQueuesLock);
+    return queues[key.hash % queues.count];
+}
+
+#pragma mark - Disk lookup filter
+
+// Make sure to call form io queue by caller, as a barrier
+- (void)_rebuildDiskLookupFilter {
+    NSMutableArray<NSString *> *names = [NSMutableArray array];
+    for (SDImageCacheDiskIndexEntry *entry in [self.diskIndex allEntries]) {
+        [names addObject:entry.name];
+    }
+    [names addObjectsFromArray:[self.packStore allNames]];
+    NSArray<NSString *> *customPaths = [self.customPaths copy];
+    NSMutableSet<NSString *> *customPathFileNames = [NSMutableSet set];
+    for (NSString *path in customPaths) {
+        NSArray<NSString *> *fileNames = [self.fileManager contentsOfDirectoryAtPath:path error:nil];
+        if (fileNames) {
+            [names addObjectsFromArray:fileNames];
+            [customPathFileNames addObjectsFromArray:fileNames];
+        }
+    }
+    if (customPaths.count > 0) {
+        self.customPathFileNames = customPathFileNames;
+    }
+    for (SDImageCacheArchive *archive in self.customArchives) {
+        [names addObjectsFromArray:[archive allNames]];
+    }
+    [self.diskLookupFilter resetWithNames:names];
+}
+
+// Return NO when the file is definitely in none of the disk paths, under either name. This counts as one lookup in the filter statistics
+- (BOOL)_diskLookupFilterMightContainFileName:(nonnull NSString *)fileName legacyFileName:(nullable NSString *)legacyFileName {
+    if (!self.config.shouldUseDiskLookupFilter) {
+        return YES;
+    }
+    // Also probe the names without extension, see https://github.com/rs/SDWebImage/pull/976
+    BOOL mightContain = [self.diskLookupFilter mightContainName:fileName] || [self.diskLookupFilter mightContainName:fileName.stringByDeletingPathExtension];
+    if (!mightContain && legacyFileName) {
+        mightContain = [self.diskLookupFilter mightContainName:legacyFileName] || [self.diskLookupFilter mightContainName:legacyFileName.stringByDeletingPathExtension];
+    }
+    [self.diskLookupFilter recordLookupPassed:mightContain];
+    return mightContain;
+}
+
+// Make sure to call form io queue by caller
+- (void)_diskLookupFilterDidMissFileName:(nonnull NSString *)fileName {
+    if (self.config.shouldUseDiskLookupFilter) {
+        [self.diskLookupFilter recordFalsePositive];
+    }
+}
+
+// Make sure to call form io queue by caller
+- (void)_removePackedDataForName:(nonnull NSString *)fileName {
+    if ([self.packStore containsDataForName:fileName]) {
+        [self.packStore removeDataForName:fileName];
+        [self.diskLookupFilter removeName:fileName];
+        [self.diskIndex setMetadata:nil forName:fileName];
+    }
+}
+
+// Make sure to call form io queue by caller
+- (void)_rebuildDiskLookupFilterIfNeeded {
+    if (self.diskLookupFilter.needsRebuild) {
+        dispatch_barrier_async(self.ioQueue, ^{
+            if (self.diskLookupFilter.needsRebuild) {
+                [self _rebuildDiskLookupFilter];
+            }
+        });
+    }
+}
+
+#pragma mark - Legacy file names
+
+// Make sure to hold `legacyFileNamesLock`
+- (void)_loadLegacyFileNamesIfNeeded {
+    if (self.legacyFileNames) {
+        return;
+    }
+    NSString *markerPath = [self.diskCachePath stringByAppendingPathComponent:kSDImageCacheFastFileNamesMarkerName];
+    NSString *legacyFileNamesPath = [self.diskCachePath stringByAppendingPathComponent:kSDImageCacheLegacyFileNamesName];
+    if ([self.fileManager fileExistsAtPath:markerPath]) {
+        NSArray<NSString *> *names = [NSArray arrayWithContentsOfFile:legacyFileNamesPath];
+        self.legacyFileNames = names ? [NSMutableSet setWithArray:names] : [NSMutableSet set];
+        return;
+    }
+    // First use of the fast hash: every file present now has its MD5 name
+    NSMutableSet<NSString *> *names = [NSMutableSet set];
+    for (SDImageCacheDiskIndexEntry *entry in [self.diskIndex allEntries]) {
+        [names addObject:entry.name];
+    }
+    [names addObjectsFromArray:[self.packStore allNames]];
+    [self.fileManager createDirectoryAtPath:self.diskCachePath withIntermediateDirectories:YES attributes:nil error:NULL];
+    if (names.count > 0) {
+        [names.allObjects writeToFile:legacyFileNamesPath atomically:YES];
+    }
+    [[NSData data] writeToFile:markerPath atomically:YES];
+    self.legacyFileNames = names;
+}
+
+// The MD5 file name of the key, when it may still be on disk under it: files not migrated yet, or files in the read-only cache paths. Otherwise nil, without hashing
+- (nullable NSString *)_legacyFileNameForKey:(nonnull NSString *)key {
+    if (self.config.diskCacheFileNameHashType != SDImageCacheConfigFileNameHashTypeFast) {
+        return nil;
+    }
+    LOCK(self.legacyFileNamesLock);
+    [self _loadLegacyFileNamesIfNeeded];
+    BOOL hasLegacyFileNames = self.legacyFileNames.count > 0;
+    UNLOCK(self.legacyFileNamesLock);
+    if (!hasLegacyFileNames && self.customPathFileNames.count == 0 && ![self _hasReadOnlyArchiveNames]) {
+        // Migration is finished and the read-only paths are empty
+        return nil;
+    }
+    return [self cachedFileNameForKey:key hashType:SDImageCacheConfigFileNameHashTypeMD5];
+}
+
+- (BOOL)_hasReadOnlyArchiveNames {
+    for (SDImageCacheArchive *archive in self.customArchives) {
+        if (archive.count > 0) {
+            return YES;
+        }
+    }
+    return NO;
+}
+
+// The name (with or without extension) under which the legacy file waits for migration in the disk cache path, or nil
+- (nullable NSString *)_pendingLegacyFileNameForName:(nonnull NSString *)legacyFileName remove:(BOOL)remove {
+    LOCK(self.legacyFileNamesLock);
+    [self _loadLegacyFileNamesIfNeeded];
+    NSString *name = nil;
+    if ([self.legacyFileNames containsObject:legacyFileName]) {
+        name = legacyFileName;
+    } else if ([self.legacyFileNames containsObject:legacyFileName.stringByDeletingPathExtension]) {
+        name = legacyFileName.stringByDeletingPathExtension;
+    }
+    if (name && remove) {
+        [self.legacyFileNames removeObject:name];
+    }
+    UNLOCK(self.legacyFileNamesLock);
+    return name;
+}
+
+// Make sure to call form io queue by caller
+// Move the data stored under the MD5 name of the key to its current name
+- (void)_migrateLegacyFileForKey:(nonnull NSString *)key {
+    NSString *legacyFileName = [self _legacyFileNameForKey:key];
+    NSString *pendingFileName = legacyFileName ? [self _pendingLegacyFileNameForName:legacyFileName remove:YES] : nil;
+    if (!pendingFileName) {
+        return;
+    }
+    NSString *fileName = [self cachedFileNameForKey:key];
+    NSData *packedData = [self.packStore dataForName:pendingFileName];
+    if (packedData) {
+        if (![self.packStore containsDataForName:fileName] && [self.packStore storeData:packedData forName:fileName]) {
+            [self.diskLookupFilter addName:fileName];
+        }
+        [self _removePackedDataForName:pendingFileName];
+        return;
+    }
+    SDImageCacheDiskIndexEntry *entry = [self.diskIndex entryForName:pendingFileName];
+    if (entry) {
+        [self.diskIndex removeName:pendingFileName];
+        [self.diskLookupFilter removeName:pendingFileName];
+    }
+    NSString *legacyPath = [self.diskCachePath stringByAppendingPathComponent:pendingFileName];
+    NSString *path = [self.diskCachePath stringByAppendingPathComponent:fileName];
+    BOOL wasIndexed = [self.diskIndex entryForName:fileName] != nil;
+    if (!wasIndexed && [self.fileManager moveItemAtPath:legacyPath toPath:path error:nil]) {
+        NSNumber *fileSize = [self.fileManager attributesOfItemAtPath:path error:nil][NSFileSize];
+        [self.diskIndex recordWriteForName:fileName size:fileSize.unsignedLongLongValue];
+        [self.diskLookupFilter addName:fileName];
+    } else {
+        // A newer file is already stored under the current name
+        [self.fileManager removeItemAtPath:legacyPath error:nil];
+    }
+}
+
+// Make sure to call form io queue by caller
+// Drop the data stored under the MD5 name of the key, before it is replaced or removed
+- (void)_removeLegacyFileForKey:(nonnull NSString *)key {
+    NSString *legacyFileName = [self _legacyFileNameForKey:key];
+    NSString *pendingFileName = legacyFileName ? [self _pendingLegacyFileNameForName:legacyFileName remove:YES] : nil;
+    if (!pendingFileName) {
+        return;
+    }
+    [self _removePackedDataForName:pendingFileName];
+    [self.fileManager removeItemAtPath:[self.diskCachePath stringByAppendingPathComponent:pendingFileName] error:nil];
+    if ([self.diskIndex entryForName:pendingFileName]) {
+        [self.diskIndex removeName:pendingFileName];
+        [self.diskLookupFilter removeName:pendingFileName];
+    }
+}
+
+// Make sure to call form io queue by caller, as a barrier
+- (void)_synchronizeLegacyFileNames {
+    LOCK(self.legacyFileNamesLock);
+    if (self.legacyFileNames) {
+        // Drop the names which were evicted meanwhile
+        for (NSString *name in self.legacyFileNames.allObjects) {
+            if (![self.diskIndex entryForName:name] && ![self.packStore containsDataForName:name]) {
+                [self.legacyFileNames removeObject:name];
+            }
+        }
+        NSString *legacyFileNamesPath = [self.diskCachePath stringByAppendingPathComponent:kSDImageCacheLegacyFileNamesName];
+        if (self.legacyFileNames.count > 0) {
+            [self.legacyFileNames.allObjects writeToFile:legacyFileNamesPath atomically:YES];
+        } else {
+            [self.fileManager removeItemAtPath:legacyFileNamesPath error:nil];
+        }
+    }
+    UNLOCK(self.legacyFileNamesLock);
+}
+
 #pragma mark - Store Ops
 //存储图片到缓存，直接调用下面的下面的方法
 - (void)storeImage:(nullable UIImage *)image
@@ -317,15 +813,21 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     // if memory cache is enabled
      //如果缓存策略指明要进行内存缓存
     if (self.config.shouldCacheImagesInMemory) {
+        // The variants were scaled from the previous image
+        [self _removeMemoryVariantsForKey:key];
          //根据前面的内联函数计算图片的大小作为cost
         NSUInteger cost = SDCacheCostForImage(image);
         //向memCache中添加图片对象，key即图片的URL，cost为上面计算的
         [self.memCache setObject:image forKey:key cost:cost];
     }
+    if (self.config.shouldCacheImageDataInMemory) {
+        // Without data, the previous data of the key would not match the image any more
+        [self.memDataCache setObject:imageData forKey:key cost:imageData.length];
+    }
     //如果要保存到磁盘中
     if (toDisk) {
-        //异步提交任务到串行的ioQueue中执行
-        dispatch_async(self.ioQueue, ^{
+        //异步提交任务到key所在的串行队列中执行
+        dispatch_async([self ioQueueForKey:key], ^{
             //进行磁盘存储的具体的操作，使用@autoreleasepool包围，执行完成后自动释放相关对象
             //我猜测这么做是为了尽快释放产生的局部变量，释放内存
             @autoreleasepool {
@@ -342,9 +844,16 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
                         format = SDImageFormatJPEG;
                     }
                     data = [[SDWebImageCodersManager sharedInstance] encodedDataWithImage:image format:format];
+                    if (data && self.config.shouldCacheImageDataInMemory) {
+                        [self.memDataCache setObject:data forKey:key cost:data.length];
+                    }
                 }
                 //调用下面的方法用于磁盘存储操作
-                [self _storeImageDataToDisk:data forKey:key];
+                if (self.config.diskWritePolicy == SDImageCacheConfigDiskWritePolicyAtomic) {
+                    [self _storeImageDataToDisk:data forKey:key];
+                } else {
+                    [self _enqueueDiskWrite:data forKey:key];
+                }
             }
             //存储完成后检查是否存在回调块
             if (completionBlock) {
@@ -367,7 +876,7 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     if (!imageData || !key) {
         return;
     }
-    dispatch_sync(self.ioQueue, ^{
+    dispatch_sync([self ioQueueForKey:key], ^{
         [self _storeImageDataToDisk:imageData forKey:key];
     });
 }
@@ -377,12 +886,46 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     if (!imageData || !key) {
         return;
     }
+    // A direct write supersedes a buffered one
+    [self _removePendingDiskWriteForKey:key];
+    [self _prepareDiskStoreForKey:key];
+    [self _writeImageDataToDisk:imageData forKey:key writingOptions:self.config.diskCacheWritingOptions];
+}
+
+// Make sure to call form io queue by caller
+- (void)_prepareDiskStoreForKey:(nonnull NSString *)key {
+    NSString *fileName = [self cachedFileNameForKey:key];
+    [self _removeLegacyFileForKey:key];
+    // The bitmap and the validators belong to the previous data
+    [self _removeBitmapImageForName:fileName];
+    [self.diskIndex setMetadata:nil forName:fileName];
+}
+
+// Make sure to call form io queue by caller
+- (void)_writeImageDataToDisk:(nonnull NSData *)imageData forKey:(nonnull NSString *)key writingOptions:(NSDataWritingOptions)writingOptions {
     //如果构造函数中构造的磁盘缓存存储图片路径的文件夹不存在
     if (![self.fileManager fileExistsAtPath:_diskCachePath]) {
         //那就根据这个路径创建需要的文件夹
         [self.fileManager createDirectoryAtPath:_diskCachePath withIntermediateDirectories:YES attributes:nil error:NULL];
     }
     
+    NSString *fileName = [self cachedFileNameForKey:key];
+    // Small images are appended to the pack store. Lookups check the pack store first, so a stale file with the same name is shadowed until cleanup
+    if (self.config.shouldUseDiskPackStore && imageData.length <= self.config.diskPackStoreMaxEntrySize) {
+        self.packStore.segmentSize = self.config.diskPackStoreSegmentSize;
+        BOOL wasPacked = [self.packStore containsDataForName:fileName];
+        if ([self.packStore storeData:imageData forName:fileName]) {
+            if (!wasPacked) {
+                [self.diskLookupFilter addName:fileName];
+                [self _rebuildDiskLookupFilterIfNeeded];
+            }
+            [self _trimDiskCacheIfNeeded];
+            return;
+        }
+    }
+    // A file written now must not be shadowed by an older pack entry
+    [self _removePackedDataForName:fileName];
+
     // get cache Path for image key
     // 根据key获取默认磁盘缓存存储路径下的MD5文件名的文件的绝对路径
     // 感觉有点绕口。。就是获取图片二进制文件在磁盘中的绝对路径，名称就是前面使用MD5散列的，路径就是构造函数默认构造的那个路径
@@ -392,62 +935,275 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     NSURL *fileURL = [NSURL fileURLWithPath:cachePathForKey];
     //使用NSFileManager创建一个文件，文件存储的数据就是imageData
     //到此，图片二进制数据就存储在了磁盘中了
-    [imageData writeToURL:fileURL options:self.config.diskCacheWritingOptions error:nil];
+    BOOL wasIndexed = [self.diskIndex entryForName:fileName] != nil;
+    if ([imageData writeToURL:fileURL options:writingOptions error:nil]) {
+        [self _didWriteDiskFileAtURL:fileURL name:fileName size:imageData.length wasIndexed:wasIndexed];
+    }
+}
+
+// Make sure to call form io queue by caller
+- (void)_didWriteDiskFileAtURL:(nonnull NSURL *)fileURL name:(nonnull NSString *)fileName size:(unsigned long long)size wasIndexed:(BOOL)wasIndexed {
+    [self.diskIndex recordWriteForName:fileName size:size];
+    if (!wasIndexed) {
+        [self.diskLookupFilter addName:fileName];
+        [self _rebuildDiskLookupFilterIfNeeded];
+    }
+    [self _trimDiskCacheIfNeeded];
     
     // disable iCloud backup
     if (self.config.shouldDisableiCloud) {
         [fileURL setResourceValue:@YES forKey:NSURLIsExcludedFromBackupKey error:nil];
     }
 }
-/*
- 上面就是图片缓存存储的核心方法了，其实看下来感觉也蛮简单的，如果要进行内存缓存就直接添加到memCache对象中，如果要进行磁盘缓存，就构造一个路径，构造一个文件名，然后存储起来就好了。这里面有几个重要的点，首先就是@autoreleasepool的使用，其实这里不添加这个autoreleasepool同样会自动释放内存，但添加后在这个代码块结束后就会立即释放，不会占用太多内存。其次，对于磁盘写入的操作是通过一个指定的串行队列实现的，这样不管执行多少个磁盘存储的操作，都必须一个一个的存储，这样就可以不用编写加锁的操作，可能有读者会疑惑为什么要进行加锁，因为并发情况下这些存储操作都不是线程安全的，很有可能会把路径修改掉或者产生其他异常行为，但使用了串行队列就完全不需要考虑加锁释放锁，一张图片存储完成才可以进行下一张图片存储的操作，这一点值得学习。
- **/
 
-#pragma mark - Query and Retrieve Ops
-//异步方式根据key判断磁盘缓存中是否存储了这个图片，查询完成后执行回调块
-- (void)diskImageExistsWithKey:(nullable NSString *)key completion:(nullable SDWebImageCheckCacheCompletionBlock)completionBlock {
-    //查询操作是异步，也放在指定的串行ioQueue中查询
-    dispatch_async(self.ioQueue, ^{
-        
-        BOOL exists = [self _diskImageDataExistsWithKey:key];
-        //查询完成后，如果存在回调块，就在主线程执行回调块并传入exists
+- (void)storeImage:(nullable UIImage *)image
+   imageFileAtPath:(nonnull NSString *)path
+            forKey:(nullable NSString *)key
+        completion:(nullable SDWebImageNoParamsBlock)completionBlock {
+    if (!path || !key) {
+        if (completionBlock) {
+            completionBlock();
+        }
+        return;
+    }
+    if (image && self.config.shouldCacheImagesInMemory) {
+        [self _removeMemoryVariantsForKey:key];
+        NSUInteger cost = SDCacheCostForImage(image);
+        [self.memCache setObject:image forKey:key cost:cost];
+    }
+    if (self.config.shouldCacheImageDataInMemory) {
+        // The data is not read, and the previous data of the key would not match any more
+        [self.memDataCache removeObjectForKey:key];
+    }
+    dispatch_async([self ioQueueForKey:key], ^{
+        @autoreleasepool {
+            [self _removePendingDiskWriteForKey:key];
+            [self _prepareDiskStoreForKey:key];
+            [self _moveImageFileAtPath:path toDiskForKey:key];
+        }
         if (completionBlock) {
             dispatch_async(dispatch_get_main_queue(), ^{
-                completionBlock(exists);
+                completionBlock();
             });
         }
     });
 }
 
-- (BOOL)diskImageDataExistsWithKey:(nullable NSString *)key {
-    if (!key) {
-        return NO;
+// Make sure to call form io queue by caller
+- (void)_moveImageFileAtPath:(nonnull NSString *)path toDiskForKey:(nonnull NSString *)key {
+    unsigned long long size = [[self.fileManager attributesOfItemAtPath:path error:nil] fileSize];
+    if (size == 0) {
+        [self.fileManager removeItemAtPath:path error:nil];
+        return;
     }
-    __block BOOL exists = NO;
-    dispatch_sync(self.ioQueue, ^{
-        exists = [self _diskImageDataExistsWithKey:key];
+    if (self.config.shouldUseDiskPackStore && size <= self.config.diskPackStoreMaxEntrySize) {
+        // Small enough to be read, the pack store saves the file system overhead
+        NSData *imageData = [NSData dataWithContentsOfFile:path];
+        [self.fileManager removeItemAtPath:path error:nil];
+        if (imageData) {
+            [self _writeImageDataToDisk:imageData forKey:key writingOptions:self.config.diskCacheWritingOptions];
+        }
+        return;
+    }
+    if (![self.fileManager fileExistsAtPath:_diskCachePath]) {
+        [self.fileManager createDirectoryAtPath:_diskCachePath withIntermediateDirectories:YES attributes:nil error:NULL];
+    }
+    NSString *fileName = [self cachedFileNameForKey:key];
+    // A file moved in now must not be shadowed by an older pack entry
+    [self _removePackedDataForName:fileName];
+    NSString *cachePathForKey = [self defaultCachePathForKey:key];
+    BOOL wasIndexed = [self.diskIndex entryForName:fileName] != nil;
+    // `rename` replaces the previous file atomically, which `moveItemAtPath:toPath:error:` does not do
+    BOOL moved = rename(path.fileSystemRepresentation, cachePathForKey.fileSystemRepresentation) == 0;
+    if (!moved && errno == EXDEV) {
+        // On another volume, copied next to the cache file first so the replacement is still atomic
+        NSString *copyPath = [self.temporaryDirectoryPath stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+        [self.fileManager createDirectoryAtPath:self.temporaryDirectoryPath withIntermediateDirectories:YES attributes:nil error:NULL];
+        if ([self.fileManager copyItemAtPath:path toPath:copyPath error:nil]) {
+            moved = rename(copyPath.fileSystemRepresentation, cachePathForKey.fileSystemRepresentation) == 0;
+            if (!moved) {
+                [self.fileManager removeItemAtPath:copyPath error:nil];
+            }
+        }
+    }
+    [self.fileManager removeItemAtPath:path error:nil];
+    if (moved) {
+        [self _didWriteDiskFileAtURL:[NSURL fileURLWithPath:cachePathForKey] name:fileName size:size wasIndexed:wasIndexed];
+    }
+}
+
+// Make sure to call form io queue by caller, as a barrier
+- (void)_removeStaleTemporaryFiles {
+    NSDate *expirationDate = [NSDate dateWithTimeIntervalSinceNow:-kSDImageCacheStaleTemporaryFileAge];
+    for (NSString *fileName in [self.fileManager contentsOfDirectoryAtPath:self.temporaryDirectoryPath error:nil]) {
+        NSString *path = [self.temporaryDirectoryPath stringByAppendingPathComponent:fileName];
+        NSDate *modificationDate = [[self.fileManager attributesOfItemAtPath:path error:nil] fileModificationDate];
+        if (modificationDate && [modificationDate compare:expirationDate] == NSOrderedAscending) {
+            [self.fileManager removeItemAtPath:path error:nil];
+        }
+    }
+}
+/*
+ 上面就是图片缓存存储的核心方法了，其实看下来感觉也蛮简单的，如果要进行内存缓存就直接添加到memCache对象中，如果要进行磁盘缓存，就构造一个路径，构造一个文件名，然后存储起来就好了。这里面有几个重要的点，首先就是@autoreleasepool的使用，其实这里不添加这个autoreleasepool同样会自动释放内存，但添加后在这个代码块结束后就会立即释放，不会占用太多内存。其次，对于磁盘写入的操作是通过一个指定的串行队列实现的，这样不管执行多少个磁盘存储的操作，都必须一个一个的存储，这样就可以不用编写加锁的操作，可能有读者会疑惑为什么要进行加锁，因为并发情况下这些存储操作都不是线程安全的，很有可能会把路径修改掉或者产生其他异常行为，但使用了串行队列就完全不需要考虑加锁释放锁，一张图片存储完成才可以进行下一张图片存储的操作，这一点值得学习。
+ **/
+
+#pragma mark - Write-behind
+
+- (void)flushPendingDiskWritesWithCompletion:(nullable SDWebImageNoParamsBlock)completionBlock {
+    dispatch_barrier_async(self.ioQueue, ^{
+        [self _flushPendingDiskWrites];
+        if (completionBlock) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                completionBlock();
+            });
+        }
     });
-    
-    return exists;
 }
 
 // Make sure to call form io queue by caller
-- (BOOL)_diskImageDataExistsWithKey:(nullable NSString *)key {
-    if (!key) {
-        return NO;
+- (void)_enqueueDiskWrite:(nullable NSData *)imageData forKey:(nonnull NSString *)key {
+    if (!imageData) {
+        return;
     }
-    /*
-     调用defualtCachePathForKey:方法获取图片如果在本地存储时的绝对路径
-     使用NSFileManager查询这个绝对路径的文件是否存在
-     */
-    BOOL exists = [self.fileManager fileExistsAtPath:[self defaultCachePathForKey:key]];
-    
+    // Done now, so the buffered data is never served along with state of the previous data
+    [self _prepareDiskStoreForKey:key];
+    LOCK(self.pendingDiskWritesLock);
+    NSData *previousData = self.pendingDiskWrites[key];
+    self.pendingDiskWritesSize -= previousData.length;
+    self.pendingDiskWrites[key] = imageData;
+    self.pendingDiskWritesSize += imageData.length;
+    BOOL shouldFlush = self.pendingDiskWrites.count >= self.config.diskWriteBatchMaxCount || self.pendingDiskWritesSize >= self.config.diskWriteBatchMaxSize;
+    BOOL shouldScheduleFlush = !shouldFlush && !self.diskWriteFlushScheduled;
+    if (shouldScheduleFlush) {
+        self.diskWriteFlushScheduled = YES;
+    }
+    UNLOCK(self.pendingDiskWritesLock);
+    if (shouldFlush) {
+        dispatch_barrier_async(self.ioQueue, ^{
+            [self _flushPendingDiskWrites];
+        });
+    } else if (shouldScheduleFlush) {
+        __weak typeof(self) wself = self;
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.config.diskWriteBatchDelay * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            __strong typeof(wself) sself = wself;
+            if (!sself) {
+                return;
+            }
+            dispatch_barrier_async(sself.ioQueue, ^{
+                [sself _flushPendingDiskWrites];
+            });
+        });
+    }
+}
+
+// Make sure to call form io queue by caller, as a barrier
+- (void)_flushPendingDiskWrites {
+    LOCK(self.pendingDiskWritesLock);
+    NSDictionary<NSString *, NSData *> *writes = [self.pendingDiskWrites copy];
+    self.diskWriteFlushScheduled = NO;
+    UNLOCK(self.pendingDiskWritesLock);
+    if (writes.count == 0) {
+        return;
+    }
+    NSDataWritingOptions writingOptions = self.config.diskCacheWritingOptions;
+    if (self.config.diskWritePolicy == SDImageCacheConfigDiskWritePolicyBestEffort) {
+        writingOptions &= ~NSDataWritingAtomic;
+    }
+    [self.diskIndex performBatchUpdates:^{
+        [writes enumerateKeysAndObjectsUsingBlock:^(NSString * _Nonnull key, NSData * _Nonnull data, BOOL * _Nonnull stop) {
+            @autoreleasepool {
+                [self _writeImageDataToDisk:data forKey:key writingOptions:writingOptions];
+            }
+        }];
+    }];
+    // Kept buffered until written, so queries from other threads never miss them
+    LOCK(self.pendingDiskWritesLock);
+    [writes enumerateKeysAndObjectsUsingBlock:^(NSString * _Nonnull key, NSData * _Nonnull data, BOOL * _Nonnull stop) {
+        if (self.pendingDiskWrites[key] == data) {
+            [self.pendingDiskWrites removeObjectForKey:key];
+            self.pendingDiskWritesSize -= data.length;
+        }
+    }];
+    UNLOCK(self.pendingDiskWritesLock);
+}
+
+- (nullable NSData *)_pendingDiskWriteForKey:(nonnull NSString *)key {
+    LOCK(self.pendingDiskWritesLock);
+    NSData *data = self.pendingDiskWrites[key];
+    UNLOCK(self.pendingDiskWritesLock);
+    return data;
+}
+
+// Make sure to call form io queue by caller
+- (void)_removePendingDiskWriteForKey:(nonnull NSString *)key {
+    LOCK(self.pendingDiskWritesLock);
+    NSData *data = self.pendingDiskWrites[key];
+    if (data) {
+        [self.pendingDiskWrites removeObjectForKey:key];
+        self.pendingDiskWritesSize -= data.length;
+    }
+    UNLOCK(self.pendingDiskWritesLock);
+}
+
+#pragma mark - Query and Retrieve Ops
+//异步方式根据key判断磁盘缓存中是否存储了这个图片，查询完成后执行回调块
+- (void)diskImageExistsWithKey:(nullable NSString *)key completion:(nullable SDWebImageCheckCacheCompletionBlock)completionBlock {
+    //查询操作是异步，也放在key所在的串行队列中查询
+    dispatch_async([self ioQueueForKey:key], ^{
+        
+        BOOL exists = [self _diskImageDataExistsWithKey:key];
+        //查询完成后，如果存在回调块，就在主线程执行回调块并传入exists
+        if (completionBlock) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                completionBlock(exists);
+            });
+        }
+    });
+}
+
+- (BOOL)diskImageDataExistsWithKey:(nullable NSString *)key {
+    if (!key) {
+        return NO;
+    }
+    __block BOOL exists = NO;
+    dispatch_sync([self ioQueueForKey:key], ^{
+        exists = [self _diskImageDataExistsWithKey:key];
+    });
+    
+    return exists;
+}
+
+// Make sure to call form io queue by caller
+- (BOOL)_diskImageDataExistsWithKey:(nullable NSString *)key {
+    if (!key) {
+        return NO;
+    }
+    if ([self _pendingDiskWriteForKey:key]) {
+        return YES;
+    }
+    [self _migrateLegacyFileForKey:key];
+    NSString *fileName = [self cachedFileNameForKey:key];
+    if (![self _diskLookupFilterMightContainFileName:fileName legacyFileName:nil]) {
+        return NO;
+    }
+    if ([self.packStore containsDataForName:fileName]) {
+        return YES;
+    }
+    /*
+     调用defualtCachePathForKey:方法获取图片如果在本地存储时的绝对路径
+     使用NSFileManager查询这个绝对路径的文件是否存在
+     */
+    BOOL exists = [self.fileManager fileExistsAtPath:[self defaultCachePathForKey:key]];
+    
     // fallback because of https://github.com/rs/SDWebImage/pull/976 that added the extension to the disk file name
     // checking the key with and without the extension
     if (!exists) {//如果不存在
         //再次去掉后缀名查询，这个问题可以自行查看上面git的问题
         exists = [self.fileManager fileExistsAtPath:[self defaultCachePathForKey:key].stringByDeletingPathExtension];
     }
+    if (!exists) {
+        [self _diskLookupFilterDidMissFileName:fileName];
+    }
     
     return exists;
 }
@@ -456,6 +1212,101 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     //直接调用NSCache的objectForKey:方法查询
     return [self.memCache objectForKey:key];
 }
+
+- (nullable UIImage *)imageFromMemoryCacheForKey:(nullable NSString *)key pixelSize:(CGSize)pixelSize {
+    if (!key) {
+        return nil;
+    }
+    return [self _memoryImageForKey:key coveringPixelSize:pixelSize exact:NULL];
+}
+
+#pragma mark - Memory variants
+
+// The smallest image in memory covering the pixel size: the variant of that size, a larger variant, or the full size image
+- (nullable UIImage *)_memoryImageForKey:(nonnull NSString *)key coveringPixelSize:(CGSize)pixelSize exact:(nullable BOOL *)exact {
+    pixelSize = SDImageCacheWholePixelSize(pixelSize);
+    LOCK(self.memoryVariantSizesLock);
+    NSArray<NSValue *> *sizeValues = [self.memoryVariantSizes[key] allObjects];
+    UNLOCK(self.memoryVariantSizesLock);
+    NSMutableArray<NSValue *> *coveringSizeValues = [NSMutableArray array];
+    for (NSValue *sizeValue in sizeValues) {
+        CGSize size;
+        [sizeValue getValue:&size];
+        if (size.width >= pixelSize.width && size.height >= pixelSize.height) {
+            [coveringSizeValues addObject:sizeValue];
+        }
+    }
+    [coveringSizeValues sortUsingComparator:^NSComparisonResult(NSValue * _Nonnull value1, NSValue * _Nonnull value2) {
+        CGSize size1, size2;
+        [value1 getValue:&size1];
+        [value2 getValue:&size2];
+        return [@(size1.width * size1.height) compare:@(size2.width * size2.height)];
+    }];
+    for (NSValue *sizeValue in coveringSizeValues) {
+        CGSize size;
+        [sizeValue getValue:&size];
+        UIImage *variant = [self.memCache objectForKey:SDImageCacheVariantKey(key, size)];
+        if (variant) {
+            if (exact) {
+                *exact = CGSizeEqualToSize(size, pixelSize);
+            }
+            return variant;
+        }
+        // Evicted since the sizes were read
+        [self _forgetMemoryVariantForKey:key pixelSize:size];
+    }
+    if (exact) {
+        *exact = NO;
+    }
+    return [self.memCache objectForKey:key];
+}
+
+- (void)_storeMemoryVariant:(nonnull UIImage *)variant forKey:(nonnull NSString *)key pixelSize:(CGSize)pixelSize {
+    if (!self.config.shouldCacheImagesInMemory) {
+        return;
+    }
+    pixelSize = SDImageCacheWholePixelSize(pixelSize);
+    [self.memCache setObject:variant forKey:SDImageCacheVariantKey(key, pixelSize) cost:SDCacheCostForImage(variant)];
+    NSValue *sizeValue = [NSValue valueWithBytes:&pixelSize objCType:@encode(CGSize)];
+    LOCK(self.memoryVariantSizesLock);
+    NSMutableSet<NSValue *> *sizeValues = self.memoryVariantSizes[key];
+    if (!sizeValues) {
+        sizeValues = [NSMutableSet set];
+        self.memoryVariantSizes[key] = sizeValues;
+    }
+    [sizeValues addObject:sizeValue];
+    UNLOCK(self.memoryVariantSizesLock);
+}
+
+- (void)_forgetMemoryVariantForKey:(nonnull NSString *)key pixelSize:(CGSize)pixelSize {
+    NSValue *sizeValue = [NSValue valueWithBytes:&pixelSize objCType:@encode(CGSize)];
+    LOCK(self.memoryVariantSizesLock);
+    NSMutableSet<NSValue *> *sizeValues = self.memoryVariantSizes[key];
+    [sizeValues removeObject:sizeValue];
+    if (sizeValues && sizeValues.count == 0) {
+        [self.memoryVariantSizes removeObjectForKey:key];
+    }
+    UNLOCK(self.memoryVariantSizesLock);
+}
+
+- (void)_removeMemoryVariantsForKey:(nonnull NSString *)key {
+    LOCK(self.memoryVariantSizesLock);
+    NSSet<NSValue *> *sizeValues = self.memoryVariantSizes[key];
+    [self.memoryVariantSizes removeObjectForKey:key];
+    UNLOCK(self.memoryVariantSizesLock);
+    for (NSValue *sizeValue in sizeValues) {
+        CGSize size;
+        [sizeValue getValue:&size];
+        [self.memCache removeObjectForKey:SDImageCacheVariantKey(key, size)];
+    }
+}
+
+- (nullable NSData *)_imageDataFromMemoryCacheForKey:(nonnull NSString *)key {
+    if (!self.config.shouldCacheImageDataInMemory) {
+        return nil;
+    }
+    return [self.memDataCache objectForKey:key];
+}
 //根据指定的key获取磁盘缓存的图片构造并返回UIImage对象
 - (nullable UIImage *)imageFromDiskCacheForKey:(nullable NSString *)key {
     //调用diskImageForKey:方法查询，这个方法下面会讲
@@ -488,12 +1339,81 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     image = [self imageFromDiskCacheForKey:key];
     return image;
 }
+
+#pragma mark - Entry Metadata
+
+- (void)storeMetadata:(nullable SDImageCacheEntryMetadata *)metadata forKey:(nullable NSString *)key completion:(nullable SDWebImageNoParamsBlock)completionBlock {
+    if (!key) {
+        if (completionBlock) {
+            completionBlock();
+        }
+        return;
+    }
+    dispatch_async([self ioQueueForKey:key], ^{
+        NSString *fileName = [self cachedFileNameForKey:key];
+        // Only entries of the default disk path, the read-only paths are not indexed
+        if (!metadata) {
+            [self.diskIndex setMetadata:nil forName:fileName];
+        } else if ([self.diskIndex entryForName:fileName] || [self.packStore containsDataForName:fileName] || [self _pendingDiskWriteForKey:key]) {
+            [self.diskIndex setMetadata:[metadata dataRepresentation] forName:fileName];
+        }
+        if (completionBlock) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                completionBlock();
+            });
+        }
+    });
+}
+
+- (nullable SDImageCacheEntryMetadata *)metadataForKey:(nullable NSString *)key {
+    if (!key) {
+        return nil;
+    }
+    NSData *data = [self.diskIndex metadataForName:[self cachedFileNameForKey:key]];
+    return [SDImageCacheEntryMetadata metadataWithData:data];
+}
 //在磁盘中所有的保存路径，包括用户添加的路径中搜索key对应的图片数据
 - (nullable NSData *)diskImageDataBySearchingAllPathsForKey:(nullable NSString *)key {
+    if (!key) {
+        return nil;
+    }
+    // Buffered stores are not on disk yet
+    NSData *pendingData = [self _pendingDiskWriteForKey:key];
+    if (pendingData) {
+        return pendingData;
+    }
+    // A definite miss in the filter saves the file system probes of every path below
+    NSString *fileName = [self cachedFileNameForKey:key];
+    NSString *legacyFileName = [self _legacyFileNameForKey:key];
+    if (![self _diskLookupFilterMightContainFileName:fileName legacyFileName:legacyFileName]) {
+        return nil;
+    }
+    NSString *pendingLegacyFileName = legacyFileName ? [self _pendingLegacyFileNameForName:legacyFileName remove:NO] : nil;
+    if (pendingLegacyFileName) {
+        // Served from the old name this time, the file is moved on the io queue of the key
+        dispatch_async([self ioQueueForKey:key], ^{
+            [self _migrateLegacyFileForKey:key];
+        });
+        NSData *legacyData = [self.packStore dataForName:pendingLegacyFileName];
+        if (!legacyData) {
+            legacyData = [NSData dataWithContentsOfFile:[self.diskCachePath stringByAppendingPathComponent:pendingLegacyFileName] options:self.config.diskCacheReadingOptions error:nil];
+        }
+        if (legacyData) {
+            return legacyData;
+        }
+    }
+    // The pack store lookup is an index probe, so try it before any file
+    NSData *packedData = [self.packStore dataForName:fileName];
+    if (packedData) {
+        return packedData;
+    }
+
     //首先在默认存储路径中查找，如果有就直接返回
     NSString *defaultPath = [self defaultCachePathForKey:key];
     NSData *data = [NSData dataWithContentsOfFile:defaultPath options:self.config.diskCacheReadingOptions error:nil];
     if (data) {
+        // Only the index is updated, the file itself is not touched
+        [self.diskIndex recordAccessForName:defaultPath.lastPathComponent];
         return data;
     }
 
@@ -502,25 +1422,47 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     //同样的去掉后缀再次查找，找到就返回
     data = [NSData dataWithContentsOfFile:defaultPath.stringByDeletingPathExtension options:self.config.diskCacheReadingOptions error:nil];
     if (data) {
+        [self.diskIndex recordAccessForName:defaultPath.stringByDeletingPathExtension.lastPathComponent];
         return data;
     }
+    // Read-only paths are never migrated, they may hold files under the MD5 names
+    NSArray<NSString *> *fileNames = legacyFileName ? @[fileName, legacyFileName] : @[fileName];
+    // An archive lookup is a hash probe, so try the archives before the read-only directories
+    for (SDImageCacheArchive *archive in self.customArchives) {
+        for (NSString *name in fileNames) {
+            NSData *archivedData = [archive dataForName:name] ?: [archive dataForName:name.stringByDeletingPathExtension];
+            if (archivedData) {
+                return archivedData;
+            }
+        }
+    }
     //在默认路径中没有找到，则在用户添加的路径中查找，找到就返回
+    // The read-only paths were listed, so only the names they hold are read
     NSArray<NSString *> *customPaths = [self.customPaths copy];
+    NSSet<NSString *> *customPathFileNames = self.customPathFileNames;
     for (NSString *path in customPaths) {
-        NSString *filePath = [self cachePathForKey:key inPath:path];
-        NSData *imageData = [NSData dataWithContentsOfFile:filePath options:self.config.diskCacheReadingOptions error:nil];
-        if (imageData) {
-            return imageData;
-        }
+        for (NSString *name in fileNames) {
+            if ([customPathFileNames containsObject:name]) {
+                NSString *filePath = [path stringByAppendingPathComponent:name];
+                NSData *imageData = [NSData dataWithContentsOfFile:filePath options:self.config.diskCacheReadingOptions error:nil];
+                if (imageData) {
+                    return imageData;
+                }
+            }
 
-        // fallback because of https://github.com/rs/SDWebImage/pull/976 that added the extension to the disk file name
-        // checking the key with and without the extension
-        //去掉后缀再次查找
-        imageData = [NSData dataWithContentsOfFile:filePath.stringByDeletingPathExtension options:self.config.diskCacheReadingOptions error:nil];
-        if (imageData) {
-            return imageData;
+            // fallback because of https://github.com/rs/SDWebImage/pull/976 that added the extension to the disk file name
+            // checking the key with and without the extension
+            //去掉后缀再次查找
+            if ([customPathFileNames containsObject:name.stringByDeletingPathExtension]) {
+                NSString *filePath = [path stringByAppendingPathComponent:name.stringByDeletingPathExtension];
+                NSData *imageData = [NSData dataWithContentsOfFile:filePath options:self.config.diskCacheReadingOptions error:nil];
+                if (imageData) {
+                    return imageData;
+                }
+            }
         }
     }
+    [self _diskLookupFilterDidMissFileName:fileName];
     //没找到返回nil
     return nil;
 }
@@ -534,16 +1476,58 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 - (nullable UIImage *)diskImageForKey:(nullable NSString *)key data:(nullable NSData *)data {
     //如果有就解码解压缩后返回UIImage对象
     if (data) {
+        // The data is still read first, so a bitmap is only used while its image data is in the cache
+        NSString *fileName = self.config.shouldUseDiskBitmapStore ? [self cachedFileNameForKey:key] : nil;
+        if (fileName) {
+            UIImage *bitmapImage = [self.bitmapStore imageForName:fileName];
+            if (bitmapImage) {
+                return bitmapImage;
+            }
+        }
         UIImage *image = [[SDWebImageCodersManager sharedInstance] decodedImageWithData:data];
         image = [self scaledImageForKey:key image:image];
         if (self.config.shouldDecompressImages) {
             image = [[SDWebImageCodersManager sharedInstance] decompressedImageWithImage:image data:&data options:@{SDWebImageCoderScaleDownLargeImagesKey: @(NO)}];
+            // Only keep what was decompressed anyway, a lazily decoded image stays lazy
+            if (fileName && image) {
+                [self _storeBitmapImage:image forName:fileName key:key];
+            }
         }
         return image;
     } else {
         return nil;
     }
 }
+// Rendering and writing the bitmap costs as much as the decode, so it is done after the image is returned, on the key's queue
+- (void)_storeBitmapImage:(nonnull UIImage *)image forName:(nonnull NSString *)fileName key:(nonnull NSString *)key {
+    id token = [NSObject new];
+    LOCK(self.pendingBitmapWritesLock);
+    self.pendingBitmapWrites[fileName] = token;
+    UNLOCK(self.pendingBitmapWritesLock);
+    dispatch_async([self ioQueueForKey:key], ^{
+        LOCK(self.pendingBitmapWritesLock);
+        BOOL isCurrent = self.pendingBitmapWrites[fileName] == token;
+        if (isCurrent) {
+            [self.pendingBitmapWrites removeObjectForKey:fileName];
+        }
+        UNLOCK(self.pendingBitmapWritesLock);
+        // The data it was decoded from was replaced or removed meanwhile
+        if (!isCurrent) {
+            return;
+        }
+        self.bitmapStore.maxSize = self.config.diskBitmapStoreMaxSize;
+        [self.bitmapStore storeImage:image forName:fileName];
+    });
+}
+
+// Make sure to call form io queue by caller
+- (void)_removeBitmapImageForName:(nonnull NSString *)fileName {
+    LOCK(self.pendingBitmapWritesLock);
+    [self.pendingBitmapWrites removeObjectForKey:fileName];
+    UNLOCK(self.pendingBitmapWritesLock);
+    [self.bitmapStore removeImageForName:fileName];
+}
+
 //在iOS watchOS下图片的真实大小与scale有关，这里做一下缩放处理
 - (nullable UIImage *)scaledImageForKey:(nullable NSString *)key image:(nullable UIImage *)image {
     return SDScaledImageForKey(key, image);
@@ -574,18 +1558,30 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     //如果存在，就在磁盘中查找对应的二进制数据，然后执行回调块
     BOOL shouldQueryMemoryOnly = (image && !(options & SDImageCacheQueryDataWhenInMemory));
     if (shouldQueryMemoryOnly) {
+        [self _recordHotKey:key];
         if (doneBlock) {
             //SDImageCacheTypeMemory表示图片在内存缓存中查找到
             doneBlock(image, nil, SDImageCacheTypeMemory);
         }
         return nil;
     }
+    // The data asked for along with the image may be in memory too
+    NSData *memoryData = image ? [self _imageDataFromMemoryCacheForKey:key] : nil;
+    if (memoryData) {
+        [self _recordHotKey:key];
+        if (doneBlock) {
+            doneBlock(image, memoryData, SDImageCacheTypeMemory);
+        }
+        return nil;
+    }
     //接下来就需要在磁盘中查找了，由于耗时构造一个NSOperation对象
     //下面是异步方式在ioQueue上进行查询操作，所以直接就返回了NSOperation对象
+    // Real requests reached the disk, the warm-up would only compete with them
+    [self.memoryCacheWarmUpOperation cancel];
     NSOperation *operation = [NSOperation new];
     //异步在ioQueue上查询
     void(^queryDiskBlock)(void) =  ^{
-        //ioQueue是串行的，而且磁盘操作很慢，有可能还没开始查询调用者就取消查询
+        //磁盘操作很慢，有可能还没开始查询调用者就取消查询
         //如果在开始查询后调用者再取消就没有用了，只有在查询前取消才有用
         if (operation.isCancelled) {
             // do not call the completion if cancelled
@@ -595,20 +1591,11 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
         //同理创建一个自动释放池，
         @autoreleasepool {
             //在磁盘中查找图片二进制数据，和UIImage对象
-            NSData *diskData = [self diskImageDataBySearchingAllPathsForKey:key];
-            UIImage *diskImage;
+            NSData *diskData = nil;
             SDImageCacheType cacheType = SDImageCacheTypeDisk;
-            if (image) {
-                // the image is from in-memory cache
-                diskImage = image;
-                cacheType = SDImageCacheTypeMemory;
-            } else if (diskData) {
-                // decode image data only if in-memory cache missed
-                diskImage = [self diskImageForKey:key data:diskData];
-                if (diskImage && self.config.shouldCacheImagesInMemory) {//找到并且需要内存缓存就设置一下
-                    NSUInteger cost = SDCacheCostForImage(diskImage);
-                    [self.memCache setObject:diskImage forKey:key cost:cost];
-                }
+            UIImage *diskImage = [self _queryDiskImageForKey:key memoryImage:image diskData:&diskData cacheType:&cacheType];
+            if (diskImage) {
+                [self _recordHotKey:key];
             }
             //在主线程中执行回调块
             if (doneBlock) {
@@ -627,15 +1614,321 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     if (options & SDImageCacheQueryDiskSync) {
         queryDiskBlock();
     } else {
-        dispatch_async(self.ioQueue, queryDiskBlock);
+        // Queries of keys in different shards run concurrently
+        dispatch_async([self ioQueueForKey:key], queryDiskBlock);
+    }
+    
+    return operation;
+}
+// Make sure to call form io queue by caller, or with `SDImageCacheQueryDiskSync`
+- (nullable UIImage *)_queryDiskImageForKey:(nonnull NSString *)key memoryImage:(nullable UIImage *)image diskData:(NSData * _Nullable * _Nonnull)diskData cacheType:(nonnull SDImageCacheType *)cacheType {
+    // An image evicted from the decoded tier is decoded again from the encoded tier, without a disk read
+    NSData *memoryData = [self _imageDataFromMemoryCacheForKey:key];
+    *diskData = memoryData ?: [self diskImageDataBySearchingAllPathsForKey:key];
+    if (*diskData && !memoryData && self.config.shouldCacheImageDataInMemory) {
+        [self.memDataCache setObject:*diskData forKey:key cost:(*diskData).length];
+    }
+    UIImage *diskImage;
+    if (image) {
+        // the image is from in-memory cache
+        diskImage = image;
+        *cacheType = SDImageCacheTypeMemory;
+    } else if (*diskData) {
+        // decode image data only if in-memory cache missed
+        diskImage = [self diskImageForKey:key data:*diskData];
+        if (diskImage && self.config.shouldCacheImagesInMemory) {//找到并且需要内存缓存就设置一下
+            NSUInteger cost = SDCacheCostForImage(diskImage);
+            [self.memCache setObject:diskImage forKey:key cost:cost];
+        }
+    }
+    return diskImage;
+}
+
+- (nullable NSOperation *)queryCacheOperationForKey:(nullable NSString *)key pixelSize:(CGSize)pixelSize done:(nullable SDCacheQueryCompletedBlock)doneBlock {
+    if (!key || pixelSize.width <= 0 || pixelSize.height <= 0) {
+        return [self queryCacheOperationForKey:key done:doneBlock];
+    }
+    BOOL exact = NO;
+    UIImage *memoryImage = [self _memoryImageForKey:key coveringPixelSize:pixelSize exact:&exact];
+    if (memoryImage) {
+        [self _recordHotKey:key];
+        BOOL needsScaling = !exact && memoryImage.images.count == 0 && SDImageCacheScaleFactorToFill(SDImageCachePixelSizeOfImage(memoryImage), pixelSize) < 1;
+        if (!needsScaling) {
+            if (doneBlock) {
+                doneBlock(memoryImage, nil, SDImageCacheTypeMemory);
+            }
+            return nil;
+        }
+        NSOperation *operation = [NSOperation new];
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            if (operation.isCancelled) {
+                return;
+            }
+            UIImage *variant = SDImageCacheScaledDownImage(memoryImage, pixelSize);
+            [self _storeMemoryVariant:variant forKey:key pixelSize:pixelSize];
+            dispatch_async(dispatch_get_main_queue(), ^{
+                if (!operation.isCancelled && doneBlock) {
+                    doneBlock(variant, nil, SDImageCacheTypeMemory);
+                }
+            });
+        });
+        return operation;
+    }
+    
+    // Real requests reached the disk, the warm-up would only compete with them
+    [self.memoryCacheWarmUpOperation cancel];
+    NSOperation *operation = [NSOperation new];
+    dispatch_async([self ioQueueForKey:key], ^{
+        if (operation.isCancelled) {
+            return;
+        }
+        @autoreleasepool {
+            NSData *data = [self _imageDataFromMemoryCacheForKey:key] ?: [self diskImageDataBySearchingAllPathsForKey:key];
+            UIImage *image = nil;
+            if (data) {
+                image = [self scaledImageForKey:key image:SDImageCacheScaledDownImageWithData(data, pixelSize)];
+                if (image) {
+                    [self _storeMemoryVariant:image forKey:key pixelSize:pixelSize];
+                } else {
+                    // Not worth a variant, or not readable by ImageIO: decode at full size, then scale down
+                    UIImage *fullImage = [self diskImageForKey:key data:data];
+                    image = SDImageCacheScaledDownImage(fullImage, pixelSize);
+                    if (image && image != fullImage) {
+                        [self _storeMemoryVariant:image forKey:key pixelSize:pixelSize];
+                    } else if (image && self.config.shouldCacheImagesInMemory) {
+                        [self.memCache setObject:image forKey:key cost:SDCacheCostForImage(image)];
+                    }
+                }
+            }
+            if (image) {
+                [self _recordHotKey:key];
+            }
+            dispatch_async(dispatch_get_main_queue(), ^{
+                if (!operation.isCancelled && doneBlock) {
+                    doneBlock(image, data, image ? SDImageCacheTypeDisk : SDImageCacheTypeNone);
+                }
+            });
+        }
+    });
+    return operation;
+}
+
+- (nullable NSOperation *)queryCacheOperationForKeys:(nonnull NSArray<NSString *> *)keys
+                                             options:(SDImageCacheOptions)options
+                                            progress:(nullable SDCacheBatchQueryProgressBlock)progressBlock
+                                                done:(nullable SDCacheBatchQueryCompletedBlock)doneBlock {
+    NSMutableDictionary<NSString *, UIImage *> *images = [NSMutableDictionary dictionary];
+    NSMutableDictionary<NSString *, NSData *> *imageDatas = [NSMutableDictionary dictionary];
+    NSMutableDictionary<NSString *, NSNumber *> *cacheTypes = [NSMutableDictionary dictionary];
+    
+    // First check the in-memory cache for all keys, and group the remaining keys by the io queue they belong to
+    NSMutableDictionary<NSString *, UIImage *> *memoryImages = [NSMutableDictionary dictionary];
+    NSMapTable<dispatch_queue_t, NSMutableArray<NSString *> *> *diskKeysByQueue = [NSMapTable strongToStrongObjectsMapTable];
+    for (NSString *key in [NSOrderedSet orderedSetWithArray:keys]) {
+        UIImage *image = [self imageFromMemoryCacheForKey:key];
+        NSData *memoryData = (image && (options & SDImageCacheQueryDataWhenInMemory)) ? [self _imageDataFromMemoryCacheForKey:key] : nil;
+        if (image && (!(options & SDImageCacheQueryDataWhenInMemory) || memoryData)) {
+            [self _recordHotKey:key];
+            images[key] = image;
+            imageDatas[key] = memoryData;
+            cacheTypes[key] = @(SDImageCacheTypeMemory);
+            if (progressBlock) {
+                progressBlock(key, image, memoryData, SDImageCacheTypeMemory);
+            }
+            continue;
+        }
+        memoryImages[key] = image;
+        dispatch_queue_t queue = [self ioQueueForKey:key];
+        NSMutableArray<NSString *> *diskKeys = [diskKeysByQueue objectForKey:queue];
+        if (!diskKeys) {
+            diskKeys = [NSMutableArray array];
+            [diskKeysByQueue setObject:diskKeys forKey:queue];
+        }
+        [diskKeys addObject:key];
+    }
+    if (diskKeysByQueue.count == 0) {
+        if (doneBlock) {
+            doneBlock([images copy], [imageDatas copy], [cacheTypes copy]);
+        }
+        return nil;
+    }
+    
+    [self.memoryCacheWarmUpOperation cancel];
+    NSOperation *operation = [NSOperation new];
+    dispatch_semaphore_t resultsLock = dispatch_semaphore_create(1);
+    BOOL sync = (options & SDImageCacheQueryDiskSync) != 0;
+    dispatch_group_t group = dispatch_group_create();
+    for (dispatch_queue_t queue in diskKeysByQueue) {
+        NSArray<NSString *> *diskKeys = [diskKeysByQueue objectForKey:queue];
+        // One block per io queue. It runs after the earlier operations on the same keys, like a single key query would
+        void(^queryDiskBlock)(void) = ^{
+            if (operation.isCancelled) {
+                return;
+            }
+            NSMutableDictionary<NSString *, UIImage *> *groupImages = [NSMutableDictionary dictionary];
+            NSMutableDictionary<NSString *, NSData *> *groupImageDatas = [NSMutableDictionary dictionary];
+            NSMutableDictionary<NSString *, NSNumber *> *groupCacheTypes = [NSMutableDictionary dictionary];
+            for (NSString *key in diskKeys) {
+                if (operation.isCancelled) {
+                    return;
+                }
+                @autoreleasepool {
+                    NSData *diskData = nil;
+                    SDImageCacheType cacheType = SDImageCacheTypeDisk;
+                    UIImage *diskImage = [self _queryDiskImageForKey:key memoryImage:memoryImages[key] diskData:&diskData cacheType:&cacheType];
+                    if (diskImage) {
+                        [self _recordHotKey:key];
+                    }
+                    groupImages[key] = diskImage;
+                    groupImageDatas[key] = diskData;
+                    groupCacheTypes[key] = @(diskImage ? cacheType : SDImageCacheTypeNone);
+                }
+            }
+            LOCK(resultsLock);
+            [images addEntriesFromDictionary:groupImages];
+            [imageDatas addEntriesFromDictionary:groupImageDatas];
+            [cacheTypes addEntriesFromDictionary:groupCacheTypes];
+            UNLOCK(resultsLock);
+            if (progressBlock) {
+                void(^reportBlock)(void) = ^{
+                    if (operation.isCancelled) {
+                        return;
+                    }
+                    for (NSString *key in diskKeys) {
+                        progressBlock(key, groupImages[key], groupImageDatas[key], groupCacheTypes[key].integerValue);
+                    }
+                };
+                if (sync) {
+                    reportBlock();
+                } else {
+                    dispatch_async(dispatch_get_main_queue(), reportBlock);
+                }
+            }
+        };
+        if (sync) {
+            queryDiskBlock();
+        } else {
+            dispatch_group_async(group, queue, queryDiskBlock);
+        }
+    }
+    
+    // The progress of the last group was submitted to the main queue before the group left, so the done block comes after it
+    void(^completionBlock)(void) = ^{
+        if (operation.isCancelled || !doneBlock) {
+            return;
+        }
+        doneBlock([images copy], [imageDatas copy], [cacheTypes copy]);
+    };
+    if (sync) {
+        completionBlock();
+    } else {
+        dispatch_group_notify(group, dispatch_get_main_queue(), completionBlock);
     }
     
     return operation;
 }
+
 /**
  上面的方法提供了内存缓存和磁盘缓存中查找的功能，比较精明的设计就是返回NSOperation对象，这个对象并不代表一个任务，仅仅利用了它的cancel方法和isCancelled属性，来取消磁盘查询。
  */
 
+#pragma mark - Memory Cache Warm-up
+
+- (void)_recordHotKey:(nonnull NSString *)key {
+    if (!self.config.shouldWarmMemoryCacheAtLaunch) {
+        return;
+    }
+    NSUInteger maxTrackedCount = MAX(self.config.memoryCacheWarmUpMaxCount * kSDImageCacheHotKeyCountsSlack, 1024);
+    LOCK(self.hotKeyCountsLock);
+    self.hotKeyCounts[key] = @(self.hotKeyCounts[key].unsignedIntegerValue + 1);
+    if (self.hotKeyCounts.count > maxTrackedCount) {
+        NSMutableDictionary<NSString *, NSNumber *> *hotKeyCounts = [NSMutableDictionary dictionaryWithCapacity:self.hotKeyCounts.count];
+        [self.hotKeyCounts enumerateKeysAndObjectsUsingBlock:^(NSString * _Nonnull hotKey, NSNumber * _Nonnull count, BOOL * _Nonnull stop) {
+            NSUInteger agedCount = count.unsignedIntegerValue / 2;
+            if (agedCount > 0) {
+                hotKeyCounts[hotKey] = @(agedCount);
+            }
+        }];
+        self.hotKeyCounts = hotKeyCounts;
+    }
+    UNLOCK(self.hotKeyCountsLock);
+}
+
+- (nonnull NSArray<NSString *> *)hotKeys {
+    LOCK(self.hotKeyCountsLock);
+    NSArray<NSString *> *keys = [self.hotKeyCounts keysSortedByValueUsingComparator:^NSComparisonResult(NSNumber * _Nonnull count1, NSNumber * _Nonnull count2) {
+        return [count2 compare:count1];
+    }];
+    UNLOCK(self.hotKeyCountsLock);
+    NSUInteger maxCount = self.config.memoryCacheWarmUpMaxCount;
+    if (keys.count > maxCount) {
+        keys = [keys subarrayWithRange:NSMakeRange(0, maxCount)];
+    }
+    return keys;
+}
+
+- (void)saveHotKeySnapshot {
+    NSArray<NSString *> *keys = [self hotKeys];
+    if (keys.count == 0) {
+        // Keep the last snapshot, a session which found nothing in the cache says little about the next one
+        return;
+    }
+    [self.fileManager createDirectoryAtPath:self.diskCachePath withIntermediateDirectories:YES attributes:nil error:NULL];
+    [keys writeToFile:[self.diskCachePath stringByAppendingPathComponent:kSDImageCacheHotKeysName] atomically:YES];
+}
+
+- (nonnull NSOperation *)warmUpMemoryCacheWithCompletion:(nullable SDWebImageNoParamsBlock)completionBlock {
+    NSOperation *operation = [NSOperation new];
+    [self.memoryCacheWarmUpOperation cancel];
+    self.memoryCacheWarmUpOperation = operation;
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^{
+        NSArray<NSString *> *keys = nil;
+        if (self.config.shouldCacheImagesInMemory) {
+            keys = [NSArray arrayWithContentsOfFile:[self.diskCachePath stringByAppendingPathComponent:kSDImageCacheHotKeysName]];
+        }
+        NSUInteger maxCount = MIN(keys.count, self.config.memoryCacheWarmUpMaxCount);
+        NSUInteger maxCost = self.maxMemoryCost;
+        NSUInteger totalCost = 0;
+        for (NSUInteger i = 0; i < maxCount && !operation.isCancelled; i++) {
+            NSString *key = keys[i];
+            if (![key isKindOfClass:[NSString class]] || [self.memCache objectForKey:key]) {
+                continue;
+            }
+            @autoreleasepool {
+                // Read on the key's queue, so the read is ordered after writes, removals and the cleanup barriers
+                __block UIImage *image = nil;
+                dispatch_sync([self ioQueueForKey:key], ^{
+                    if (!operation.isCancelled) {
+                        image = [self diskImageForKey:key];
+                    }
+                });
+                if (!image) {
+                    continue;
+                }
+                NSUInteger cost = SDCacheCostForImage(image);
+                // 0 means no cost limit
+                if (maxCost > 0 && totalCost + cost > maxCost) {
+                    break;
+                }
+                // A real query may have cached it meanwhile
+                if (!operation.isCancelled && ![self.memCache objectForKey:key]) {
+                    [self.memCache setObject:image forKey:key cost:cost];
+                    totalCost += cost;
+                }
+            }
+        }
+        if (self.memoryCacheWarmUpOperation == operation) {
+            self.memoryCacheWarmUpOperation = nil;
+        }
+        if (completionBlock && !operation.isCancelled) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                completionBlock();
+            });
+        }
+    });
+    return operation;
+}
+
 #pragma mark - Remove Ops
 //删除缓存总指定key的图片，删除完成后的回调块completion
 //该方法也直接调用了下面的方法，默认也删除磁盘的数据
@@ -653,13 +1946,24 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
         //调用NSCache的removeObjectForKey方法
         [self.memCache removeObjectForKey:key];
     }
+    [self _removeMemoryVariantsForKey:key];
+    [self.memDataCache removeObjectForKey:key];
     //如果要删除磁盘数据
     if (fromDisk) {
-        //异步方式在ioQueue上执行删除操作
-        dispatch_async(self.ioQueue, ^{
+        //异步方式在key所在的串行队列上执行删除操作
+        dispatch_async([self ioQueueForKey:key], ^{
             //使用key构造一个默认路径下的文件存储的绝对路径
             //调用NSFileManager删除该路径的文件
+            NSString *fileName = [self cachedFileNameForKey:key];
+            [self _removePendingDiskWriteForKey:key];
+            [self _removeLegacyFileForKey:key];
+            [self _removePackedDataForName:fileName];
+            [self _removeBitmapImageForName:fileName];
             [self.fileManager removeItemAtPath:[self defaultCachePathForKey:key] error:nil];
+            if ([self.diskIndex entryForName:fileName]) {
+                [self.diskIndex removeName:fileName];
+                [self.diskLookupFilter removeName:fileName];
+            }
             //有回调块就在主线程中执行
             if (completion) {
                 dispatch_async(dispatch_get_main_queue(), ^{
@@ -694,23 +1998,82 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     self.memCache.countLimit = maxCountLimit;
 }
 
+- (NSUInteger)maxMemoryDataCost {
+    return self.memDataCache.totalCostLimit;
+}
+
+- (void)setMaxMemoryDataCost:(NSUInteger)maxMemoryDataCost {
+    self.memDataCache.totalCostLimit = maxMemoryDataCost;
+}
+
+- (SDMemoryCacheAdmissionPolicy)memoryCacheAdmissionPolicy {
+    return self.memCache.admissionPolicy;
+}
+
+- (void)setMemoryCacheAdmissionPolicy:(SDMemoryCacheAdmissionPolicy)memoryCacheAdmissionPolicy {
+    self.memCache.admissionPolicy = memoryCacheAdmissionPolicy;
+}
+
 #pragma mark - Cache clean Ops
 //清除缓存的操作，在收到系统内存警告通知时执行
 - (void)clearMemory {
     //调用NSCache方法删除所有缓存对象
     [self.memCache removeAllObjects];
+    [self.memDataCache removeAllObjects];
+    LOCK(self.memoryVariantSizesLock);
+    [self.memoryVariantSizes removeAllObjects];
+    UNLOCK(self.memoryVariantSizesLock);
+}
+
+- (NSUInteger)trimMemoryForPressureLevel:(SDMemoryCachePressureLevel)level {
+    return [self.memCache trimForMemoryPressureLevel:level];
+}
+
+- (NSUInteger)lastMemoryPressureTrimReleasedCost {
+    return self.memCache.lastPressureTrimReleasedCost;
+}
+
+- (NSUInteger)memoryPressureTrimReleasedCost {
+    return self.memCache.pressureTrimReleasedCost;
+}
+
+- (NSUInteger)memoryPressureTrimRedecodedCost {
+    return self.memCache.pressureTrimRedecodedCost;
 }
 //清空磁盘的缓存，完成后的回调块completion
 - (void)clearDiskOnCompletion:(nullable SDWebImageNoParamsBlock)completion {
-    //使用异步提交在ioQueue中执行
-    dispatch_async(self.ioQueue, ^{
+    //使用异步提交在ioQueue中执行，barrier保证独占磁盘缓存
+    dispatch_barrier_async(self.ioQueue, ^{
          //获取默认的图片存储路径然后使用NSFileManager删除这个路径的所有文件及文件夹
-        [self.fileManager removeItemAtPath:self.diskCachePath error:nil];
+        LOCK(self.pendingDiskWritesLock);
+        [self.pendingDiskWrites removeAllObjects];
+        self.pendingDiskWritesSize = 0;
+        UNLOCK(self.pendingDiskWritesLock);
+        [self.packStore removeAllData];
+        [self.diskIndex removeAllEntries];
+        LOCK(self.pendingBitmapWritesLock);
+        [self.pendingBitmapWrites removeAllObjects];
+        UNLOCK(self.pendingBitmapWritesLock);
+        [self.bitmapStore removeAllImages];
+        // The data tier would keep serving the bytes of the removed files
+        [self.memDataCache removeAllObjects];
+        // Downloads still being written are moved in later, stale ones are removed by the cleanup
+        for (NSString *fileName in [self.fileManager contentsOfDirectoryAtPath:self.diskCachePath error:nil]) {
+            if (![fileName isEqualToString:kSDImageCacheTemporaryDirectoryName]) {
+                [self.fileManager removeItemAtPath:[self.diskCachePath stringByAppendingPathComponent:fileName] error:nil];
+            }
+        }
         //删除以后再创建一个空的文件夹
         [self.fileManager createDirectoryAtPath:self.diskCachePath
                 withIntermediateDirectories:YES
                                  attributes:nil
                                       error:NULL];
+        // Listed again on next use, the empty directory has no legacy file
+        LOCK(self.legacyFileNamesLock);
+        self.legacyFileNames = nil;
+        UNLOCK(self.legacyFileNamesLock);
+        // Only the read-only paths are left
+        [self _rebuildDiskLookupFilter];
         //完成后有回调块就在主线程中执行
         if (completion) {
             dispatch_async(dispatch_get_main_queue(), ^{
@@ -725,19 +2088,40 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 }
 //删除磁盘中老的即超过缓存最长时限maxCacheAge的图片，完成后回调块completionBlock
 - (void)deleteOldFilesWithCompletionBlock:(nullable SDWebImageNoParamsBlock)completionBlock {
-   //异步方式在ioQueue上执行
-    dispatch_async(self.ioQueue, ^{
+   //异步方式在ioQueue上执行，barrier保证独占磁盘缓存
+    dispatch_barrier_async(self.ioQueue, ^{
+        // Buffered stores count as cache content too, and this also flushes them before the app is suspended or terminated
+        [self _flushPendingDiskWrites];
+        [self _removeStaleTemporaryFiles];
+        // Overwritten and removed entries would otherwise count toward the size until their whole segment is evicted
+        [self.packStore compactSegmentsWithDeadRatio:kSDImageCachePackCompactionDeadRatio];
+        NSDate *planDate = [NSDate date];
         //获取磁盘缓存存储图片的路径构造为NSURL对象
         NSURL *diskCacheURL = [NSURL fileURLWithPath:self.diskCachePath isDirectory:YES];
         //后面会用到，查询文件的属性
         NSArray<NSString *> *resourceKeys = @[NSURLIsDirectoryKey, NSURLContentModificationDateKey, NSURLTotalFileAllocatedSizeKey];
 
-        // This enumerator prefetches useful properties for our cache files.
-        //构造一个存储图片目录的迭代器，使用了上面的文件属性
-        NSDirectoryEnumerator *fileEnumerator = [self.fileManager enumeratorAtURL:diskCacheURL
-                                                   includingPropertiesForKeys:resourceKeys
-                                                                      options:NSDirectoryEnumerationSkipsHiddenFiles
-                                                                 errorHandler:NULL];
+        // The disk index describes every cache file, so the directory does not need to be enumerated and stat'ed.
+        NSMutableDictionary<NSURL *, NSDictionary<NSString *, id> *> *candidateFiles = [NSMutableDictionary dictionary];
+        for (SDImageCacheDiskIndexEntry *entry in [self.diskIndex allEntries]) {
+            NSURL *fileURL = [diskCacheURL URLByAppendingPathComponent:entry.name isDirectory:NO];
+            candidateFiles[fileURL] = @{NSURLContentModificationDateKey: [NSDate dateWithTimeIntervalSinceReferenceDate:entry.modificationTime],
+                                        NSURLContentAccessDateKey: [NSDate dateWithTimeIntervalSinceReferenceDate:entry.accessTime],
+                                        NSURLTotalFileAllocatedSizeKey: @(entry.size)};
+        }
+        // Pack segments are handled as whole units, there are only a few of them
+        for (NSURL *segmentURL in [self.packStore segmentURLs]) {
+            NSMutableDictionary<NSString *, id> *resourceValues = [[segmentURL resourceValuesForKeys:resourceKeys error:nil] mutableCopy];
+            if (resourceValues) {
+                // A segment was last used when one of its entries was last read, or when it was last appended to
+                NSDate *modificationDate = resourceValues[NSURLContentModificationDateKey];
+                NSDate *accessDate = [self _lastAccessDateForPackSegmentAtURL:segmentURL];
+                resourceValues[NSURLContentAccessDateKey] = accessDate ? [accessDate laterDate:modificationDate] : modificationDate;
+                candidateFiles[segmentURL] = resourceValues;
+            }
+        }
+        // Either evict the least recently used or the oldest written files
+        NSString *dateKey = self.config.diskCacheExpireType == SDImageCacheConfigExpireTypeAccessDate ? NSURLContentAccessDateKey : NSURLContentModificationDateKey;
         //构造过期日期，即当前时间往前maxCacheAge秒的日期
         NSDate *expirationDate = [NSDate dateWithTimeIntervalSinceNow:-self.config.maxCacheAge];
         //缓存的文件的字典
@@ -745,29 +2129,25 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
         //当前缓存大小
         NSUInteger currentCacheSize = 0;
 
-        // Enumerate all of the files in the cache directory.  This loop has two purposes:
+        // Go through all of the cache files.  This loop has two purposes:
         //
         //  1. Removing files that are older than the expiration date.
         //  2. Storing file attributes for the size-based cleanup pass.
         //需要删除的图片的文件URL
         NSMutableArray<NSURL *> *urlsToDelete = [[NSMutableArray alloc] init];
-        //遍历上面创建的那个目录迭代器
-        for (NSURL *fileURL in fileEnumerator) {
-            NSError *error;
-            //根据resourcesKeys获取文件的相关属性
-            NSDictionary<NSString *, id> *resourceValues = [fileURL resourceValuesForKeys:resourceKeys error:&error];
-
-            // Skip directories and errors.
-            //有错误，然后属性为nil或者路径是个目录就continue
-            if (error || !resourceValues || [resourceValues[NSURLIsDirectoryKey] boolValue]) {
+        for (NSURL *fileURL in candidateFiles) {
+            NSDictionary<NSString *, id> *resourceValues = candidateFiles[fileURL];
+
+            // Skip directories.
+            if ([resourceValues[NSURLIsDirectoryKey] boolValue]) {
                 continue;
             }
 
             // Remove files that are older than the expiration date;
-            //获取文件的上次修改日期，即创建日期
-            NSDate *modificationDate = resourceValues[NSURLContentModificationDateKey];
+            //获取文件的上次访问或修改日期
+            NSDate *date = resourceValues[dateKey];
             //如果过期就加进要删除的集合中
-            if ([[modificationDate laterDate:expirationDate] isEqualToDate:expirationDate]) {
+            if ([[date laterDate:expirationDate] isEqualToDate:expirationDate]) {
                 [urlsToDelete addObject:fileURL];
                 continue;
             }
@@ -779,30 +2159,39 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
             currentCacheSize += totalAllocatedSize.unsignedIntegerValue;
             cacheFiles[fileURL] = resourceValues;
         }
+        // If our remaining disk cache exceeds the high watermark, perform a second
+        // size-based cleanup pass down to the low watermark.  We delete the oldest files first.
+        //如果缓存策略配置了最大缓存大小，并且当前缓存的大小大于这个值则需要清理
+        const NSUInteger maxCacheSize = self.config.maxCacheSize;
+        const NSUInteger desiredCacheSize = (NSUInteger)(maxCacheSize * self.config.diskCacheTrimLowWatermark);
+        NSArray<NSURL *> *sortedFiles = @[];
+        if (maxCacheSize > 0 && currentCacheSize > (NSUInteger)(maxCacheSize * self.config.diskCacheTrimHighWatermark)) {
+            // Sort the remaining cache files by their last access or modification time (oldest first).
+            //根据文件访问或修改的日期排序
+            sortedFiles = [cacheFiles keysSortedByValueWithOptions:NSSortConcurrent
+                                                   usingComparator:^NSComparisonResult(id obj1, id obj2) {
+                                                       return [obj1[dateKey] compare:obj2[dateKey]];
+                                                   }];
+        }
+
+        if (self.config.shouldTrimDiskCacheIncrementally) {
+            // The expired files go first, then the least recently used ones, in short slices
+            NSArray<NSURL *> *fileURLs = [urlsToDelete arrayByAddingObjectsFromArray:sortedFiles];
+            [self _removeDiskCacheFilesIncrementally:fileURLs fromIndex:0 expiredCount:urlsToDelete.count desiredSize:desiredCacheSize planDate:planDate completion:completionBlock];
+            return;
+        }
+
         //遍历要删除的过期的图片文件URL集合，并删除文件
+        NSMutableSet<NSString *> *removedFileNames = [NSMutableSet set];
         for (NSURL *fileURL in urlsToDelete) {
-            [self.fileManager removeItemAtURL:fileURL error:nil];
+            [self _removeDiskCacheFileAtURL:fileURL removedFileNames:removedFileNames];
         }
 
-        // If our remaining disk cache exceeds a configured maximum size, perform a second
-        // size-based cleanup pass.  We delete the oldest files first.
-        //如果缓存策略配置了最大缓存大小，并且当前缓存的大小大于这个值则需要清理
-        if (self.config.maxCacheSize > 0 && currentCacheSize > self.config.maxCacheSize) {
-            // Target half of our maximum cache size for this cleanup pass.
-             //清理到只占用最大缓存大小的一半
-            const NSUInteger desiredCacheSize = self.config.maxCacheSize / 2;
-
-            // Sort the remaining cache files by their last modification time (oldest first).
-            //根据文件创建的日期排序
-            NSArray<NSURL *> *sortedFiles = [cacheFiles keysSortedByValueWithOptions:NSSortConcurrent
-                                                                     usingComparator:^NSComparisonResult(id obj1, id obj2) {
-                                                                         return [obj1[NSURLContentModificationDateKey] compare:obj2[NSURLContentModificationDateKey]];
-                                                                     }];
-
+        if (sortedFiles.count > 0) {
             // Delete files until we fall below our desired cache size.
             //按创建的先后顺序遍历，然后删除，直到缓存大小是最大值的一半
             for (NSURL *fileURL in sortedFiles) {
-                if ([self.fileManager removeItemAtURL:fileURL error:nil]) {
+                if ([self _removeDiskCacheFileAtURL:fileURL removedFileNames:removedFileNames]) {
                     NSDictionary<NSString *, id> *resourceValues = cacheFiles[fileURL];
                     NSNumber *totalAllocatedSize = resourceValues[NSURLTotalFileAllocatedSizeKey];
                     currentCacheSize -= totalAllocatedSize.unsignedIntegerValue;
@@ -813,6 +2202,8 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
                 }
             }
         }
+        [self _removeMemoryDataForFileNames:removedFileNames];
+        [self _finishDiskCacheCleanup];
         //执行完成后在主线程执行回调块
         if (completionBlock) {
             dispatch_async(dispatch_get_main_queue(), ^{
@@ -822,6 +2213,154 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     });
 }
 
+// Make sure to call form io queue by caller, as a barrier
+- (void)_removeDiskCacheFilesIncrementally:(nonnull NSArray<NSURL *> *)fileURLs
+                                 fromIndex:(NSUInteger)index
+                              expiredCount:(NSUInteger)expiredCount
+                               desiredSize:(NSUInteger)desiredSize
+                                  planDate:(nonnull NSDate *)planDate
+                                completion:(nullable SDWebImageNoParamsBlock)completionBlock {
+    CFAbsoluteTime deadline = CFAbsoluteTimeGetCurrent() + self.config.diskCacheTrimSliceDuration;
+    NSMutableSet<NSString *> *removedFileNames = [NSMutableSet set];
+    BOOL finished = NO;
+    while (!finished) {
+        // The real size is checked, it includes what was stored since the plan was made
+        if (index >= fileURLs.count || (index >= expiredCount && [self getSize] <= desiredSize)) {
+            finished = YES;
+            break;
+        }
+        NSURL *fileURL = fileURLs[index];
+        index += 1;
+        if (![self _diskCacheFileAtURL:fileURL wasUsedSinceDate:planDate]) {
+            [self _removeDiskCacheFileAtURL:fileURL removedFileNames:removedFileNames];
+        }
+        if (CFAbsoluteTimeGetCurrent() >= deadline) {
+            break;
+        }
+    }
+    // Before the queries submitted during this slice run
+    [self _removeMemoryDataForFileNames:removedFileNames];
+    if (!finished) {
+        // A new barrier only runs after the queries and stores submitted during this slice
+        dispatch_barrier_async(self.ioQueue, ^{
+            [self _removeDiskCacheFilesIncrementally:fileURLs fromIndex:index expiredCount:expiredCount desiredSize:desiredSize planDate:planDate completion:completionBlock];
+        });
+        return;
+    }
+    
+    [self _finishDiskCacheCleanup];
+    if (completionBlock) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            completionBlock();
+        });
+    }
+}
+
+// Make sure to call form io queue by caller
+// The reads of this session are tracked by the pack store, the earlier ones were saved to the disk index by the last cleanup
+- (nullable NSDate *)_lastAccessDateForPackSegmentAtURL:(nonnull NSURL *)segmentURL {
+    NSDate *accessDate = [self.packStore lastAccessDateForSegmentAtURL:segmentURL];
+    if (accessDate) {
+        return accessDate;
+    }
+    NSData *metadata = [self.diskIndex metadataForName:SDImageCachePackSegmentMetadataName(segmentURL)];
+    if (metadata.length != sizeof(CFSwappedFloat64)) {
+        return nil;
+    }
+    CFSwappedFloat64 accessTime;
+    [metadata getBytes:&accessTime length:sizeof(accessTime)];
+    return [NSDate dateWithTimeIntervalSinceReferenceDate:CFConvertDoubleSwappedToHost(accessTime)];
+}
+
+// Make sure to call form io queue by caller
+// A file read or written after the cleanup was planned is no longer a good victim
+- (BOOL)_diskCacheFileAtURL:(nonnull NSURL *)fileURL wasUsedSinceDate:(nonnull NSDate *)date {
+    if ([fileURL.URLByDeletingLastPathComponent.lastPathComponent isEqualToString:kSDImageCachePackDirectoryName]) {
+        NSDate *accessDate = [self.packStore lastAccessDateForSegmentAtURL:fileURL];
+        return accessDate && [accessDate compare:date] == NSOrderedDescending;
+    }
+    SDImageCacheDiskIndexEntry *entry = [self.diskIndex entryForName:fileURL.lastPathComponent];
+    return entry && MAX(entry.accessTime, entry.modificationTime) > date.timeIntervalSinceReferenceDate;
+}
+
+// Make sure to call form io queue by caller, when a store may have pushed the disk cache above the high watermark
+- (void)_trimDiskCacheIfNeeded {
+    NSUInteger maxCacheSize = self.config.maxCacheSize;
+    if (!self.config.shouldTrimDiskCacheIncrementally || maxCacheSize == 0) {
+        return;
+    }
+    if ([self getSize] <= (NSUInteger)(maxCacheSize * self.config.diskCacheTrimHighWatermark)) {
+        return;
+    }
+    LOCK(self.diskTrimLock);
+    BOOL scheduled = self.diskTrimScheduled;
+    self.diskTrimScheduled = YES;
+    UNLOCK(self.diskTrimLock);
+    if (!scheduled) {
+        [self deleteOldFilesWithCompletionBlock:nil];
+    }
+}
+
+// Make sure to call form io queue by caller, as a barrier
+- (void)_finishDiskCacheCleanup {
+    // The bitmap tier has its own budget. Bitmaps of images in evicted pack segments are never served again, they just age out here
+    [self.bitmapStore removeImagesLastAccessedBeforeDate:[NSDate dateWithTimeIntervalSinceNow:-self.config.maxCacheAge]];
+    if (self.config.diskBitmapStoreMaxSize > 0) {
+        [self.bitmapStore trimToSize:self.config.diskBitmapStoreMaxSize];
+    }
+    // Keep the access times of the pack segments for the next launch, and drop the metadata of the entries in evicted segments
+    NSMutableSet<NSString *> *packNames = [NSMutableSet setWithArray:[self.packStore allNames]];
+    [self.diskIndex performBatchUpdates:^{
+        for (NSURL *segmentURL in [self.packStore segmentURLs]) {
+            NSString *metadataName = SDImageCachePackSegmentMetadataName(segmentURL);
+            NSDate *accessDate = [self.packStore lastAccessDateForSegmentAtURL:segmentURL];
+            if (accessDate) {
+                CFSwappedFloat64 accessTime = CFConvertDoubleHostToSwapped(accessDate.timeIntervalSinceReferenceDate);
+                [self.diskIndex setMetadata:[NSData dataWithBytes:&accessTime length:sizeof(accessTime)] forName:metadataName];
+            }
+            [packNames addObject:metadataName];
+        }
+        [self.diskIndex removeMetadataOfUnindexedNamesExcept:packNames];
+    }];
+    // Persist the buffered index records, compacting the journal if needed
+    [self.diskIndex synchronize];
+    [self _synchronizeLegacyFileNames];
+    // Removing whole pack segments drops many names at once, a rebuild is simpler than tracking them
+    [self _rebuildDiskLookupFilter];
+    LOCK(self.diskTrimLock);
+    self.diskTrimScheduled = NO;
+    UNLOCK(self.diskTrimLock);
+}
+
+// Make sure to call form io queue by caller. The names of the removed entries are added to `removedFileNames`
+- (BOOL)_removeDiskCacheFileAtURL:(nonnull NSURL *)fileURL removedFileNames:(nonnull NSMutableSet<NSString *> *)removedFileNames {
+    if ([fileURL.URLByDeletingLastPathComponent.lastPathComponent isEqualToString:kSDImageCachePackDirectoryName]) {
+        [removedFileNames addObjectsFromArray:[self.packStore removeSegmentAtURL:fileURL]];
+        return YES;
+    }
+    NSError *error;
+    BOOL removed = [self.fileManager removeItemAtURL:fileURL error:&error];
+    // A file which is already gone only has to be dropped from the index
+    if (removed || error.code == NSFileNoSuchFileError) {
+        [self.diskIndex removeName:fileURL.lastPathComponent];
+        [self _removeBitmapImageForName:fileURL.lastPathComponent];
+        [removedFileNames addObject:fileURL.lastPathComponent];
+        return YES;
+    }
+    return NO;
+}
+
+// Make sure to call form io queue by caller
+// The data tier is keyed by cache key, so its keys are mapped to their file names to find the evicted ones
+- (void)_removeMemoryDataForFileNames:(nonnull NSSet<NSString *> *)fileNames {
+    if (fileNames.count == 0) {
+        return;
+    }
+    [self.memDataCache removeObjectsPassingTest:^BOOL(NSString * _Nonnull key) {
+        return [fileNames containsObject:[self cachedFileNameForKey:key]];
+    }];
+}
+
 #if SD_UIKIT
 //在ios下才会有的函数
 //写不动了，就是在后台删除。。。自己看看吧。。。唉
@@ -844,6 +2383,33 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
         bgTask = UIBackgroundTaskInvalid;
     }];
 }
+
+// The snapshot is written on the io queue, the background task keeps the app running until it is on disk
+- (void)backgroundSaveHotKeySnapshot {
+    if (!self.config.shouldWarmMemoryCacheAtLaunch) {
+        return;
+    }
+    Class UIApplicationClass = NSClassFromString(@"UIApplication");
+    if(!UIApplicationClass || ![UIApplicationClass respondsToSelector:@selector(sharedApplication)]) {
+        dispatch_async(self.ioQueue, ^{
+            [self saveHotKeySnapshot];
+        });
+        return;
+    }
+    UIApplication *application = [UIApplication performSelector:@selector(sharedApplication)];
+    __block UIBackgroundTaskIdentifier bgTask = [application beginBackgroundTaskWithExpirationHandler:^{
+        [application endBackgroundTask:bgTask];
+        bgTask = UIBackgroundTaskInvalid;
+    }];
+
+    dispatch_async(self.ioQueue, ^{
+        [self saveHotKeySnapshot];
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [application endBackgroundTask:bgTask];
+            bgTask = UIBackgroundTaskInvalid;
+        });
+    });
+}
 #endif
 
 /**
@@ -851,47 +2417,43 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
  */
 
 #pragma mark - Cache Info
+
+- (NSUInteger)diskLookupFilterNegativeCount {
+    return self.diskLookupFilter.negativeCount;
+}
+
+- (NSUInteger)diskLookupFilterHitCount {
+    // Read the false positives first, they never outnumber the positives recorded before them
+    NSUInteger falsePositiveCount = self.diskLookupFilter.falsePositiveCount;
+    return self.diskLookupFilter.positiveCount - falsePositiveCount;
+}
+
+- (NSUInteger)diskLookupFilterFalsePositiveCount {
+    return self.diskLookupFilter.falsePositiveCount;
+}
 //计算磁盘缓存占用空间大小
+// Both the disk index and the pack store keep their totals in memory, so this does not wait for the ioQueue
 - (NSUInteger)getSize {
-    __block NSUInteger size = 0;
-    dispatch_sync(self.ioQueue, ^{
-        NSDirectoryEnumerator *fileEnumerator = [self.fileManager enumeratorAtPath:self.diskCachePath];
-        for (NSString *fileName in fileEnumerator) {
-            NSString *filePath = [self.diskCachePath stringByAppendingPathComponent:fileName];
-            NSDictionary<NSString *, id> *attrs = [self.fileManager attributesOfItemAtPath:filePath error:nil];
-            size += [attrs fileSize];
-        }
-    });
-    return size;
+    return (NSUInteger)self.diskIndex.totalSize + self.packStore.totalSize;
 }
 //计算磁盘缓存图片的个数
 - (NSUInteger)getDiskCount {
-    __block NSUInteger count = 0;
-    dispatch_sync(self.ioQueue, ^{
-        NSDirectoryEnumerator *fileEnumerator = [self.fileManager enumeratorAtPath:self.diskCachePath];
-        count = fileEnumerator.allObjects.count;
-    });
-    return count;
+    return self.diskIndex.count + self.packStore.entryCount;
 }
-//同时计算磁盘缓存图片占用空间大小和缓存图片的个数，然后调用回调块，传入相关参数
-- (void)calculateSizeWithCompletionBlock:(nullable SDWebImageCalculateSizeBlock)completionBlock {
-    NSURL *diskCacheURL = [NSURL fileURLWithPath:self.diskCachePath isDirectory:YES];
 
-    dispatch_async(self.ioQueue, ^{
-        NSUInteger fileCount = 0;
-        NSUInteger totalSize = 0;
-
-        NSDirectoryEnumerator *fileEnumerator = [self.fileManager enumeratorAtURL:diskCacheURL
-                                                   includingPropertiesForKeys:@[NSFileSize]
-                                                                      options:NSDirectoryEnumerationSkipsHiddenFiles
-                                                                 errorHandler:NULL];
+- (NSUInteger)getMemorySize {
+    return self.memCache.totalCost;
+}
 
-        for (NSURL *fileURL in fileEnumerator) {
-            NSNumber *fileSize;
-            [fileURL getResourceValue:&fileSize forKey:NSURLFileSizeKey error:NULL];
-            totalSize += fileSize.unsignedIntegerValue;
-            fileCount += 1;
-        }
+- (NSUInteger)getMemoryCount {
+    return self.memCache.totalCount;
+}
+//同时计算磁盘缓存图片占用空间大小和缓存图片的个数，然后调用回调块，传入相关参数
+- (void)calculateSizeWithCompletionBlock:(nullable SDWebImageCalculateSizeBlock)completionBlock {
+    // Still hop through the ioQueue as a barrier, so the result includes the disk operations submitted before
+    dispatch_barrier_async(self.ioQueue, ^{
+        NSUInteger fileCount = self.diskIndex.count + self.packStore.entryCount;
+        NSUInteger totalSize = (NSUInteger)self.diskIndex.totalSize + self.packStore.totalSize;
 
         if (completionBlock) {
             dispatch_async(dispatch_get_main_queue(), ^{
@@ -902,6 +2464,37 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 }
 //上面的方法就是用来计算磁盘中缓存图片的数量和占用磁盘空间大小
 
+- (void)writeArchiveToFile:(nonnull NSString *)path completion:(nullable void (^)(NSError * _Nullable error))completionBlock {
+    // A barrier, so no store or cleanup changes the disk cache while it is read
+    dispatch_barrier_async(self.ioQueue, ^{
+        [self _flushPendingDiskWrites];
+        // The loose files, then the packed entries. The hidden directories hold the stores and the downloads, not cache files
+        NSMutableOrderedSet<NSString *> *names = [NSMutableOrderedSet orderedSet];
+        NSURL *diskCacheURL = [NSURL fileURLWithPath:self.diskCachePath isDirectory:YES];
+        for (NSURL *fileURL in [self.fileManager contentsOfDirectoryAtURL:diskCacheURL includingPropertiesForKeys:@[NSURLIsRegularFileKey] options:NSDirectoryEnumerationSkipsHiddenFiles error:nil]) {
+            NSNumber *isRegularFile;
+            [fileURL getResourceValue:&isRegularFile forKey:NSURLIsRegularFileKey error:nil];
+            if (isRegularFile.boolValue) {
+                [names addObject:fileURL.lastPathComponent];
+            }
+        }
+        [names addObjectsFromArray:[self.packStore allNames]];
+        NSError *error = nil;
+        [SDImageCacheArchive writeArchiveToFile:path names:names.array dataProvider:^NSData *(NSString *name, NSError **dataError) {
+            NSData *packedData = [self.packStore dataForName:name];
+            if (packedData) {
+                return packedData;
+            }
+            return [NSData dataWithContentsOfURL:[diskCacheURL URLByAppendingPathComponent:name isDirectory:NO] options:NSDataReadingMappedIfSafe error:dataError];
+        } error:&error];
+        if (completionBlock) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                completionBlock(error);
+            });
+        }
+    });
+}
+
 @end
 
 /*
@@ -0,0 +1,87 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+
+/**
+ * The path extension of archive files. A read-only cache path with this extension is opened as an archive.
+ */
+FOUNDATION_EXPORT NSString * _Nonnull const SDImageCacheArchivePathExtension;
+
+/**
+ * A read-only, memory-mapped archive of cache files, meant to ship pre-loaded images with an app.
+ * The file is a header, the payloads one after the other, and a table of contents (name, offset, length) at the end.
+ * The table is read once when the archive is opened. Lookups are a hash probe, and the data returned is a zero-copy slice of the mapping.
+ * Archives are built from a cache with `-[SDImageCache writeArchiveToFile:completion:]`, or from a directory of cache files with `writeArchiveToFile:fromDirectory:error:`, see also the `sdarchive` command-line tool in `Tools`.
+ * All methods are thread-safe.
+ */
+@interface SDImageCacheArchive : NSObject
+
+/**
+ * The path of the archive file.
+ */
+@property (nonatomic, copy, readonly, nonnull) NSString *path;
+
+/**
+ * The number of entries in the archive.
+ */
+@property (nonatomic, assign, readonly) NSUInteger count;
+
+/**
+ * Map the archive file and read its table of contents.
+ *
+ * @return nil if the file can not be mapped or is not a valid archive
+ */
++ (nullable instancetype)archiveWithContentsOfFile:(nonnull NSString *)path;
+
+- (nonnull instancetype)init NS_UNAVAILABLE;
+
+/**
+ * Return the data for the given name as a slice of the mapped file, or nil if it is not in the archive.
+ */
+- (nullable NSData *)dataForName:(nonnull NSString *)name;
+
+/**
+ * Check whether the archive holds the given name.
+ */
+- (BOOL)containsName:(nonnull NSString *)name;
+
+/**
+ * The names of all entries.
+ */
+- (nonnull NSArray<NSString *> *)allNames;
+
+/**
+ * Write an archive holding every regular, non hidden file at the top level of the given directory, under its file name.
+ * The directory of a cache filled with `SDImageCache` only holds all of its images when the pack store is off and the buffered stores are flushed. This fails when the directory holds packed entries, prefer `-[SDImageCache writeArchiveToFile:completion:]` to archive a cache.
+ *
+ * @param path      The path of the archive file to write, replaced if it exists
+ * @param directory The directory holding the cache files
+ * @param error     On failure, the reason
+ *
+ * @return YES if the archive was written
+ */
++ (BOOL)writeArchiveToFile:(nonnull NSString *)path fromDirectory:(nonnull NSString *)directory error:(NSError * _Nullable * _Nullable)error;
+
+/**
+ * Write an archive holding the given names, with the data returned for each of them.
+ *
+ * @param path         The path of the archive file to write, replaced if it exists
+ * @param names        The names of the entries
+ * @param dataProvider Return the data of the name. Return nil to leave the name out, or nil with an error to fail the whole archive
+ * @param error        On failure, the reason
+ *
+ * @return YES if the archive was written
+ */
++ (BOOL)writeArchiveToFile:(nonnull NSString *)path
+                     names:(nonnull NSArray<NSString *> *)names
+              dataProvider:(NSData * _Nullable (^ _Nonnull)(NSString * _Nonnull name, NSError * _Nullable * _Nullable error))dataProvider
+                     error:(NSError * _Nullable * _Nullable)error;
+
+@end
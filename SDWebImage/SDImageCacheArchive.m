@@ -0,0 +1,231 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDImageCacheArchive.h"
+
+NSString * const SDImageCacheArchivePathExtension = @"sdarchive";
+
+static const uint32_t kSDArchiveMagic = 0x52414453; // "SDAR"
+static const uint32_t kSDArchiveVersion = 1;
+
+// All fields little endian. The table of contents is a sequence of (name length, name, offset, length)
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t entryCount;
+    uint64_t tableOffset;
+    uint64_t tableLength;
+} SDArchiveHeader;
+
+@interface SDImageCacheArchive ()
+
+@property (nonatomic, copy, readwrite, nonnull) NSString *path;
+@property (nonatomic, strong, nonnull) NSData *mappedData;
+@property (nonatomic, copy, nonnull) NSDictionary<NSString *, NSValue *> *ranges; // name -> NSRange of the payload
+
+@end
+
+@implementation SDImageCacheArchive
+
++ (instancetype)archiveWithContentsOfFile:(NSString *)path {
+    if (!path) {
+        return nil;
+    }
+    NSData *mappedData = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedAlways error:nil];
+    if (mappedData.length < sizeof(SDArchiveHeader)) {
+        return nil;
+    }
+    const uint8_t *bytes = mappedData.bytes;
+    NSUInteger length = mappedData.length;
+    SDArchiveHeader header;
+    memcpy(&header, bytes, sizeof(header));
+    uint64_t entryCount = CFSwapInt64LittleToHost(header.entryCount);
+    uint64_t tableOffset = CFSwapInt64LittleToHost(header.tableOffset);
+    uint64_t tableLength = CFSwapInt64LittleToHost(header.tableLength);
+    if (CFSwapInt32LittleToHost(header.magic) != kSDArchiveMagic || CFSwapInt32LittleToHost(header.version) != kSDArchiveVersion ||
+        tableOffset < sizeof(header) || tableOffset > length || tableLength > length - tableOffset) {
+        return nil;
+    }
+
+    NSMutableDictionary<NSString *, NSValue *> *ranges = [NSMutableDictionary dictionaryWithCapacity:(NSUInteger)MIN(entryCount, (uint64_t)tableLength)];
+    NSUInteger cursor = (NSUInteger)tableOffset;
+    NSUInteger tableEnd = (NSUInteger)(tableOffset + tableLength);
+    for (uint64_t i = 0; i < entryCount; i++) {
+        uint16_t nameLength;
+        uint64_t offset, entryLength;
+        if (cursor + sizeof(nameLength) > tableEnd) {
+            return nil;
+        }
+        memcpy(&nameLength, bytes + cursor, sizeof(nameLength));
+        cursor += sizeof(nameLength);
+        nameLength = CFSwapInt16LittleToHost(nameLength);
+        if (cursor + nameLength + sizeof(offset) + sizeof(entryLength) > tableEnd) {
+            return nil;
+        }
+        NSString *name = [[NSString alloc] initWithBytes:bytes + cursor length:nameLength encoding:NSUTF8StringEncoding];
+        cursor += nameLength;
+        memcpy(&offset, bytes + cursor, sizeof(offset));
+        cursor += sizeof(offset);
+        memcpy(&entryLength, bytes + cursor, sizeof(entryLength));
+        cursor += sizeof(entryLength);
+        offset = CFSwapInt64LittleToHost(offset);
+        entryLength = CFSwapInt64LittleToHost(entryLength);
+        // Payloads live between the header and the table
+        if (!name || offset < sizeof(header) || offset > tableOffset || entryLength > tableOffset - offset) {
+            return nil;
+        }
+        ranges[name] = [NSValue valueWithRange:NSMakeRange((NSUInteger)offset, (NSUInteger)entryLength)];
+    }
+
+    SDImageCacheArchive *archive = [[self alloc] initWithPath:path];
+    archive.mappedData = mappedData;
+    archive.ranges = ranges;
+    return archive;
+}
+
+- (instancetype)initWithPath:(NSString *)path {
+    self = [super init];
+    if (self) {
+        _path = [path copy];
+    }
+    return self;
+}
+
+- (NSUInteger)count {
+    return self.ranges.count;
+}
+
+- (NSData *)dataForName:(NSString *)name {
+    if (!name) {
+        return nil;
+    }
+    NSValue *rangeValue = self.ranges[name];
+    if (!rangeValue) {
+        return nil;
+    }
+    NSRange range = rangeValue.rangeValue;
+    NSData *mappedData = self.mappedData;
+    void *bytes = (uint8_t *)mappedData.bytes + range.location;
+    return [[NSData alloc] initWithBytesNoCopy:bytes length:range.length deallocator:^(void * _Nonnull b, NSUInteger l) {
+        // The slice retains the mapping, so it stays valid even if the archive is released meanwhile
+        (void)mappedData;
+    }];
+}
+
+- (BOOL)containsName:(NSString *)name {
+    if (!name) {
+        return NO;
+    }
+    return self.ranges[name] != nil;
+}
+
+- (NSArray<NSString *> *)allNames {
+    return self.ranges.allKeys;
+}
+
+#pragma mark - Writing
+
++ (BOOL)writeArchiveToFile:(NSString *)path fromDirectory:(NSString *)directory error:(NSError **)error {
+    NSFileManager *fileManager = [NSFileManager new];
+    // The small entries of a cache using the pack store are in its hidden segments, which are not cache files: the archive would miss them
+    NSArray<NSString *> *packedFileNames = [fileManager contentsOfDirectoryAtPath:[directory stringByAppendingPathComponent:@".pack"] error:nil];
+    if (packedFileNames.count > 0) {
+        if (error) {
+            *error = [NSError errorWithDomain:SDWebImageErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey : [NSString stringWithFormat:@"%@ holds packed entries, archive it with -[SDImageCache writeArchiveToFile:completion:]", directory]}];
+        }
+        return NO;
+    }
+    NSURL *directoryURL = [NSURL fileURLWithPath:directory isDirectory:YES];
+    NSArray<NSString *> *resourceKeys = @[NSURLIsRegularFileKey];
+    NSArray<NSURL *> *fileURLs = [fileManager contentsOfDirectoryAtURL:directoryURL
+                                            includingPropertiesForKeys:resourceKeys
+                                                               options:NSDirectoryEnumerationSkipsHiddenFiles
+                                                                 error:error];
+    if (!fileURLs) {
+        return NO;
+    }
+    NSMutableArray<NSString *> *names = [NSMutableArray arrayWithCapacity:fileURLs.count];
+    for (NSURL *fileURL in fileURLs) {
+        NSNumber *isRegularFile;
+        [fileURL getResourceValue:&isRegularFile forKey:NSURLIsRegularFileKey error:nil];
+        if (isRegularFile.boolValue) {
+            [names addObject:fileURL.lastPathComponent];
+        }
+    }
+    return [self writeArchiveToFile:path names:names dataProvider:^NSData *(NSString *name, NSError **dataError) {
+        return [NSData dataWithContentsOfURL:[directoryURL URLByAppendingPathComponent:name] options:NSDataReadingMappedIfSafe error:dataError];
+    } error:error];
+}
+
++ (BOOL)writeArchiveToFile:(NSString *)path names:(NSArray<NSString *> *)names dataProvider:(NSData * (^)(NSString *name, NSError **error))dataProvider error:(NSError **)error {
+    NSFileManager *fileManager = [NSFileManager new];
+    NSString *temporaryPath = [path stringByAppendingString:@".tmp"];
+    [fileManager removeItemAtPath:temporaryPath error:nil];
+    if (![fileManager createFileAtPath:temporaryPath contents:nil attributes:nil]) {
+        if (error) {
+            *error = [NSError errorWithDomain:SDWebImageErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey : [NSString stringWithFormat:@"Can not create %@", temporaryPath]}];
+        }
+        return NO;
+    }
+    NSFileHandle *fileHandle = [NSFileHandle fileHandleForWritingAtPath:temporaryPath];
+    SDArchiveHeader header = {0};
+    [fileHandle writeData:[NSData dataWithBytes:&header length:sizeof(header)]];
+
+    // Payloads are streamed to the file, only the table is built in memory
+    NSMutableData *table = [NSMutableData data];
+    uint64_t offset = sizeof(header);
+    uint64_t entryCount = 0;
+    for (NSString *name in names) {
+        @autoreleasepool {
+            NSData *nameData = [name dataUsingEncoding:NSUTF8StringEncoding];
+            if (!nameData || nameData.length > UINT16_MAX) {
+                continue;
+            }
+            NSError *dataError = nil;
+            NSData *data = dataProvider(name, &dataError);
+            if (!data) {
+                if (!dataError) {
+                    // Gone meanwhile
+                    continue;
+                }
+                if (error) {
+                    *error = dataError;
+                }
+                [fileHandle closeFile];
+                [fileManager removeItemAtPath:temporaryPath error:nil];
+                return NO;
+            }
+            [fileHandle writeData:data];
+            uint16_t nameLength = CFSwapInt16HostToLittle((uint16_t)nameData.length);
+            uint64_t entryOffset = CFSwapInt64HostToLittle(offset);
+            uint64_t entryLength = CFSwapInt64HostToLittle((uint64_t)data.length);
+            [table appendBytes:&nameLength length:sizeof(nameLength)];
+            [table appendData:nameData];
+            [table appendBytes:&entryOffset length:sizeof(entryOffset)];
+            [table appendBytes:&entryLength length:sizeof(entryLength)];
+            offset += data.length;
+            entryCount += 1;
+        }
+    }
+    [fileHandle writeData:table];
+
+    header.magic = CFSwapInt32HostToLittle(kSDArchiveMagic);
+    header.version = CFSwapInt32HostToLittle(kSDArchiveVersion);
+    header.entryCount = CFSwapInt64HostToLittle(entryCount);
+    header.tableOffset = CFSwapInt64HostToLittle(offset);
+    header.tableLength = CFSwapInt64HostToLittle((uint64_t)table.length);
+    [fileHandle seekToFileOffset:0];
+    [fileHandle writeData:[NSData dataWithBytes:&header length:sizeof(header)]];
+    [fileHandle synchronizeFile];
+    [fileHandle closeFile];
+
+    [fileManager removeItemAtPath:path error:nil];
+    return [fileManager moveItemAtPath:temporaryPath toPath:path error:error];
+}
+
+@end
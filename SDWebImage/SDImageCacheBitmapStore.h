@@ -0,0 +1,85 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+
+/**
+ * A disk store of already decoded images. Each file holds a small header (size, row stride, scale, orientation) followed by the 32 bit premultiplied BGRA bitmap.
+ * Reads memory-map the file and wrap it in a `CGDataProvider`, so the returned image is ready to draw without any decode or heap copy.
+ * The store has its own size budget and evicts the least recently used files first.
+ * All methods are thread-safe.
+ */
+@interface SDImageCacheBitmapStore : NSObject
+
+/**
+ * The directory which holds the bitmap files.
+ */
+@property (nonatomic, copy, readonly, nonnull) NSString *directory;
+
+/**
+ * The maximum total size of the bitmap files, in bytes. When a store exceeds it, the least recently used files are removed until half of it is used.
+ * 0 means no limit.
+ */
+@property (nonatomic, assign) NSUInteger maxSize;
+
+/**
+ * The total size of the bitmap files, in bytes.
+ */
+@property (nonatomic, assign, readonly) NSUInteger totalSize;
+
+/**
+ * The number of bitmap files.
+ */
+@property (nonatomic, assign, readonly) NSUInteger count;
+
+/**
+ * Create a store using the files in the given directory. The directory is created on the first write.
+ * The existing files are listed lazily on first access.
+ *
+ * @param directory The directory which holds the bitmap files
+ * @param maxSize   The size budget in bytes, 0 means no limit
+ */
+- (nonnull instancetype)initWithDirectory:(nonnull NSString *)directory maxSize:(NSUInteger)maxSize NS_DESIGNATED_INITIALIZER;
+
+- (nonnull instancetype)init NS_UNAVAILABLE;
+
+/**
+ * Render the image into a bitmap file for the given name, replacing any previous one.
+ * Animated images and images larger than the whole budget are not stored.
+ *
+ * @return YES if the file was written
+ */
+- (BOOL)storeImage:(nonnull UIImage *)image forName:(nonnull NSString *)name;
+
+/**
+ * Return the image for the given name backed by the mapped file, or nil if there is none or the file is invalid.
+ */
+- (nullable UIImage *)imageForName:(nonnull NSString *)name;
+
+/**
+ * Remove the bitmap file for the given name.
+ */
+- (void)removeImageForName:(nonnull NSString *)name;
+
+/**
+ * Remove all bitmap files.
+ */
+- (void)removeAllImages;
+
+/**
+ * Remove the files which were not read or written since the given date.
+ */
+- (void)removeImagesLastAccessedBeforeDate:(nonnull NSDate *)date;
+
+/**
+ * Remove the least recently used files until the total size is at most the given size.
+ */
+- (void)trimToSize:(NSUInteger)size;
+
+@end
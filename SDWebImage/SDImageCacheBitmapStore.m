@@ -0,0 +1,315 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDImageCacheBitmapStore.h"
+#import "SDWebImageCoder.h"
+#import "NSImage+WebCache.h"
+
+#define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
+#define UNLOCK(lock) dispatch_semaphore_signal(lock);
+
+static const uint32_t kSDBitmapFileMagic = 0x5344424D; // "SDBM"
+static const uint32_t kSDBitmapFileVersion = 1;
+// Rows are aligned for fast drawing, the header is padded to the same alignment so the pixels are too
+static const size_t kSDBitmapRowAlignment = 64;
+
+// On-disk header, stored in host byte order like the pixels which follow it
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytesPerRow;
+    uint32_t bitmapInfo;
+    uint32_t orientation;
+    uint32_t reserved;
+    double scale;
+    uint8_t padding[24]; // up to kSDBitmapRowAlignment
+} SDBitmapFileHeader;
+
+static void SDBitmapStoreReleaseData(void *info, const void *data, size_t size) {
+    // Balance the retain of the mapped data in `imageForName:`
+    CFRelease(info);
+}
+
+@interface SDImageCacheBitmapEntry : NSObject
+
+@property (nonatomic, assign) NSUInteger size;
+@property (nonatomic, assign) NSTimeInterval accessTime;
+
+@end
+
+@implementation SDImageCacheBitmapEntry
+
+@end
+
+@interface SDImageCacheBitmapStore ()
+
+@property (nonatomic, copy, readwrite, nonnull) NSString *directory;
+@property (nonatomic, strong, nonnull) dispatch_semaphore_t lock; // a lock to keep the access to `entries` thread-safe
+@property (nonatomic, strong, nullable) NSMutableDictionary<NSString *, SDImageCacheBitmapEntry *> *entries; // nil until the directory is listed
+@property (nonatomic, assign) NSUInteger currentSize;
+@property (nonatomic, strong, nonnull) NSFileManager *fileManager;
+
+@end
+
+@implementation SDImageCacheBitmapStore
+
+- (instancetype)initWithDirectory:(NSString *)directory maxSize:(NSUInteger)maxSize {
+    self = [super init];
+    if (self) {
+        _directory = [directory copy];
+        _maxSize = maxSize;
+        _lock = dispatch_semaphore_create(1);
+        _fileManager = [NSFileManager new];
+    }
+    return self;
+}
+
+#pragma mark - Public
+
+- (NSUInteger)totalSize {
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    NSUInteger size = self.currentSize;
+    UNLOCK(self.lock);
+    return size;
+}
+
+- (NSUInteger)count {
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    NSUInteger count = self.entries.count;
+    UNLOCK(self.lock);
+    return count;
+}
+
+- (BOOL)storeImage:(UIImage *)image forName:(NSString *)name {
+    if (!image || !name || image.images.count > 0) {
+        return NO;
+    }
+    CGImageRef imageRef = image.CGImage;
+    if (!imageRef) {
+        return NO;
+    }
+    size_t width = CGImageGetWidth(imageRef);
+    size_t height = CGImageGetHeight(imageRef);
+    if (width == 0 || height == 0 || width > UINT32_MAX || height > UINT32_MAX) {
+        return NO;
+    }
+    size_t bytesPerRow = (width * 4 + kSDBitmapRowAlignment - 1) / kSDBitmapRowAlignment * kSDBitmapRowAlignment;
+    NSUInteger fileSize = sizeof(SDBitmapFileHeader) + bytesPerRow * height;
+    NSUInteger maxSize = self.maxSize;
+    if (bytesPerRow > UINT32_MAX || (maxSize > 0 && fileSize > maxSize)) {
+        return NO;
+    }
+
+    // The same format the system uses for decoded images, so drawing does not convert
+    CGBitmapInfo bitmapInfo = kCGBitmapByteOrder32Host;
+    bitmapInfo |= SDCGImageRefContainsAlpha(imageRef) ? kCGImageAlphaPremultipliedFirst : kCGImageAlphaNoneSkipFirst;
+    NSMutableData *fileData = [NSMutableData dataWithLength:fileSize];
+    if (!fileData) {
+        return NO;
+    }
+    SDBitmapFileHeader *header = fileData.mutableBytes;
+    header->magic = kSDBitmapFileMagic;
+    header->version = kSDBitmapFileVersion;
+    header->width = (uint32_t)width;
+    header->height = (uint32_t)height;
+    header->bytesPerRow = (uint32_t)bytesPerRow;
+    header->bitmapInfo = bitmapInfo;
+#if SD_UIKIT || SD_WATCH
+    header->orientation = (uint32_t)image.imageOrientation;
+    header->scale = image.scale;
+#else
+    header->orientation = 0;
+    header->scale = 1;
+#endif
+    void *pixels = (uint8_t *)fileData.mutableBytes + sizeof(SDBitmapFileHeader);
+    CGContextRef context = CGBitmapContextCreate(pixels, width, height, 8, bytesPerRow, SDCGColorSpaceGetDeviceRGB(), bitmapInfo);
+    if (!context) {
+        return NO;
+    }
+    CGContextDrawImage(context, CGRectMake(0, 0, width, height), imageRef);
+    CGContextRelease(context);
+
+    if (![self.fileManager fileExistsAtPath:self.directory]) {
+        [self.fileManager createDirectoryAtPath:self.directory withIntermediateDirectories:YES attributes:nil error:NULL];
+    }
+    // Written aside and renamed, so a reader never maps a partial file
+    if (![fileData writeToFile:[self pathForName:name] options:NSDataWritingAtomic error:nil]) {
+        return NO;
+    }
+
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    SDImageCacheBitmapEntry *entry = self.entries[name];
+    if (entry) {
+        self.currentSize -= entry.size;
+    } else {
+        entry = [SDImageCacheBitmapEntry new];
+        self.entries[name] = entry;
+    }
+    entry.size = fileSize;
+    entry.accessTime = [NSDate timeIntervalSinceReferenceDate];
+    self.currentSize += fileSize;
+    if (maxSize > 0 && self.currentSize > maxSize) {
+        [self trimToSizeLocked:maxSize / 2];
+    }
+    UNLOCK(self.lock);
+    return YES;
+}
+
+- (UIImage *)imageForName:(NSString *)name {
+    if (!name) {
+        return nil;
+    }
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    SDImageCacheBitmapEntry *entry = self.entries[name];
+    entry.accessTime = [NSDate timeIntervalSinceReferenceDate];
+    UNLOCK(self.lock);
+    if (!entry) {
+        return nil;
+    }
+
+    NSData *fileData = [NSData dataWithContentsOfFile:[self pathForName:name] options:NSDataReadingMappedAlways error:nil];
+    if (fileData.length < sizeof(SDBitmapFileHeader)) {
+        return nil;
+    }
+    const SDBitmapFileHeader *header = fileData.bytes;
+    if (header->magic != kSDBitmapFileMagic || header->version != kSDBitmapFileVersion
+        || header->width == 0 || header->height == 0 || header->bytesPerRow < (size_t)header->width * 4
+        || fileData.length < sizeof(SDBitmapFileHeader) + (size_t)header->bytesPerRow * header->height) {
+        return nil;
+    }
+
+    size_t pixelsLength = (size_t)header->bytesPerRow * header->height;
+    const void *pixels = (const uint8_t *)fileData.bytes + sizeof(SDBitmapFileHeader);
+    // The provider keeps the mapping alive for as long as the image needs it
+    CGDataProviderRef provider = CGDataProviderCreateWithData((__bridge_retained void *)fileData, pixels, pixelsLength, SDBitmapStoreReleaseData);
+    if (!provider) {
+        CFRelease((__bridge CFTypeRef)fileData);
+        return nil;
+    }
+    CGImageRef imageRef = CGImageCreate(header->width, header->height, 8, 32, header->bytesPerRow, SDCGColorSpaceGetDeviceRGB(), header->bitmapInfo, provider, NULL, false, kCGRenderingIntentDefault);
+    CGDataProviderRelease(provider);
+    if (!imageRef) {
+        return nil;
+    }
+#if SD_UIKIT || SD_WATCH
+    UIImage *image = [[UIImage alloc] initWithCGImage:imageRef scale:header->scale orientation:(UIImageOrientation)header->orientation];
+#else
+    UIImage *image = [[UIImage alloc] initWithCGImage:imageRef size:NSZeroSize];
+#endif
+    CGImageRelease(imageRef);
+    return image;
+}
+
+- (void)removeImageForName:(NSString *)name {
+    if (!name) {
+        return;
+    }
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    [self removeEntryLockedForName:name];
+    UNLOCK(self.lock);
+}
+
+- (void)removeAllImages {
+    LOCK(self.lock);
+    [self.fileManager removeItemAtPath:self.directory error:nil];
+    self.entries = [NSMutableDictionary dictionary];
+    self.currentSize = 0;
+    UNLOCK(self.lock);
+}
+
+- (void)removeImagesLastAccessedBeforeDate:(NSDate *)date {
+    NSTimeInterval time = date.timeIntervalSinceReferenceDate;
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    for (NSString *name in self.entries.allKeys) {
+        if (self.entries[name].accessTime < time) {
+            [self removeEntryLockedForName:name];
+        }
+    }
+    UNLOCK(self.lock);
+}
+
+- (void)trimToSize:(NSUInteger)size {
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    [self trimToSizeLocked:size];
+    UNLOCK(self.lock);
+}
+
+#pragma mark - Private
+
+- (NSString *)pathForName:(NSString *)name {
+    return [self.directory stringByAppendingPathComponent:name];
+}
+
+// Make sure to hold the lock
+- (void)loadIfNeeded {
+    if (self.entries) {
+        return;
+    }
+    self.entries = [NSMutableDictionary dictionary];
+    self.currentSize = 0;
+    NSURL *directoryURL = [NSURL fileURLWithPath:self.directory isDirectory:YES];
+    NSArray<NSString *> *resourceKeys = @[NSURLIsRegularFileKey, NSURLContentModificationDateKey, NSURLFileSizeKey];
+    NSArray<NSURL *> *fileURLs = [self.fileManager contentsOfDirectoryAtURL:directoryURL
+                                                 includingPropertiesForKeys:resourceKeys
+                                                                    options:NSDirectoryEnumerationSkipsHiddenFiles
+                                                                      error:nil];
+    for (NSURL *fileURL in fileURLs) {
+        NSDictionary<NSString *, id> *resourceValues = [fileURL resourceValuesForKeys:resourceKeys error:nil];
+        if (![resourceValues[NSURLIsRegularFileKey] boolValue]) {
+            continue;
+        }
+        // Reads are only tracked in memory, after a relaunch the write date is the best estimate
+        SDImageCacheBitmapEntry *entry = [SDImageCacheBitmapEntry new];
+        entry.size = [resourceValues[NSURLFileSizeKey] unsignedIntegerValue];
+        entry.accessTime = [resourceValues[NSURLContentModificationDateKey] timeIntervalSinceReferenceDate];
+        self.entries[fileURL.lastPathComponent] = entry;
+        self.currentSize += entry.size;
+    }
+}
+
+// Make sure to hold the lock
+- (void)removeEntryLockedForName:(NSString *)name {
+    SDImageCacheBitmapEntry *entry = self.entries[name];
+    if (!entry) {
+        return;
+    }
+    // A mapped file stays readable after it is unlinked, so images handed out before are not affected
+    [self.fileManager removeItemAtPath:[self pathForName:name] error:nil];
+    [self.entries removeObjectForKey:name];
+    self.currentSize -= entry.size;
+}
+
+// Make sure to hold the lock
+- (void)trimToSizeLocked:(NSUInteger)size {
+    if (self.currentSize <= size) {
+        return;
+    }
+    NSArray<NSString *> *sortedNames = [self.entries keysSortedByValueUsingComparator:^NSComparisonResult(SDImageCacheBitmapEntry *obj1, SDImageCacheBitmapEntry *obj2) {
+        if (obj1.accessTime < obj2.accessTime) {
+            return NSOrderedAscending;
+        }
+        return obj1.accessTime > obj2.accessTime ? NSOrderedDescending : NSOrderedSame;
+    }];
+    for (NSString *name in sortedNames) {
+        if (self.currentSize <= size) {
+            break;
+        }
+        [self removeEntryLockedForName:name];
+    }
+}
+
+@end
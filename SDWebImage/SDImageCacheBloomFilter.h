@@ -0,0 +1,75 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+
+/**
+ * A counting Bloom filter over cache file names. It answers "definitely not on disk" without touching the file system, and supports removal.
+ * Until it is populated by `resetWithNames:` it reports every name as possibly present.
+ * All methods are thread-safe.
+ */
+@interface SDImageCacheBloomFilter : NSObject
+
+/**
+ * Whether the filter has been populated and can reject names.
+ */
+@property (nonatomic, assign, readonly, getter=isReady) BOOL ready;
+
+/**
+ * YES when the filter holds so many more names than it was sized for that its false positive rate is degrading, and it should be rebuilt.
+ */
+@property (nonatomic, assign, readonly) BOOL needsRebuild;
+
+/**
+ * The number of lookups answered as a definite miss.
+ */
+@property (nonatomic, assign, readonly) NSUInteger negativeCount;
+
+/**
+ * The number of lookups answered as a possible hit.
+ */
+@property (nonatomic, assign, readonly) NSUInteger positiveCount;
+
+/**
+ * The number of possible hits which turned out to be misses, as reported through `recordFalsePositive`.
+ */
+@property (nonatomic, assign, readonly) NSUInteger falsePositiveCount;
+
+/**
+ * Replace the content of the filter with the given names, sized for them with room to grow. After this the filter is ready.
+ * The new counters are built aside and swapped in, so concurrent lookups never see a partially built filter. The lookup counters are kept.
+ */
+- (void)resetWithNames:(nonnull NSArray<NSString *> *)names;
+
+/**
+ * Add a name. Each `addName:` must be balanced by at most one `removeName:`.
+ */
+- (void)addName:(nonnull NSString *)name;
+
+/**
+ * Remove a name previously added.
+ */
+- (void)removeName:(nonnull NSString *)name;
+
+/**
+ * Return NO if the name was definitely never added, YES if it may have been.
+ */
+- (BOOL)mightContainName:(nonnull NSString *)name;
+
+/**
+ * Record the answer the filter gave for one lookup. A lookup may probe several names, so this is reported separately.
+ */
+- (void)recordLookupPassed:(BOOL)passed;
+
+/**
+ * Record that a lookup the filter let through did not find anything.
+ */
+- (void)recordFalsePositive;
+
+@end
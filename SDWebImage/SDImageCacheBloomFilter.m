@@ -0,0 +1,196 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDImageCacheBloomFilter.h"
+
+#define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
+#define UNLOCK(lock) dispatch_semaphore_signal(lock);
+
+static const NSUInteger kSDBloomFilterHashCount = 4;
+// 16 counters per name with 4 hashes keeps the false positive rate well below 1%
+static const NSUInteger kSDBloomFilterCountersPerName = 16;
+static const NSUInteger kSDBloomFilterMinCounterCount = 1 << 16;
+static const uint8_t kSDBloomFilterMaxCounter = UINT8_MAX;
+
+// FNV-1a, the second hash for double hashing is derived with a 64 bit finalizer
+static inline uint64_t SDBloomFilterHash(NSString *name) {
+    const char *str = name.UTF8String;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    if (str) {
+        for (const unsigned char *p = (const unsigned char *)str; *p; p++) {
+            hash ^= *p;
+            hash *= 0x100000001b3ULL;
+        }
+    }
+    return hash;
+}
+
+static inline uint64_t SDBloomFilterMix(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+@interface SDImageCacheBloomFilter () {
+    uint8_t *_counters;
+    NSUInteger _counterMask;
+    NSUInteger _capacity;
+    NSUInteger _nameCount;
+}
+
+@property (nonatomic, strong, nonnull) dispatch_semaphore_t lock; // a lock to keep the access to the counters thread-safe
+@property (nonatomic, assign, readwrite, getter=isReady) BOOL ready;
+@property (nonatomic, assign, readwrite) NSUInteger negativeCount;
+@property (nonatomic, assign, readwrite) NSUInteger positiveCount;
+@property (nonatomic, assign, readwrite) NSUInteger falsePositiveCount;
+
+@end
+
+@implementation SDImageCacheBloomFilter
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _lock = dispatch_semaphore_create(1);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    free(_counters);
+}
+
+- (BOOL)needsRebuild {
+    LOCK(self.lock);
+    BOOL needsRebuild = _ready && _nameCount > _capacity * 2;
+    UNLOCK(self.lock);
+    return needsRebuild;
+}
+
+- (void)resetWithNames:(NSArray<NSString *> *)names {
+    // Leave room to grow before a rebuild is needed
+    NSUInteger capacity = MAX(names.count * 2, kSDBloomFilterMinCounterCount / kSDBloomFilterCountersPerName);
+    NSUInteger counterCount = kSDBloomFilterMinCounterCount;
+    while (counterCount < capacity * kSDBloomFilterCountersPerName) {
+        counterCount <<= 1;
+    }
+    uint8_t *counters = calloc(counterCount, sizeof(uint8_t));
+    if (!counters) {
+        return;
+    }
+    NSUInteger counterMask = counterCount - 1;
+    for (NSString *name in names) {
+        uint64_t h1 = SDBloomFilterHash(name);
+        uint64_t h2 = SDBloomFilterMix(h1) | 1;
+        for (NSUInteger i = 0; i < kSDBloomFilterHashCount; i++) {
+            NSUInteger index = (NSUInteger)((h1 + i * h2) & counterMask);
+            if (counters[index] < kSDBloomFilterMaxCounter) {
+                counters[index] += 1;
+            }
+        }
+    }
+    LOCK(self.lock);
+    free(_counters);
+    _counters = counters;
+    _counterMask = counterMask;
+    _capacity = capacity;
+    _nameCount = names.count;
+    _ready = YES;
+    UNLOCK(self.lock);
+}
+
+- (void)addName:(NSString *)name {
+    if (!name) {
+        return;
+    }
+    uint64_t h1 = SDBloomFilterHash(name);
+    uint64_t h2 = SDBloomFilterMix(h1) | 1;
+    LOCK(self.lock);
+    if (_counters) {
+        for (NSUInteger i = 0; i < kSDBloomFilterHashCount; i++) {
+            NSUInteger index = (NSUInteger)((h1 + i * h2) & _counterMask);
+            if (_counters[index] < kSDBloomFilterMaxCounter) {
+                _counters[index] += 1;
+            }
+        }
+        _nameCount += 1;
+    }
+    UNLOCK(self.lock);
+}
+
+- (void)removeName:(NSString *)name {
+    if (!name) {
+        return;
+    }
+    uint64_t h1 = SDBloomFilterHash(name);
+    uint64_t h2 = SDBloomFilterMix(h1) | 1;
+    LOCK(self.lock);
+    if (_counters) {
+        BOOL present = YES;
+        for (NSUInteger i = 0; i < kSDBloomFilterHashCount; i++) {
+            if (_counters[(h1 + i * h2) & _counterMask] == 0) {
+                present = NO;
+                break;
+            }
+        }
+        if (present) {
+            for (NSUInteger i = 0; i < kSDBloomFilterHashCount; i++) {
+                NSUInteger index = (NSUInteger)((h1 + i * h2) & _counterMask);
+                // A saturated counter has lost its exact count, so it must stay set
+                if (_counters[index] < kSDBloomFilterMaxCounter) {
+                    _counters[index] -= 1;
+                }
+            }
+            if (_nameCount > 0) {
+                _nameCount -= 1;
+            }
+        }
+    }
+    UNLOCK(self.lock);
+}
+
+- (BOOL)mightContainName:(NSString *)name {
+    if (!name) {
+        return NO;
+    }
+    uint64_t h1 = SDBloomFilterHash(name);
+    uint64_t h2 = SDBloomFilterMix(h1) | 1;
+    BOOL mightContain = YES;
+    LOCK(self.lock);
+    if (_ready && _counters) {
+        for (NSUInteger i = 0; i < kSDBloomFilterHashCount; i++) {
+            if (_counters[(h1 + i * h2) & _counterMask] == 0) {
+                mightContain = NO;
+                break;
+            }
+        }
+    }
+    UNLOCK(self.lock);
+    return mightContain;
+}
+
+- (void)recordLookupPassed:(BOOL)passed {
+    LOCK(self.lock);
+    if (passed) {
+        _positiveCount += 1;
+    } else {
+        _negativeCount += 1;
+    }
+    UNLOCK(self.lock);
+}
+
+- (void)recordFalsePositive {
+    LOCK(self.lock);
+    _falsePositiveCount += 1;
+    UNLOCK(self.lock);
+}
+
+@end
@@ -9,6 +9,45 @@
 #import <Foundation/Foundation.h>
 #import "SDWebImageCompat.h"
 
+typedef NS_ENUM(NSUInteger, SDImageCacheConfigExpireType) {
+    /**
+     * When the image is read from or written to the disk cache, refresh its date. Cleanup evicts the least recently used images first.
+     */
+    SDImageCacheConfigExpireTypeAccessDate,
+    /**
+     * Only writing the image refreshes its date. Cleanup evicts the oldest written images first.
+     */
+    SDImageCacheConfigExpireTypeModificationDate
+};
+
+typedef NS_ENUM(NSUInteger, SDImageCacheConfigFileNameHashType) {
+    /**
+     * A fast non-cryptographic 128 bit hash (MurmurHash3). File names only need to be well distributed, not secure.
+     */
+    SDImageCacheConfigFileNameHashTypeFast,
+    /**
+     * MD5, the hash of the file names of earlier versions. Other code computing the file names of the cache, such as an app extension, can reproduce it.
+     */
+    SDImageCacheConfigFileNameHashTypeMD5
+};
+
+typedef NS_ENUM(NSUInteger, SDImageCacheConfigDiskWritePolicy) {
+    /**
+     * Every store writes its file right away, with `diskCacheWritingOptions`.
+     */
+    SDImageCacheConfigDiskWritePolicyAtomic,
+    /**
+     * Stores are buffered in memory and written together in batches, with `diskCacheWritingOptions` and a single index update per batch.
+     * A crash loses the buffered stores, never leaves a partial file behind with the default atomic writing option.
+     */
+    SDImageCacheConfigDiskWritePolicyBatched,
+    /**
+     * Like batched, but files are written in place without the temporary file and rename of `NSDataWritingAtomic`.
+     * A crash may lose the buffered stores or leave a truncated file, which fails to decode and is downloaded again.
+     */
+    SDImageCacheConfigDiskWritePolicyBestEffort
+};
+
 @interface SDImageCacheConfig : NSObject
 
 /**
@@ -42,6 +81,51 @@
  */
 @property (assign, nonatomic) NSDataWritingOptions diskCacheWritingOptions;
 
+/**
+ * How stores reach the disk. With a write-behind policy, queries see the buffered images right away, and a store of a key which is still buffered replaces the buffered data.
+ * The buffer is flushed when it reaches `diskWriteBatchMaxCount` or `diskWriteBatchMaxSize`, `diskWriteBatchDelay` after the first buffered store, before every cleanup and when the app goes to the background.
+ * Defaults to `SDImageCacheConfigDiskWritePolicyAtomic`.
+ */
+@property (assign, nonatomic) SDImageCacheConfigDiskWritePolicy diskWritePolicy;
+
+/**
+ * The number of buffered stores which triggers a flush. Defaults to 32.
+ */
+@property (assign, nonatomic) NSUInteger diskWriteBatchMaxCount;
+
+/**
+ * The total size of the buffered stores which triggers a flush, in bytes. Defaults to 4MB.
+ */
+@property (assign, nonatomic) NSUInteger diskWriteBatchMaxSize;
+
+/**
+ * The longest time a store stays buffered, in seconds. Defaults to 0.2.
+ */
+@property (assign, nonatomic) NSTimeInterval diskWriteBatchDelay;
+
+/**
+ * Keep an in-memory membership filter of the files in the disk cache and read-only cache paths, so a lookup for an image which is definitely not on disk returns without any file system access.
+ * The filter is built in the background when the cache is created and kept up to date on store and remove. Files added to the cache directory behind the cache's back are not seen until the next cleanup.
+ * Defaults to YES.
+ */
+@property (assign, nonatomic) BOOL shouldUseDiskLookupFilter;
+
+/**
+ * The number of disk operations which can run at the same time.
+ * Keys are spread over this many shards: queries, stores and removals of keys in different shards run concurrently, while operations on the same shard (and so on the same key) keep their order and never overlap. Cleanup takes the whole disk cache exclusively.
+ * Defaults to 4. This is read once, on the first disk operation of the cache.
+ */
+@property (assign, nonatomic) NSUInteger maxConcurrentDiskOperations;
+
+/**
+ * The hash used to derive the disk cache file name of a key.
+ * With `SDImageCacheConfigFileNameHashTypeFast`, the files written earlier under their MD5 names are still found: the first lookup, store or removal of such a key moves its file to the new name. Read-only cache paths are searched under both names.
+ * Switching back to MD5 does not migrate the files, they age out. Set this before the first disk operation.
+ * The fast hash changes what `cachedFileNameForKey:` and `defaultCachePathForKey:` return, so code computing the MD5 file names itself, such as in an app extension, no longer finds the files. Only opt in when nothing outside of `SDImageCache` depends on the file names.
+ * Defaults to `SDImageCacheConfigFileNameHashTypeMD5`.
+ */
+@property (assign, nonatomic) SDImageCacheConfigFileNameHashType diskCacheFileNameHashType;
+
 /**
  * The maximum length of time to keep an image in the cache, in seconds.
  缓存图片的最长时间，单位是秒，默认是缓存一周
@@ -56,4 +140,89 @@
  */
 @property (assign, nonatomic) NSUInteger maxCacheSize;
 
+/**
+ * The date which `maxCacheAge` and the size-based cleanup are measured against.
+ * Access dates are recorded in the cache's own index, reading an image never touches its file.
+ * Defaults to `SDImageCacheConfigExpireTypeAccessDate`.
+ */
+@property (assign, nonatomic) SDImageCacheConfigExpireType diskCacheExpireType;
+
+/**
+ * The size-based cleanup starts when the disk cache grows above this fraction of `maxCacheSize`.
+ * Defaults to 1.0.
+ */
+@property (assign, nonatomic) double diskCacheTrimHighWatermark;
+
+/**
+ * The size-based cleanup removes the least recently used images until the disk cache is below this fraction of `maxCacheSize`.
+ * Defaults to 0.5.
+ */
+@property (assign, nonatomic) double diskCacheTrimLowWatermark;
+
+/**
+ * Run the cleanup in short slices instead of one long exclusive pass, so the queries and stores submitted meanwhile are served between two slices.
+ * In this mode a store which pushes the disk cache above the high watermark also starts the cleanup, so the cache is trimmed continuously and not only on the app events.
+ * Defaults to NO.
+ */
+@property (assign, nonatomic) BOOL shouldTrimDiskCacheIncrementally;
+
+/**
+ * When `shouldTrimDiskCacheIncrementally` is YES, the time (in seconds) a slice may take before it yields to the other disk operations. A slice always removes at least one file.
+ * Defaults to 5ms.
+ */
+@property (assign, nonatomic) NSTimeInterval diskCacheTrimSliceDuration;
+
+/**
+ * Store small images by appending them to a few large pack segment files instead of writing one file per image.
+ * This saves inodes and open/close calls for caches holding many thumbnails, and size-based cleanup evicts whole segments.
+ * Defaults to NO. Images written before switching this on or off are still found.
+ */
+@property (assign, nonatomic) BOOL shouldUseDiskPackStore;
+
+/**
+ * When `shouldUseDiskPackStore` is YES, image data larger than this (in bytes) is still written to its own file.
+ * Defaults to 64KB.
+ */
+@property (assign, nonatomic) NSUInteger diskPackStoreMaxEntrySize;
+
+/**
+ * When `shouldUseDiskPackStore` is YES, the size (in bytes) at which a pack segment is sealed and a new one is started.
+ * Defaults to 4MB.
+ */
+@property (assign, nonatomic) NSUInteger diskPackStoreSegmentSize;
+
+/**
+ * Also keep the decoded bitmap of static images read from disk, in a separate disk tier. Later disk hits map that file and return an image which is ready to draw, without decoding or decompressing.
+ * Bitmaps are much larger than the image data, so this tier has its own budget, see `diskBitmapStoreMaxSize`. It is not included in `maxCacheSize` nor in `getSize`.
+ * Defaults to NO.
+ */
+@property (assign, nonatomic) BOOL shouldUseDiskBitmapStore;
+
+/**
+ * When `shouldUseDiskBitmapStore` is YES, the maximum total size (in bytes) of the decoded bitmaps on disk. The least recently used are removed first. 0 means no limit.
+ * Defaults to 100MB.
+ */
+@property (assign, nonatomic) NSUInteger diskBitmapStoreMaxSize;
+
+/**
+ * Count how often each key is queried, save the hottest keys when the app goes to the background or terminates, and warm the memory cache with them at the next launch.
+ * The warm-up decodes the images from disk on a background priority queue, hottest first, until `maxMemoryCost` or `memoryCacheWarmUpMaxCount` is reached. The first query which has to read the disk cancels it, so it never competes with real requests.
+ * The warm-up starts on the main queue turn after the cache is created, so this can be set right after creating the cache.
+ * Defaults to NO.
+ */
+@property (assign, nonatomic) BOOL shouldWarmMemoryCacheAtLaunch;
+
+/**
+ * The number of hottest keys which are saved and warmed up. Defaults to 300.
+ */
+@property (assign, nonatomic) NSUInteger memoryCacheWarmUpMaxCount;
+
+/**
+ * Also keep the encoded image data in memory, in a second tier with its own budget, see `SDImageCache.maxMemoryDataCost`.
+ * The encoded data is 10 to 40 times smaller than the decoded image. The tier serves `SDImageCacheQueryDataWhenInMemory` queries without a disk read, and disk queries of images evicted from the decoded tier or purged on memory warning, which are then decoded without a disk read.
+ * The tier is not trimmed on memory warning.
+ * Defaults to NO.
+ */
+@property (assign, nonatomic) BOOL shouldCacheImageDataInMemory;
+
 @end
@@ -9,6 +9,15 @@
 #import "SDImageCacheConfig.h"
 
 static const NSInteger kDefaultCacheMaxCacheAge = 60 * 60 * 24 * 7; // 1 week
+static const NSUInteger kDefaultMaxConcurrentDiskOperations = 4;
+static const NSTimeInterval kDefaultDiskCacheTrimSliceDuration = 0.005; // 5ms
+static const NSUInteger kDefaultDiskPackStoreMaxEntrySize = 64 * 1024; // 64KB
+static const NSUInteger kDefaultDiskPackStoreSegmentSize = 4 * 1024 * 1024; // 4MB
+static const NSUInteger kDefaultDiskBitmapStoreMaxSize = 100 * 1024 * 1024; // 100MB
+static const NSUInteger kDefaultDiskWriteBatchMaxCount = 32;
+static const NSUInteger kDefaultDiskWriteBatchMaxSize = 4 * 1024 * 1024; // 4MB
+static const NSTimeInterval kDefaultDiskWriteBatchDelay = 0.2; // 200ms
+static const NSUInteger kDefaultMemoryCacheWarmUpMaxCount = 300;
 
 @implementation SDImageCacheConfig
 
@@ -19,8 +28,28 @@ static const NSInteger kDefaultCacheMaxCacheAge = 60 * 60 * 24 * 7; // 1 week
         _shouldCacheImagesInMemory = YES;
         _diskCacheReadingOptions = 0;
         _diskCacheWritingOptions = NSDataWritingAtomic;
+        _diskWritePolicy = SDImageCacheConfigDiskWritePolicyAtomic;
+        _diskWriteBatchMaxCount = kDefaultDiskWriteBatchMaxCount;
+        _diskWriteBatchMaxSize = kDefaultDiskWriteBatchMaxSize;
+        _diskWriteBatchDelay = kDefaultDiskWriteBatchDelay;
+        _maxConcurrentDiskOperations = kDefaultMaxConcurrentDiskOperations;
+        _shouldUseDiskLookupFilter = YES;
+        _diskCacheFileNameHashType = SDImageCacheConfigFileNameHashTypeMD5;
         _maxCacheAge = kDefaultCacheMaxCacheAge;
         _maxCacheSize = 0;
+        _diskCacheExpireType = SDImageCacheConfigExpireTypeAccessDate;
+        _diskCacheTrimHighWatermark = 1.0;
+        _diskCacheTrimLowWatermark = 0.5;
+        _shouldTrimDiskCacheIncrementally = NO;
+        _diskCacheTrimSliceDuration = kDefaultDiskCacheTrimSliceDuration;
+        _shouldUseDiskPackStore = NO;
+        _diskPackStoreMaxEntrySize = kDefaultDiskPackStoreMaxEntrySize;
+        _diskPackStoreSegmentSize = kDefaultDiskPackStoreSegmentSize;
+        _shouldUseDiskBitmapStore = NO;
+        _diskBitmapStoreMaxSize = kDefaultDiskBitmapStoreMaxSize;
+        _shouldWarmMemoryCacheAtLaunch = NO;
+        _memoryCacheWarmUpMaxCount = kDefaultMemoryCacheWarmUpMaxCount;
+        _shouldCacheImageDataInMemory = NO;
     }
     return self;
 }
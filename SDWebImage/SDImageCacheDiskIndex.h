@@ -0,0 +1,131 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+
+/**
+ * A snapshot of one file tracked by `SDImageCacheDiskIndex`.
+ */
+@interface SDImageCacheDiskIndexEntry : NSObject <NSCopying>
+
+/**
+ * The cache file name, which is the hash of the cache key plus its extension.
+ */
+@property (nonatomic, copy, readonly, nonnull) NSString *name;
+/**
+ * The size of the file, in bytes.
+ */
+@property (nonatomic, assign, readonly) unsigned long long size;
+/**
+ * The time the file was last written, as seconds since the reference date.
+ */
+@property (nonatomic, assign, readonly) NSTimeInterval modificationTime;
+/**
+ * The time the file was last read or written, as seconds since the reference date.
+ */
+@property (nonatomic, assign, readonly) NSTimeInterval accessTime;
+
+@end
+
+/**
+ * An in-memory index of the files in a disk cache directory (name -> size, modification time, access time, optional metadata), persisted as an append-only journal.
+ * It lets the cache answer size and count queries and pick eviction candidates without enumerating the directory.
+ * The index is loaded lazily from the journal, and rebuilt from a directory scan only when the journal is missing or corrupt.
+ * All methods are thread-safe.
+ */
+@interface SDImageCacheDiskIndex : NSObject
+
+/**
+ * The directory whose files are indexed.
+ */
+@property (nonatomic, copy, readonly, nonnull) NSString *directory;
+
+/**
+ * The path of the journal file.
+ */
+@property (nonatomic, copy, readonly, nonnull) NSString *journalPath;
+
+/**
+ * The number of indexed files.
+ */
+@property (nonatomic, assign, readonly) NSUInteger count;
+
+/**
+ * The sum of the sizes of all indexed files, in bytes.
+ */
+@property (nonatomic, assign, readonly) unsigned long long totalSize;
+
+/**
+ * Create an index for the given directory.
+ *
+ * @param directory   The directory whose files are indexed
+ * @param journalPath The path of the journal file. If it is inside `directory`, make it a hidden file so the rebuild scan skips it
+ */
+- (nonnull instancetype)initWithDirectory:(nonnull NSString *)directory journalPath:(nonnull NSString *)journalPath NS_DESIGNATED_INITIALIZER;
+
+- (nonnull instancetype)init NS_UNAVAILABLE;
+
+/**
+ * Record that a file was written. This updates both the modification and the access time.
+ */
+- (void)recordWriteForName:(nonnull NSString *)name size:(unsigned long long)size;
+
+/**
+ * Record that an indexed file was read. Access records are buffered and flushed together, so this is cheap to call on every hit.
+ */
+- (void)recordAccessForName:(nonnull NSString *)name;
+
+/**
+ * Stop tracking a file.
+ */
+- (void)removeName:(nonnull NSString *)name;
+
+/**
+ * Stop tracking all files and reset the journal.
+ */
+- (void)removeAllEntries;
+
+/**
+ * Return the entry for the given name, or nil if it is not indexed.
+ */
+- (nullable SDImageCacheDiskIndexEntry *)entryForName:(nonnull NSString *)name;
+
+/**
+ * Return a snapshot of all entries.
+ */
+- (nonnull NSArray<SDImageCacheDiskIndexEntry *> *)allEntries;
+
+/**
+ * Attach an opaque metadata blob (at most 64KB) to a name, or remove it when nil. The name does not have to be indexed, so entries stored outside the directory can have metadata too.
+ * A write record does not touch the metadata, `removeName:` drops it.
+ */
+- (void)setMetadata:(nullable NSData *)metadata forName:(nonnull NSString *)name;
+
+/**
+ * Return the metadata attached to the given name, or nil if there is none.
+ */
+- (nullable NSData *)metadataForName:(nonnull NSString *)name;
+
+/**
+ * Drop the metadata of all names which are neither indexed nor in the given set.
+ */
+- (void)removeMetadataOfUnindexedNamesExcept:(nonnull NSSet<NSString *> *)names;
+
+/**
+ * Run the updates in the block and write their records to the journal together, once the block returns.
+ * Writes and removals are otherwise flushed one by one.
+ */
+- (void)performBatchUpdates:(nonnull void (^)(void))updates;
+
+/**
+ * Flush buffered records to the journal, compacting it first when it holds mostly stale records.
+ */
+- (void)synchronize;
+
+@end
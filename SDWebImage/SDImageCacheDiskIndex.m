@@ -0,0 +1,557 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDImageCacheDiskIndex.h"
+#import <fcntl.h>
+#import <unistd.h>
+#import <sys/stat.h>
+
+#define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
+#define UNLOCK(lock) dispatch_semaphore_signal(lock);
+
+static const uint32_t kSDDiskIndexMagic = 0x58494453; // "SDIX"
+static const uint32_t kSDDiskIndexVersion = 1;
+static const NSUInteger kSDDiskIndexHeaderLength = 8;
+// Buffered access records are flushed once they reach this size
+static const NSUInteger kSDDiskIndexMaxPendingLength = 4 * 1024;
+// The journal is compacted once it holds this many more records than live entries
+static const NSUInteger kSDDiskIndexCompactionSlack = 1024;
+
+typedef NS_ENUM(uint8_t, SDDiskIndexRecordType) {
+    SDDiskIndexRecordTypeWrite = 1, // name, size, modification time, access time
+    SDDiskIndexRecordTypeAccess = 2, // name, access time
+    SDDiskIndexRecordTypeRemove = 3, // name
+    SDDiskIndexRecordTypeMetadata = 4, // name, metadata length, metadata. An empty metadata removes it
+};
+
+@interface SDImageCacheDiskIndexEntry ()
+
+@property (nonatomic, copy, readwrite, nonnull) NSString *name;
+@property (nonatomic, assign, readwrite) unsigned long long size;
+@property (nonatomic, assign, readwrite) NSTimeInterval modificationTime;
+@property (nonatomic, assign, readwrite) NSTimeInterval accessTime;
+
+@end
+
+@implementation SDImageCacheDiskIndexEntry
+
+- (id)copyWithZone:(NSZone *)zone {
+    SDImageCacheDiskIndexEntry *entry = [[[self class] allocWithZone:zone] init];
+    entry.name = self.name;
+    entry.size = self.size;
+    entry.modificationTime = self.modificationTime;
+    entry.accessTime = self.accessTime;
+    return entry;
+}
+
+@end
+
+#pragma mark - Journal encoding
+
+static void SDDiskIndexAppendUInt64(NSMutableData *data, uint64_t value) {
+    value = CFSwapInt64HostToLittle(value);
+    [data appendBytes:&value length:sizeof(value)];
+}
+
+static void SDDiskIndexAppendTime(NSMutableData *data, NSTimeInterval time) {
+    uint64_t bits;
+    memcpy(&bits, &time, sizeof(bits));
+    SDDiskIndexAppendUInt64(data, bits);
+}
+
+static void SDDiskIndexAppendRecord(NSMutableData *data, SDDiskIndexRecordType type, SDImageCacheDiskIndexEntry *entry) {
+    // The entry does not carry the metadata, those records are written by `SDDiskIndexAppendMetadataRecord`
+    NSCParameterAssert(type != SDDiskIndexRecordTypeMetadata);
+    NSData *nameData = [entry.name dataUsingEncoding:NSUTF8StringEncoding];
+    if (!nameData || nameData.length > UINT16_MAX || type == SDDiskIndexRecordTypeMetadata) {
+        return;
+    }
+    uint16_t nameLength = CFSwapInt16HostToLittle((uint16_t)nameData.length);
+    [data appendBytes:&type length:sizeof(type)];
+    [data appendBytes:&nameLength length:sizeof(nameLength)];
+    [data appendData:nameData];
+    switch (type) {
+        case SDDiskIndexRecordTypeWrite:
+            SDDiskIndexAppendUInt64(data, entry.size);
+            SDDiskIndexAppendTime(data, entry.modificationTime);
+            SDDiskIndexAppendTime(data, entry.accessTime);
+            break;
+        case SDDiskIndexRecordTypeAccess:
+            SDDiskIndexAppendTime(data, entry.accessTime);
+            break;
+        case SDDiskIndexRecordTypeRemove:
+        case SDDiskIndexRecordTypeMetadata:
+            break;
+    }
+}
+
+static void SDDiskIndexAppendMetadataRecord(NSMutableData *data, NSString *name, NSData *metadata) {
+    NSData *nameData = [name dataUsingEncoding:NSUTF8StringEncoding];
+    if (!nameData || nameData.length > UINT16_MAX || metadata.length > UINT16_MAX) {
+        return;
+    }
+    SDDiskIndexRecordType type = SDDiskIndexRecordTypeMetadata;
+    uint16_t nameLength = CFSwapInt16HostToLittle((uint16_t)nameData.length);
+    uint16_t metadataLength = CFSwapInt16HostToLittle((uint16_t)metadata.length);
+    [data appendBytes:&type length:sizeof(type)];
+    [data appendBytes:&nameLength length:sizeof(nameLength)];
+    [data appendData:nameData];
+    [data appendBytes:&metadataLength length:sizeof(metadataLength)];
+    if (metadata.length > 0) {
+        [data appendData:metadata];
+    }
+}
+
+static BOOL SDDiskIndexReadBytes(const uint8_t *bytes, NSUInteger length, NSUInteger *cursor, void *value, NSUInteger valueLength) {
+    if (*cursor + valueLength > length) {
+        return NO;
+    }
+    memcpy(value, bytes + *cursor, valueLength);
+    *cursor += valueLength;
+    return YES;
+}
+
+static BOOL SDDiskIndexReadTime(const uint8_t *bytes, NSUInteger length, NSUInteger *cursor, NSTimeInterval *time) {
+    uint64_t bits;
+    if (!SDDiskIndexReadBytes(bytes, length, cursor, &bits, sizeof(bits))) {
+        return NO;
+    }
+    bits = CFSwapInt64LittleToHost(bits);
+    memcpy(time, &bits, sizeof(bits));
+    return YES;
+}
+
+@interface SDImageCacheDiskIndex ()
+
+@property (nonatomic, copy, readwrite, nonnull) NSString *directory;
+@property (nonatomic, copy, readwrite, nonnull) NSString *journalPath;
+@property (nonatomic, strong, nonnull) dispatch_semaphore_t lock; // a lock to keep the access to the entries and the journal thread-safe
+@property (nonatomic, strong, nullable) NSMutableDictionary<NSString *, SDImageCacheDiskIndexEntry *> *entries; // nil until loaded
+@property (nonatomic, strong, nonnull) NSMutableDictionary<NSString *, NSData *> *metadatas; // kept apart from the entries, names outside the directory can have metadata too
+@property (nonatomic, strong, nonnull) NSMutableData *pendingRecords;
+@property (nonatomic, strong, nonnull) NSFileManager *fileManager;
+@property (nonatomic, assign) unsigned long long currentTotalSize;
+@property (nonatomic, assign) NSUInteger journalRecordCount;
+@property (nonatomic, assign) int journalFileDescriptor;
+@property (nonatomic, assign) NSUInteger batchUpdateDepth;
+
+@end
+
+@implementation SDImageCacheDiskIndex
+
+- (instancetype)initWithDirectory:(NSString *)directory journalPath:(NSString *)journalPath {
+    self = [super init];
+    if (self) {
+        _directory = [directory copy];
+        _journalPath = [journalPath copy];
+        _lock = dispatch_semaphore_create(1);
+        _pendingRecords = [NSMutableData data];
+        _metadatas = [NSMutableDictionary dictionary];
+        _fileManager = [NSFileManager new];
+        _journalFileDescriptor = -1;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self flushPendingRecords];
+    [self closeJournal];
+}
+
+#pragma mark - Public
+
+- (NSUInteger)count {
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    NSUInteger count = self.entries.count;
+    UNLOCK(self.lock);
+    return count;
+}
+
+- (unsigned long long)totalSize {
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    unsigned long long totalSize = self.currentTotalSize;
+    UNLOCK(self.lock);
+    return totalSize;
+}
+
+- (void)recordWriteForName:(NSString *)name size:(unsigned long long)size {
+    if (!name) {
+        return;
+    }
+    NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    SDImageCacheDiskIndexEntry *entry = self.entries[name];
+    if (entry) {
+        self.currentTotalSize -= entry.size;
+    } else {
+        entry = [SDImageCacheDiskIndexEntry new];
+        entry.name = name;
+        self.entries[name] = entry;
+    }
+    entry.size = size;
+    entry.modificationTime = now;
+    entry.accessTime = now;
+    self.currentTotalSize += size;
+    SDDiskIndexAppendRecord(self.pendingRecords, SDDiskIndexRecordTypeWrite, entry);
+    self.journalRecordCount += 1;
+    // Write records are flushed right away, so a crash does not leave untracked files behind
+    [self flushPendingRecordsIfNeeded];
+    UNLOCK(self.lock);
+}
+
+- (void)recordAccessForName:(NSString *)name {
+    if (!name) {
+        return;
+    }
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    SDImageCacheDiskIndexEntry *entry = self.entries[name];
+    if (entry) {
+        entry.accessTime = [NSDate timeIntervalSinceReferenceDate];
+        SDDiskIndexAppendRecord(self.pendingRecords, SDDiskIndexRecordTypeAccess, entry);
+        self.journalRecordCount += 1;
+        if (self.pendingRecords.length >= kSDDiskIndexMaxPendingLength) {
+            [self flushPendingRecords];
+        }
+    }
+    UNLOCK(self.lock);
+}
+
+- (void)removeName:(NSString *)name {
+    if (!name) {
+        return;
+    }
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    SDImageCacheDiskIndexEntry *entry = self.entries[name];
+    if (entry) {
+        self.currentTotalSize -= entry.size;
+        [self.entries removeObjectForKey:name];
+        SDDiskIndexAppendRecord(self.pendingRecords, SDDiskIndexRecordTypeRemove, entry);
+        self.journalRecordCount += 1;
+        [self.metadatas removeObjectForKey:name];
+        [self flushPendingRecordsIfNeeded];
+    } else if (self.metadatas[name]) {
+        [self.metadatas removeObjectForKey:name];
+        SDDiskIndexAppendMetadataRecord(self.pendingRecords, name, nil);
+        self.journalRecordCount += 1;
+        [self flushPendingRecordsIfNeeded];
+    }
+    UNLOCK(self.lock);
+}
+
+- (void)removeAllEntries {
+    LOCK(self.lock);
+    [self closeJournal];
+    [self.fileManager removeItemAtPath:self.journalPath error:nil];
+    self.entries = [NSMutableDictionary dictionary];
+    [self.metadatas removeAllObjects];
+    self.pendingRecords.length = 0;
+    self.currentTotalSize = 0;
+    self.journalRecordCount = 0;
+    UNLOCK(self.lock);
+}
+
+- (SDImageCacheDiskIndexEntry *)entryForName:(NSString *)name {
+    if (!name) {
+        return nil;
+    }
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    SDImageCacheDiskIndexEntry *entry = [self.entries[name] copy];
+    UNLOCK(self.lock);
+    return entry;
+}
+
+- (NSArray<SDImageCacheDiskIndexEntry *> *)allEntries {
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    NSArray<SDImageCacheDiskIndexEntry *> *entries = [[NSArray alloc] initWithArray:self.entries.allValues copyItems:YES];
+    UNLOCK(self.lock);
+    return entries;
+}
+
+- (void)setMetadata:(NSData *)metadata forName:(NSString *)name {
+    if (!name || metadata.length > UINT16_MAX) {
+        return;
+    }
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    if (metadata.length > 0) {
+        if (![self.metadatas[name] isEqualToData:metadata]) {
+            self.metadatas[name] = [metadata copy];
+            SDDiskIndexAppendMetadataRecord(self.pendingRecords, name, metadata);
+            self.journalRecordCount += 1;
+            // Like write records, metadata records come once per download and are flushed right away
+            [self flushPendingRecordsIfNeeded];
+        }
+    } else if (self.metadatas[name]) {
+        [self.metadatas removeObjectForKey:name];
+        SDDiskIndexAppendMetadataRecord(self.pendingRecords, name, nil);
+        self.journalRecordCount += 1;
+        [self flushPendingRecordsIfNeeded];
+    }
+    UNLOCK(self.lock);
+}
+
+- (NSData *)metadataForName:(NSString *)name {
+    if (!name) {
+        return nil;
+    }
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    NSData *metadata = self.metadatas[name];
+    UNLOCK(self.lock);
+    return metadata;
+}
+
+- (void)removeMetadataOfUnindexedNamesExcept:(NSSet<NSString *> *)names {
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    for (NSString *name in self.metadatas.allKeys) {
+        if (!self.entries[name] && ![names containsObject:name]) {
+            [self.metadatas removeObjectForKey:name];
+            SDDiskIndexAppendMetadataRecord(self.pendingRecords, name, nil);
+            self.journalRecordCount += 1;
+        }
+    }
+    [self flushPendingRecords];
+    UNLOCK(self.lock);
+}
+
+- (void)performBatchUpdates:(void (^)(void))updates {
+    if (!updates) {
+        return;
+    }
+    LOCK(self.lock);
+    self.batchUpdateDepth += 1;
+    UNLOCK(self.lock);
+    updates();
+    LOCK(self.lock);
+    self.batchUpdateDepth -= 1;
+    [self flushPendingRecordsIfNeeded];
+    UNLOCK(self.lock);
+}
+
+- (void)synchronize {
+    LOCK(self.lock);
+    if (self.entries) {
+        if (self.journalRecordCount > (self.entries.count + self.metadatas.count) * 2 + kSDDiskIndexCompactionSlack) {
+            [self writeSnapshot];
+        } else {
+            [self flushPendingRecords];
+        }
+    }
+    UNLOCK(self.lock);
+}
+
+#pragma mark - Private, make sure to call while holding the lock
+
+- (void)loadIfNeeded {
+    if (self.entries) {
+        return;
+    }
+    self.entries = [NSMutableDictionary dictionary];
+    if (![self loadJournal]) {
+        [self rebuildFromDirectory];
+    }
+}
+
+- (BOOL)loadJournal {
+    NSData *journal = [NSData dataWithContentsOfFile:self.journalPath options:NSDataReadingMappedIfSafe error:nil];
+    if (journal.length < kSDDiskIndexHeaderLength) {
+        return NO;
+    }
+    const uint8_t *bytes = journal.bytes;
+    NSUInteger length = journal.length;
+    NSUInteger cursor = 0;
+    uint32_t magic, version;
+    SDDiskIndexReadBytes(bytes, length, &cursor, &magic, sizeof(magic));
+    SDDiskIndexReadBytes(bytes, length, &cursor, &version, sizeof(version));
+    if (CFSwapInt32LittleToHost(magic) != kSDDiskIndexMagic || CFSwapInt32LittleToHost(version) != kSDDiskIndexVersion) {
+        return NO;
+    }
+
+    NSUInteger recordCount = 0;
+    NSUInteger validLength = cursor;
+    while (cursor < length) {
+        uint8_t type;
+        uint16_t nameLength;
+        if (!SDDiskIndexReadBytes(bytes, length, &cursor, &type, sizeof(type)) ||
+            !SDDiskIndexReadBytes(bytes, length, &cursor, &nameLength, sizeof(nameLength))) {
+            break;
+        }
+        nameLength = CFSwapInt16LittleToHost(nameLength);
+        if (cursor + nameLength > length) {
+            break;
+        }
+        NSString *name = [[NSString alloc] initWithBytes:bytes + cursor length:nameLength encoding:NSUTF8StringEncoding];
+        cursor += nameLength;
+        if (!name) {
+            return NO;
+        }
+        if (type == SDDiskIndexRecordTypeWrite) {
+            uint64_t size;
+            NSTimeInterval modificationTime, accessTime;
+            if (!SDDiskIndexReadBytes(bytes, length, &cursor, &size, sizeof(size)) ||
+                !SDDiskIndexReadTime(bytes, length, &cursor, &modificationTime) ||
+                !SDDiskIndexReadTime(bytes, length, &cursor, &accessTime)) {
+                break;
+            }
+            SDImageCacheDiskIndexEntry *entry = self.entries[name];
+            if (entry) {
+                self.currentTotalSize -= entry.size;
+            } else {
+                entry = [SDImageCacheDiskIndexEntry new];
+                entry.name = name;
+                self.entries[name] = entry;
+            }
+            entry.size = CFSwapInt64LittleToHost(size);
+            entry.modificationTime = modificationTime;
+            entry.accessTime = accessTime;
+            self.currentTotalSize += entry.size;
+        } else if (type == SDDiskIndexRecordTypeAccess) {
+            NSTimeInterval accessTime;
+            if (!SDDiskIndexReadTime(bytes, length, &cursor, &accessTime)) {
+                break;
+            }
+            self.entries[name].accessTime = accessTime;
+        } else if (type == SDDiskIndexRecordTypeRemove) {
+            SDImageCacheDiskIndexEntry *entry = self.entries[name];
+            if (entry) {
+                self.currentTotalSize -= entry.size;
+                [self.entries removeObjectForKey:name];
+            }
+            [self.metadatas removeObjectForKey:name];
+        } else if (type == SDDiskIndexRecordTypeMetadata) {
+            uint16_t metadataLength;
+            if (!SDDiskIndexReadBytes(bytes, length, &cursor, &metadataLength, sizeof(metadataLength))) {
+                break;
+            }
+            metadataLength = CFSwapInt16LittleToHost(metadataLength);
+            if (cursor + metadataLength > length) {
+                break;
+            }
+            if (metadataLength > 0) {
+                self.metadatas[name] = [NSData dataWithBytes:bytes + cursor length:metadataLength];
+            } else {
+                [self.metadatas removeObjectForKey:name];
+            }
+            cursor += metadataLength;
+        } else {
+            // Unknown record, the journal can not be trusted
+            [self.entries removeAllObjects];
+            [self.metadatas removeAllObjects];
+            self.currentTotalSize = 0;
+            return NO;
+        }
+        recordCount += 1;
+        validLength = cursor;
+    }
+    if (validLength < length) {
+        // Drop the torn tail left by an interrupted append
+        truncate(self.journalPath.fileSystemRepresentation, (off_t)validLength);
+    }
+    self.journalRecordCount = recordCount;
+    return YES;
+}
+
+- (void)rebuildFromDirectory {
+    [self.entries removeAllObjects];
+    // The metadata only lives in the journal, without it the entries are simply downloaded again on refresh
+    [self.metadatas removeAllObjects];
+    self.currentTotalSize = 0;
+    NSURL *directoryURL = [NSURL fileURLWithPath:self.directory isDirectory:YES];
+    NSArray<NSString *> *resourceKeys = @[NSURLIsDirectoryKey, NSURLContentModificationDateKey, NSURLFileSizeKey];
+    NSDirectoryEnumerator *fileEnumerator = [self.fileManager enumeratorAtURL:directoryURL
+                                                   includingPropertiesForKeys:resourceKeys
+                                                                      options:NSDirectoryEnumerationSkipsHiddenFiles
+                                                                 errorHandler:NULL];
+    for (NSURL *fileURL in fileEnumerator) {
+        NSDictionary<NSString *, id> *resourceValues = [fileURL resourceValuesForKeys:resourceKeys error:nil];
+        if (!resourceValues) {
+            continue;
+        }
+        if ([resourceValues[NSURLIsDirectoryKey] boolValue]) {
+            [fileEnumerator skipDescendants];
+            continue;
+        }
+        SDImageCacheDiskIndexEntry *entry = [SDImageCacheDiskIndexEntry new];
+        entry.name = fileURL.lastPathComponent;
+        entry.size = [resourceValues[NSURLFileSizeKey] unsignedLongLongValue];
+        entry.modificationTime = [resourceValues[NSURLContentModificationDateKey] timeIntervalSinceReferenceDate];
+        entry.accessTime = entry.modificationTime;
+        self.entries[entry.name] = entry;
+        self.currentTotalSize += entry.size;
+    }
+    [self writeSnapshot];
+}
+
+- (NSData *)journalHeader {
+    uint32_t header[2] = {CFSwapInt32HostToLittle(kSDDiskIndexMagic), CFSwapInt32HostToLittle(kSDDiskIndexVersion)};
+    return [NSData dataWithBytes:header length:sizeof(header)];
+}
+
+- (void)writeSnapshot {
+    NSMutableData *snapshot = [NSMutableData dataWithData:[self journalHeader]];
+    for (SDImageCacheDiskIndexEntry *entry in self.entries.allValues) {
+        SDDiskIndexAppendRecord(snapshot, SDDiskIndexRecordTypeWrite, entry);
+    }
+    [self.metadatas enumerateKeysAndObjectsUsingBlock:^(NSString *name, NSData *metadata, BOOL *stop) {
+        SDDiskIndexAppendMetadataRecord(snapshot, name, metadata);
+    }];
+    [self closeJournal];
+    [self.fileManager createDirectoryAtPath:self.journalPath.stringByDeletingLastPathComponent withIntermediateDirectories:YES attributes:nil error:NULL];
+    [snapshot writeToFile:self.journalPath atomically:YES];
+    self.pendingRecords.length = 0;
+    self.journalRecordCount = self.entries.count + self.metadatas.count;
+}
+
+- (void)closeJournal {
+    if (self.journalFileDescriptor >= 0) {
+        close(self.journalFileDescriptor);
+        self.journalFileDescriptor = -1;
+    }
+}
+
+// Records of a batch are flushed when it ends
+- (void)flushPendingRecordsIfNeeded {
+    if (self.batchUpdateDepth == 0) {
+        [self flushPendingRecords];
+    }
+}
+
+- (void)flushPendingRecords {
+    if (self.pendingRecords.length == 0) {
+        return;
+    }
+    if (self.journalFileDescriptor < 0) {
+        const char *path = self.journalPath.fileSystemRepresentation;
+        int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd < 0) {
+            [self.fileManager createDirectoryAtPath:self.journalPath.stringByDeletingLastPathComponent withIntermediateDirectories:YES attributes:nil error:NULL];
+            fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        }
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size == 0) {
+            NSData *header = [self journalHeader];
+            write(fd, header.bytes, header.length);
+        }
+        self.journalFileDescriptor = fd;
+    }
+    write(self.journalFileDescriptor, self.pendingRecords.bytes, self.pendingRecords.length);
+    self.pendingRecords.length = 0;
+}
+
+@end
@@ -0,0 +1,78 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+
+/**
+ * The HTTP metadata of a disk cache entry: its validators (ETag, Last-Modified), its freshness lifetime and its content type.
+ * It is taken from the response the image was downloaded with, and lets a later refresh send a conditional request instead of downloading the image again.
+ */
+@interface SDImageCacheEntryMetadata : NSObject <NSCopying>
+
+/**
+ * The value of the `ETag` response header.
+ */
+@property (nonatomic, copy, nullable) NSString *eTag;
+
+/**
+ * The value of the `Last-Modified` response header, kept as sent by the server.
+ */
+@property (nonatomic, copy, nullable) NSString *lastModified;
+
+/**
+ * The date until which the entry is fresh and can be used without asking the server, from `Cache-Control: max-age` or `Expires`.
+ * nil when the server gave no lifetime or asked for revalidation (`no-cache`).
+ */
+@property (nonatomic, strong, nullable) NSDate *expirationDate;
+
+/**
+ * The value of the `Content-Type` response header.
+ */
+@property (nonatomic, copy, nullable) NSString *contentType;
+
+/**
+ * Whether the entry is still within its freshness lifetime.
+ */
+@property (nonatomic, assign, readonly, getter=isFresh) BOOL fresh;
+
+/**
+ * Whether the entry has a validator, so it can be revalidated with a conditional request.
+ */
+@property (nonatomic, assign, readonly) BOOL hasValidator;
+
+/**
+ * The `If-None-Match` and `If-Modified-Since` header fields to revalidate the entry with. Empty if there is no validator.
+ */
+@property (nonatomic, copy, readonly, nonnull) NSDictionary<NSString *, NSString *> *conditionalRequestHeaders;
+
+/**
+ * Create the metadata from a response.
+ *
+ * @return nil if the response is not an HTTP response, forbids storing (`Cache-Control: no-store`), or carries none of the fields
+ */
++ (nullable instancetype)metadataWithResponse:(nullable NSURLResponse *)response;
+
+/**
+ * Return a copy updated with the fields of a `304 Not Modified` response. Fields the response does not carry are kept.
+ */
+- (nonnull instancetype)metadataByUpdatingWithResponse:(nullable NSURLResponse *)response;
+
+/**
+ * Decode the metadata from its compact binary form.
+ *
+ * @return nil if the data is not valid
+ */
++ (nullable instancetype)metadataWithData:(nullable NSData *)data;
+
+/**
+ * The compact binary form of the metadata.
+ */
+- (nonnull NSData *)dataRepresentation;
+
+@end
@@ -0,0 +1,230 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDImageCacheEntryMetadata.h"
+
+static const uint8_t kSDEntryMetadataVersion = 1;
+static const uint8_t kSDEntryMetadataHasExpirationDate = 1 << 0;
+
+// The keys of `allHeaderFields` are not canonicalized on every OS version
+static NSString *SDEntryMetadataHeaderValue(NSDictionary *headers, NSString *field) {
+    NSString *value = headers[field];
+    if (value) {
+        return value;
+    }
+    for (NSString *key in headers) {
+        if ([key caseInsensitiveCompare:field] == NSOrderedSame) {
+            return headers[key];
+        }
+    }
+    return nil;
+}
+
+static NSDate *SDEntryMetadataDateFromHTTPDate(NSString *string) {
+    static NSDateFormatter *formatter;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        formatter = [NSDateFormatter new];
+        formatter.locale = [NSLocale localeWithLocaleIdentifier:@"en_US_POSIX"];
+        formatter.timeZone = [NSTimeZone timeZoneForSecondsFromGMT:0];
+        formatter.dateFormat = @"EEE',' dd MMM yyyy HH':'mm':'ss 'GMT'";
+    });
+    if (!string) {
+        return nil;
+    }
+    return [formatter dateFromString:string];
+}
+
+static void SDEntryMetadataAppendString(NSMutableData *data, NSString *string) {
+    NSData *stringData = [string dataUsingEncoding:NSUTF8StringEncoding];
+    uint16_t length = (stringData.length <= UINT16_MAX) ? (uint16_t)stringData.length : 0;
+    uint16_t littleLength = CFSwapInt16HostToLittle(length);
+    [data appendBytes:&littleLength length:sizeof(littleLength)];
+    if (length > 0) {
+        [data appendData:stringData];
+    }
+}
+
+static BOOL SDEntryMetadataReadString(const uint8_t *bytes, NSUInteger length, NSUInteger *cursor, NSString **string) {
+    uint16_t stringLength;
+    if (*cursor + sizeof(stringLength) > length) {
+        return NO;
+    }
+    memcpy(&stringLength, bytes + *cursor, sizeof(stringLength));
+    *cursor += sizeof(stringLength);
+    stringLength = CFSwapInt16LittleToHost(stringLength);
+    if (*cursor + stringLength > length) {
+        return NO;
+    }
+    *string = stringLength > 0 ? [[NSString alloc] initWithBytes:bytes + *cursor length:stringLength encoding:NSUTF8StringEncoding] : nil;
+    *cursor += stringLength;
+    return YES;
+}
+
+@implementation SDImageCacheEntryMetadata
+
++ (instancetype)metadataWithResponse:(NSURLResponse *)response {
+    if (![response isKindOfClass:[NSHTTPURLResponse class]]) {
+        return nil;
+    }
+    NSDictionary *headers = ((NSHTTPURLResponse *)response).allHeaderFields;
+    NSString *cacheControl = SDEntryMetadataHeaderValue(headers, @"Cache-Control").lowercaseString;
+    if ([cacheControl rangeOfString:@"no-store"].location != NSNotFound) {
+        return nil;
+    }
+    SDImageCacheEntryMetadata *metadata = [self new];
+    [metadata updateWithHeaders:headers];
+    if (!metadata.eTag && !metadata.lastModified && !metadata.expirationDate && !metadata.contentType) {
+        return nil;
+    }
+    return metadata;
+}
+
+- (instancetype)metadataByUpdatingWithResponse:(NSURLResponse *)response {
+    SDImageCacheEntryMetadata *metadata = [self copy];
+    if ([response isKindOfClass:[NSHTTPURLResponse class]]) {
+        [metadata updateWithHeaders:((NSHTTPURLResponse *)response).allHeaderFields];
+    }
+    return metadata;
+}
+
+- (void)updateWithHeaders:(NSDictionary *)headers {
+    NSString *eTag = SDEntryMetadataHeaderValue(headers, @"ETag");
+    if (eTag.length > 0) {
+        self.eTag = eTag;
+    }
+    NSString *lastModified = SDEntryMetadataHeaderValue(headers, @"Last-Modified");
+    if (lastModified.length > 0) {
+        self.lastModified = lastModified;
+    }
+    NSString *contentType = SDEntryMetadataHeaderValue(headers, @"Content-Type");
+    if (contentType.length > 0) {
+        self.contentType = contentType;
+    }
+
+    NSString *cacheControl = SDEntryMetadataHeaderValue(headers, @"Cache-Control").lowercaseString;
+    NSString *expires = SDEntryMetadataHeaderValue(headers, @"Expires");
+    if (!cacheControl && !expires) {
+        // No new lifetime, keep the previous one
+        return;
+    }
+    BOOL hasLifetime = NO;
+    NSTimeInterval lifetime = 0;
+    BOOL noCache = NO;
+    for (NSString *component in [cacheControl componentsSeparatedByString:@","]) {
+        NSString *directive = [component stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+        if ([directive isEqualToString:@"no-cache"]) {
+            noCache = YES;
+        } else if ([directive hasPrefix:@"max-age="]) {
+            hasLifetime = YES;
+            lifetime = [directive substringFromIndex:@"max-age=".length].doubleValue;
+        }
+    }
+    if (!hasLifetime && expires) {
+        // Measure the lifetime against the server's own clock, so a skewed device clock does not matter
+        NSDate *expirationDate = SDEntryMetadataDateFromHTTPDate(expires);
+        NSDate *responseDate = SDEntryMetadataDateFromHTTPDate(SDEntryMetadataHeaderValue(headers, @"Date")) ?: [NSDate date];
+        hasLifetime = YES;
+        // An invalid date such as "0" means already expired
+        lifetime = expirationDate ? [expirationDate timeIntervalSinceDate:responseDate] : 0;
+    }
+    if (noCache || !hasLifetime) {
+        self.expirationDate = nil;
+        return;
+    }
+    NSTimeInterval age = [SDEntryMetadataHeaderValue(headers, @"Age") doubleValue];
+    self.expirationDate = [NSDate dateWithTimeIntervalSinceNow:MAX(lifetime - age, 0)];
+}
+
+- (BOOL)isFresh {
+    return self.expirationDate && self.expirationDate.timeIntervalSinceNow > 0;
+}
+
+- (BOOL)hasValidator {
+    return self.eTag.length > 0 || self.lastModified.length > 0;
+}
+
+- (NSDictionary<NSString *, NSString *> *)conditionalRequestHeaders {
+    NSMutableDictionary<NSString *, NSString *> *headers = [NSMutableDictionary dictionary];
+    if (self.eTag.length > 0) {
+        headers[@"If-None-Match"] = self.eTag;
+    }
+    if (self.lastModified.length > 0) {
+        headers[@"If-Modified-Since"] = self.lastModified;
+    }
+    return [headers copy];
+}
+
+#pragma mark - Encoding
+
++ (instancetype)metadataWithData:(NSData *)data {
+    if (data.length < 2) {
+        return nil;
+    }
+    const uint8_t *bytes = data.bytes;
+    NSUInteger length = data.length;
+    NSUInteger cursor = 0;
+    uint8_t version = bytes[cursor++];
+    uint8_t flags = bytes[cursor++];
+    if (version != kSDEntryMetadataVersion) {
+        return nil;
+    }
+    SDImageCacheEntryMetadata *metadata = [self new];
+    if (flags & kSDEntryMetadataHasExpirationDate) {
+        uint64_t bits;
+        if (cursor + sizeof(bits) > length) {
+            return nil;
+        }
+        memcpy(&bits, bytes + cursor, sizeof(bits));
+        cursor += sizeof(bits);
+        bits = CFSwapInt64LittleToHost(bits);
+        NSTimeInterval time;
+        memcpy(&time, &bits, sizeof(time));
+        metadata.expirationDate = [NSDate dateWithTimeIntervalSinceReferenceDate:time];
+    }
+    NSString *eTag, *lastModified, *contentType;
+    if (!SDEntryMetadataReadString(bytes, length, &cursor, &eTag) ||
+        !SDEntryMetadataReadString(bytes, length, &cursor, &lastModified) ||
+        !SDEntryMetadataReadString(bytes, length, &cursor, &contentType)) {
+        return nil;
+    }
+    metadata.eTag = eTag;
+    metadata.lastModified = lastModified;
+    metadata.contentType = contentType;
+    return metadata;
+}
+
+- (NSData *)dataRepresentation {
+    NSMutableData *data = [NSMutableData data];
+    uint8_t header[2] = {kSDEntryMetadataVersion, self.expirationDate ? kSDEntryMetadataHasExpirationDate : 0};
+    [data appendBytes:header length:sizeof(header)];
+    if (self.expirationDate) {
+        NSTimeInterval time = self.expirationDate.timeIntervalSinceReferenceDate;
+        uint64_t bits;
+        memcpy(&bits, &time, sizeof(bits));
+        bits = CFSwapInt64HostToLittle(bits);
+        [data appendBytes:&bits length:sizeof(bits)];
+    }
+    SDEntryMetadataAppendString(data, self.eTag);
+    SDEntryMetadataAppendString(data, self.lastModified);
+    SDEntryMetadataAppendString(data, self.contentType);
+    return [data copy];
+}
+
+#pragma mark - NSCopying
+
+- (id)copyWithZone:(NSZone *)zone {
+    SDImageCacheEntryMetadata *metadata = [[[self class] allocWithZone:zone] init];
+    metadata.eTag = self.eTag;
+    metadata.lastModified = self.lastModified;
+    metadata.expirationDate = self.expirationDate;
+    metadata.contentType = self.contentType;
+    return metadata;
+}
+
+@end
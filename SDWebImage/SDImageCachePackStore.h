@@ -0,0 +1,109 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+
+/**
+ * A disk store which appends small entries to a few large segment files instead of writing one file per entry.
+ * Each segment is a sequence of self-describing records (header, name, payload), so the in-memory offset index can always be rebuilt by scanning the segments.
+ * Reads are served as zero-copy slices of the memory-mapped segment. Eviction works on whole segments, and segments holding mostly overwritten or removed records are compacted.
+ * All methods are thread-safe.
+ */
+@interface SDImageCachePackStore : NSObject
+
+/**
+ * The directory which holds the segment files.
+ */
+@property (nonatomic, copy, readonly, nonnull) NSString *directory;
+
+/**
+ * When the segment currently being appended reaches this size (in bytes), it is sealed and a new segment is started.
+ */
+@property (nonatomic, assign) NSUInteger segmentSize;
+
+/**
+ * The number of live entries in the store.
+ */
+@property (nonatomic, assign, readonly) NSUInteger entryCount;
+
+/**
+ * The total size of all segment files, in bytes. This includes space used by overwritten or removed entries until their segment is compacted or evicted.
+ */
+@property (nonatomic, assign, readonly) NSUInteger totalSize;
+
+/**
+ * Create a store using the segments in the given directory. The directory is created on the first write.
+ * The existing segments are indexed lazily on first access.
+ *
+ * @param directory   The directory which holds the segment files
+ * @param segmentSize The size at which a segment is sealed, in bytes
+ */
+- (nonnull instancetype)initWithDirectory:(nonnull NSString *)directory segmentSize:(NSUInteger)segmentSize NS_DESIGNATED_INITIALIZER;
+
+- (nonnull instancetype)init NS_UNAVAILABLE;
+
+/**
+ * Append the data for the given name to the current segment. A later store for the same name replaces the earlier one.
+ *
+ * @return YES if the record was written
+ */
+- (BOOL)storeData:(nonnull NSData *)data forName:(nonnull NSString *)name;
+
+/**
+ * Return the data for the given name, as a slice of the mapped segment, or nil if it is not in the store.
+ */
+- (nullable NSData *)dataForName:(nonnull NSString *)name;
+
+/**
+ * Check whether the store holds data for the given name. This only probes the in-memory index.
+ */
+- (BOOL)containsDataForName:(nonnull NSString *)name;
+
+/**
+ * Remove the data for the given name. A tombstone record is appended so the removal survives a relaunch.
+ */
+- (void)removeDataForName:(nonnull NSString *)name;
+
+/**
+ * Remove all segments and reset the index.
+ */
+- (void)removeAllData;
+
+/**
+ * The names of all live entries.
+ */
+- (nonnull NSArray<NSString *> *)allNames;
+
+/**
+ * The file URLs of all segments, oldest first.
+ */
+- (nonnull NSArray<NSURL *> *)segmentURLs;
+
+/**
+ * The last time an entry of the segment was read during this session, or nil if none was read.
+ * This is kept in memory only, the owner has to persist it to keep it across launches.
+ */
+- (nullable NSDate *)lastAccessDateForSegmentAtURL:(nonnull NSURL *)segmentURL;
+
+/**
+ * Remove a whole segment and all entries it holds, and return the names of those entries.
+ * When older segments remain, tombstones for the evicted entries and the segment's own tombstones are appended to the current segment first, so older records of those names do not come back after a relaunch.
+ */
+- (nonnull NSArray<NSString *> *)removeSegmentAtURL:(nonnull NSURL *)segmentURL;
+
+/**
+ * Compact every sealed segment whose dead bytes (overwritten or removed records, and tombstones no longer needed) make up at least the given ratio of its size.
+ * The live records are rewritten into the current segment and the old segment is removed. The names and data of the entries do not change.
+ *
+ * @param deadRatio The ratio of dead bytes, between 0 and 1, from which a segment is compacted
+ * @return The number of compacted segments
+ */
+- (NSUInteger)compactSegmentsWithDeadRatio:(double)deadRatio;
+
+@end
@@ -0,0 +1,515 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDImageCachePackStore.h"
+#import <fcntl.h>
+#import <unistd.h>
+#import <sys/stat.h>
+
+#define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
+#define UNLOCK(lock) dispatch_semaphore_signal(lock);
+
+static NSString * const kSDPackSegmentExtension = @"sdpack";
+static const uint32_t kSDPackRecordMagic = 0x53445042; // "SDPB"
+static const uint32_t kSDPackRecordFlagTombstone = 1 << 0;
+
+// On-disk record header, stored little endian. It is followed by the UTF-8 name and then the payload.
+typedef struct {
+    uint32_t magic;
+    uint32_t nameLength;
+    uint32_t dataLength;
+    uint32_t flags;
+} SDPackRecordHeader;
+
+@interface SDImageCachePackEntry : NSObject
+
+@property (nonatomic, assign) NSUInteger segment;
+@property (nonatomic, assign) unsigned long long offset; // offset of the payload in the segment
+@property (nonatomic, assign) NSUInteger length;
+@property (nonatomic, assign) NSUInteger recordLength; // header, name and payload
+
+@end
+
+@implementation SDImageCachePackEntry
+
+@end
+
+@interface SDImageCachePackStore ()
+
+@property (nonatomic, copy, readwrite, nonnull) NSString *directory;
+@property (nonatomic, strong, nonnull) dispatch_semaphore_t lock; // a lock to keep the access to the index and the segment file thread-safe
+@property (nonatomic, strong, nullable) NSMutableDictionary<NSString *, SDImageCachePackEntry *> *entries; // nil until the segments are scanned
+@property (nonatomic, strong, nonnull) NSMutableDictionary<NSString *, NSNumber *> *tombstoneSegments; // the segment of the last tombstone of each removed name
+@property (nonatomic, strong, nonnull) NSMutableDictionary<NSNumber *, NSNumber *> *segmentLengths;
+@property (nonatomic, strong, nonnull) NSMutableDictionary<NSNumber *, NSNumber *> *segmentLiveLengths; // the bytes of the records still in `entries`, the rest is dead
+@property (nonatomic, strong, nonnull) NSMutableDictionary<NSNumber *, NSData *> *mappedSegments;
+@property (nonatomic, strong, nonnull) NSMutableDictionary<NSNumber *, NSNumber *> *segmentAccessTimes;
+@property (nonatomic, strong, nonnull) NSFileManager *fileManager;
+@property (nonatomic, assign) NSUInteger currentSegment;
+@property (nonatomic, assign) int currentFileDescriptor;
+
+@end
+
+@implementation SDImageCachePackStore
+
+- (instancetype)initWithDirectory:(NSString *)directory segmentSize:(NSUInteger)segmentSize {
+    self = [super init];
+    if (self) {
+        _directory = [directory copy];
+        _segmentSize = segmentSize;
+        _lock = dispatch_semaphore_create(1);
+        _segmentLengths = [NSMutableDictionary dictionary];
+        _segmentLiveLengths = [NSMutableDictionary dictionary];
+        _mappedSegments = [NSMutableDictionary dictionary];
+        _segmentAccessTimes = [NSMutableDictionary dictionary];
+        _tombstoneSegments = [NSMutableDictionary dictionary];
+        _fileManager = [NSFileManager new];
+        _currentSegment = 1;
+        _currentFileDescriptor = -1;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (_currentFileDescriptor >= 0) {
+        close(_currentFileDescriptor);
+    }
+}
+
+#pragma mark - Public
+
+- (NSUInteger)entryCount {
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    NSUInteger count = self.entries.count;
+    UNLOCK(self.lock);
+    return count;
+}
+
+- (NSUInteger)totalSize {
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    NSUInteger size = 0;
+    for (NSNumber *length in self.segmentLengths.allValues) {
+        size += length.unsignedIntegerValue;
+    }
+    UNLOCK(self.lock);
+    return size;
+}
+
+- (BOOL)storeData:(NSData *)data forName:(NSString *)name {
+    if (!data || !name) {
+        return NO;
+    }
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    SDImageCachePackEntry *entry = [self appendRecordWithName:name data:data flags:0];
+    if (entry) {
+        [self setEntry:entry forName:name];
+        [self.tombstoneSegments removeObjectForKey:name];
+    }
+    UNLOCK(self.lock);
+    return entry != nil;
+}
+
+- (NSData *)dataForName:(NSString *)name {
+    if (!name) {
+        return nil;
+    }
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    SDImageCachePackEntry *entry = self.entries[name];
+    NSData *segmentData = nil;
+    if (entry) {
+        segmentData = [self mappedSegment:entry.segment length:entry.offset + entry.length];
+        self.segmentAccessTimes[@(entry.segment)] = @([NSDate timeIntervalSinceReferenceDate]);
+    }
+    UNLOCK(self.lock);
+
+    if (!entry || segmentData.length < entry.offset + entry.length) {
+        return nil;
+    }
+    void *bytes = (uint8_t *)segmentData.bytes + entry.offset;
+    return [[NSData alloc] initWithBytesNoCopy:bytes length:entry.length deallocator:^(void * _Nonnull b, NSUInteger l) {
+        // The slice retains the mapping, so it stays valid even if the segment is evicted meanwhile
+        (void)segmentData;
+    }];
+}
+
+- (BOOL)containsDataForName:(NSString *)name {
+    if (!name) {
+        return NO;
+    }
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    BOOL contains = self.entries[name] != nil;
+    UNLOCK(self.lock);
+    return contains;
+}
+
+- (void)removeDataForName:(NSString *)name {
+    if (!name) {
+        return;
+    }
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    if (self.entries[name]) {
+        [self appendTombstoneForName:name];
+        [self setEntry:nil forName:name];
+    }
+    UNLOCK(self.lock);
+}
+
+- (void)removeAllData {
+    LOCK(self.lock);
+    [self closeCurrentSegment];
+    [self.fileManager removeItemAtPath:self.directory error:nil];
+    self.entries = [NSMutableDictionary dictionary];
+    [self.segmentLengths removeAllObjects];
+    [self.segmentLiveLengths removeAllObjects];
+    [self.mappedSegments removeAllObjects];
+    [self.segmentAccessTimes removeAllObjects];
+    [self.tombstoneSegments removeAllObjects];
+    self.currentSegment = 1;
+    UNLOCK(self.lock);
+}
+
+- (NSArray<NSString *> *)allNames {
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    NSArray<NSString *> *names = self.entries.allKeys;
+    UNLOCK(self.lock);
+    return names;
+}
+
+- (NSArray<NSURL *> *)segmentURLs {
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    NSArray<NSNumber *> *segments = [self.segmentLengths.allKeys sortedArrayUsingSelector:@selector(compare:)];
+    NSMutableArray<NSURL *> *URLs = [NSMutableArray arrayWithCapacity:segments.count];
+    for (NSNumber *segment in segments) {
+        [URLs addObject:[NSURL fileURLWithPath:[self pathForSegment:segment.unsignedIntegerValue]]];
+    }
+    UNLOCK(self.lock);
+    return [URLs copy];
+}
+
+- (NSDate *)lastAccessDateForSegmentAtURL:(NSURL *)segmentURL {
+    NSString *segmentName = segmentURL.lastPathComponent;
+    if (![segmentName.pathExtension isEqualToString:kSDPackSegmentExtension]) {
+        return nil;
+    }
+    NSUInteger segment = (NSUInteger)segmentName.stringByDeletingPathExtension.longLongValue;
+    LOCK(self.lock);
+    NSNumber *accessTime = self.segmentAccessTimes[@(segment)];
+    UNLOCK(self.lock);
+    return accessTime ? [NSDate dateWithTimeIntervalSinceReferenceDate:accessTime.doubleValue] : nil;
+}
+
+- (NSArray<NSString *> *)removeSegmentAtURL:(NSURL *)segmentURL {
+    NSString *segmentName = segmentURL.lastPathComponent;
+    if (![segmentName.pathExtension isEqualToString:kSDPackSegmentExtension]) {
+        return @[];
+    }
+    NSUInteger segment = (NSUInteger)segmentName.stringByDeletingPathExtension.longLongValue;
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    NSArray<NSString *> *evictedNames = self.segmentLengths[@(segment)] ? [self removeSegment:segment] : @[];
+    UNLOCK(self.lock);
+    return evictedNames;
+}
+
+- (NSUInteger)compactSegmentsWithDeadRatio:(double)deadRatio {
+    LOCK(self.lock);
+    [self loadIfNeeded];
+    NSUInteger compactedCount = 0;
+    // The last tombstone of a removed name still hides its older records, so it is not dead space
+    NSMutableDictionary<NSNumber *, NSNumber *> *tombstoneLengths = [NSMutableDictionary dictionary];
+    [self.tombstoneSegments enumerateKeysAndObjectsUsingBlock:^(NSString * _Nonnull name, NSNumber * _Nonnull segment, BOOL * _Nonnull stop) {
+        NSUInteger tombstoneLength = sizeof(SDPackRecordHeader) + [name lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+        tombstoneLengths[segment] = @(tombstoneLengths[segment].unsignedIntegerValue + tombstoneLength);
+    }];
+    NSArray<NSNumber *> *segments = [self.segmentLengths.allKeys sortedArrayUsingSelector:@selector(compare:)];
+    for (NSNumber *segment in segments) {
+        // The live records are rewritten into the current segment, so it is never a candidate itself
+        if (segment.unsignedIntegerValue == self.currentSegment) {
+            continue;
+        }
+        NSUInteger length = self.segmentLengths[segment].unsignedIntegerValue;
+        NSUInteger liveLength = MIN(length, self.segmentLiveLengths[segment].unsignedIntegerValue + tombstoneLengths[segment].unsignedIntegerValue);
+        if (length > 0 && (double)(length - liveLength) < deadRatio * length) {
+            continue;
+        }
+        if (![self compactSegment:segment.unsignedIntegerValue]) {
+            // Out of space, the remaining segments stay as they are
+            break;
+        }
+        compactedCount += 1;
+    }
+    UNLOCK(self.lock);
+    return compactedCount;
+}
+
+#pragma mark - Private, make sure to call while holding the lock
+
+- (NSString *)pathForSegment:(NSUInteger)segment {
+    NSString *segmentName = [NSString stringWithFormat:@"%08lu.%@", (unsigned long)segment, kSDPackSegmentExtension];
+    return [self.directory stringByAppendingPathComponent:segmentName];
+}
+
+- (NSArray<NSString *> *)removeSegment:(NSUInteger)segment {
+    NSMutableArray<NSString *> *evictedNames = [NSMutableArray array];
+    [self.entries enumerateKeysAndObjectsUsingBlock:^(NSString * _Nonnull name, SDImageCachePackEntry * _Nonnull entry, BOOL * _Nonnull stop) {
+        if (entry.segment == segment) {
+            [evictedNames addObject:name];
+        }
+    }];
+    NSMutableArray<NSString *> *tombstonedNames = [NSMutableArray array];
+    [self.tombstoneSegments enumerateKeysAndObjectsUsingBlock:^(NSString * _Nonnull name, NSNumber * _Nonnull tombstoneSegment, BOOL * _Nonnull stop) {
+        if (tombstoneSegment.unsignedIntegerValue == segment) {
+            [tombstonedNames addObject:name];
+        }
+    }];
+    BOOL hasOlderSegments = NO;
+    for (NSNumber *otherSegment in self.segmentLengths) {
+        if (otherSegment.unsignedIntegerValue < segment) {
+            hasOlderSegments = YES;
+            break;
+        }
+    }
+    if (hasOlderSegments) {
+        // An older segment may still hold a previous record of the evicted or removed names, which would come back on the next scan.
+        // Write their tombstones to a later segment before this one is gone
+        if (segment == self.currentSegment) {
+            [self closeCurrentSegment];
+            self.currentSegment += 1;
+        }
+        for (NSString *name in evictedNames) {
+            [self appendTombstoneForName:name];
+        }
+        for (NSString *name in tombstonedNames) {
+            [self appendTombstoneForName:name];
+        }
+    } else {
+        // Nothing older is left for these tombstones to hide
+        [self.tombstoneSegments removeObjectsForKeys:tombstonedNames];
+        if (segment == self.currentSegment) {
+            // The next append starts a fresh file under the same number
+            [self closeCurrentSegment];
+        }
+    }
+    [self.fileManager removeItemAtPath:[self pathForSegment:segment] error:nil];
+    [self.segmentLengths removeObjectForKey:@(segment)];
+    [self.segmentLiveLengths removeObjectForKey:@(segment)];
+    [self.mappedSegments removeObjectForKey:@(segment)];
+    [self.segmentAccessTimes removeObjectForKey:@(segment)];
+    [self.entries removeObjectsForKeys:evictedNames];
+    return [evictedNames copy];
+}
+
+- (BOOL)compactSegment:(NSUInteger)segment {
+    NSMutableArray<NSString *> *liveNames = [NSMutableArray array];
+    __block unsigned long long liveEnd = 0;
+    [self.entries enumerateKeysAndObjectsUsingBlock:^(NSString * _Nonnull name, SDImageCachePackEntry * _Nonnull entry, BOOL * _Nonnull stop) {
+        if (entry.segment == segment) {
+            [liveNames addObject:name];
+            liveEnd = MAX(liveEnd, entry.offset + entry.length);
+        }
+    }];
+    NSData *segmentData = [self mappedSegment:segment length:liveEnd];
+    if (liveNames.count > 0 && !segmentData) {
+        return NO;
+    }
+    for (NSString *name in liveNames) {
+        SDImageCachePackEntry *entry = self.entries[name];
+        NSData *data = [segmentData subdataWithRange:NSMakeRange((NSUInteger)entry.offset, entry.length)];
+        SDImageCachePackEntry *movedEntry = [self appendRecordWithName:name data:data flags:0];
+        if (!movedEntry) {
+            // The records moved so far win over the ones left in this segment, so the store stays consistent
+            return NO;
+        }
+        [self setEntry:movedEntry forName:name];
+    }
+    // Only the tombstones are left, they are carried over like on eviction
+    [self removeSegment:segment];
+    return YES;
+}
+
+- (void)setEntry:(nullable SDImageCachePackEntry *)entry forName:(NSString *)name {
+    SDImageCachePackEntry *oldEntry = self.entries[name];
+    if (oldEntry) {
+        NSUInteger liveLength = self.segmentLiveLengths[@(oldEntry.segment)].unsignedIntegerValue;
+        self.segmentLiveLengths[@(oldEntry.segment)] = @(liveLength - MIN(liveLength, oldEntry.recordLength));
+    }
+    if (entry) {
+        self.entries[name] = entry;
+        self.segmentLiveLengths[@(entry.segment)] = @(self.segmentLiveLengths[@(entry.segment)].unsignedIntegerValue + entry.recordLength);
+    } else {
+        [self.entries removeObjectForKey:name];
+    }
+}
+
+- (nullable NSData *)mappedSegment:(NSUInteger)segment length:(unsigned long long)length {
+    NSData *segmentData = self.mappedSegments[@(segment)];
+    if (segmentData.length < length) {
+        // Not mapped yet, or the segment grew since it was mapped
+        segmentData = [NSData dataWithContentsOfFile:[self pathForSegment:segment] options:NSDataReadingMappedAlways error:nil];
+        if (segmentData) {
+            self.mappedSegments[@(segment)] = segmentData;
+        }
+    }
+    return segmentData.length < length ? nil : segmentData;
+}
+
+- (void)loadIfNeeded {
+    if (self.entries) {
+        return;
+    }
+    self.entries = [NSMutableDictionary dictionary];
+    NSMutableArray<NSNumber *> *segments = [NSMutableArray array];
+    for (NSString *fileName in [self.fileManager contentsOfDirectoryAtPath:self.directory error:nil]) {
+        if ([fileName.pathExtension isEqualToString:kSDPackSegmentExtension]) {
+            [segments addObject:@(fileName.stringByDeletingPathExtension.longLongValue)];
+        }
+    }
+    // Later segments override earlier ones, so scan in order
+    [segments sortUsingSelector:@selector(compare:)];
+    for (NSNumber *segment in segments) {
+        [self scanSegment:segment.unsignedIntegerValue];
+    }
+    self.currentSegment = segments.count > 0 ? segments.lastObject.unsignedIntegerValue : 1;
+}
+
+- (void)scanSegment:(NSUInteger)segment {
+    int fd = open([self pathForSegment:segment].fileSystemRepresentation, O_RDWR);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return;
+    }
+    unsigned long long fileLength = (unsigned long long)st.st_size;
+    unsigned long long offset = 0;
+    NSMutableData *nameBuffer = [NSMutableData data];
+    while (offset + sizeof(SDPackRecordHeader) <= fileLength) {
+        SDPackRecordHeader header;
+        if (pread(fd, &header, sizeof(header), (off_t)offset) != sizeof(header)) {
+            break;
+        }
+        uint32_t magic = CFSwapInt32LittleToHost(header.magic);
+        uint32_t nameLength = CFSwapInt32LittleToHost(header.nameLength);
+        uint32_t dataLength = CFSwapInt32LittleToHost(header.dataLength);
+        uint32_t flags = CFSwapInt32LittleToHost(header.flags);
+        unsigned long long payloadOffset = offset + sizeof(header) + nameLength;
+        unsigned long long recordEnd = payloadOffset + dataLength;
+        if (magic != kSDPackRecordMagic || recordEnd > fileLength) {
+            break;
+        }
+        nameBuffer.length = nameLength;
+        if (pread(fd, nameBuffer.mutableBytes, nameLength, (off_t)(offset + sizeof(header))) != (ssize_t)nameLength) {
+            break;
+        }
+        NSString *name = [[NSString alloc] initWithData:nameBuffer encoding:NSUTF8StringEncoding];
+        if (name) {
+            if (flags & kSDPackRecordFlagTombstone) {
+                [self setEntry:nil forName:name];
+                self.tombstoneSegments[name] = @(segment);
+            } else {
+                SDImageCachePackEntry *entry = [SDImageCachePackEntry new];
+                entry.segment = segment;
+                entry.offset = payloadOffset;
+                entry.length = dataLength;
+                entry.recordLength = (NSUInteger)(recordEnd - offset);
+                [self setEntry:entry forName:name];
+                [self.tombstoneSegments removeObjectForKey:name];
+            }
+        }
+        offset = recordEnd;
+    }
+    if (offset < fileLength) {
+        // Drop the torn tail left by an interrupted append
+        ftruncate(fd, (off_t)offset);
+    }
+    close(fd);
+    self.segmentLengths[@(segment)] = @(offset);
+}
+
+- (void)closeCurrentSegment {
+    if (self.currentFileDescriptor >= 0) {
+        close(self.currentFileDescriptor);
+        self.currentFileDescriptor = -1;
+    }
+}
+
+- (void)appendTombstoneForName:(NSString *)name {
+    SDImageCachePackEntry *entry = [self appendRecordWithName:name data:[NSData data] flags:kSDPackRecordFlagTombstone];
+    if (entry) {
+        self.tombstoneSegments[name] = @(entry.segment);
+    }
+}
+
+- (nullable SDImageCachePackEntry *)appendRecordWithName:(NSString *)name data:(NSData *)data flags:(uint32_t)flags {
+    NSData *nameData = [name dataUsingEncoding:NSUTF8StringEncoding];
+    if (!nameData || data.length > UINT32_MAX) {
+        return nil;
+    }
+    unsigned long long currentLength = self.segmentLengths[@(self.currentSegment)].unsignedLongLongValue;
+    if (self.segmentSize > 0 && currentLength >= self.segmentSize) {
+        // Seal the full segment
+        [self closeCurrentSegment];
+        self.currentSegment += 1;
+        currentLength = 0;
+    }
+    if (self.currentFileDescriptor < 0) {
+        const char *path = [self pathForSegment:self.currentSegment].fileSystemRepresentation;
+        int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd < 0) {
+            [self.fileManager createDirectoryAtPath:self.directory withIntermediateDirectories:YES attributes:nil error:NULL];
+            fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        }
+        if (fd < 0) {
+            return nil;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0) {
+            currentLength = (unsigned long long)st.st_size;
+        }
+        self.currentFileDescriptor = fd;
+    }
+
+    SDPackRecordHeader header;
+    header.magic = CFSwapInt32HostToLittle(kSDPackRecordMagic);
+    header.nameLength = CFSwapInt32HostToLittle((uint32_t)nameData.length);
+    header.dataLength = CFSwapInt32HostToLittle((uint32_t)data.length);
+    header.flags = CFSwapInt32HostToLittle(flags);
+    // Entries are small, so assemble the record and issue a single write
+    NSMutableData *record = [NSMutableData dataWithCapacity:sizeof(header) + nameData.length + data.length];
+    [record appendBytes:&header length:sizeof(header)];
+    [record appendData:nameData];
+    [record appendData:data];
+
+    ssize_t written = write(self.currentFileDescriptor, record.bytes, record.length);
+    if (written != (ssize_t)record.length) {
+        if (written > 0) {
+            ftruncate(self.currentFileDescriptor, (off_t)currentLength);
+        }
+        return nil;
+    }
+    self.segmentLengths[@(self.currentSegment)] = @(currentLength + record.length);
+
+    SDImageCachePackEntry *entry = [SDImageCachePackEntry new];
+    entry.segment = self.currentSegment;
+    entry.offset = currentLength + sizeof(header) + nameData.length;
+    entry.length = data.length;
+    entry.recordLength = record.length;
+    return entry;
+}
+
+@end
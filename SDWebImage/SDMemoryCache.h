@@ -0,0 +1,197 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+
+/**
+ * The cost of an image in the memory cache: the bytes of its decoded backing store, bytes per row times height.
+ * For an animated image, the sum over its frames, where frames repeated to hold them longer are counted once.
+ */
+FOUNDATION_EXPORT NSUInteger SDCacheCostForImage(UIImage * _Nonnull image);
+
+/**
+ * Which new entries the memory cache admits when it is full.
+ */
+typedef NS_ENUM(NSUInteger, SDMemoryCacheAdmissionPolicy) {
+    /**
+     * Admit every entry, evicting the least recently used ones.
+     */
+    SDMemoryCacheAdmissionPolicyLRU,
+    /**
+     * TinyLFU: a compact frequency sketch counts the recent accesses of every key, stored or not.
+     * When the cache is full, a new entry is only admitted if its key was accessed more often than the least recently used entry it would evict.
+     * This keeps the images reused on every screen, such as avatars and icons, when a prefetch or a fast scroll goes through many images seen once.
+     * The sketch takes 8KB per segment.
+     */
+    SDMemoryCacheAdmissionPolicyTinyLFU
+};
+
+/**
+ * How hard to trim the memory cache under memory pressure.
+ */
+typedef NS_ENUM(NSUInteger, SDMemoryCachePressureLevel) {
+    /**
+     * Release the least recently used half of the total cost.
+     */
+    SDMemoryCachePressureLevelModerate,
+    /**
+     * Release everything. The objects still retained elsewhere, such as the images shown by live views, stay reachable through the weak table.
+     */
+    SDMemoryCachePressureLevelCritical
+};
+
+/**
+ * The in-memory image cache of `SDImageCache`. It replaces NSCache, whose eviction order is undocumented and whose limits are only hints.
+ * Entries are kept in a hash map plus a doubly linked list in least recently used order, so get, set and evict are O(1).
+ * `totalCostLimit` and `countLimit` are strict: every store evicts the least recently used entries until both hold again.
+ * Keys are not copied, like NSCache.
+ * On iOS and tvOS the cache is trimmed on memory warning, see `shouldTrimOnMemoryWarning`. Objects still retained elsewhere (such as by image views) are kept in a weak table and brought back on access, without a disk read.
+ * All methods are thread-safe. The cache can be split into segments, each with its own lock, so threads working on different keys do not wait on each other.
+ */
+@interface SDMemoryCache <KeyType, ObjectType> : NSObject
+
+/**
+ * Create a cache with a single segment: the limits apply to the least recently used objects of the whole cache.
+ */
+- (nonnull instancetype)init;
+
+/**
+ * Create a cache split into the given number of segments. Keys are spread over the segments by hash.
+ * `totalCostLimit` and `countLimit` hold for the whole cache, and each segment gets an equal slice of them. When a store goes over the limits, the segment storing evicts its least recently used objects down to its slice, then the other segments do. A store under the limits takes no other lock than the one of its segment.
+ * An object costing more than a slice still fits: if the slices are not enough, the least recently used objects among all segments are evicted.
+ * With the TinyLFU policy, a segment holding more than its slice compares a new key with its own least recently used one.
+ *
+ * @param segmentCount The number of segments, at least 1
+ */
+- (nonnull instancetype)initWithSegmentCount:(NSUInteger)segmentCount NS_DESIGNATED_INITIALIZER;
+
+/**
+ * The number of segments.
+ */
+@property (nonatomic, assign, readonly) NSUInteger segmentCount;
+
+/**
+ * The name of the cache, for debugging.
+ */
+@property (nonatomic, copy, nullable) NSString *name;
+
+/**
+ * The maximum total cost of the objects held. Setting it evicts at once. 0 means no limit, the default.
+ */
+@property (nonatomic, assign) NSUInteger totalCostLimit;
+
+/**
+ * The maximum number of objects held. Setting it evicts at once. 0 means no limit, the default.
+ */
+@property (nonatomic, assign) NSUInteger countLimit;
+
+/**
+ * Whether memory warnings trim the cache, on iOS and tvOS. A warning is a moderate pressure, and a second warning within 10 seconds a critical one. Defaults to YES.
+ */
+@property (nonatomic, assign) BOOL shouldTrimOnMemoryWarning;
+
+/**
+ * The admission policy. Defaults to `SDMemoryCacheAdmissionPolicyLRU`.
+ */
+@property (nonatomic, assign) SDMemoryCacheAdmissionPolicy admissionPolicy;
+
+/**
+ * A block called with the key of every object leaving the cache: evicted to hold the limits, trimmed or removed. Not called when an object is replaced by another for the same key.
+ * It runs while a segment is locked, so it must not use the cache.
+ */
+@property (nonatomic, copy, nullable) void (^removalBlock)(KeyType _Nonnull key);
+
+/**
+ * The total cost of the objects held now.
+ */
+@property (nonatomic, assign, readonly) NSUInteger totalCost;
+
+/**
+ * The number of objects held now.
+ */
+@property (nonatomic, assign, readonly) NSUInteger totalCount;
+
+/**
+ * Return the object for the key and mark it as the most recently used.
+ */
+- (nullable ObjectType)objectForKey:(nonnull KeyType)key;
+
+/**
+ * Same as `setObject:forKey:cost:` with a 0 cost.
+ */
+- (void)setObject:(nullable ObjectType)obj forKey:(nonnull KeyType)key;
+
+/**
+ * Store the object as the most recently used, replacing the previous one for the key, then evict to the limits. A nil object removes the key.
+ * With the TinyLFU policy, a new key may not be admitted, see `SDMemoryCacheAdmissionPolicyTinyLFU`.
+ */
+- (void)setObject:(nullable ObjectType)obj forKey:(nonnull KeyType)key cost:(NSUInteger)g;
+
+/**
+ * Remove the object for the key, from the weak table too.
+ */
+- (void)removeObjectForKey:(nonnull KeyType)key;
+
+/**
+ * Remove all objects, from the weak table too.
+ */
+- (void)removeAllObjects;
+
+/**
+ * Remove the objects whose key passes the test, from the weak table too.
+ * The test runs while a segment is locked, so it must not use the cache.
+ */
+- (void)removeObjectsPassingTest:(nonnull BOOL (^)(KeyType _Nonnull key))predicate;
+
+/**
+ * Evict the least recently used objects until the total cost is at most the given cost.
+ */
+- (void)trimToCost:(NSUInteger)cost;
+
+/**
+ * Evict the least recently used objects until at most the given number is held.
+ */
+- (void)trimToCount:(NSUInteger)count;
+
+/**
+ * Evict the objects which were not used for the given number of seconds or more.
+ */
+- (void)trimToAge:(NSTimeInterval)age;
+
+#pragma mark - Memory pressure
+
+/**
+ * Trim as for a memory warning of the given level. Each segment releases its least recently used objects.
+ *
+ * @return The cost released
+ */
+- (NSUInteger)trimForMemoryPressureLevel:(SDMemoryCachePressureLevel)level;
+
+/**
+ * The number of pressure trims so far, from memory warnings or `trimForMemoryPressureLevel:`.
+ */
+@property (nonatomic, assign, readonly) NSUInteger pressureTrimCount;
+
+/**
+ * The cost released by the last pressure trim.
+ */
+@property (nonatomic, assign, readonly) NSUInteger lastPressureTrimReleasedCost;
+
+/**
+ * The cost released by all pressure trims.
+ */
+@property (nonatomic, assign, readonly) NSUInteger pressureTrimReleasedCost;
+
+/**
+ * The cost of the objects stored again after the last pressure trim of their segment released them, which were decoded again. Objects brought back from the weak table are not counted.
+ * Compared to `pressureTrimReleasedCost`, it tells how much the trims cost in decoding.
+ */
+@property (nonatomic, assign, readonly) NSUInteger pressureTrimRedecodedCost;
+
+@end
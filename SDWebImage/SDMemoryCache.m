@@ -0,0 +1,819 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDMemoryCache.h"
+#import "NSImage+WebCache.h"
+#import <stdatomic.h>
+
+#define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
+#define UNLOCK(lock) dispatch_semaphore_signal(lock);
+
+// The bytes of the backing store of one frame. Images which are not decoded yet count as decoded, as they will be once drawn
+static inline NSUInteger SDCacheCostForCGImage(CGImageRef cgImage) {
+    return CGImageGetBytesPerRow(cgImage) * CGImageGetHeight(cgImage);
+}
+
+NSUInteger SDCacheCostForImage(UIImage *image) {
+    NSArray<UIImage *> *frames = image.images;
+    if (frames.count == 0) {
+        CGImageRef cgImage = image.CGImage;
+        if (cgImage) {
+            return SDCacheCostForCGImage(cgImage);
+        }
+        // Not bitmap backed (such as a CIImage), assume 4 bytes per pixel
+#if SD_MAC
+        return image.size.height * image.size.width * 4;
+#elif SD_UIKIT || SD_WATCH
+        return image.size.height * image.size.width * image.scale * image.scale * 4;
+#endif
+    }
+    // Animated images repeat a frame to hold it longer, and every repeat shares the same backing store: count it once
+    NSUInteger cost = 0;
+    CFMutableSetRef countedFrames = CFSetCreateMutable(kCFAllocatorDefault, frames.count, NULL);
+    for (UIImage *frame in frames) {
+        CGImageRef cgImage = frame.CGImage;
+        if (cgImage && !CFSetContainsValue(countedFrames, cgImage)) {
+            CFSetAddValue(countedFrames, cgImage);
+            cost += SDCacheCostForCGImage(cgImage);
+        }
+    }
+    CFRelease(countedFrames);
+    return cost;
+}
+
+// The totals and limits of the whole cache, shared by its segments. Atomic, so a store checks them without taking the lock of every segment
+typedef struct {
+    _Atomic(NSUInteger) cost;
+    _Atomic(NSUInteger) count;
+    _Atomic(NSUInteger) costLimit; // NSUIntegerMax means no limit
+    _Atomic(NSUInteger) countLimit; // NSUIntegerMax means no limit
+} SDMemoryCacheTotals;
+
+static inline BOOL SDMemoryCacheTotalsExceedCost(SDMemoryCacheTotals *totals) {
+    return atomic_load(&totals->cost) > atomic_load(&totals->costLimit);
+}
+
+static inline BOOL SDMemoryCacheTotalsExceedCount(SDMemoryCacheTotals *totals) {
+    return atomic_load(&totals->count) > atomic_load(&totals->countLimit);
+}
+
+// A node of the LRU list. The list does not retain its nodes, the map does
+@interface SDMemoryCacheNode : NSObject {
+    @package
+    __unsafe_unretained SDMemoryCacheNode *_prev;
+    __unsafe_unretained SDMemoryCacheNode *_next;
+    id _key;
+    id _value;
+    NSUInteger _cost;
+    CFAbsoluteTime _time;
+}
+@end
+
+@implementation SDMemoryCacheNode
+@end
+
+// A memory warning within this many seconds of the previous one is critical
+static const CFTimeInterval kSDMemoryCacheCriticalWarningInterval = 10;
+
+// The count-min sketch of the TinyLFU policy: rows of saturating counters, indexed by differently seeded hashes of the key
+static const NSUInteger kSDMemoryCacheSketchDepth = 4;
+static const NSUInteger kSDMemoryCacheSketchWidth = 2048; // a power of 2
+static const uint8_t kSDMemoryCacheSketchMaxCount = 15;
+// All counters are halved after this many increments, so the frequencies follow the recent accesses
+static const NSUInteger kSDMemoryCacheSketchSampleSize = 10 * kSDMemoryCacheSketchWidth;
+static const uint64_t kSDMemoryCacheSketchSeeds[kSDMemoryCacheSketchDepth] = {0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL, 0x27d4eb2f165667c5ULL};
+
+static inline NSUInteger SDMemoryCacheSketchIndex(NSUInteger hash, NSUInteger row) {
+    uint64_t h = ((uint64_t)hash ^ kSDMemoryCacheSketchSeeds[row]) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return row * kSDMemoryCacheSketchWidth + (NSUInteger)(h & (kSDMemoryCacheSketchWidth - 1));
+}
+
+// One independently locked part of the cache: a map, an LRU list and a weak table
+@interface SDMemoryCacheSegment : NSObject {
+    @package
+    dispatch_semaphore_t _lock; // a lock to keep the access to all the fields below thread-safe
+    CFMutableDictionaryRef _map; // key -> node
+    SDMemoryCacheNode *_head; // most recently used
+    SDMemoryCacheNode *_tail; // least recently used
+    NSUInteger _totalCost;
+    NSUInteger _totalCount;
+    SDMemoryCacheTotals *_totals; // owned by the cache
+    NSUInteger _costSlice; // the share of the cost limit this segment trims to first when the cache is over it, 0 means no limit
+    NSUInteger _countSlice; // the share of the count limit this segment trims to first when the cache is over it, 0 means no limit
+    NSMapTable *_weakCache; // strong-weak cache
+    uint8_t *_sketch; // only with the TinyLFU policy, otherwise NULL
+    NSUInteger _sketchIncrements;
+    NSMutableSet *_pressureTrimmedKeys; // the keys released by the last pressure trim, which were not stored again yet
+    NSUInteger _redecodedCost;
+    void (^_removalBlock)(id key);
+}
+@end
+
+@implementation SDMemoryCacheSegment
+
+- (void)dealloc {
+    CFRelease(_map);
+    free(_sketch);
+}
+
+- (instancetype)initWithTotals:(SDMemoryCacheTotals *)totals {
+    self = [super init];
+    if (self) {
+        _totals = totals;
+        _lock = dispatch_semaphore_create(1);
+        // Retain keys without copying them, like NSCache
+        _map = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+        // Use a strong-weak maptable storing the secondary cache.
+        // This is useful when the memory warning, the cache was purged. However, the image instance can be retained by other instance such as imageViews and alive.
+        // At this case, we can sync weak cache back and do not need to load from disk cache
+        _weakCache = [[NSMapTable alloc] initWithKeyOptions:NSPointerFunctionsStrongMemory valueOptions:NSPointerFunctionsWeakMemory capacity:0];
+        _pressureTrimmedKeys = [NSMutableSet set];
+    }
+    return self;
+}
+
+#pragma mark LRU list
+
+// Make sure to hold `_lock`
+- (void)_insertNodeAtHead:(SDMemoryCacheNode *)node {
+    node->_prev = nil;
+    node->_next = _head;
+    if (_head) {
+        _head->_prev = node;
+    }
+    _head = node;
+    if (!_tail) {
+        _tail = node;
+    }
+}
+
+// Make sure to hold `_lock`
+- (void)_unlinkNode:(SDMemoryCacheNode *)node {
+    if (node->_prev) {
+        node->_prev->_next = node->_next;
+    } else {
+        _head = node->_next;
+    }
+    if (node->_next) {
+        node->_next->_prev = node->_prev;
+    } else {
+        _tail = node->_prev;
+    }
+    node->_prev = nil;
+    node->_next = nil;
+}
+
+// Make sure to hold `_lock`
+- (void)_bringNodeToHead:(SDMemoryCacheNode *)node {
+    if (_head == node) {
+        return;
+    }
+    [self _unlinkNode:node];
+    [self _insertNodeAtHead:node];
+}
+
+// Make sure to hold `_lock`. Return the node, so the caller releases it (and its value) after unlocking
+- (SDMemoryCacheNode *)_removeNode:(SDMemoryCacheNode *)node {
+    [self _unlinkNode:node];
+    _totalCost -= node->_cost;
+    _totalCount -= 1;
+    atomic_fetch_sub(&_totals->cost, node->_cost);
+    atomic_fetch_sub(&_totals->count, 1);
+    CFDictionaryRemoveValue(_map, (__bridge const void *)node->_key);
+    if (_removalBlock) {
+        _removalBlock(node->_key);
+    }
+    return node;
+}
+
+// Make sure to hold `_lock`. Evicted nodes are added to the array, to be released after unlocking
+- (void)_trimToCost:(NSUInteger)cost count:(NSUInteger)count evictedNodes:(NSMutableArray *)evictedNodes {
+    while (_tail && (_totalCost > cost || _totalCount > count)) {
+        [evictedNodes addObject:[self _removeNode:_tail]];
+    }
+}
+
+// Make sure to hold `_lock`. Evict while the whole cache is over a limit and this segment holds more than its slice of it. The head is kept if asked, it is the object just stored
+- (void)_trimToSlicesKeepingHead:(BOOL)keepingHead evictedNodes:(NSMutableArray *)evictedNodes {
+    while (_tail && !(keepingHead && _tail == _head)) {
+        BOOL overCost = _costSlice > 0 && _totalCost > _costSlice && SDMemoryCacheTotalsExceedCost(_totals);
+        BOOL overCount = _countSlice > 0 && _totalCount > _countSlice && SDMemoryCacheTotalsExceedCount(_totals);
+        if (!overCost && !overCount) {
+            break;
+        }
+        [evictedNodes addObject:[self _removeNode:_tail]];
+    }
+}
+
+- (void)setRemovalBlock:(void (^)(id key))removalBlock {
+    LOCK(_lock);
+    _removalBlock = removalBlock;
+    UNLOCK(_lock);
+}
+
+#pragma mark TinyLFU
+
+- (void)setAdmissionPolicy:(SDMemoryCacheAdmissionPolicy)admissionPolicy {
+    LOCK(_lock);
+    if (admissionPolicy == SDMemoryCacheAdmissionPolicyTinyLFU && !_sketch) {
+        _sketch = calloc(kSDMemoryCacheSketchDepth * kSDMemoryCacheSketchWidth, sizeof(uint8_t));
+        _sketchIncrements = 0;
+    } else if (admissionPolicy == SDMemoryCacheAdmissionPolicyLRU && _sketch) {
+        free(_sketch);
+        _sketch = NULL;
+    }
+    UNLOCK(_lock);
+}
+
+// Make sure to hold `_lock`
+- (void)_recordAccessForKey:(nonnull id)key {
+    if (!_sketch) {
+        return;
+    }
+    NSUInteger hash = [key hash];
+    for (NSUInteger row = 0; row < kSDMemoryCacheSketchDepth; row++) {
+        uint8_t *counter = &_sketch[SDMemoryCacheSketchIndex(hash, row)];
+        if (*counter < kSDMemoryCacheSketchMaxCount) {
+            *counter += 1;
+        }
+    }
+    _sketchIncrements += 1;
+    if (_sketchIncrements >= kSDMemoryCacheSketchSampleSize) {
+        for (NSUInteger i = 0; i < kSDMemoryCacheSketchDepth * kSDMemoryCacheSketchWidth; i++) {
+            _sketch[i] >>= 1;
+        }
+        _sketchIncrements /= 2;
+    }
+}
+
+// Make sure to hold `_lock`. The estimated number of recent accesses, which may be over but never under the real one
+- (uint8_t)_frequencyForKey:(nonnull id)key {
+    NSUInteger hash = [key hash];
+    uint8_t frequency = kSDMemoryCacheSketchMaxCount;
+    for (NSUInteger row = 0; row < kSDMemoryCacheSketchDepth; row++) {
+        frequency = MIN(frequency, _sketch[SDMemoryCacheSketchIndex(hash, row)]);
+    }
+    return frequency;
+}
+
+// Make sure to hold `_lock`. Whether a new entry may take the place of the least recently used one. Always YES when it fits without evicting
+- (BOOL)_shouldAdmitKey:(nonnull id)key cost:(NSUInteger)g {
+    if (!_sketch || !_tail) {
+        return YES;
+    }
+    BOOL exceedsCost = _costSlice > 0 && _totalCost + g > _costSlice;
+    BOOL exceedsCount = _countSlice > 0 && _totalCount + 1 > _countSlice;
+    if (!exceedsCost && !exceedsCount) {
+        return YES;
+    }
+    // A tie keeps the resident entry, so a scan of keys seen once does not flush the cache
+    return [self _frequencyForKey:key] > [self _frequencyForKey:_tail->_key];
+}
+
+#pragma mark Store
+
+// Make sure to hold `_lock`
+- (void)_setObject:(nonnull id)obj forKey:(nonnull id)key cost:(NSUInteger)g evictedNodes:(NSMutableArray *)evictedNodes {
+    [self _recordAccessForKey:key];
+    SDMemoryCacheNode *node = (__bridge SDMemoryCacheNode *)CFDictionaryGetValue(_map, (__bridge const void *)key);
+    if (!node && ![self _shouldAdmitKey:key cost:g]) {
+        // Rejected, only the weak cache keeps track of it
+        return;
+    }
+    if (node) {
+        // Keep the previous value alive until the lock is released
+        [evictedNodes addObject:node->_value];
+        _totalCost = _totalCost - node->_cost + g;
+        atomic_fetch_add(&_totals->cost, g);
+        atomic_fetch_sub(&_totals->cost, node->_cost);
+        [self _bringNodeToHead:node];
+    } else {
+        node = [SDMemoryCacheNode new];
+        node->_key = key;
+        CFDictionarySetValue(_map, (__bridge const void *)key, (__bridge const void *)node);
+        [self _insertNodeAtHead:node];
+        _totalCost += g;
+        _totalCount += 1;
+        atomic_fetch_add(&_totals->cost, g);
+        atomic_fetch_add(&_totals->count, 1);
+    }
+    node->_value = obj;
+    node->_cost = g;
+    node->_time = CFAbsoluteTimeGetCurrent();
+    // The writing segment gives back its excess first, under the lock it already holds
+    [self _trimToSlicesKeepingHead:YES evictedNodes:evictedNodes];
+}
+
+#pragma mark Access
+
+// `didStore` is set when the object came back from the weak cache and was stored again
+- (id)objectForKey:(id)key didStore:(BOOL *)didStore {
+    NSMutableArray *evictedNodes = nil;
+    LOCK(_lock);
+    SDMemoryCacheNode *node = (__bridge SDMemoryCacheNode *)CFDictionaryGetValue(_map, (__bridge const void *)key);
+    id obj = nil;
+    // Misses count too: a key requested again and again is worth admitting once it is stored
+    [self _recordAccessForKey:key];
+    if (node) {
+        node->_time = CFAbsoluteTimeGetCurrent();
+        [self _bringNodeToHead:node];
+        obj = node->_value;
+    } else {
+        // Check weak cache
+        obj = [_weakCache objectForKey:key];
+        if (obj) {
+            // Sync cache
+            NSUInteger cost = 0;
+            if ([obj isKindOfClass:[UIImage class]]) {
+                cost = SDCacheCostForImage(obj);
+            }
+            evictedNodes = [NSMutableArray array];
+            [self _setObject:obj forKey:key cost:cost evictedNodes:evictedNodes];
+            *didStore = YES;
+        }
+    }
+    UNLOCK(_lock);
+    return obj;
+}
+
+- (void)setObject:(id)obj forKey:(id)key cost:(NSUInteger)g {
+    NSMutableArray *evictedNodes = [NSMutableArray array];
+    LOCK(_lock);
+    // Stored again from outside (not from the weak cache), so it was decoded again
+    if (_pressureTrimmedKeys.count > 0 && [_pressureTrimmedKeys containsObject:key]) {
+        [_pressureTrimmedKeys removeObject:key];
+        _redecodedCost += g;
+    }
+    [self _setObject:obj forKey:key cost:g evictedNodes:evictedNodes];
+    // Store weak cache
+    [_weakCache setObject:obj forKey:key];
+    UNLOCK(_lock);
+}
+
+- (void)removeObjectForKey:(id)key {
+    LOCK(_lock);
+    SDMemoryCacheNode *node = (__bridge SDMemoryCacheNode *)CFDictionaryGetValue(_map, (__bridge const void *)key);
+    if (node) {
+        node = [self _removeNode:node];
+    }
+    // Remove weak cache
+    [_weakCache removeObjectForKey:key];
+    UNLOCK(_lock);
+    // The node is released here, outside of the lock
+    node = nil;
+}
+
+- (void)removeAllObjectsIncludingWeakCache:(BOOL)includingWeakCache {
+    NSMutableArray *evictedNodes = [NSMutableArray array];
+    LOCK(_lock);
+    [self _trimToCost:0 count:0 evictedNodes:evictedNodes];
+    if (includingWeakCache) {
+        [_weakCache removeAllObjects];
+        [_pressureTrimmedKeys removeAllObjects];
+    }
+    UNLOCK(_lock);
+}
+
+- (void)removeObjectsPassingTest:(BOOL (^)(id key))predicate {
+    NSMutableArray *evictedNodes = [NSMutableArray array];
+    LOCK(_lock);
+    SDMemoryCacheNode *node = _head;
+    while (node) {
+        SDMemoryCacheNode *next = node->_next;
+        if (predicate(node->_key)) {
+            [evictedNodes addObject:[self _removeNode:node]];
+        }
+        node = next;
+    }
+    NSMutableArray *weakKeys = [NSMutableArray array];
+    for (id key in _weakCache) {
+        if (predicate(key)) {
+            [weakKeys addObject:key];
+        }
+    }
+    for (id key in weakKeys) {
+        [_weakCache removeObjectForKey:key];
+    }
+    UNLOCK(_lock);
+}
+
+// Return the released cost
+- (NSUInteger)trimForPressureLevel:(SDMemoryCachePressureLevel)level {
+    NSMutableArray *evictedNodes = [NSMutableArray array];
+    LOCK(_lock);
+    NSUInteger previousCost = _totalCost;
+    if (level == SDMemoryCachePressureLevelCritical) {
+        [self _trimToCost:0 count:0 evictedNodes:evictedNodes];
+    } else if (_totalCost > 0) {
+        [self _trimToCost:_totalCost / 2 count:NSUIntegerMax evictedNodes:evictedNodes];
+    } else {
+        // No cost recorded, halve the count instead
+        [self _trimToCost:NSUIntegerMax count:_totalCount / 2 evictedNodes:evictedNodes];
+    }
+    [_pressureTrimmedKeys removeAllObjects];
+    for (SDMemoryCacheNode *node in evictedNodes) {
+        [_pressureTrimmedKeys addObject:node->_key];
+    }
+    NSUInteger releasedCost = previousCost - _totalCost;
+    UNLOCK(_lock);
+    return releasedCost;
+}
+
+- (NSUInteger)redecodedCost {
+    LOCK(_lock);
+    NSUInteger redecodedCost = _redecodedCost;
+    UNLOCK(_lock);
+    return redecodedCost;
+}
+
+- (void)setCostSlice:(NSUInteger)costSlice countSlice:(NSUInteger)countSlice {
+    NSMutableArray *evictedNodes = [NSMutableArray array];
+    LOCK(_lock);
+    _costSlice = costSlice;
+    _countSlice = countSlice;
+    [self _trimToSlicesKeepingHead:NO evictedNodes:evictedNodes];
+    UNLOCK(_lock);
+}
+
+- (void)trimToSlices {
+    NSMutableArray *evictedNodes = [NSMutableArray array];
+    LOCK(_lock);
+    [self _trimToSlicesKeepingHead:NO evictedNodes:evictedNodes];
+    UNLOCK(_lock);
+}
+
+- (void)trimToCost:(NSUInteger)cost count:(NSUInteger)count {
+    NSMutableArray *evictedNodes = [NSMutableArray array];
+    LOCK(_lock);
+    [self _trimToCost:cost count:count evictedNodes:evictedNodes];
+    UNLOCK(_lock);
+}
+
+- (void)trimToTime:(CFAbsoluteTime)time {
+    NSMutableArray *evictedNodes = [NSMutableArray array];
+    LOCK(_lock);
+    // The list is in use order, so the stale nodes are all at the tail
+    while (_tail && _tail->_time <= time) {
+        [evictedNodes addObject:[self _removeNode:_tail]];
+    }
+    UNLOCK(_lock);
+}
+
+// Return NO if the segment is empty
+- (BOOL)getTailTime:(CFAbsoluteTime *)tailTime {
+    LOCK(_lock);
+    BOOL hasTail = _tail != nil;
+    if (hasTail) {
+        *tailTime = _tail->_time;
+    }
+    UNLOCK(_lock);
+    return hasTail;
+}
+
+// The tail is only removed if it was not used after the given time, another thread may have used it meanwhile
+- (void)removeTailNotUsedSince:(CFAbsoluteTime)time {
+    SDMemoryCacheNode *node = nil;
+    LOCK(_lock);
+    if (_tail && _tail->_time <= time) {
+        node = [self _removeNode:_tail];
+    }
+    UNLOCK(_lock);
+    // The node is released here, outside of the lock
+    node = nil;
+}
+
+@end
+
+// The share of a limit for one of `count` segments. The remainder goes to the first segments, and a limit never slices down to 0, which means no limit
+static inline NSUInteger SDMemoryCacheLimitSlice(NSUInteger limit, NSUInteger index, NSUInteger count) {
+    if (limit == 0 || limit == NSUIntegerMax) {
+        return limit;
+    }
+    NSUInteger slice = limit / count + (index < limit % count ? 1 : 0);
+    return MAX(slice, 1);
+}
+
+@interface SDMemoryCache ()
+
+@property (nonatomic, copy, nonnull) NSArray<SDMemoryCacheSegment *> *segments;
+@property (nonatomic, strong, nonnull) dispatch_semaphore_t limitsLock; // a lock to keep the access to the limits thread-safe
+@property (nonatomic, strong, nonnull) dispatch_semaphore_t pressureLock; // a lock to keep the access to the pressure trim statistics thread-safe
+@property (nonatomic, assign) CFAbsoluteTime lastMemoryWarningTime;
+@property (nonatomic, assign, readwrite) NSUInteger pressureTrimCount;
+@property (nonatomic, assign, readwrite) NSUInteger lastPressureTrimReleasedCost;
+@property (nonatomic, assign, readwrite) NSUInteger pressureTrimReleasedCost;
+
+@end
+
+@implementation SDMemoryCache {
+    NSUInteger _totalCostLimit;
+    NSUInteger _countLimit;
+    SDMemoryCacheAdmissionPolicy _admissionPolicy;
+    void (^_removalBlock)(id key);
+    SDMemoryCacheTotals *_totals;
+}
+
+- (void)dealloc {
+#if SD_UIKIT
+    [[NSNotificationCenter defaultCenter] removeObserver:self name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+#endif
+    free(_totals);
+}
+
+- (instancetype)init {
+    return [self initWithSegmentCount:1];
+}
+
+- (instancetype)initWithSegmentCount:(NSUInteger)segmentCount {
+    self = [super init];
+    if (self) {
+        _totals = calloc(1, sizeof(SDMemoryCacheTotals));
+        atomic_init(&_totals->cost, 0);
+        atomic_init(&_totals->count, 0);
+        atomic_init(&_totals->costLimit, NSUIntegerMax);
+        atomic_init(&_totals->countLimit, NSUIntegerMax);
+        NSMutableArray<SDMemoryCacheSegment *> *segments = [NSMutableArray arrayWithCapacity:MAX(segmentCount, 1)];
+        for (NSUInteger i = 0; i < MAX(segmentCount, 1); i++) {
+            [segments addObject:[[SDMemoryCacheSegment alloc] initWithTotals:_totals]];
+        }
+        _segments = [segments copy];
+        _limitsLock = dispatch_semaphore_create(1);
+        _pressureLock = dispatch_semaphore_create(1);
+        _shouldTrimOnMemoryWarning = YES;
+#if SD_UIKIT
+        [[NSNotificationCenter defaultCenter] addObserver:self
+                                                 selector:@selector(didReceiveMemoryWarning:)
+                                                     name:UIApplicationDidReceiveMemoryWarningNotification
+                                                   object:nil];
+#endif
+    }
+    return self;
+}
+
+#if SD_UIKIT
+- (void)didReceiveMemoryWarning:(NSNotification *)notification {
+    if (!self.shouldTrimOnMemoryWarning) {
+        return;
+    }
+    // The first warning trims half, a second one soon after means the first was not enough
+    LOCK(self.pressureLock);
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    BOOL critical = self.lastMemoryWarningTime > 0 && now - self.lastMemoryWarningTime < kSDMemoryCacheCriticalWarningInterval;
+    self.lastMemoryWarningTime = now;
+    UNLOCK(self.pressureLock);
+    [self trimForMemoryPressureLevel:critical ? SDMemoryCachePressureLevelCritical : SDMemoryCachePressureLevelModerate];
+}
+#endif
+
+#pragma mark - Memory pressure
+
+- (NSUInteger)trimForMemoryPressureLevel:(SDMemoryCachePressureLevel)level {
+    NSUInteger releasedCost = 0;
+    // The weak cache is kept, so the images still shown come back without a decode
+    for (SDMemoryCacheSegment *segment in self.segments) {
+        releasedCost += [segment trimForPressureLevel:level];
+    }
+    LOCK(self.pressureLock);
+    self.pressureTrimCount += 1;
+    self.lastPressureTrimReleasedCost = releasedCost;
+    self.pressureTrimReleasedCost += releasedCost;
+    UNLOCK(self.pressureLock);
+    return releasedCost;
+}
+
+- (NSUInteger)pressureTrimRedecodedCost {
+    NSUInteger redecodedCost = 0;
+    for (SDMemoryCacheSegment *segment in self.segments) {
+        redecodedCost += [segment redecodedCost];
+    }
+    return redecodedCost;
+}
+
+- (NSUInteger)segmentCount {
+    return self.segments.count;
+}
+
+- (SDMemoryCacheSegment *)segmentForKey:(id)key {
+    NSArray<SDMemoryCacheSegment *> *segments = self.segments;
+    if (segments.count == 1) {
+        return segments[0];
+    }
+    // Mix the high bits in, some `hash` implementations leave the low bits poorly distributed
+    NSUInteger hash = [key hash];
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3b;
+    hash ^= hash >> 16;
+    return segments[hash % segments.count];
+}
+
+#pragma mark - Limits
+
+- (SDMemoryCacheAdmissionPolicy)admissionPolicy {
+    LOCK(self.limitsLock);
+    SDMemoryCacheAdmissionPolicy admissionPolicy = _admissionPolicy;
+    UNLOCK(self.limitsLock);
+    return admissionPolicy;
+}
+
+- (void)setAdmissionPolicy:(SDMemoryCacheAdmissionPolicy)admissionPolicy {
+    LOCK(self.limitsLock);
+    _admissionPolicy = admissionPolicy;
+    for (SDMemoryCacheSegment *segment in self.segments) {
+        [segment setAdmissionPolicy:admissionPolicy];
+    }
+    UNLOCK(self.limitsLock);
+}
+
+- (void (^)(id))removalBlock {
+    LOCK(self.limitsLock);
+    void (^removalBlock)(id key) = _removalBlock;
+    UNLOCK(self.limitsLock);
+    return removalBlock;
+}
+
+- (void)setRemovalBlock:(void (^)(id))removalBlock {
+    LOCK(self.limitsLock);
+    _removalBlock = [removalBlock copy];
+    for (SDMemoryCacheSegment *segment in self.segments) {
+        [segment setRemovalBlock:_removalBlock];
+    }
+    UNLOCK(self.limitsLock);
+}
+
+- (NSUInteger)totalCostLimit {
+    LOCK(self.limitsLock);
+    NSUInteger totalCostLimit = _totalCostLimit;
+    UNLOCK(self.limitsLock);
+    return totalCostLimit;
+}
+
+- (void)setTotalCostLimit:(NSUInteger)totalCostLimit {
+    LOCK(self.limitsLock);
+    _totalCostLimit = totalCostLimit;
+    [self _applyLimits];
+    UNLOCK(self.limitsLock);
+    [self _trimSegmentsToLimitsPreferringSegment:nil];
+}
+
+- (NSUInteger)countLimit {
+    LOCK(self.limitsLock);
+    NSUInteger countLimit = _countLimit;
+    UNLOCK(self.limitsLock);
+    return countLimit;
+}
+
+- (void)setCountLimit:(NSUInteger)countLimit {
+    LOCK(self.limitsLock);
+    _countLimit = countLimit;
+    [self _applyLimits];
+    UNLOCK(self.limitsLock);
+    [self _trimSegmentsToLimitsPreferringSegment:nil];
+}
+
+// Make sure to hold `limitsLock`
+- (void)_applyLimits {
+    NSArray<SDMemoryCacheSegment *> *segments = self.segments;
+    NSUInteger totalCostLimit = _totalCostLimit;
+    NSUInteger countLimit = _countLimit;
+    atomic_store(&_totals->costLimit, totalCostLimit > 0 ? totalCostLimit : NSUIntegerMax);
+    atomic_store(&_totals->countLimit, countLimit > 0 ? countLimit : NSUIntegerMax);
+    // Each segment gets its own slice of the limits, to which it trims first. An object costing more than a slice still fits while the whole cache is within the limits
+    [segments enumerateObjectsUsingBlock:^(SDMemoryCacheSegment * _Nonnull segment, NSUInteger idx, BOOL * _Nonnull stop) {
+        [segment setCostSlice:SDMemoryCacheLimitSlice(totalCostLimit, idx, segments.count)
+                   countSlice:SDMemoryCacheLimitSlice(countLimit, idx, segments.count)];
+    }];
+}
+
+// The segment which has just stored is trimmed by itself under its lock, see `_trimToSlicesKeepingHead:evictedNodes:`. Only when that is not enough, such as for a large object or a limit smaller than the segment count, are the other segments locked
+- (void)_trimSegmentsToLimitsPreferringSegment:(SDMemoryCacheSegment *)preferredSegment {
+    if (!SDMemoryCacheTotalsExceedCost(_totals) && !SDMemoryCacheTotalsExceedCount(_totals)) {
+        return;
+    }
+    for (SDMemoryCacheSegment *segment in self.segments) {
+        if (segment != preferredSegment) {
+            [segment trimToSlices];
+        }
+        if (!SDMemoryCacheTotalsExceedCost(_totals) && !SDMemoryCacheTotalsExceedCount(_totals)) {
+            return;
+        }
+    }
+    // Still over, as the slices round up or the new object is large: evict the least recently used objects of the whole cache
+    [self _trimSegmentsToCost:atomic_load(&_totals->costLimit) count:atomic_load(&_totals->countLimit)];
+}
+
+// Evict the least recently used tail among the segments, one at a time, until the totals of the whole cache are within the given cost and count
+- (void)_trimSegmentsToCost:(NSUInteger)cost count:(NSUInteger)count {
+    NSArray<SDMemoryCacheSegment *> *segments = self.segments;
+    while (atomic_load(&_totals->cost) > cost || atomic_load(&_totals->count) > count) {
+        SDMemoryCacheSegment *oldestSegment = nil;
+        CFAbsoluteTime oldestTime = 0;
+        for (SDMemoryCacheSegment *segment in segments) {
+            CFAbsoluteTime tailTime = 0;
+            if ([segment getTailTime:&tailTime] && (!oldestSegment || tailTime < oldestTime)) {
+                oldestSegment = segment;
+                oldestTime = tailTime;
+            }
+        }
+        if (!oldestSegment) {
+            break;
+        }
+        [oldestSegment removeTailNotUsedSince:oldestTime];
+    }
+}
+
+- (NSUInteger)totalCost {
+    return atomic_load(&_totals->cost);
+}
+
+- (NSUInteger)totalCount {
+    return atomic_load(&_totals->count);
+}
+
+#pragma mark - Access
+
+- (id)objectForKey:(id)key {
+    if (!key) {
+        return nil;
+    }
+    BOOL didStore = NO;
+    SDMemoryCacheSegment *segment = [self segmentForKey:key];
+    id obj = [segment objectForKey:key didStore:&didStore];
+    if (didStore) {
+        [self _trimSegmentsToLimitsPreferringSegment:segment];
+    }
+    return obj;
+}
+
+- (void)setObject:(id)obj forKey:(id)key {
+    [self setObject:obj forKey:key cost:0];
+}
+
+- (void)setObject:(id)obj forKey:(id)key cost:(NSUInteger)g {
+    if (!key) {
+        return;
+    }
+    if (!obj) {
+        [self removeObjectForKey:key];
+        return;
+    }
+    SDMemoryCacheSegment *segment = [self segmentForKey:key];
+    [segment setObject:obj forKey:key cost:g];
+    [self _trimSegmentsToLimitsPreferringSegment:segment];
+}
+
+- (void)removeObjectForKey:(id)key {
+    if (!key) {
+        return;
+    }
+    [[self segmentForKey:key] removeObjectForKey:key];
+}
+
+- (void)removeAllObjects {
+    // Manually remove should also remove weak cache
+    for (SDMemoryCacheSegment *segment in self.segments) {
+        [segment removeAllObjectsIncludingWeakCache:YES];
+    }
+}
+
+- (void)removeObjectsPassingTest:(BOOL (^)(id key))predicate {
+    for (SDMemoryCacheSegment *segment in self.segments) {
+        [segment removeObjectsPassingTest:predicate];
+    }
+}
+
+#pragma mark - Trim
+
+- (void)trimToCost:(NSUInteger)cost {
+    if (self.segments.count == 1) {
+        [self.segments[0] trimToCost:cost count:NSUIntegerMax];
+        return;
+    }
+    [self _trimSegmentsToCost:cost count:NSUIntegerMax];
+}
+
+- (void)trimToCount:(NSUInteger)count {
+    if (self.segments.count == 1) {
+        [self.segments[0] trimToCost:NSUIntegerMax count:count];
+        return;
+    }
+    [self _trimSegmentsToCost:NSUIntegerMax count:count];
+}
+
+- (void)trimToAge:(NSTimeInterval)age {
+    CFAbsoluteTime time = CFAbsoluteTimeGetCurrent() - age;
+    for (SDMemoryCacheSegment *segment in self.segments) {
+        [segment trimToTime:time];
+    }
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@: %p> %@ (%lu objects, cost %lu, %lu segments)", self.class, self, self.name, (unsigned long)self.totalCount, (unsigned long)self.totalCost, (unsigned long)self.segmentCount];
+}
+
+@end
@@ -10,6 +10,7 @@
 #import <Foundation/Foundation.h>
 #import "SDWebImageCompat.h"
 #import "SDWebImageOperation.h"
+#import "SDWebImageDownloaderConcurrencyController.h"
 //下载选项设置的一系列枚举
 typedef NS_OPTIONS(NSUInteger, SDWebImageDownloaderOptions) {
     /**
@@ -61,6 +62,18 @@ typedef NS_OPTIONS(NSUInteger, SDWebImageDownloaderOptions) {
      * Scale down the image
      */
     SDWebImageDownloaderScaleDownLargeImages = 1 << 8,
+
+    /**
+     * Write the received data to a file in `downloadDirectory` instead of memory, so the memory used does not grow with the image.
+     * The data passed to the completion block is mapped from that file, which is `SDWebImageDownloadToken.downloadedFilePath`.
+     * `SDWebImageDownloaderProgressiveDownload` is ignored with this option.
+     */
+    SDWebImageDownloaderStreamToFile = 1 << 9,
+
+    /**
+     * Put the download below the low priority, with `SDWebImageDownloaderPriorityPrefetch`, for images which may be shown later. Ignored with `SDWebImageDownloaderHighPriority`.
+     */
+    SDWebImageDownloaderPrefetchPriority = 1 << 10,
 };
 //下载图片时的顺序，FIFO或者LIFO
 typedef NS_ENUM(NSInteger, SDWebImageDownloaderExecutionOrder) {
@@ -74,6 +87,33 @@ typedef NS_ENUM(NSInteger, SDWebImageDownloaderExecutionOrder) {
      */
     SDWebImageDownloaderLIFOExecutionOrder
 };
+
+/**
+ * The priority of a download, which can be changed while it runs with `SDWebImageDownloadToken.priority`.
+ * The downloader always starts the pending download of the highest priority next. A download shared by several tokens runs at the highest priority among them.
+ */
+typedef NS_ENUM(NSInteger, SDWebImageDownloaderPriority) {
+    /**
+     * For images which may be shown later, such as the ones prefetched. The priority of `SDWebImageDownloaderPrefetchPriority`.
+     */
+    SDWebImageDownloaderPriorityPrefetch = NSOperationQueuePriorityVeryLow,
+    /**
+     * The priority of `SDWebImageDownloaderLowPriority`.
+     */
+    SDWebImageDownloaderPriorityLow = NSOperationQueuePriorityLow,
+    /**
+     * Default value.
+     */
+    SDWebImageDownloaderPriorityDefault = NSOperationQueuePriorityNormal,
+    /**
+     * For images about to be shown, such as the ones of the cells just off screen. The priority of `SDWebImageDownloaderHighPriority`.
+     */
+    SDWebImageDownloaderPriorityNearVisible = NSOperationQueuePriorityHigh,
+    /**
+     * For images shown now.
+     */
+    SDWebImageDownloaderPriorityVisible = NSOperationQueuePriorityVeryHigh
+};
 //声明通知的全局变量名
 FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageDownloadStartNotification;
 FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageDownloadStopNotification;
@@ -105,12 +145,59 @@ typedef SDHTTPHeadersDictionary * _Nullable (^SDWebImageDownloaderHeadersFilterB
  @note use `-[SDWebImageDownloadToken cancel]` to cancel the token
  */
 @property (nonatomic, strong, nullable) id downloadOperationCancelToken;
+/**
+ The response of the download, set once it is completed. This is nil if no response was received
+ */
+@property (nonatomic, strong, readonly, nullable) NSURLResponse *response;
+/**
+ The priority of the download for this token, from the options it was created with. Set it to raise or lower the priority while the download is queued or running, for example when its view scrolls on or off screen.
+ The download is not restarted: a queued download moves in the queue, and a running one changes its task priority. With several tokens for the same URL, the download runs at the highest priority among them.
+ */
+@property (nonatomic, assign) SDWebImageDownloaderPriority priority;
+/**
+ The file the data was written to with `SDWebImageDownloaderStreamToFile`, set once the download succeeded.
+ The file is removed once the tokens of the download are released, unless it was moved away before, for example into the disk cache with `-[SDImageCache storeImage:imageFileAtPath:forKey:completion:]`
+ */
+@property (nonatomic, copy, readonly, nullable) NSString *downloadedFilePath;
+
+@end
+
+/**
+ * A snapshot of the downloads of one host, see `-[SDWebImageDownloader statisticsForHost:]`.
+ */
+@interface SDWebImageDownloaderHostStatistics : NSObject
+
+/**
+ * The host, lowercased.
+ */
+@property (nonatomic, copy, readonly, nonnull) NSString *host;
+/**
+ * The number of downloads started and not finished.
+ */
+@property (nonatomic, assign, readonly) NSUInteger inFlightCount;
+/**
+ * The number of downloads waiting for a free slot, or for the budget of the host.
+ */
+@property (nonatomic, assign, readonly) NSUInteger queuedCount;
+/**
+ * The number of downloads finished, including the failed ones.
+ */
+@property (nonatomic, assign, readonly) NSUInteger completedCount;
+/**
+ * The moving average of the time to first byte, in seconds. 0 before the first response.
+ */
+@property (nonatomic, assign, readonly) NSTimeInterval averageLatency;
+/**
+ * The budget of the host: the maximum number of its downloads in flight. 0 means no limit.
+ */
+@property (nonatomic, assign, readonly) NSInteger maxConcurrentDownloads;
 
 @end
 
 
 /**
  * Asynchronous downloader dedicated and optimized for image loading.
+ * Downloads wait in the downloader until a slot is free, one list per host. The next download started is the one of the highest priority; between hosts with downloads of the same priority, the hosts take turns. A host which reached its budget is skipped, so a slow host can not hold all the slots.
  //异步下载图片
  */
 @interface SDWebImageDownloader : NSObject
@@ -124,10 +211,23 @@ typedef SDHTTPHeadersDictionary * _Nullable (^SDWebImageDownloaderHeadersFilterB
 
 /**
  *  The maximum number of concurrent downloads
+ *  @note While `concurrencyController` is set, its window replaces this value after each download.
  //支持的最大同时下载图片的数量，其实就是NSOperationQueue支持的最大并发数
  */
 @property (assign, nonatomic) NSInteger maxConcurrentDownloads;
 
+/**
+ * Sizes `maxConcurrentDownloads` from the throughput and the time to first byte of the downloads, within its bounds. Every download is reported to it.
+ * Defaults to nil, for a fixed `maxConcurrentDownloads` of 6.
+ */
+@property (strong, nonatomic, nullable) SDWebImageDownloaderConcurrencyController *concurrencyController;
+
+/**
+ * The maximum number of downloads in flight for one host, unless the host has its own budget set with `setMaxConcurrentDownloads:forHost:`.
+ * Defaults to 0, no limit other than `maxConcurrentDownloads`.
+ */
+@property (assign, nonatomic) NSInteger maxConcurrentDownloadsPerHost;
+
 /**
  * Shows the current amount of downloads that still need to be downloaded
  //当前正在下载图片的数量，其实就是NSOperationQueue的operationCount即正在执行下载任务的operation的数量
@@ -140,6 +240,12 @@ typedef SDHTTPHeadersDictionary * _Nullable (^SDWebImageDownloaderHeadersFilterB
  */
 @property (assign, nonatomic) NSTimeInterval downloadTimeout;
 
+/**
+ * The directory the downloads with `SDWebImageDownloaderStreamToFile` are written to. `SDWebImageManager` sets it to the `temporaryDirectoryPath` of its cache if it is nil, so the cache takes the files over with a rename.
+ * Defaults to nil, for a directory in `NSTemporaryDirectory()`.
+ */
+@property (copy, nonatomic, nullable) NSString *downloadDirectory;
+
 /**
  * The configuration in use by the internal NSURLSession.
  * Mutating this object directly has no effect.
@@ -257,6 +363,25 @@ typedef SDHTTPHeadersDictionary * _Nullable (^SDWebImageDownloaderHeadersFilterB
                                                   progress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
                                                  completed:(nullable SDWebImageDownloaderCompletedBlock)completedBlock;
 
+/**
+ * Creates a SDWebImageDownloader async downloader instance with a given URL and extra header fields for this request only.
+ * This is how conditional requests are sent: with `If-None-Match` or `If-Modified-Since` set, a `304 Not Modified` response completes with a nil image, nil data and no error.
+ *
+ * @param url            The URL to the image to download
+ * @param options        The options to be used for this download
+ * @param HTTPHeaders    The header fields added to the request, after `headersFilter` is applied. They are ignored if a download for the same URL is already running
+ * @param progressBlock  A block called repeatedly while the image is downloading
+ *                       @note the progress block is executed on a background queue
+ * @param completedBlock A block called once the download is completed, see `downloadImageWithURL:options:progress:completed:`
+ *
+ * @return A token (SDWebImageDownloadToken) that can be passed to -cancel: to cancel this operation
+ */
+- (nullable SDWebImageDownloadToken *)downloadImageWithURL:(nullable NSURL *)url
+                                                   options:(SDWebImageDownloaderOptions)options
+                                               HTTPHeaders:(nullable SDHTTPHeadersDictionary *)HTTPHeaders
+                                                  progress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
+                                                 completed:(nullable SDWebImageDownloaderCompletedBlock)completedBlock;
+
 /**
  * Cancels a download that was previously queued using -downloadImageWithURL:options:progress:completed:
  *
@@ -265,6 +390,30 @@ typedef SDHTTPHeadersDictionary * _Nullable (^SDWebImageDownloaderHeadersFilterB
  */
 - (void)cancel:(nullable SDWebImageDownloadToken *)token;
 
+/**
+ * Set the budget of a host: the maximum number of its downloads in flight.
+ *
+ * @param maxConcurrentDownloads The budget. 0 reverts to `maxConcurrentDownloadsPerHost`
+ * @param host                   The host of the image URLs, such as `images.example.com`
+ */
+- (void)setMaxConcurrentDownloads:(NSInteger)maxConcurrentDownloads forHost:(nonnull NSString *)host;
+
+/**
+ * The budget of a host, its own or `maxConcurrentDownloadsPerHost`. 0 means no limit.
+ */
+- (NSInteger)maxConcurrentDownloadsForHost:(nonnull NSString *)host;
+
+/**
+ * The statistics of a host, or nil if it has no download queued or in flight and no budget of its own.
+ * A host is forgotten with its counts once it is idle, so that the hosts of a long prefetch do not pile up.
+ */
+- (nullable SDWebImageDownloaderHostStatistics *)statisticsForHost:(nonnull NSString *)host;
+
+/**
+ * The statistics of all the hosts with downloads queued or in flight, or a budget of their own.
+ */
+- (nonnull NSArray<SDWebImageDownloaderHostStatistics *> *)hostStatistics;
+
 /**
  * Sets the download queue suspension state
  //设置下载队列NSOperationQueue挂起
@@ -12,15 +12,50 @@
 #define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
 #define UNLOCK(lock) dispatch_semaphore_signal(lock);
 
+// The weight of a new sample in `averageLatency`
+static const double kSDHostLatencySmoothing = 0.2;
+
+@interface SDWebImageDownloader (SDWebImageDownloadToken)
+
+// Changes the priority of the token's handlers and moves a waiting operation to its new place
+- (void)setPriority:(SDWebImageDownloaderPriority)priority forToken:(nonnull SDWebImageDownloadToken *)token;
+
+@end
+
 @interface SDWebImageDownloadToken ()
 
 @property (nonatomic, weak, nullable) NSOperation<SDWebImageDownloaderOperationInterface> *downloadOperation;
+// The downloader the token is cancelled through, so that it can release a download which was not started yet
+@property (nonatomic, weak, nullable) SDWebImageDownloader *downloader;
+// The key of the operation in `URLOperations`, the URL unless the request is conditional
+@property (nonatomic, copy, nullable) id<NSCopying> operationKey;
+@property (nonatomic, strong, readwrite, nullable) NSURLResponse *response;
+@property (nonatomic, copy, readwrite, nullable) NSString *downloadedFilePath;
+@property (nonatomic, strong, nullable) id downloadedFileOwner; // the operation, which removes the file when it is deallocated
 
 @end
 
 @implementation SDWebImageDownloadToken
 
+- (void)setPriority:(SDWebImageDownloaderPriority)priority {
+    _priority = priority;
+    SDWebImageDownloader *downloader = self.downloader;
+    if (downloader) {
+        [downloader setPriority:priority forToken:self];
+        return;
+    }
+    NSOperation<SDWebImageDownloaderOperationInterface> *downloadOperation = self.downloadOperation;
+    if ([downloadOperation respondsToSelector:@selector(setPriority:forToken:)]) {
+        [downloadOperation setPriority:priority forToken:self.downloadOperationCancelToken];
+    }
+}
+
 - (void)cancel {
+    SDWebImageDownloader *downloader = self.downloader;
+    if (downloader) {
+        [downloader cancel:self];
+        return;
+    }
     if (self.downloadOperation) {
         SDWebImageDownloadToken *cancelToken = self.downloadOperationCancelToken;
         if (cancelToken) {
@@ -31,21 +66,67 @@
 
 @end
 
+@interface SDWebImageDownloaderHostStatistics ()
+
+@property (nonatomic, copy, readwrite, nonnull) NSString *host;
+@property (nonatomic, assign, readwrite) NSUInteger inFlightCount;
+@property (nonatomic, assign, readwrite) NSUInteger queuedCount;
+@property (nonatomic, assign, readwrite) NSUInteger completedCount;
+@property (nonatomic, assign, readwrite) NSTimeInterval averageLatency;
+@property (nonatomic, assign, readwrite) NSInteger maxConcurrentDownloads;
+
+@end
+
+@implementation SDWebImageDownloaderHostStatistics
+
+@end
+
+// The downloads of one host. Guarded by `operationsLock`
+@interface SDWebImageDownloaderHost : NSObject
+
+@property (nonatomic, copy, nonnull) NSString *name;
+// Created and not started yet, the highest priority first. Equal priorities are in `executionOrder` at the time they were added
+@property (nonatomic, strong, nonnull) NSMutableArray<NSOperation<SDWebImageDownloaderOperationInterface> *> *pendingOperations;
+@property (nonatomic, assign) NSUInteger inFlightCount;
+@property (nonatomic, assign) NSUInteger completedCount;
+@property (nonatomic, assign) NSTimeInterval averageLatency;
+// The budget set for this host, 0 if none
+@property (nonatomic, assign) NSInteger maxConcurrentDownloads;
+
+@end
+
+@implementation SDWebImageDownloaderHost
+
+- (instancetype)initWithName:(NSString *)name {
+    if ((self = [super init])) {
+        _name = [name copy];
+        _pendingOperations = [NSMutableArray new];
+    }
+    return self;
+}
+
+@end
+
 //遵守NSURLSessionTaskDelegate和NSURLSessionDataDelegate协议
 @interface SDWebImageDownloader () <NSURLSessionTaskDelegate, NSURLSessionDataDelegate>
 
 //定义一个NSOperationQueue的下载队列
 @property (strong, nonatomic, nonnull) NSOperationQueue *downloadQueue;
-//最近一次添加进队列的operation主要用于LIFO时设置依赖
-@property (weak, nonatomic, nullable) NSOperation *lastAddedOperation;
+// The downloads by host, and the order the hosts take turns in
+@property (strong, nonatomic, nonnull) NSMutableDictionary<NSString *, SDWebImageDownloaderHost *> *hosts;
+@property (strong, nonatomic, nonnull) NSMutableArray<SDWebImageDownloaderHost *> *hostRotation;
+// The host after the one which got the last slot
+@property (assign, nonatomic) NSUInteger hostRotationIndex;
+// The operations added to `downloadQueue` and not finished yet
+@property (assign, nonatomic) NSUInteger admittedCount;
 //operationClass默认是SDWebImageDownloaderOperation
 @property (assign, nonatomic, nullable) Class operationClass;
-//可变字典，key是图片的URL，value是对应的下载任务Operation
-@property (strong, nonatomic, nonnull) NSMutableDictionary<NSURL *, SDWebImageDownloaderOperation *> *URLOperations;
+//可变字典，key是图片的URL，value是对应的下载任务Operation。条件请求的key还包含验证首部
+@property (strong, nonatomic, nonnull) NSMutableDictionary<id<NSCopying>, SDWebImageDownloaderOperation *> *URLOperations;
 //<NSString*, NSString*>类型的字典，存储http首部
 @property (strong, nonatomic, nullable) SDHTTPHeadersMutableDictionary *HTTPHeaders;
 //一个GCD的队列 @property (SDDispatchQueueSetterSementics, nonatomic, nullable) dispatch_queue_t barrierQueue;
-@property (strong, nonatomic, nonnull) dispatch_semaphore_t operationsLock; // a lock to keep the access to `URLOperations` thread-safe
+@property (strong, nonatomic, nonnull) dispatch_semaphore_t operationsLock; // a lock to keep the access to `URLOperations` and the hosts thread-safe
 @property (strong, nonatomic, nonnull) dispatch_semaphore_t headersLock; // a lock to keep the access to `HTTPHeaders` thread-safe
 
 // The session in which data tasks will run//NSURLSession对象
@@ -107,6 +188,8 @@
         _downloadQueue.name = @"com.hackemist.SDWebImageDownloader";
         //设置下载webp格式图片的http首部
         _URLOperations = [NSMutableDictionary new];
+        _hosts = [NSMutableDictionary new];
+        _hostRotation = [NSMutableArray new];
 #ifdef SD_WEBP
         _HTTPHeaders = [@{@"Accept": @"image/webp,image/*;q=0.8"} mutableCopy];
 #else
@@ -146,6 +229,10 @@
     if (self == [SDWebImageDownloader sharedDownloader]) {
         return;
     }
+    // The waiting operations can not create a task in the invalidated session, they are finished now
+    LOCK(self.operationsLock);
+    [self cancelPendingOperations];
+    UNLOCK(self.operationsLock);
     if (cancelPendingOperations) {
         [self.session invalidateAndCancel];
     } else {
@@ -157,6 +244,9 @@
     [self.session invalidateAndCancel];
     self.session = nil;
  //NSOperationQueue取消所有的下载操作
+    for (SDWebImageDownloaderHost *host in _hostRotation) {
+        [host.pendingOperations makeObjectsPerformSelector:@selector(cancel)];
+    }
     [self.downloadQueue cancelAllOperations];
 }
 //为http首部设置键值对
@@ -185,11 +275,23 @@
 }
 //设置最大同时下载图片的数量，即NSOperationQueue最大并发数
 - (void)setMaxConcurrentDownloads:(NSInteger)maxConcurrentDownloads {
+    LOCK(self.operationsLock);
     _downloadQueue.maxConcurrentOperationCount = maxConcurrentDownloads;
+    [self startPendingOperations];
+    UNLOCK(self.operationsLock);
 }
-//当前正在下载图片数量，即NSOperationQueue中正在执行的operation数量
+- (void)setConcurrencyController:(SDWebImageDownloaderConcurrencyController *)concurrencyController {
+    _concurrencyController = concurrencyController;
+    if (concurrencyController) {
+        self.maxConcurrentDownloads = concurrencyController.window;
+    }
+}
+//当前正在下载图片数量，包括等待空位的
 - (NSUInteger)currentDownloadCount {
-    return _downloadQueue.operationCount;
+    LOCK(self.operationsLock);
+    NSUInteger count = _downloadQueue.operationCount + [self pendingOperationCount];
+    UNLOCK(self.operationsLock);
+    return count;
 }
 //获取最大同时下载图片的数量
 - (NSInteger)maxConcurrentDownloads {
@@ -212,10 +314,18 @@
                                                    options:(SDWebImageDownloaderOptions)options
                                                   progress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
                                                  completed:(nullable SDWebImageDownloaderCompletedBlock)completedBlock {
+    return [self downloadImageWithURL:url options:options HTTPHeaders:nil progress:progressBlock completed:completedBlock];
+}
+
+- (nullable SDWebImageDownloadToken *)downloadImageWithURL:(nullable NSURL *)url
+                                                   options:(SDWebImageDownloaderOptions)options
+                                               HTTPHeaders:(nullable SDHTTPHeadersDictionary *)HTTPHeaders
+                                                  progress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
+                                                 completed:(nullable SDWebImageDownloaderCompletedBlock)completedBlock {
     __weak SDWebImageDownloader *wself = self;
 
     //直接调用另一个方法，后面大片的block代码目的就是为了创建一个SDWebImageDownloaderOperation类的对象
-    return [self addProgressCallback:progressBlock completedBlock:completedBlock forURL:url createCallback:^SDWebImageDownloaderOperation *{
+    SDWebImageDownloadToken *token = [self addProgressCallback:progressBlock completedBlock:completedBlock forURL:url operationKey:[self operationKeyForURL:url HTTPHeaders:HTTPHeaders] createCallback:^SDWebImageDownloaderOperation *{
         //block中为了防止引用循环和空指针，先weak后strong
         __strong __typeof (wself) sself = wself;
         //设置超时时间
@@ -240,6 +350,9 @@
         else {
             request.allHTTPHeaderFields = [sself allHTTPHeaderFields];
         }
+        [HTTPHeaders enumerateKeysAndObjectsUsingBlock:^(NSString *field, NSString *value, BOOL *stop) {
+            [request setValue:value forHTTPHeaderField:field];
+        }];
         //创建一个SDWebImageDownloaderOperation类的对象
         //传入request、session和下载选项配置options
         SDWebImageDownloaderOperation *operation = [[sself.operationClass alloc] initWithRequest:request inSession:sself.session options:options];
@@ -254,34 +367,73 @@
         //设置下载优先级
         if (options & SDWebImageDownloaderHighPriority) {
             operation.queuePriority = NSOperationQueuePriorityHigh;
+        } else if (options & SDWebImageDownloaderPrefetchPriority) {
+            operation.queuePriority = NSOperationQueuePriorityVeryLow;
         } else if (options & SDWebImageDownloaderLowPriority) {
             operation.queuePriority = NSOperationQueuePriorityLow;
         }
-      //如果是LIFO就设置一个依赖
-        if (sself.executionOrder == SDWebImageDownloaderLIFOExecutionOrder) {
-            // Emulate LIFO execution order by systematically adding new operations as last operation's dependency
-            [sself.lastAddedOperation addDependency:operation];
-            sself.lastAddedOperation = operation;
+        if ((options & SDWebImageDownloaderStreamToFile) && [operation respondsToSelector:@selector(setDownloadFilePath:)]) {
+            NSString *directory = sself.downloadDirectory ?: [NSTemporaryDirectory() stringByAppendingPathComponent:@"com.hackemist.SDWebImageDownloader"];
+            operation.downloadFilePath = [directory stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
         }
-
         return operation;
     }];
+    // A download already running for the URL is raised to this priority if it is higher
+    if (options & SDWebImageDownloaderHighPriority) {
+        token.priority = SDWebImageDownloaderPriorityNearVisible;
+    } else if (options & SDWebImageDownloaderPrefetchPriority) {
+        token.priority = SDWebImageDownloaderPriorityPrefetch;
+    } else if (options & SDWebImageDownloaderLowPriority) {
+        token.priority = SDWebImageDownloaderPriorityLow;
+    } else {
+        token.priority = SDWebImageDownloaderPriorityDefault;
+    }
+    return token;
+}
+
+// A conditional request can be answered by a 304 without any image, so it is only shared with callers which sent the same validators
+- (nullable id<NSCopying>)operationKeyForURL:(nullable NSURL *)url HTTPHeaders:(nullable SDHTTPHeadersDictionary *)HTTPHeaders {
+    NSString *eTag = nil;
+    NSString *lastModified = nil;
+    for (NSString *field in HTTPHeaders) {
+        if ([field caseInsensitiveCompare:@"If-None-Match"] == NSOrderedSame) {
+            eTag = HTTPHeaders[field];
+        } else if ([field caseInsensitiveCompare:@"If-Modified-Since"] == NSOrderedSame) {
+            lastModified = HTTPHeaders[field];
+        }
+    }
+    if (!url || (!eTag && !lastModified)) {
+        return url;
+    }
+    return [NSString stringWithFormat:@"%@\nIf-None-Match: %@\nIf-Modified-Since: %@", url.absoluteString, eTag ?: @"", lastModified ?: @""];
 }
+
 //取消一个下载任务，需要传入上一个方法返回的token，其实具体的token是由下一个方法创建的
 - (void)cancel:(nullable SDWebImageDownloadToken *)token {
     NSURL *url = token.url;
     if (!url) {
         return;
     }
+    id<NSCopying> operationKey = token.operationKey ?: url;
     LOCK(self.operationsLock);
-    //通过token的url获取到这个Operation
-    SDWebImageDownloaderOperation *operation = [self.URLOperations objectForKey:url];
+    //通过token获取到这个Operation，同一个URL的字典中可能已经是新的Operation
+    NSOperation<SDWebImageDownloaderOperationInterface> *operation = token.downloadOperation ?: [self.URLOperations objectForKey:operationKey];
     if (operation) {
         //调用Operation自定义的cancel方法来取消任务，传入一个回调块字典的token
         BOOL canceled = [operation cancel:token.downloadOperationCancelToken];
+        SDWebImageDownloaderHost *host = self.hosts[url.host.lowercaseString ?: @""];
         //如果取消了就从字典中移除掉这个键值对
         if (canceled) {
-            [self.URLOperations removeObjectForKey:url];
+            if ([self.URLOperations objectForKey:operationKey] == operation) {
+                [self.URLOperations removeObjectForKey:operationKey];
+            }
+            // A waiting operation is started to finish it
+            if (host && [host.pendingOperations indexOfObjectIdenticalTo:operation] != NSNotFound) {
+                [self admitOperation:operation ofHost:host];
+            }
+        } else {
+            // The remaining handlers may have a lower priority
+            [self repositionPendingOperation:operation ofHost:host];
         }
     }
     UNLOCK(self.operationsLock);
@@ -294,6 +446,14 @@
                                            completedBlock:(SDWebImageDownloaderCompletedBlock)completedBlock
                                                    forURL:(nullable NSURL *)url
                                            createCallback:(SDWebImageDownloaderOperation *(^)(void))createCallback {
+    return [self addProgressCallback:progressBlock completedBlock:completedBlock forURL:url operationKey:url createCallback:createCallback];
+}
+
+- (nullable SDWebImageDownloadToken *)addProgressCallback:(SDWebImageDownloaderProgressBlock)progressBlock
+                                           completedBlock:(SDWebImageDownloaderCompletedBlock)completedBlock
+                                                   forURL:(nullable NSURL *)url
+                                             operationKey:(nullable id<NSCopying>)operationKey
+                                           createCallback:(SDWebImageDownloaderOperation *(^)(void))createCallback {
     // The URL will be used as the key to the callbacks dictionary so it cannot be nil. If it is nil immediately call the completed block with no image or data.
     //URL为nil就调用下载完成回调块，返回nil
     if (url == nil) {
@@ -303,37 +463,63 @@
         return nil;
     }
     
+    operationKey = operationKey ?: url;
     LOCK(self.operationsLock);
     //通过URL获取Operation
-    SDWebImageDownloaderOperation *operation = [self.URLOperations objectForKey:url];
-    if (!operation) {
+    SDWebImageDownloaderOperation *operation = [self.URLOperations objectForKey:operationKey];
+    // A cancelled or finished operation takes no more handlers, its completion may not have removed it yet
+    if (!operation || operation.isCancelled || operation.isFinished) {
         //如果URL对应的Operation不存在就调用，createCallback块创建一个
         operation = createCallback();
+        SDWebImageDownloaderHost *host = [self hostForName:url.host];
         __weak typeof(self) wself = self;
+        __weak typeof(operation) woperation = operation;
         operation.completionBlock = ^{
             __strong typeof(wself) sself = wself;
             if (!sself) {
                 return;
             }
             LOCK(sself.operationsLock);
-            //下载完成就从字典中删除
-            [sself.URLOperations removeObjectForKey:url];
+            //下载完成就从字典中删除，除非已经被同一个URL的新Operation替换
+            if ([sself.URLOperations objectForKey:operationKey] == woperation) {
+                [sself.URLOperations removeObjectForKey:operationKey];
+            }
+            [sself operation:woperation didFinishForHost:host];
             UNLOCK(sself.operationsLock);
         };
         //添加进字典中
-        [self.URLOperations setObject:operation forKey:url];
+        [self.URLOperations setObject:operation forKey:operationKey];
         // Add operation to operation queue only after all configuration done according to Apple's doc.
         // `addOperation:` does not synchronously execute the `operation.completionBlock` so this will not cause deadlock.
-        [self.downloadQueue addOperation:operation];
+        [self enqueuePendingOperation:operation ofHost:host];
+        [self startPendingOperations];
     }
     UNLOCK(self.operationsLock);
 
+    SDWebImageDownloadToken *token = [SDWebImageDownloadToken new];
+    SDWebImageDownloaderCompletedBlock tokenCompletedBlock = completedBlock;
+    if (completedBlock) {
+        // Keep the response on the token, the operation may be gone by the time the completion runs on the main queue.
+        // The block retains the operation until the operation drops its callbacks when it is done or cancelled
+        __weak typeof(token) wtoken = token;
+        tokenCompletedBlock = ^(UIImage *image, NSData *data, NSError *error, BOOL finished) {
+            if (finished && [operation respondsToSelector:@selector(response)]) {
+                wtoken.response = operation.response;
+            }
+            if (finished && data && !error && [operation respondsToSelector:@selector(downloadFilePath)] && operation.downloadFilePath) {
+                wtoken.downloadedFilePath = operation.downloadFilePath;
+                wtoken.downloadedFileOwner = operation;
+            }
+            completedBlock(image, data, error, finished);
+        };
+    }
     //取消下载任务时的token，第一个值就是url，第二个值就是回调块字典
-    id downloadOperationCancelToken = [operation addHandlersForProgress:progressBlock completed:completedBlock];
+    id downloadOperationCancelToken = [operation addHandlersForProgress:progressBlock completed:tokenCompletedBlock];
     
-    SDWebImageDownloadToken *token = [SDWebImageDownloadToken new];
     token.downloadOperation = operation;
+    token.downloader = self;
     token.url = url;
+    token.operationKey = operationKey;
     token.downloadOperationCancelToken = downloadOperationCancelToken;
 
     return token;
@@ -344,9 +530,219 @@
 }
 //取消所有的下载任务
 - (void)cancelAllDownloads {
+    LOCK(self.operationsLock);
+    [self cancelPendingOperations];
+    UNLOCK(self.operationsLock);
     [self.downloadQueue cancelAllOperations];
 }
 
+#pragma mark Hosts
+
+- (void)setMaxConcurrentDownloadsPerHost:(NSInteger)maxConcurrentDownloadsPerHost {
+    LOCK(self.operationsLock);
+    _maxConcurrentDownloadsPerHost = maxConcurrentDownloadsPerHost;
+    [self startPendingOperations];
+    UNLOCK(self.operationsLock);
+}
+
+- (void)setMaxConcurrentDownloads:(NSInteger)maxConcurrentDownloads forHost:(nonnull NSString *)host {
+    LOCK(self.operationsLock);
+    SDWebImageDownloaderHost *downloaderHost = [self hostForName:host];
+    downloaderHost.maxConcurrentDownloads = MAX(maxConcurrentDownloads, 0);
+    [self startPendingOperations];
+    [self forgetHostIfIdle:downloaderHost];
+    UNLOCK(self.operationsLock);
+}
+
+- (NSInteger)maxConcurrentDownloadsForHost:(nonnull NSString *)host {
+    LOCK(self.operationsLock);
+    NSInteger maxConcurrentDownloads = [self budgetOfHost:self.hosts[host.lowercaseString]];
+    UNLOCK(self.operationsLock);
+    return maxConcurrentDownloads;
+}
+
+- (nullable SDWebImageDownloaderHostStatistics *)statisticsForHost:(nonnull NSString *)host {
+    LOCK(self.operationsLock);
+    SDWebImageDownloaderHost *downloaderHost = self.hosts[host.lowercaseString];
+    SDWebImageDownloaderHostStatistics *statistics = downloaderHost ? [self statisticsOfHost:downloaderHost] : nil;
+    UNLOCK(self.operationsLock);
+    return statistics;
+}
+
+- (nonnull NSArray<SDWebImageDownloaderHostStatistics *> *)hostStatistics {
+    LOCK(self.operationsLock);
+    NSMutableArray<SDWebImageDownloaderHostStatistics *> *hostStatistics = [NSMutableArray arrayWithCapacity:self.hostRotation.count];
+    for (SDWebImageDownloaderHost *host in self.hostRotation) {
+        [hostStatistics addObject:[self statisticsOfHost:host]];
+    }
+    UNLOCK(self.operationsLock);
+    return [hostStatistics copy];
+}
+
+// Make sure to call with `operationsLock` held
+- (nonnull SDWebImageDownloaderHostStatistics *)statisticsOfHost:(nonnull SDWebImageDownloaderHost *)host {
+    SDWebImageDownloaderHostStatistics *statistics = [SDWebImageDownloaderHostStatistics new];
+    statistics.host = host.name;
+    statistics.inFlightCount = host.inFlightCount;
+    statistics.queuedCount = host.pendingOperations.count;
+    statistics.completedCount = host.completedCount;
+    statistics.averageLatency = host.averageLatency;
+    statistics.maxConcurrentDownloads = [self budgetOfHost:host];
+    return statistics;
+}
+
+- (void)setPriority:(SDWebImageDownloaderPriority)priority forToken:(nonnull SDWebImageDownloadToken *)token {
+    LOCK(self.operationsLock);
+    NSOperation<SDWebImageDownloaderOperationInterface> *operation = token.downloadOperation;
+    if ([operation respondsToSelector:@selector(setPriority:forToken:)]) {
+        [operation setPriority:priority forToken:token.downloadOperationCancelToken];
+        [self repositionPendingOperation:operation ofHost:self.hosts[token.url.host.lowercaseString ?: @""]];
+    }
+    UNLOCK(self.operationsLock);
+}
+
+// Make sure to call with `operationsLock` held
+- (nonnull SDWebImageDownloaderHost *)hostForName:(nullable NSString *)name {
+    name = name.lowercaseString ?: @"";
+    SDWebImageDownloaderHost *host = self.hosts[name];
+    if (!host) {
+        host = [[SDWebImageDownloaderHost alloc] initWithName:name];
+        self.hosts[name] = host;
+        [self.hostRotation addObject:host];
+    }
+    return host;
+}
+
+// A host with nothing queued or in flight and no budget of its own is dropped, so a long prefetch over many hosts does not go through all of them on every admission
+// Make sure to call with `operationsLock` held
+- (void)forgetHostIfIdle:(nullable SDWebImageDownloaderHost *)host {
+    if (!host || host.inFlightCount > 0 || host.pendingOperations.count > 0 || host.maxConcurrentDownloads > 0 || self.hosts[host.name] != host) {
+        return;
+    }
+    NSUInteger hostIndex = [self.hostRotation indexOfObjectIdenticalTo:host];
+    [self.hosts removeObjectForKey:host.name];
+    [self.hostRotation removeObjectAtIndex:hostIndex];
+    // The host after the removed one keeps its turn
+    if (hostIndex < self.hostRotationIndex) {
+        self.hostRotationIndex -= 1;
+    }
+    if (self.hostRotationIndex >= self.hostRotation.count) {
+        self.hostRotationIndex = 0;
+    }
+}
+
+// Make sure to call with `operationsLock` held
+- (void)enqueuePendingOperation:(nonnull NSOperation<SDWebImageDownloaderOperationInterface> *)operation ofHost:(nonnull SDWebImageDownloaderHost *)host {
+    NSMutableArray<NSOperation<SDWebImageDownloaderOperationInterface> *> *pendingOperations = host.pendingOperations;
+    NSOperationQueuePriority priority = operation.queuePriority;
+    BOOL lifo = self.executionOrder == SDWebImageDownloaderLIFOExecutionOrder;
+    // After the higher priorities, and after (FIFO) or before (LIFO) the equal ones
+    NSUInteger low = 0;
+    NSUInteger high = pendingOperations.count;
+    while (low < high) {
+        NSUInteger middle = low + (high - low) / 2;
+        NSOperationQueuePriority middlePriority = pendingOperations[middle].queuePriority;
+        if (middlePriority > priority || (!lifo && middlePriority == priority)) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    [pendingOperations insertObject:operation atIndex:low];
+}
+
+// Make sure to call with `operationsLock` held
+- (void)repositionPendingOperation:(nonnull NSOperation<SDWebImageDownloaderOperationInterface> *)operation ofHost:(nullable SDWebImageDownloaderHost *)host {
+    NSUInteger index = [host.pendingOperations indexOfObjectIdenticalTo:operation];
+    if (index == NSNotFound) {
+        return;
+    }
+    [host.pendingOperations removeObjectAtIndex:index];
+    [self enqueuePendingOperation:operation ofHost:host];
+}
+
+// Make sure to call with `operationsLock` held
+- (NSInteger)budgetOfHost:(nullable SDWebImageDownloaderHost *)host {
+    return host.maxConcurrentDownloads > 0 ? host.maxConcurrentDownloads : MAX(self.maxConcurrentDownloadsPerHost, 0);
+}
+
+// Make sure to call with `operationsLock` held
+- (NSUInteger)pendingOperationCount {
+    NSUInteger count = 0;
+    for (SDWebImageDownloaderHost *host in self.hostRotation) {
+        count += host.pendingOperations.count;
+    }
+    return count;
+}
+
+// The cancelled operations are started at once, to finish them
+// Make sure to call with `operationsLock` held
+- (void)cancelPendingOperations {
+    for (SDWebImageDownloaderHost *host in [self.hostRotation copy]) {
+        for (NSOperation<SDWebImageDownloaderOperationInterface> *operation in [host.pendingOperations copy]) {
+            [operation cancel];
+            [self admitOperation:operation ofHost:host];
+        }
+    }
+}
+
+// Make sure to call with `operationsLock` held
+- (void)admitOperation:(nonnull NSOperation<SDWebImageDownloaderOperationInterface> *)operation ofHost:(nonnull SDWebImageDownloaderHost *)host {
+    NSUInteger index = [host.pendingOperations indexOfObjectIdenticalTo:operation];
+    if (index != NSNotFound) {
+        [host.pendingOperations removeObjectAtIndex:index];
+    }
+    host.inFlightCount += 1;
+    self.admittedCount += 1;
+    [self.downloadQueue addOperation:operation];
+}
+
+// Make sure to call with `operationsLock` held
+- (void)operation:(nullable NSOperation *)operation didFinishForHost:(nonnull SDWebImageDownloaderHost *)host {
+    host.inFlightCount -= 1;
+    host.completedCount += 1;
+    self.admittedCount -= 1;
+    NSTimeInterval latency = [operation isKindOfClass:[SDWebImageDownloaderOperation class]] ? ((SDWebImageDownloaderOperation *)operation).timeToFirstByte : 0;
+    if (latency > 0) {
+        host.averageLatency = host.averageLatency > 0 ? host.averageLatency + kSDHostLatencySmoothing * (latency - host.averageLatency) : latency;
+    }
+    [self startPendingOperations];
+    [self forgetHostIfIdle:host];
+}
+
+// Fill the free slots of the queue: the highest priority first, the hosts taking turns between equal priorities, the hosts at their budget skipped.
+// The next operation of a host is the first of its sorted pending operations. Cancelled operations are started by whoever cancels them, see `cancel:`
+// Make sure to call with `operationsLock` held
+- (void)startPendingOperations {
+    NSInteger maxConcurrentDownloads = self.downloadQueue.maxConcurrentOperationCount;
+    NSUInteger hostCount = self.hostRotation.count;
+    while (maxConcurrentDownloads < 0 || self.admittedCount < (NSUInteger)maxConcurrentDownloads) {
+        NSOperation<SDWebImageDownloaderOperationInterface> *nextOperation = nil;
+        SDWebImageDownloaderHost *nextHost = nil;
+        NSUInteger nextHostIndex = 0;
+        for (NSUInteger i = 0; i < hostCount; i++) {
+            NSUInteger hostIndex = (self.hostRotationIndex + i) % hostCount;
+            SDWebImageDownloaderHost *host = self.hostRotation[hostIndex];
+            NSInteger budget = [self budgetOfHost:host];
+            if (host.pendingOperations.count == 0 || (budget > 0 && host.inFlightCount >= (NSUInteger)budget)) {
+                continue;
+            }
+            NSOperation<SDWebImageDownloaderOperationInterface> *candidate = host.pendingOperations.firstObject;
+            // An earlier host in the turn keeps the slot on a tie
+            if (!nextOperation || candidate.queuePriority > nextOperation.queuePriority) {
+                nextOperation = candidate;
+                nextHost = host;
+                nextHostIndex = hostIndex;
+            }
+        }
+        if (!nextOperation) {
+            break;
+        }
+        [self admitOperation:nextOperation ofHost:nextHost];
+        self.hostRotationIndex = (nextHostIndex + 1) % hostCount;
+    }
+}
+
 #pragma mark Helper methods
 //通过NSURLSessionTask找到NSOPerationQueue里的任务
 - (SDWebImageDownloaderOperation *)operationWithTask:(NSURLSessionTask *)task {
@@ -413,6 +809,16 @@ didReceiveResponse:(NSURLResponse *)response
     if ([dataOperation respondsToSelector:@selector(URLSession:task:didCompleteWithError:)]) {
         [dataOperation URLSession:session task:task didCompleteWithError:error];
     }
+    
+    SDWebImageDownloaderConcurrencyController *concurrencyController = self.concurrencyController;
+    if (concurrencyController && [dataOperation isKindOfClass:[SDWebImageDownloaderOperation class]]) {
+        [concurrencyController recordDownloadWithReceivedBytes:task.countOfBytesReceived
+                                               timeToFirstByte:dataOperation.timeToFirstByte
+                                                      duration:dataOperation.duration
+                                                         error:error
+                                                 downloadCount:self.currentDownloadCount];
+        self.maxConcurrentDownloads = concurrencyController.window;
+    }
 }
 
 - (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task willPerformHTTPRedirection:(NSHTTPURLResponse *)response newRequest:(NSURLRequest *)request completionHandler:(void (^)(NSURLRequest * _Nullable))completionHandler {
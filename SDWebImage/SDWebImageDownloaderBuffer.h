@@ -0,0 +1,46 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+
+/**
+ * The data received by a download. Appending never moves or changes the bytes received before, so a snapshot of them shares the storage instead of copying it.
+ * The storage is allocated for the expected size of the download, up to 8MB. Data past it moves everything to a storage twice as large, so the bytes copied stay linear in the bytes received.
+ * Append from one queue at a time. The snapshots can be read from any thread.
+ */
+@interface SDWebImageDownloaderBuffer : NSObject
+
+/**
+ * Create a buffer with a storage of the given capacity, the expected size of the download or 0 if it is unknown.
+ */
+- (nonnull instancetype)initWithCapacity:(NSUInteger)capacity NS_DESIGNATED_INITIALIZER;
+
+/**
+ * The number of bytes received.
+ */
+@property (nonatomic, assign, readonly) NSUInteger length;
+
+/**
+ * The number of bytes copied so far: the bytes appended, and the bytes moved when the storage had to grow.
+ */
+@property (nonatomic, assign, readonly) NSUInteger copiedLength;
+
+/**
+ * Append the bytes of the data, which is copied into the storage.
+ *
+ * @return NO if the storage could not be allocated, the data is not appended then
+ */
+- (BOOL)appendData:(nonnull NSData *)data;
+
+/**
+ * An immutable data of the bytes received so far, sharing the storage. The storage lives as long as the buffer or one of its snapshots.
+ */
+- (nonnull NSData *)snapshot;
+
+@end
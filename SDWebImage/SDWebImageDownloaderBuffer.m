@@ -0,0 +1,89 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDWebImageDownloaderBuffer.h"
+
+// The first storage when the expected size is unknown
+static const NSUInteger kSDDownloaderBufferMinimumCapacity = 64 * 1024;
+// The largest first storage. The expected size comes from the server, a bogus one must not allocate more than that before any byte arrives
+static const NSUInteger kSDDownloaderBufferMaximumInitialCapacity = 8 * 1024 * 1024;
+
+@interface SDWebImageDownloaderBuffer ()
+
+@property (nonatomic, assign, readwrite) NSUInteger length;
+@property (nonatomic, assign, readwrite) NSUInteger copiedLength;
+// Never resized, so its bytes stay where the snapshots point to
+@property (nonatomic, strong, nullable) NSMutableData *storage;
+@property (nonatomic, assign) NSUInteger capacity;
+
+@end
+
+@implementation SDWebImageDownloaderBuffer
+
+- (instancetype)init {
+    return [self initWithCapacity:0];
+}
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity {
+    if ((self = [super init])) {
+        // Allocated on the first append
+        _capacity = capacity;
+    }
+    return self;
+}
+
+- (BOOL)appendData:(nonnull NSData *)data {
+    if (data.length == 0) {
+        return YES;
+    }
+    if (data.length > NSUIntegerMax - self.length) {
+        return NO;
+    }
+    NSUInteger length = self.length + data.length;
+    if (!self.storage || length > self.capacity) {
+        NSUInteger capacity;
+        if (self.storage) {
+            capacity = self.capacity <= NSUIntegerMax / 2 ? self.capacity * 2 : NSUIntegerMax;
+        } else {
+            capacity = MIN(MAX(self.capacity, kSDDownloaderBufferMinimumCapacity), kSDDownloaderBufferMaximumInitialCapacity);
+        }
+        capacity = MAX(capacity, length);
+        // The previous storage is left to its snapshots
+        NSMutableData *storage = [NSMutableData dataWithLength:capacity];
+        if (!storage) {
+            return NO;
+        }
+        if (self.length > 0) {
+            memcpy(storage.mutableBytes, self.storage.bytes, self.length);
+            self.copiedLength += self.length;
+        }
+        self.storage = storage;
+        self.capacity = capacity;
+    }
+    uint8_t *bytes = (uint8_t *)self.storage.mutableBytes + self.length;
+    [data enumerateByteRangesUsingBlock:^(const void *rangeBytes, NSRange byteRange, BOOL *stop) {
+        memcpy(bytes + byteRange.location, rangeBytes, byteRange.length);
+    }];
+    self.copiedLength += data.length;
+    self.length = length;
+    return YES;
+}
+
+- (nonnull NSData *)snapshot {
+    NSMutableData *storage = self.storage;
+    if (!storage) {
+        return [NSData data];
+    }
+    // Only the bytes past `length` are written later, the snapshot does not see them
+    return [[NSData alloc] initWithBytesNoCopy:storage.mutableBytes length:self.length deallocator:^(void *bytes, NSUInteger length) {
+        // Keeps the storage
+        (void)storage;
+    }];
+}
+
+@end
@@ -0,0 +1,85 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+
+/**
+ * Sizes the window of concurrent downloads from what the downloads observe, with additive increase and multiplicative decrease (AIMD).
+ * The downloads are counted in rounds of `window` completions. After a round in which the window was full and the aggregate throughput held, the window grows by one.
+ * It is halved on a sign of congestion: a download which timed out or lost its connection, or a time to first byte more than twice the lowest one of the last 8 rounds. It is halved at most once per round.
+ * The lowest time to first byte is taken over the last 8 rounds only, so the controller adapts when the device moves to another network.
+ * Set it as the `concurrencyController` of a `SDWebImageDownloader`, which reports every download and applies the window to its queue.
+ * All methods are thread-safe.
+ */
+@interface SDWebImageDownloaderConcurrencyController : NSObject
+
+/**
+ * Create a controller with a window from 2 to 16.
+ */
+- (nonnull instancetype)init;
+
+/**
+ * Create a controller with the given bounds. The window starts at 6, the former fixed limit, clamped to the bounds.
+ *
+ * @param minimumWindow The smallest window, at least 1
+ * @param maximumWindow The largest window, at least `minimumWindow`
+ */
+- (nonnull instancetype)initWithMinimumWindow:(NSUInteger)minimumWindow maximumWindow:(NSUInteger)maximumWindow NS_DESIGNATED_INITIALIZER;
+
+/**
+ * The smallest window.
+ */
+@property (nonatomic, assign, readonly) NSUInteger minimumWindow;
+
+/**
+ * The largest window.
+ */
+@property (nonatomic, assign, readonly) NSUInteger maximumWindow;
+
+/**
+ * The number of downloads to run at once now.
+ */
+@property (nonatomic, assign, readonly) NSUInteger window;
+
+/**
+ * The aggregate throughput of the last complete round, in bytes per second. 0 before the first round.
+ */
+@property (nonatomic, assign, readonly) double throughput;
+
+/**
+ * The moving average of the time to first byte, in seconds.
+ */
+@property (nonatomic, assign, readonly) NSTimeInterval averageTimeToFirstByte;
+
+/**
+ * The lowest time to first byte of the last 8 rounds, in seconds, used as the latency of an idle network.
+ */
+@property (nonatomic, assign, readonly) NSTimeInterval minimumTimeToFirstByte;
+
+/**
+ * The number of downloads recorded.
+ */
+@property (nonatomic, assign, readonly) NSUInteger sampleCount;
+
+/**
+ * Record a completed download and update the window.
+ *
+ * @param receivedBytes   The bytes received
+ * @param timeToFirstByte The time from the start of the request to the response, 0 if there was no response
+ * @param duration        The time from the start of the request to its end
+ * @param error           The error of the download, if any. Cancelled downloads are ignored
+ * @param downloadCount   The number of downloads queued or running when it completed, itself included. The window only grows when it was the limit
+ */
+- (void)recordDownloadWithReceivedBytes:(int64_t)receivedBytes
+                        timeToFirstByte:(NSTimeInterval)timeToFirstByte
+                               duration:(NSTimeInterval)duration
+                                  error:(nullable NSError *)error
+                          downloadCount:(NSUInteger)downloadCount;
+
+@end
@@ -0,0 +1,197 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDWebImageDownloaderConcurrencyController.h"
+
+#define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
+#define UNLOCK(lock) dispatch_semaphore_signal(lock);
+
+static const NSUInteger kSDDefaultInitialWindow = 6;
+static const NSUInteger kSDDefaultMinimumWindow = 2;
+static const NSUInteger kSDDefaultMaximumWindow = 16;
+// A time to first byte above this multiple of the idle one means the requests queue up somewhere
+static const double kSDLatencyInflationFactor = 2;
+// The window keeps growing while the throughput of a round stays above this share of the previous one
+static const double kSDThroughputHoldRatio = 0.95;
+// The weight of a new sample in `averageTimeToFirstByte`
+static const double kSDTimeToFirstByteSmoothing = 0.2;
+// The number of rounds the idle time to first byte is taken over. Long enough that the window grows past the point where requests queue up before the baseline follows
+#define SD_BASELINE_ROUNDS 8
+
+@interface SDWebImageDownloaderConcurrencyController ()
+
+@property (nonatomic, assign, readwrite) NSUInteger window;
+@property (nonatomic, assign, readwrite) double throughput;
+@property (nonatomic, assign, readwrite) NSTimeInterval averageTimeToFirstByte;
+@property (nonatomic, assign, readwrite) NSUInteger sampleCount;
+@property (nonatomic, strong, nonnull) dispatch_semaphore_t lock;
+
+@end
+
+@implementation SDWebImageDownloaderConcurrencyController {
+    // The round in progress
+    NSUInteger _roundCompletions;
+    int64_t _roundBytes;
+    NSTimeInterval _roundDuration;
+    NSTimeInterval _roundMinimumTimeToFirstByte;
+    BOOL _roundSaturated;
+    BOOL _roundDecreased;
+    // The lowest time to first byte of the previous rounds, a ring
+    NSTimeInterval _previousRoundMinimums[SD_BASELINE_ROUNDS];
+    NSUInteger _previousRoundIndex;
+}
+
+- (instancetype)init {
+    return [self initWithMinimumWindow:kSDDefaultMinimumWindow maximumWindow:kSDDefaultMaximumWindow];
+}
+
+- (instancetype)initWithMinimumWindow:(NSUInteger)minimumWindow maximumWindow:(NSUInteger)maximumWindow {
+    if ((self = [super init])) {
+        _minimumWindow = MAX(minimumWindow, 1);
+        _maximumWindow = MAX(maximumWindow, _minimumWindow);
+        _window = MIN(MAX(kSDDefaultInitialWindow, _minimumWindow), _maximumWindow);
+        _lock = dispatch_semaphore_create(1);
+        _roundSaturated = YES;
+    }
+    return self;
+}
+
+- (NSUInteger)window {
+    LOCK(self.lock);
+    NSUInteger window = _window;
+    UNLOCK(self.lock);
+    return window;
+}
+
+- (double)throughput {
+    LOCK(self.lock);
+    double throughput = _throughput;
+    UNLOCK(self.lock);
+    return throughput;
+}
+
+- (NSTimeInterval)averageTimeToFirstByte {
+    LOCK(self.lock);
+    NSTimeInterval averageTimeToFirstByte = _averageTimeToFirstByte;
+    UNLOCK(self.lock);
+    return averageTimeToFirstByte;
+}
+
+- (NSTimeInterval)minimumTimeToFirstByte {
+    LOCK(self.lock);
+    NSTimeInterval minimumTimeToFirstByte = [self baselineTimeToFirstByte];
+    UNLOCK(self.lock);
+    return minimumTimeToFirstByte;
+}
+
+- (NSUInteger)sampleCount {
+    LOCK(self.lock);
+    NSUInteger sampleCount = _sampleCount;
+    UNLOCK(self.lock);
+    return sampleCount;
+}
+
+- (void)recordDownloadWithReceivedBytes:(int64_t)receivedBytes
+                        timeToFirstByte:(NSTimeInterval)timeToFirstByte
+                               duration:(NSTimeInterval)duration
+                                  error:(nullable NSError *)error
+                          downloadCount:(NSUInteger)downloadCount {
+    if ([error.domain isEqualToString:NSURLErrorDomain] && error.code == NSURLErrorCancelled) {
+        return;
+    }
+    LOCK(self.lock);
+    _sampleCount += 1;
+    if ([self isCongestionError:error]) {
+        [self decreaseWindow];
+        UNLOCK(self.lock);
+        return;
+    }
+    if (timeToFirstByte > 0) {
+        // Compared to the baseline before the sample joins it
+        NSTimeInterval baseline = [self baselineTimeToFirstByte];
+        _averageTimeToFirstByte = _averageTimeToFirstByte > 0 ? _averageTimeToFirstByte + kSDTimeToFirstByteSmoothing * (timeToFirstByte - _averageTimeToFirstByte) : timeToFirstByte;
+        _roundMinimumTimeToFirstByte = _roundMinimumTimeToFirstByte > 0 ? MIN(_roundMinimumTimeToFirstByte, timeToFirstByte) : timeToFirstByte;
+        if (baseline > 0 && timeToFirstByte > baseline * kSDLatencyInflationFactor) {
+            [self decreaseWindow];
+            UNLOCK(self.lock);
+            return;
+        }
+    }
+    if (error) {
+        // Not a network condition, such as a 404
+        UNLOCK(self.lock);
+        return;
+    }
+    _roundCompletions += 1;
+    _roundBytes += MAX(receivedBytes, 0);
+    _roundDuration += MAX(duration, 0);
+    _roundSaturated = _roundSaturated && downloadCount >= _window;
+    if (_roundCompletions >= _window) {
+        [self finishRound];
+    }
+    UNLOCK(self.lock);
+}
+
+#pragma mark - Private
+
+// Make sure to call with `lock` held
+- (NSTimeInterval)baselineTimeToFirstByte {
+    NSTimeInterval baseline = _roundMinimumTimeToFirstByte;
+    for (NSUInteger i = 0; i < SD_BASELINE_ROUNDS; i++) {
+        NSTimeInterval minimum = _previousRoundMinimums[i];
+        if (minimum > 0 && (baseline <= 0 || minimum < baseline)) {
+            baseline = minimum;
+        }
+    }
+    return baseline;
+}
+
+- (BOOL)isCongestionError:(nullable NSError *)error {
+    if (![error.domain isEqualToString:NSURLErrorDomain]) {
+        return NO;
+    }
+    return error.code == NSURLErrorTimedOut || error.code == NSURLErrorNetworkConnectionLost;
+}
+
+// Make sure to call with `lock` held
+- (void)decreaseWindow {
+    if (_roundDecreased) {
+        return;
+    }
+    _window = MAX(_window / 2, _minimumWindow);
+    [self startRound];
+    _roundDecreased = YES;
+}
+
+// Make sure to call with `lock` held
+- (void)finishRound {
+    // `window` downloads ran side by side, so the aggregate rate is the window times the average rate of one
+    double throughput = _roundDuration > 0 ? (double)_roundBytes / (_roundDuration / _roundCompletions) : 0;
+    BOOL held = _throughput <= 0 || throughput >= _throughput * kSDThroughputHoldRatio;
+    if (!_roundDecreased && _roundSaturated && held) {
+        _window = MIN(_window + 1, _maximumWindow);
+    }
+    _throughput = throughput;
+    [self startRound];
+}
+
+// Make sure to call with `lock` held
+- (void)startRound {
+    if (_roundMinimumTimeToFirstByte > 0) {
+        _previousRoundMinimums[_previousRoundIndex] = _roundMinimumTimeToFirstByte;
+        _previousRoundIndex = (_previousRoundIndex + 1) % SD_BASELINE_ROUNDS;
+    }
+    _roundMinimumTimeToFirstByte = 0;
+    _roundCompletions = 0;
+    _roundBytes = 0;
+    _roundDuration = 0;
+    _roundSaturated = YES;
+    _roundDecreased = NO;
+}
+
+@end
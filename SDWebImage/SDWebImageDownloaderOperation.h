@@ -43,6 +43,10 @@ FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageDownloadFinishNotification
 
 - (BOOL)cancel:(nullable id)token;
 
+@optional
+//修改某个回调块token的下载优先级
+- (void)setPriority:(SDWebImageDownloaderPriority)priority forToken:(nullable id)token;
+
 @end
 
 /*
@@ -97,6 +101,27 @@ FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageDownloadFinishNotification
  */
 @property (strong, nonatomic, nullable) NSURLResponse *response;
 
+/**
+ * The priority of the operation: the highest priority among its handlers. It sets `queuePriority`, and the task priority once the operation started.
+ */
+@property (assign, nonatomic, readonly) SDWebImageDownloaderPriority priority;
+
+/**
+ * The time from the start of the task to its response, in seconds. 0 until the response is received.
+ */
+@property (assign, nonatomic, readonly) NSTimeInterval timeToFirstByte;
+
+/**
+ * The time from the start of the task to its completion, in seconds. 0 until the task completes.
+ */
+@property (assign, nonatomic, readonly) NSTimeInterval duration;
+
+/**
+ * The file the data is written to with `SDWebImageDownloaderStreamToFile`, set by the downloader before the operation starts. Without it the data is kept in memory.
+ * The file is removed in the background if the download fails or is cancelled. Once passed to the completion blocks, it is removed when the operation is deallocated if it is still there.
+ */
+@property (copy, nonatomic, nullable) NSString *downloadFilePath;
+
 /**
  *  Initializes a `SDWebImageDownloaderOperation` object
  *
@@ -140,6 +165,14 @@ FOUNDATION_EXPORT NSString * _Nonnull const SDWebImageDownloadFinishNotification
  */
 - (BOOL)cancel:(nullable id)token;
 
+/**
+ *  Changes the priority of a set of handlers. The operation runs at the highest priority among its handlers.
+ *
+ *  @param priority the new priority
+ *  @param token    the token returned by `addHandlersForProgress:completed:`
+ */
+- (void)setPriority:(SDWebImageDownloaderPriority)priority forToken:(nullable id)token;
+
 @end
 /*
  上述头文件声明中定义了一个协议，开发者就可以不使用SDWebImage提供的下载任务类，而可以自定义相关类，只需要遵守协议即可，SDWebImageDownloaderOperation类也遵守了该协议，该类继承自NSOperation主要是为了将任务加进并发队列里实现多线程下载多张图片，真正实现下载操作的是NSURLSessionTask类的子类，
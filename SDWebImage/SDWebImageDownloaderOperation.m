@@ -7,9 +7,12 @@
  */
 
 #import "SDWebImageDownloaderOperation.h"
+#import <fcntl.h>
+#import <unistd.h>
 #import "SDWebImageManager.h"
 #import "NSImage+WebCache.h"
 #import "SDWebImageCodersManager.h"
+#import "SDWebImageDownloaderBuffer.h"
 
 #define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
 #define UNLOCK(lock) dispatch_semaphore_signal(lock);
@@ -29,6 +32,23 @@ NSString *const SDWebImageDownloadFinishNotification = @"SDWebImageDownloadFinis
 //进度回调块和下载完成回调块的字符串类型的key
 static NSString *const kProgressCallbackKey = @"progress";
 static NSString *const kCompletedCallbackKey = @"completed";
+static NSString *const kPriorityKey = @"priority";
+
+static inline SDWebImageDownloaderPriority SDWebImageDownloaderPriorityForOptions(SDWebImageDownloaderOptions options) {
+    if (options & SDWebImageDownloaderHighPriority) {
+        return SDWebImageDownloaderPriorityNearVisible;
+    } else if (options & SDWebImageDownloaderPrefetchPriority) {
+        return SDWebImageDownloaderPriorityPrefetch;
+    } else if (options & SDWebImageDownloaderLowPriority) {
+        return SDWebImageDownloaderPriorityLow;
+    }
+    return SDWebImageDownloaderPriorityDefault;
+}
+
+// From 0 for prefetch to 1 for visible, so the high and low priorities keep NSURLSessionTaskPriorityHigh and NSURLSessionTaskPriorityLow
+static inline float SDWebImageDownloaderTaskPriority(SDWebImageDownloaderPriority priority) {
+    return (float)(priority - SDWebImageDownloaderPriorityPrefetch) / (SDWebImageDownloaderPriorityVisible - SDWebImageDownloaderPriorityPrefetch);
+}
 
 //定义了一个可变字典类型的回调块集合，这个字典key的取值就是上面两个字符串
 typedef NSMutableDictionary<NSString *, id> SDCallbacksDictionary;
@@ -47,7 +67,8 @@ typedef NSMutableDictionary<NSString *, id> SDCallbacksDictionary;
 @property (assign, nonatomic, getter = isExecuting) BOOL executing;
 @property (assign, nonatomic, getter = isFinished) BOOL finished;
 //可变NSData数据，存储下载的图片数据
-@property (strong, nonatomic, nullable) NSMutableData *imageData;
+// Snapshots of it share its storage, so the progressive decoding does not copy what was received each time
+@property (strong, nonatomic, nullable) SDWebImageDownloaderBuffer *imageBuffer;
 //缓存的图片数据
 @property (copy, nonatomic, nullable) NSData *cachedData; // for `SDWebImageDownloaderIgnoreCachedResponse`
 
@@ -64,6 +85,17 @@ typedef NSMutableDictionary<NSString *, id> SDCallbacksDictionary;
 @property (strong, nonatomic, readwrite, nullable) NSURLSessionTask *dataTask;
 
 @property (strong, nonatomic, nonnull) dispatch_semaphore_t callbacksLock; // a lock to keep the access to `callbackBlocks` thread-safe
+@property (assign, nonatomic, readwrite) SDWebImageDownloaderPriority priority; // guarded by `callbacksLock`
+@property (assign, nonatomic) CFAbsoluteTime taskStartTime;
+@property (assign, nonatomic, readwrite) NSTimeInterval timeToFirstByte;
+@property (assign, nonatomic, readwrite) NSTimeInterval duration;
+// The file of `downloadFilePath` opened for writing, -1 until the first data is written. The file is only written, closed and removed on `coderQueue`
+@property (assign, nonatomic) int downloadFileDescriptor;
+@property (assign, nonatomic) NSInteger downloadFileSize; // the bytes received for the file
+// Reported in place of the cancellation of the task once writing to the file failed
+@property (strong, nonatomic, nullable) NSError *downloadFileError;
+// Set on `coderQueue` when the file is passed to the completion blocks, it is theirs to move until the operation is deallocated
+@property (assign, nonatomic) BOOL downloadFileHandedOff;
 
 //解码queue队列
 @property (strong, nonatomic, nonnull) dispatch_queue_t coderQueue; // the queue to do image decoding
@@ -98,12 +130,27 @@ typedef NSMutableDictionary<NSString *, id> SDCallbacksDictionary;
         _executing = NO;
         _finished = NO;
         _expectedSize = 0;
+        _priority = SDWebImageDownloaderPriorityForOptions(options);
         _unownedSession = session;
         _callbacksLock = dispatch_semaphore_create(1);
         _coderQueue = dispatch_queue_create("com.hackemist.SDWebImageDownloaderOperationCoderQueue", DISPATCH_QUEUE_SERIAL);
+        _downloadFileDescriptor = -1;
     }
     return self;
 }
+
+- (void)dealloc {
+    if (_downloadFileDescriptor >= 0) {
+        close(_downloadFileDescriptor);
+    }
+    // Unless it was moved away. The data mapped from it stays readable. The last reference may go on any thread, so do not wait for the file system here
+    if (_downloadFilePath && _downloadFileHandedOff) {
+        NSString *downloadFilePath = _downloadFilePath;
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^{
+            [[NSFileManager defaultManager] removeItemAtPath:downloadFilePath error:nil];
+        });
+    }
+}
 /*
  合成存取了executing和finished属性，接下来就是两个初始化构造函数，进行了相关的初始化操作，注意看，在初始化方法中将传入的session赋给了unownedSession，所以这个session是外部传入的，本类就不需要负责管理它，但是它有可能会被释放，所以当这个session不可用时需要自己创建一个新的session并自行管理，上面还创建了一个并发队列，但这个队列都是以dispatch_barrier_(a)sync函数来执行，所以在这个并发队列上具体的执行方式还是串行，因为队列会被阻塞，在析构函数中释放这个队列
  */
@@ -116,6 +163,8 @@ typedef NSMutableDictionary<NSString *, id> SDCallbacksDictionary;
     if (progressBlock) callbacks[kProgressCallbackKey] = [progressBlock copy];
     //如果下载完成回调块存在就加进字典里，key为@"completed"
     if (completedBlock) callbacks[kCompletedCallbackKey] = [completedBlock copy];
+    //默认优先级来自下载选项
+    callbacks[kPriorityKey] = @(SDWebImageDownloaderPriorityForOptions(self.options));
     //使用dispatch_barrier_async方法异步方式不阻塞当前线程，但阻塞并发对列，串行执行添加进数组的操作
 //    dispatch_barrier_async(self.barrierQueue, ^{
 //        [self.callbackBlocks addObject:callbacks];
@@ -168,14 +217,67 @@ typedef NSMutableDictionary<NSString *, id> SDCallbacksDictionary;
     if (self.callbackBlocks.count == 0) {
         shouldCancel = YES;
     }
+    SDWebImageDownloaderPriority priority = [self highestCallbackPriority];
     UNLOCK(self.callbacksLock);
     
     ////如果要真的要取消任务就调用cancel方法
     if (shouldCancel) {
         [self cancel];
+    } else {
+        // The remaining handlers may want less
+        [self applyPriority:priority];
     }
     return shouldCancel;
 }
+
+- (void)setPriority:(SDWebImageDownloaderPriority)priority forToken:(nullable id)token {
+    if (!token) {
+        return;
+    }
+    LOCK(self.callbacksLock);
+    if ([self.callbackBlocks indexOfObjectIdenticalTo:token] == NSNotFound) {
+        UNLOCK(self.callbacksLock);
+        return;
+    }
+    ((SDCallbacksDictionary *)token)[kPriorityKey] = @(priority);
+    SDWebImageDownloaderPriority operationPriority = [self highestCallbackPriority];
+    UNLOCK(self.callbacksLock);
+    [self applyPriority:operationPriority];
+}
+
+// Make sure to call with `callbacksLock` held
+- (SDWebImageDownloaderPriority)highestCallbackPriority {
+    if (self.callbackBlocks.count == 0) {
+        return self.priority;
+    }
+    SDWebImageDownloaderPriority priority = SDWebImageDownloaderPriorityPrefetch;
+    for (SDCallbacksDictionary *callbacks in self.callbackBlocks) {
+        priority = MAX(priority, [callbacks[kPriorityKey] integerValue]);
+    }
+    return priority;
+}
+
+- (void)applyPriority:(SDWebImageDownloaderPriority)priority {
+    LOCK(self.callbacksLock);
+    BOOL changed = priority != self.priority;
+    self.priority = priority;
+    UNLOCK(self.callbacksLock);
+    if (!changed) {
+        return;
+    }
+    // The next download to start is picked by priority, so a waiting download moves without being restarted
+    self.queuePriority = (NSOperationQueuePriority)priority;
+    NSURLSessionTask *dataTask;
+    @synchronized (self) {
+        dataTask = self.dataTask;
+    }
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunguarded-availability"
+    if ([dataTask respondsToSelector:@selector(setPriority:)]) {
+        dataTask.priority = SDWebImageDownloaderTaskPriority(priority);
+    }
+#pragma clang diagnostic pop
+}
 /*
  上面三个方法主要就是往一个字典类型的数组中添加回调块，这个字典最多只有两个key-value键值对，数组中可以有多个这样的字典，每添加一个进度回调块和下载完成回调块就会把这个字典返回作为token，在取消任务方法中就会从数组中删除掉这个字典，但是只有当数组中的回调块字典全部被删除完了才会真正取消任务。
 */
@@ -262,13 +364,13 @@ typedef NSMutableDictionary<NSString *, id> SDCallbacksDictionary;
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wunguarded-availability"
         if ([self.dataTask respondsToSelector:@selector(setPriority:)]) {
-            if (self.options & SDWebImageDownloaderHighPriority) {
-                self.dataTask.priority = NSURLSessionTaskPriorityHigh;
-            } else if (self.options & SDWebImageDownloaderLowPriority) {
-                self.dataTask.priority = NSURLSessionTaskPriorityLow;
-            }
+            LOCK(self.callbacksLock);
+            SDWebImageDownloaderPriority priority = self.priority;
+            UNLOCK(self.callbacksLock);
+            self.dataTask.priority = SDWebImageDownloaderTaskPriority(priority);
         }
 #pragma clang diagnostic pop
+        self.taskStartTime = CFAbsoluteTimeGetCurrent();
         [self.dataTask resume];//NSURLSessionDataTask任务开始执行
         //遍历所有的进度回调块并执行
         for (SDWebImageDownloaderProgressBlock progressBlock in [self callbacksForKey:kProgressCallbackKey]) {
@@ -352,6 +454,16 @@ typedef NSMutableDictionary<NSString *, id> SDCallbacksDictionary;
     //NSURLSessionDataTask对象置为nil，等待回收
     self.dataTask = nil;
     
+    if (self.downloadFilePath) {
+        // After the writes still queued. A file passed to the completion blocks is kept
+        dispatch_async(self.coderQueue, ^{
+            [self closeDownloadFile];
+            if (!self.downloadFileHandedOff) {
+                [[NSFileManager defaultManager] removeItemAtPath:self.downloadFilePath error:nil];
+            }
+        });
+    }
+    
     //如果ownedSession存在，就需要我们手动调用invalidateAndCancel方法打破引用循环
     if (self.ownedSession) {
         [self.ownedSession invalidateAndCancel];
@@ -390,6 +502,7 @@ didReceiveResponse:(NSURLResponse *)response
     expected = expected > 0 ? expected : 0;
     ////设置长度
     self.expectedSize = expected;
+    self.timeToFirstByte = CFAbsoluteTimeGetCurrent() - self.taskStartTime;
     //将response赋值到成员变量
     self.response = response;
     NSInteger statusCode = [response respondsToSelector:@selector(statusCode)] ? ((NSHTTPURLResponse *)response).statusCode : 200;
@@ -397,7 +510,8 @@ didReceiveResponse:(NSURLResponse *)response
     //'304 Not Modified' is an exceptional one. It should be treated as cancelled if no cache data
     //URLSession current behavior will return 200 status code when the server respond 304 and URLCache hit. But this is not a standard behavior and we just add a check
     //根据http状态码判断是否成功响应，需要注意的是304认为是异常响应
-    if (statusCode == 304 && !self.cachedData) {
+    //A conditional request made by the caller expects it, it means the caller's copy is still valid
+    if (statusCode == 304 && !self.cachedData && !self.isConditionalRequest) {
         valid = NO;
     }
     
@@ -422,15 +536,29 @@ didReceiveResponse:(NSURLResponse *)response
 }
 //收到数据的回调方法，可能执行多次
 - (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveData:(NSData *)data {
-    if (!self.imageData) {
-        self.imageData = [[NSMutableData alloc] initWithCapacity:self.expectedSize];
+    if (self.downloadFilePath) {
+        // Written through, so the memory used does not grow with the image
+        self.downloadFileSize += data.length;
+        dispatch_async(self.coderQueue, ^{
+            if (![self writeDataToDownloadFile:data]) {
+                [dataTask cancel];
+            }
+        });
+    } else {
+        if (!self.imageBuffer) {
+            self.imageBuffer = [[SDWebImageDownloaderBuffer alloc] initWithCapacity:self.expectedSize];
+        }
+        //向可变数据中添加接收到的数据
+        if (![self.imageBuffer appendData:data]) {
+            // Out of memory for the image, fail the download
+            [dataTask cancel];
+            return;
+        }
     }
-    //向可变数据中添加接收到的数据
-    [self.imageData appendData:data];
   //如果下载选项需要支持progressive下载，即展示已经下载的部分，并且响应中返回的图片大小大于0
-    if ((self.options & SDWebImageDownloaderProgressiveDownload) && self.expectedSize > 0) {
-        // Get the image data //复制data数据
-        __block NSData *imageData = [self.imageData copy];
+    if ((self.options & SDWebImageDownloaderProgressiveDownload) && self.expectedSize > 0 && !self.downloadFilePath) {
+        // Get the image data //数据快照，与缓冲区共享存储，不复制
+        __block NSData *imageData = [self.imageBuffer snapshot];
         // Get the total bytes downloaded //获取已经下载了多大的数据
         const NSInteger totalSize = imageData.length;
         // Get the finish status//判断是否已经下载完成
@@ -470,7 +598,7 @@ didReceiveResponse:(NSURLResponse *)response
     }
 //调用进度回调块并触发进度回调块
     for (SDWebImageDownloaderProgressBlock progressBlock in [self callbacksForKey:kProgressCallbackKey]) {
-        progressBlock(self.imageData.length, self.expectedSize, self.request.URL);
+        progressBlock(self.downloadFilePath ? self.downloadFileSize : self.imageBuffer.length, self.expectedSize, self.request.URL);
     }
 }
 //如果要缓存响应时回调该方法
@@ -508,7 +636,17 @@ didReceiveResponse:(NSURLResponse *)response
      一个是Task的线程来执行下载任务
      Operation和Task是一对一的关系，应该不会有竞争条件产生呀？
      */
+    if (self.downloadFilePath) {
+        // Once the queued writes are done. On error, `done` removes the file
+        dispatch_sync(self.coderQueue, ^{
+            [self closeDownloadFile];
+        });
+        if (self.downloadFileError) {
+            error = self.downloadFileError;
+        }
+    }
     @synchronized(self) {
+        self.duration = CFAbsoluteTimeGetCurrent() - self.taskStartTime;
         //置空
         self.dataTask = nil;
         //主线程根据error是否为空发送对应通知
@@ -535,9 +673,13 @@ didReceiveResponse:(NSURLResponse *)response
              *  If you specified to use `NSURLCache`, then the response you get here is what you need.
              //获取不可变data图片数据
              */
-            __block NSData *imageData = [self.imageData copy];
-            //如果下载的图片存在
-            if (imageData) {
+            __block NSData *imageData = self.downloadFilePath ? [self mappedDownloadFileData] : [self.imageBuffer snapshot];
+            NSInteger statusCode = [self.response respondsToSelector:@selector(statusCode)] ? ((NSHTTPURLResponse *)self.response).statusCode : 200;
+            if (statusCode == 304 && self.isConditionalRequest) {
+                // Not modified, call completion block with nil like a matching `SDWebImageDownloaderIgnoreCachedResponse`
+                [self callCompletionBlocksWithImage:nil imageData:nil error:nil finished:YES];
+                [self done];
+            } else if (imageData) {
                 /**  if you specified to only use cached data via `SDWebImageDownloaderIgnoreCachedResponse`,
                  *  then we should check if the cached data is equal to image data
                  //如果下载设置只使用缓存数据就会判断缓存数据与当前获取的数据是否一致，一致就触发完成回调块
@@ -580,6 +722,9 @@ didReceiveResponse:(NSURLResponse *)response
                         if (imageSize.width == 0 || imageSize.height == 0) {
                             [self callCompletionBlocksWithError:[NSError errorWithDomain:SDWebImageErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey : @"Downloaded image has 0 pixels"}]];
                         } else {
+                            if (self.downloadFilePath) {
+                                self.downloadFileHandedOff = YES;
+                            }
                             [self callCompletionBlocksWithImage:image imageData:imageData error:nil finished:YES];
                         }
                         [self done];
@@ -626,6 +771,58 @@ didReceiveResponse:(NSURLResponse *)response
 }
 
 #pragma mark Helper methods
+
+// Make sure to call on `coderQueue`
+- (BOOL)writeDataToDownloadFile:(nonnull NSData *)data {
+    if (self.downloadFileError) {
+        // The task is being cancelled
+        return YES;
+    }
+    if (self.downloadFileDescriptor < 0) {
+        [[NSFileManager defaultManager] createDirectoryAtPath:[self.downloadFilePath stringByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:NULL];
+        self.downloadFileDescriptor = open(self.downloadFilePath.fileSystemRepresentation, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    int fileDescriptor = self.downloadFileDescriptor;
+    __block BOOL written = fileDescriptor >= 0;
+    [data enumerateByteRangesUsingBlock:^(const void *bytes, NSRange byteRange, BOOL *stop) {
+        size_t offset = 0;
+        while (written && offset < byteRange.length) {
+            ssize_t count = write(fileDescriptor, (const char *)bytes + offset, byteRange.length - offset);
+            if (count >= 0) {
+                offset += count;
+            } else if (errno != EINTR) {
+                written = NO;
+            }
+        }
+        *stop = !written;
+    }];
+    if (!written) {
+        // Such as a full disk
+        self.downloadFileError = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{NSLocalizedDescriptionKey : @"Downloaded data can't be written to file"}];
+        return NO;
+    }
+    return YES;
+}
+
+// Make sure to call on `coderQueue`
+- (void)closeDownloadFile {
+    if (_downloadFileDescriptor >= 0) {
+        close(_downloadFileDescriptor);
+        _downloadFileDescriptor = -1;
+    }
+}
+
+- (nullable NSData *)mappedDownloadFileData {
+    if (self.downloadFileSize == 0) {
+        return nil;
+    }
+    // Paged in by the decoder as it reads, and evicted by the system under pressure instead of counting as dirty memory
+    return [NSData dataWithContentsOfFile:self.downloadFilePath options:NSDataReadingMappedAlways error:nil];
+}
+// A revalidation of a cached response, which the server may answer with a 304
+- (BOOL)isConditionalRequest {
+    return [self.request valueForHTTPHeaderField:@"If-None-Match"] || [self.request valueForHTTPHeaderField:@"If-Modified-Since"];
+}
 //不同平台计算图片大小方式不同，图片需要缩放一下，读者可以自行查阅源码，很好理解
 - (nullable UIImage *)scaledImageForKey:(nullable NSString *)key image:(nullable UIImage *)image {
     return SDScaledImageForKey(key, image);
@@ -115,7 +115,18 @@ typedef NS_OPTIONS(NSUInteger, SDWebImageOptions) {
     /**
      * By default, when you use `SDWebImageTransition` to do some view transition after the image load finished, this transition is only applied for image download from the network. This mask can force to apply view transition for memory and disk cache as well.
      */
-    SDWebImageForceTransition = 1 << 16
+    SDWebImageForceTransition = 1 << 16,
+    
+    /**
+     * By default, the downloaded data is kept in memory until it is decoded and written to disk. This flag streams it to a file in the disk cache directory instead, decodes from a mapped view of the file, and moves the file into the disk cache.
+     * The peak memory of a download does not grow with the size of the image any more. Progressive download is not supported with this flag.
+     */
+    SDWebImageStreamDownloadToDisk = 1 << 17,
+
+    /**
+     * Download below the low priority, after every other download, for images which may be shown later. `SDWebImagePrefetcher` sets it. Ignored with `SDWebImageHighPriority`.
+     */
+    SDWebImagePrefetchPriority = 1 << 18
 };
 
 typedef void(^SDExternalCompletionBlock)(UIImage * _Nullable image, NSError * _Nullable error, SDImageCacheType cacheType, NSURL * _Nullable imageURL);
@@ -49,6 +49,10 @@
     if ((self = [super init])) {
         _imageCache = cache;
         _imageDownloader = downloader;
+        // Next to the cache files, so the streamed downloads are moved in with a rename
+        if (!downloader.downloadDirectory) {
+            downloader.downloadDirectory = cache.temporaryDirectoryPath;
+        }
         _failedURLs = [NSMutableSet new];
         _runningOperations = [NSMutableArray new];
     }
@@ -157,9 +161,15 @@
             return;
         }
         
+        // The HTTP metadata stored with the image, used to honor the server freshness and to revalidate instead of using NSURLCache
+        SDImageCacheEntryMetadata *cachedMetadata = nil;
+        if (cachedImage && options & SDWebImageRefreshCached) {
+            cachedMetadata = [self.imageCache metadataForKey:key];
+        }
+        
         // Check whether we should download image from network
         BOOL shouldDownload = (!(options & SDWebImageFromCacheOnly))
-            && (!cachedImage || options & SDWebImageRefreshCached)
+            && (!cachedImage || (options & SDWebImageRefreshCached && !cachedMetadata.isFresh))
             && (![self.delegate respondsToSelector:@selector(imageManager:shouldDownloadImageForURL:)] || [self.delegate imageManager:self shouldDownloadImageForURL:url]);
         if (shouldDownload) {
             if (cachedImage && options & SDWebImageRefreshCached) {
@@ -177,18 +187,27 @@
             if (options & SDWebImageHandleCookies) downloaderOptions |= SDWebImageDownloaderHandleCookies;
             if (options & SDWebImageAllowInvalidSSLCertificates) downloaderOptions |= SDWebImageDownloaderAllowInvalidSSLCertificates;
             if (options & SDWebImageHighPriority) downloaderOptions |= SDWebImageDownloaderHighPriority;
+            if (options & SDWebImagePrefetchPriority) downloaderOptions |= SDWebImageDownloaderPrefetchPriority;
             if (options & SDWebImageScaleDownLargeImages) downloaderOptions |= SDWebImageDownloaderScaleDownLargeImages;
+            if (options & SDWebImageStreamDownloadToDisk) downloaderOptions |= SDWebImageDownloaderStreamToFile;
             
+            SDHTTPHeadersDictionary *conditionalHeaders = nil;
             if (cachedImage && options & SDWebImageRefreshCached) {
                 // force progressive off if image already cached but forced refreshing
                 downloaderOptions &= ~SDWebImageDownloaderProgressiveDownload;
-                // ignore image read from NSURLCache if image if cached but force refreshing
-                downloaderOptions |= SDWebImageDownloaderIgnoreCachedResponse;
+                if (cachedMetadata.hasValidator) {
+                    // revalidate the cached image with the server, NSURLCache would only duplicate it
+                    downloaderOptions &= ~SDWebImageDownloaderUseNSURLCache;
+                    conditionalHeaders = cachedMetadata.conditionalRequestHeaders;
+                } else {
+                    // ignore image read from NSURLCache if image if cached but force refreshing
+                    downloaderOptions |= SDWebImageDownloaderIgnoreCachedResponse;
+                }
             }
             
             // `SDWebImageCombinedOperation` -> `SDWebImageDownloadToken` -> `downloadOperationCancelToken`, which is a `SDCallbacksDictionary` and retain the completed block below, so we need weak-strong again to avoid retain cycle
             __weak typeof(strongOperation) weakSubOperation = strongOperation;
-            strongOperation.downloadToken = [self.imageDownloader downloadImageWithURL:url options:downloaderOptions progress:progressBlock completed:^(UIImage *downloadedImage, NSData *downloadedData, NSError *error, BOOL finished) {
+            strongOperation.downloadToken = [self.imageDownloader downloadImageWithURL:url options:downloaderOptions HTTPHeaders:conditionalHeaders progress:progressBlock completed:^(UIImage *downloadedImage, NSData *downloadedData, NSError *error, BOOL finished) {
                 __strong typeof(weakSubOperation) strongSubOperation = weakSubOperation;
                 if (!strongSubOperation || strongSubOperation.isCancelled) {
                     // Do nothing if the operation was cancelled
@@ -225,6 +244,12 @@
                     }
                     
                     BOOL cacheOnDisk = !(options & SDWebImageCacheMemoryOnly);
+                    NSURLResponse *response = strongSubOperation.downloadToken.response;
+                    // The metadata is attached once the image is on disk, storing the image drops the previous one
+                    SDImageCacheEntryMetadata *metadata = (cacheOnDisk && finished) ? [SDImageCacheEntryMetadata metadataWithResponse:response] : nil;
+                    SDWebImageNoParamsBlock storeCompletionBlock = metadata ? ^{
+                        [self.imageCache storeMetadata:metadata forKey:key completion:nil];
+                    } : nil;
                     
                     // We've done the scale process in SDWebImageDownloader with the shared manager, this is used for custom manager and avoid extra scale.
                     if (self != [SDWebImageManager sharedManager] && self.cacheKeyFilter && downloadedImage) {
@@ -232,7 +257,10 @@
                     }
 
                     if (options & SDWebImageRefreshCached && cachedImage && !downloadedImage) {
-                        // Image refresh hit the NSURLCache cache, do not call the completion block
+                        // Image refresh hit the NSURLCache cache or was not modified, do not call the completion block
+                        if (cachedMetadata && finished) {
+                            [self.imageCache storeMetadata:[cachedMetadata metadataByUpdatingWithResponse:response] forKey:key completion:nil];
+                        }
                     } else if (downloadedImage && (!downloadedImage.images || (options & SDWebImageTransformAnimatedImage)) && [self.delegate respondsToSelector:@selector(imageManager:transformDownloadedImage:withURL:)]) {
                         dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), ^{
                             UIImage *transformedImage = [self.delegate imageManager:self transformDownloadedImage:downloadedImage withURL:url];
@@ -246,20 +274,29 @@
                                 } else {
                                     cacheData = (imageWasTransformed ? nil : downloadedData);
                                 }
-                                [self.imageCache storeImage:transformedImage imageData:cacheData forKey:key toDisk:cacheOnDisk completion:nil];
+                                [self.imageCache storeImage:transformedImage imageData:cacheData forKey:key toDisk:cacheOnDisk completion:storeCompletionBlock];
                             }
                             
                             [self callCompletionBlockForOperation:strongSubOperation completion:completedBlock image:transformedImage data:downloadedData error:nil cacheType:SDImageCacheTypeNone finished:finished url:url];
                         });
                     } else {
-                        if (downloadedImage && finished) {
+                        SDWebImageDownloadToken *downloadToken = strongSubOperation.downloadToken;
+                        if (downloadedImage && finished && cacheOnDisk && !self.cacheSerializer && downloadToken.downloadedFilePath) {
+                            // The token keeps the file until it is moved into the disk cache
+                            [self.imageCache storeImage:downloadedImage imageFileAtPath:downloadToken.downloadedFilePath forKey:key completion:^{
+                                (void)downloadToken;
+                                if (storeCompletionBlock) {
+                                    storeCompletionBlock();
+                                }
+                            }];
+                        } else if (downloadedImage && finished) {
                             if (self.cacheSerializer) {
                                 dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), ^{
                                     NSData *cacheData = self.cacheSerializer(downloadedImage, downloadedData, url);
-                                    [self.imageCache storeImage:downloadedImage imageData:cacheData forKey:key toDisk:cacheOnDisk completion:nil];
+                                    [self.imageCache storeImage:downloadedImage imageData:cacheData forKey:key toDisk:cacheOnDisk completion:storeCompletionBlock];
                                 });
                             } else {
-                                [self.imageCache storeImage:downloadedImage imageData:downloadedData forKey:key toDisk:cacheOnDisk completion:nil];
+                                [self.imageCache storeImage:downloadedImage imageData:downloadedData forKey:key toDisk:cacheOnDisk completion:storeCompletionBlock];
                             }
                         }
                         [self callCompletionBlockForOperation:strongSubOperation completion:completedBlock image:downloadedImage data:downloadedData error:nil cacheType:SDImageCacheTypeNone finished:finished url:url];
@@ -49,12 +49,13 @@ typedef void(^SDWebImagePrefetcherCompletionBlock)(NSUInteger noOfFinishedUrls,
 @property (strong, nonatomic, readonly, nonnull) SDWebImageManager *manager;
 
 /**
- * Maximum number of URLs to prefetch at the same time. Defaults to 3.
+ * Maximum number of URLs to prefetch at the same time. Defaults to 3, or to the window of the downloader if it has a `concurrencyController`.
  */
 @property (nonatomic, assign) NSUInteger maxConcurrentDownloads;
 
 /**
  * SDWebImageOptions for prefetcher. Defaults to SDWebImageLowPriority.
+ * `SDWebImagePrefetchPriority` is always added, so prefetched images download after the ones of the views, unless `SDWebImageHighPriority` is set.
  */
 @property (nonatomic, assign) SDWebImageOptions options;
 
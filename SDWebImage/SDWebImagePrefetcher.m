@@ -41,7 +41,10 @@
         _manager = manager;
         _options = SDWebImageLowPriority;
         _prefetcherQueue = dispatch_get_main_queue();
-        self.maxConcurrentDownloads = 3;
+        // An adaptive downloader sizes its own window
+        if (!manager.imageDownloader.concurrencyController) {
+            self.maxConcurrentDownloads = 3;
+        }
     }
     return self;
 }
@@ -61,7 +64,8 @@
         currentURL = self.prefetchURLs[index];
         self.requestedCount++;
     }
-    [self.manager loadImageWithURL:currentURL options:self.options progress:nil completed:^(UIImage *image, NSData *data, NSError *error, SDImageCacheType cacheType, BOOL finished, NSURL *imageURL) {
+    // Below the low priority requests of the views, which are shown now or soon
+    [self.manager loadImageWithURL:currentURL options:self.options | SDWebImagePrefetchPriority progress:nil completed:^(UIImage *image, NSData *data, NSError *error, SDImageCacheType cacheType, BOOL finished, NSURL *imageURL) {
         if (!finished) return;
         self.finishedCount++;
 
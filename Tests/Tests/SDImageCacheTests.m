@@ -9,6 +9,9 @@
 #import "SDTestCase.h"
 #import <SDWebImage/SDImageCache.h>
 #import <SDWebImage/SDWebImageCodersManager.h>
+#import <SDWebImage/SDImageCacheArchive.h>
+#import <SDWebImage/SDImageCachePackStore.h>
+#import <SDWebImage/SDMemoryCache.h>
 #import "SDWebImageTestDecoder.h"
 
 NSString *kImageTestKey = @"TestImageKey.jpg";
@@ -303,8 +306,988 @@ NSString *kImageTestKey = @"TestImageKey.jpg";
     [self waitForExpectationsWithCommonTimeout];
 }
 
+- (void)test42StoreImageDataIntoPackStore {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Pack store serves small images"];
+    SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"TestPackStore"];
+    cache.config.shouldUseDiskPackStore = YES;
+    NSData *imageData = [NSData dataWithContentsOfFile:[self testImagePath]];
+    cache.config.diskPackStoreMaxEntrySize = imageData.length;
+    
+    [cache clearDiskOnCompletion:^{
+        [cache storeImageDataToDisk:imageData forKey:kImageTestKey];
+        // Packed entries do not get their own file
+        NSString *cachePath = [cache defaultCachePathForKey:kImageTestKey];
+        expect([[NSFileManager defaultManager] fileExistsAtPath:cachePath]).to.beFalsy();
+        expect([cache diskImageDataExistsWithKey:kImageTestKey]).to.beTruthy();
+        expect([cache getDiskCount]).to.equal(1);
+        
+        UIImage *cachedImage = [cache imageFromDiskCacheForKey:kImageTestKey];
+        expect(cachedImage.size).to.equal([self imageForTesting].size);
+        
+        [cache removeImageForKey:kImageTestKey withCompletion:^{
+            expect([cache diskImageDataExistsWithKey:kImageTestKey]).to.beFalsy();
+            [cache clearDiskOnCompletion:^{
+                [expectation fulfill];
+            }];
+        }];
+    }];
+    
+    [self waitForExpectationsWithCommonTimeout];
+}
+
+- (void)test43DiskIndexSurvivesRelaunchAndRebuildsWhenCorrupt {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Disk index tracks size and count"];
+    SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"TestDiskIndex"];
+    NSData *imageData = [NSData dataWithContentsOfFile:[self testImagePath]];
+    
+    [cache clearDiskOnCompletion:^{
+        [cache storeImageDataToDisk:imageData forKey:kImageTestKey];
+        expect([cache getDiskCount]).to.equal(1);
+        expect([cache getSize]).to.equal(imageData.length);
+        [cache deleteOldFilesWithCompletionBlock:^{
+            // A new instance loads the same numbers from the journal
+            SDImageCache *relaunchedCache = [[SDImageCache alloc] initWithNamespace:@"TestDiskIndex"];
+            expect([relaunchedCache getDiskCount]).to.equal(1);
+            expect([relaunchedCache getSize]).to.equal(imageData.length);
+            
+            // A corrupt journal is rebuilt from the directory
+            NSString *journalPath = [[cache defaultCachePathForKey:kImageTestKey].stringByDeletingLastPathComponent stringByAppendingPathComponent:@".index"];
+            [[@"corrupt" dataUsingEncoding:NSUTF8StringEncoding] writeToFile:journalPath atomically:YES];
+            SDImageCache *rebuiltCache = [[SDImageCache alloc] initWithNamespace:@"TestDiskIndex"];
+            expect([rebuiltCache getDiskCount]).to.equal(1);
+            expect([rebuiltCache getSize]).to.equal(imageData.length);
+            
+            [rebuiltCache clearDiskOnCompletion:^{
+                [expectation fulfill];
+            }];
+        }];
+    }];
+    
+    [self waitForExpectationsWithCommonTimeout];
+}
+
+- (void)test44SizeBasedCleanupEvictsLeastRecentlyUsedFirst {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Cleanup keeps recently read images"];
+    SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"TestAccessDateExpire"];
+    NSData *imageData = [NSData dataWithContentsOfFile:[self testImagePath]];
+    cache.config.diskCacheExpireType = SDImageCacheConfigExpireTypeAccessDate;
+    cache.config.maxCacheSize = imageData.length * 3 - 1;
+    
+    [cache clearDiskOnCompletion:^{
+        [cache storeImageDataToDisk:imageData forKey:@"TestAccessDateExpireA"];
+        [cache storeImageDataToDisk:imageData forKey:@"TestAccessDateExpireB"];
+        [cache storeImageDataToDisk:imageData forKey:@"TestAccessDateExpireC"];
+        // A is the oldest written file, but the most recently read one
+        expect([cache imageFromDiskCacheForKey:@"TestAccessDateExpireA"]).toNot.beNil();
+        [cache deleteOldFilesWithCompletionBlock:^{
+            expect([cache diskImageDataExistsWithKey:@"TestAccessDateExpireA"]).to.beTruthy();
+            expect([cache diskImageDataExistsWithKey:@"TestAccessDateExpireB"]).to.beFalsy();
+            expect([cache diskImageDataExistsWithKey:@"TestAccessDateExpireC"]).to.beFalsy();
+            [cache clearDiskOnCompletion:^{
+                [expectation fulfill];
+            }];
+        }];
+    }];
+    
+    [self waitForExpectationsWithCommonTimeout];
+}
+
+- (void)test45ConcurrentDiskQueriesSeeTheirOwnWrites {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Concurrent disk queries"];
+    SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"TestConcurrentDiskQueries"];
+    cache.config.shouldCacheImagesInMemory = NO;
+    cache.config.maxConcurrentDiskOperations = 4;
+    UIImage *image = [self imageForTesting];
+    NSUInteger keyCount = 16;
+    __block NSUInteger hitCount = 0;
+    
+    for (NSUInteger i = 0; i < keyCount; i++) {
+        NSString *key = [NSString stringWithFormat:@"TestConcurrentDiskQueries%lu", (unsigned long)i];
+        [cache storeImage:image forKey:key completion:nil];
+        // The query is queued behind the store of the same key
+        [cache queryCacheOperationForKey:key done:^(UIImage * _Nullable cachedImage, NSData * _Nullable data, SDImageCacheType cacheType) {
+            expect(cachedImage).toNot.beNil();
+            expect(cacheType).to.equal(SDImageCacheTypeDisk);
+            hitCount += 1;
+            if (hitCount == keyCount) {
+                [cache clearDiskOnCompletion:^{
+                    [expectation fulfill];
+                }];
+            }
+        }];
+    }
+    
+    [self waitForExpectationsWithCommonTimeout];
+}
+
+- (void)test46DiskLookupFilterAnswersMissesWithoutTouchingDisk {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Disk lookup filter"];
+    SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"TestDiskLookupFilter"];
+    NSString *key = @"TestDiskLookupFilterKey";
+    [cache storeImageDataToDisk:[NSData dataWithContentsOfFile:[self testImagePath]] forKey:key];
+    
+    // The filter is built as a barrier on the io queue, the sync lookups below are queued after it
+    expect([cache diskImageDataExistsWithKey:key]).to.beTruthy();
+    NSUInteger negativeCount = cache.diskLookupFilterNegativeCount;
+    for (NSUInteger i = 0; i < 100; i++) {
+        expect([cache diskImageDataExistsWithKey:[NSString stringWithFormat:@"TestDiskLookupFilterMissing%lu", (unsigned long)i]]).to.beFalsy();
+    }
+    expect(cache.diskLookupFilterHitCount).to.equal(1);
+    // With the filter sized for far more names, a false positive among 100 misses is very unlikely
+    expect(cache.diskLookupFilterNegativeCount - negativeCount + cache.diskLookupFilterFalsePositiveCount).to.equal(100);
+    expect(cache.diskLookupFilterNegativeCount - negativeCount).to.beGreaterThan(95);
+    
+    // A removed key is a definite miss again
+    [cache removeImageForKey:key withCompletion:^{
+        expect([cache diskImageDataExistsWithKey:key]).to.beFalsy();
+        [cache clearDiskOnCompletion:^{
+            [expectation fulfill];
+        }];
+    }];
+    [self waitForExpectationsWithCommonTimeout];
+}
+
+- (void)test47DiskHitIsServedFromDecodedBitmapStore {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Decoded bitmap store"];
+    SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"TestDiskBitmapStore"];
+    cache.config.shouldCacheImagesInMemory = NO;
+    cache.config.shouldUseDiskBitmapStore = YES;
+    NSString *key = @"TestDiskBitmapStoreKey";
+    [cache storeImageDataToDisk:[NSData dataWithContentsOfFile:[self testImagePath]] forKey:key];
+    
+    // The first hit decodes the data and keeps the bitmap, written afterwards on the key's queue
+    UIImage *decodedImage = [cache imageFromDiskCacheForKey:key];
+    expect(decodedImage).toNot.beNil();
+    expect([cache diskImageDataExistsWithKey:key]).to.beTruthy();
+    NSString *bitmapPath = [[[cache defaultCachePathForKey:key] stringByDeletingLastPathComponent] stringByAppendingPathComponent:@".bitmap"];
+    bitmapPath = [bitmapPath stringByAppendingPathComponent:[cache defaultCachePathForKey:key].lastPathComponent];
+    expect([[NSFileManager defaultManager] fileExistsAtPath:bitmapPath]).to.beTruthy();
+    
+    // The second hit is backed by the mapped bitmap, with its aligned rows
+    UIImage *bitmapImage = [cache imageFromDiskCacheForKey:key];
+    expect(bitmapImage).toNot.beNil();
+    expect(bitmapImage.size).to.equal(decodedImage.size);
+    expect(CGImageGetWidth(bitmapImage.CGImage)).to.equal(CGImageGetWidth(decodedImage.CGImage));
+    expect(CGImageGetBytesPerRow(bitmapImage.CGImage) % 64).to.equal(0);
+    
+    // New image data drops the stale bitmap
+    [cache storeImageDataToDisk:[NSData dataWithContentsOfFile:[self testImagePath]] forKey:key];
+    expect([[NSFileManager defaultManager] fileExistsAtPath:bitmapPath]).to.beFalsy();
+    [cache clearDiskOnCompletion:^{
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithCommonTimeout];
+}
+
+- (void)test48BatchQueryReportsEveryKeyOnce {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Batch cache query"];
+    SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"TestBatchQuery"];
+    UIImage *image = [self imageForTesting];
+    NSString *memoryKey = @"TestBatchQueryMemory";
+    NSString *diskKey = @"TestBatchQueryDisk";
+    NSString *missingKey = @"TestBatchQueryMissing";
+    [cache storeImage:image forKey:memoryKey toDisk:NO completion:nil];
+    [cache storeImageDataToDisk:[NSData dataWithContentsOfFile:[self testImagePath]] forKey:diskKey];
+    
+    NSMutableArray<NSString *> *progressKeys = [NSMutableArray array];
+    [cache queryCacheOperationForKeys:@[memoryKey, diskKey, missingKey, diskKey] options:0 progress:^(NSString * _Nonnull key, UIImage * _Nullable image, NSData * _Nullable data, SDImageCacheType cacheType) {
+        [progressKeys addObject:key];
+    } done:^(NSDictionary<NSString *,UIImage *> * _Nonnull images, NSDictionary<NSString *,NSData *> * _Nonnull imageDatas, NSDictionary<NSString *,NSNumber *> * _Nonnull cacheTypes) {
+        // Duplicated keys are queried once, and the memory hit was reported first
+        expect(progressKeys.count).to.equal(3);
+        expect(progressKeys.firstObject).to.equal(memoryKey);
+        expect(images[memoryKey]).to.equal(image);
+        expect(images[diskKey]).toNot.beNil();
+        expect(images[missingKey]).to.beNil();
+        expect(imageDatas[diskKey]).toNot.beNil();
+        expect(cacheTypes[memoryKey].integerValue).to.equal(SDImageCacheTypeMemory);
+        expect(cacheTypes[diskKey].integerValue).to.equal(SDImageCacheTypeDisk);
+        expect(cacheTypes[missingKey].integerValue).to.equal(SDImageCacheTypeNone);
+        [cache clearMemory];
+        [cache clearDiskOnCompletion:^{
+            [expectation fulfill];
+        }];
+    }];
+    [self waitForExpectationsWithCommonTimeout];
+}
+
+- (void)test49IncrementalCleanupTrimsDownToLowWatermark {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Incremental cleanup"];
+    SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"TestIncrementalCleanup"];
+    NSData *imageData = [NSData dataWithContentsOfFile:[self testImagePath]];
+    cache.config.shouldTrimDiskCacheIncrementally = YES;
+    // One file per slice, so every removal is a separate barrier
+    cache.config.diskCacheTrimSliceDuration = 0;
+    cache.config.diskCacheTrimLowWatermark = 0.4;
+    
+    [cache clearDiskOnCompletion:^{
+        [cache storeImageDataToDisk:imageData forKey:@"TestIncrementalCleanupA"];
+        [cache storeImageDataToDisk:imageData forKey:@"TestIncrementalCleanupB"];
+        [cache storeImageDataToDisk:imageData forKey:@"TestIncrementalCleanupC"];
+        // Only the most recent file fits below the low watermark
+        cache.config.maxCacheSize = imageData.length * 3 - 1;
+        [cache deleteOldFilesWithCompletionBlock:^{
+            expect([cache getDiskCount]).to.equal(1);
+            expect([cache diskImageDataExistsWithKey:@"TestIncrementalCleanupC"]).to.beTruthy();
+            [cache clearDiskOnCompletion:^{
+                [expectation fulfill];
+            }];
+        }];
+    }];
+    
+    [self waitForExpectationsWithCommonTimeout];
+}
+
+- (void)test50MD5FileNamesAreMigratedToFastFileNames {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"File name migration"];
+    NSString *key = @"TestFileNameMigrationKey.png";
+    SDImageCache *legacyCache = [[SDImageCache alloc] initWithNamespace:@"TestFileNameMigration"];
+    legacyCache.config.diskCacheFileNameHashType = SDImageCacheConfigFileNameHashTypeMD5;
+    
+    [legacyCache clearDiskOnCompletion:^{
+        [legacyCache storeImageDataToDisk:[NSData dataWithContentsOfFile:[self testImagePath]] forKey:key];
+        NSString *legacyPath = [legacyCache defaultCachePathForKey:key];
+        
+        // Same directory, now with the fast file names
+        SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"TestFileNameMigration"];
+        cache.config.diskCacheFileNameHashType = SDImageCacheConfigFileNameHashTypeFast;
+        NSString *path = [cache defaultCachePathForKey:key];
+        expect(path).toNot.equal(legacyPath);
+        expect(path.lastPathComponent.length).to.equal(legacyPath.lastPathComponent.length);
+        expect(path.pathExtension).to.equal(@"png");
+        expect([cache diskImageDataExistsWithKey:key]).to.beTruthy();
+        expect([[NSFileManager defaultManager] fileExistsAtPath:path]).to.beTruthy();
+        expect([[NSFileManager defaultManager] fileExistsAtPath:legacyPath]).to.beFalsy();
+        expect([cache imageFromDiskCacheForKey:key]).toNot.beNil();
+        [cache clearDiskOnCompletion:^{
+            [expectation fulfill];
+        }];
+    }];
+    [self waitForExpectationsWithCommonTimeout];
+}
+
+- (void)test51FastFileNamePerformance {
+    SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"TestFileNamePerformance"];
+    cache.config.diskCacheFileNameHashType = SDImageCacheConfigFileNameHashTypeFast;
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 10000; i++) {
+            [cache defaultCachePathForKey:kTestJpegURL];
+        }
+    }];
+}
+
+- (void)test52MD5FileNamePerformance {
+    SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"TestFileNamePerformance"];
+    cache.config.diskCacheFileNameHashType = SDImageCacheConfigFileNameHashTypeMD5;
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 10000; i++) {
+            [cache defaultCachePathForKey:kTestJpegURL];
+        }
+    }];
+}
+
+- (void)test53EntryMetadataIsPersistedWithTheDiskEntry {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Entry metadata"];
+    NSString *key = @"TestEntryMetadataKey.jpg";
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:[NSURL URLWithString:kTestJpegURL]
+                                                              statusCode:200
+                                                             HTTPVersion:@"HTTP/1.1"
+                                                            headerFields:@{@"ETag": @"\"abc\"",
+                                                                           @"Last-Modified": @"Wed, 21 Oct 2015 07:28:00 GMT",
+                                                                           @"Cache-Control": @"public, max-age=3600",
+                                                                           @"Content-Type": @"image/jpeg"}];
+    SDImageCacheEntryMetadata *metadata = [SDImageCacheEntryMetadata metadataWithResponse:response];
+    expect(metadata.isFresh).to.beTruthy();
+    expect(metadata.conditionalRequestHeaders[@"If-None-Match"]).to.equal(@"\"abc\"");
+    expect(metadata.conditionalRequestHeaders[@"If-Modified-Since"]).to.equal(@"Wed, 21 Oct 2015 07:28:00 GMT");
+    NSHTTPURLResponse *noStoreResponse = [[NSHTTPURLResponse alloc] initWithURL:[NSURL URLWithString:kTestJpegURL]
+                                                                     statusCode:200
+                                                                    HTTPVersion:@"HTTP/1.1"
+                                                                   headerFields:@{@"ETag": @"\"abc\"", @"Cache-Control": @"no-store"}];
+    expect([SDImageCacheEntryMetadata metadataWithResponse:noStoreResponse]).to.beNil();
+    NSHTTPURLResponse *notModifiedResponse = [[NSHTTPURLResponse alloc] initWithURL:[NSURL URLWithString:kTestJpegURL]
+                                                                         statusCode:304
+                                                                        HTTPVersion:@"HTTP/1.1"
+                                                                       headerFields:@{@"Cache-Control": @"no-cache"}];
+    SDImageCacheEntryMetadata *revalidatedMetadata = [metadata metadataByUpdatingWithResponse:notModifiedResponse];
+    expect(revalidatedMetadata.isFresh).to.beFalsy();
+    expect(revalidatedMetadata.eTag).to.equal(metadata.eTag);
+    
+    SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"TestEntryMetadata"];
+    [cache clearDiskOnCompletion:^{
+        [cache storeMetadata:metadata forKey:key completion:^{
+            // No disk entry yet
+            expect([cache metadataForKey:key]).to.beNil();
+            [cache storeImage:[self imageForTesting] forKey:key toDisk:YES completion:^{
+                [cache storeMetadata:metadata forKey:key completion:^{
+                    // The metadata is read back from the journal by another instance
+                    SDImageCache *otherCache = [[SDImageCache alloc] initWithNamespace:@"TestEntryMetadata"];
+                    SDImageCacheEntryMetadata *storedMetadata = [otherCache metadataForKey:key];
+                    expect(storedMetadata.eTag).to.equal(metadata.eTag);
+                    expect(storedMetadata.lastModified).to.equal(metadata.lastModified);
+                    expect(storedMetadata.contentType).to.equal(@"image/jpeg");
+                    expect(storedMetadata.expirationDate.timeIntervalSinceReferenceDate).to.equal(metadata.expirationDate.timeIntervalSinceReferenceDate);
+                    // Storing the image again drops the validators of the previous data
+                    [cache storeImage:[self imageForTesting] forKey:key toDisk:YES completion:^{
+                        expect([cache metadataForKey:key]).to.beNil();
+                        [cache clearDiskOnCompletion:^{
+                            [expectation fulfill];
+                        }];
+                    }];
+                }];
+            }];
+        }];
+    }];
+    [self waitForExpectationsWithCommonTimeout];
+}
+
+- (void)test54WriteBehindStoresAreVisibleBeforeTheyAreWritten {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Write-behind stores"];
+    SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"TestWriteBehind"];
+    cache.config.diskWritePolicy = SDImageCacheConfigDiskWritePolicyBatched;
+    // Only an explicit flush writes the buffer in this test
+    cache.config.diskWriteBatchDelay = 60;
+    NSData *imageData = [NSData dataWithContentsOfFile:[self testImagePath]];
+    NSArray<NSString *> *keys = @[@"TestWriteBehindKey1.jpg", @"TestWriteBehindKey2.jpg", @"TestWriteBehindKey3.jpg"];
+    
+    [cache clearDiskOnCompletion:^{
+        for (NSString *key in keys) {
+            [cache storeImage:[self imageForTesting] imageData:imageData forKey:key toDisk:YES completion:nil];
+        }
+        // The same key again only replaces the buffered data
+        [cache storeImage:[self imageForTesting] imageData:imageData forKey:keys[0] toDisk:YES completion:nil];
+        [cache removeImageForKey:keys[2] withCompletion:^{
+            // The sync queries wait for the stores of their key
+            expect([cache diskImageDataExistsWithKey:keys[0]]).to.beTruthy();
+            expect([cache diskImageDataExistsWithKey:keys[1]]).to.beTruthy();
+            expect([cache diskImageDataExistsWithKey:keys[2]]).to.beFalsy();
+            expect([cache imageFromDiskCacheForKey:keys[1]]).toNot.beNil();
+            for (NSString *key in keys) {
+                expect([[NSFileManager defaultManager] fileExistsAtPath:[cache defaultCachePathForKey:key]]).to.beFalsy();
+            }
+            [cache flushPendingDiskWritesWithCompletion:^{
+                expect([[NSFileManager defaultManager] fileExistsAtPath:[cache defaultCachePathForKey:keys[0]]]).to.beTruthy();
+                expect([[NSFileManager defaultManager] fileExistsAtPath:[cache defaultCachePathForKey:keys[1]]]).to.beTruthy();
+                expect([[NSFileManager defaultManager] fileExistsAtPath:[cache defaultCachePathForKey:keys[2]]]).to.beFalsy();
+                expect([cache getDiskCount]).to.equal(2);
+                [cache clearDiskOnCompletion:^{
+                    [expectation fulfill];
+                }];
+            }];
+        }];
+    }];
+    [self waitForExpectationsWithCommonTimeout];
+}
+
+- (void)test55HotKeysWarmTheMemoryCache {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Memory cache warm-up"];
+    SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"TestMemoryCacheWarmUp"];
+    cache.config.shouldWarmMemoryCacheAtLaunch = YES;
+    NSString *hotKey = @"TestHotKey.jpg";
+    NSString *coldKey = @"TestColdKey.jpg";
+    
+    [cache clearDiskOnCompletion:^{
+        [cache storeImage:[self imageForTesting] forKey:coldKey completion:nil];
+        [cache storeImage:[self imageForTesting] forKey:hotKey completion:^{
+            for (NSUInteger i = 0; i < 3; i++) {
+                [cache queryCacheOperationForKey:hotKey done:nil];
+            }
+            [cache queryCacheOperationForKey:coldKey done:nil];
+            expect([cache hotKeys]).to.equal(@[hotKey, coldKey]);
+            [cache saveHotKeySnapshot];
+            
+            [cache clearMemory];
+            [cache warmUpMemoryCacheWithCompletion:^{
+                expect([cache imageFromMemoryCacheForKey:hotKey]).toNot.beNil();
+                expect([cache imageFromMemoryCacheForKey:coldKey]).toNot.beNil();
+                [cache clearDiskOnCompletion:^{
+                    [expectation fulfill];
+                }];
+            }];
+        }];
+    }];
+    [self waitForExpectationsWithCommonTimeout];
+}
+
+- (void)test56DiskQueryCancelsMemoryCacheWarmUp {
+    SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"TestMemoryCacheWarmUp"];
+    NSOperation *operation = [cache warmUpMemoryCacheWithCompletion:nil];
+    [cache queryCacheOperationForKey:@"TestWarmUpMissKey.jpg" done:nil];
+    expect(operation.isCancelled).to.beTruthy();
+}
+
+- (void)test57ReadOnlyArchiveIsSearched {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Read-only archive"];
+    NSString *key = @"TestArchiveKey.jpg";
+    SDImageCache *seedCache = [[SDImageCache alloc] initWithNamespace:@"TestArchiveSeed"];
+    
+    [seedCache clearDiskOnCompletion:^{
+        [seedCache storeImageDataToDisk:[NSData dataWithContentsOfFile:[self testImagePath]] forKey:key];
+        NSString *archivePath = [NSTemporaryDirectory() stringByAppendingPathComponent:[@"TestArchive" stringByAppendingPathExtension:SDImageCacheArchivePathExtension]];
+        NSError *error;
+        expect([SDImageCacheArchive writeArchiveToFile:archivePath fromDirectory:seedCache.diskCachePath error:&error]).to.beTruthy();
+        expect(error).to.beNil();
+        SDImageCacheArchive *archive = [SDImageCacheArchive archiveWithContentsOfFile:archivePath];
+        NSString *fileName = [seedCache defaultCachePathForKey:key].lastPathComponent;
+        expect([archive containsName:fileName]).to.beTruthy();
+        expect([archive dataForName:fileName]).to.equal([NSData dataWithContentsOfFile:[self testImagePath]]);
+        
+        SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"TestArchive"];
+        [cache clearDiskOnCompletion:^{
+            [cache addReadOnlyCachePath:archivePath];
+            // The query runs after the archive names are added to the lookup filter
+            [cache queryCacheOperationForKey:key done:^(UIImage * _Nullable image, NSData * _Nullable data, SDImageCacheType cacheType) {
+                expect(image).toNot.beNil();
+                expect(cacheType).to.equal(SDImageCacheTypeDisk);
+                [[NSFileManager defaultManager] removeItemAtPath:archivePath error:nil];
+                [seedCache clearDiskOnCompletion:^{
+                    [expectation fulfill];
+                }];
+            }];
+        }];
+    }];
+    [self waitForExpectationsWithCommonTimeout];
+}
+
+- (void)test58MemoryCacheEvictsLeastRecentlyUsedFirst {
+    SDMemoryCache<NSString *, NSString *> *memoryCache = [SDMemoryCache new];
+    memoryCache.totalCostLimit = 30;
+    [memoryCache setObject:@"A" forKey:@"a" cost:10];
+    [memoryCache setObject:@"B" forKey:@"b" cost:10];
+    [memoryCache setObject:@"C" forKey:@"c" cost:10];
+    // Touch "a", so "b" is the least recently used
+    expect([memoryCache objectForKey:@"a"]).to.equal(@"A");
+    [memoryCache setObject:@"D" forKey:@"d" cost:10];
+    expect(memoryCache.totalCost).to.equal(30);
+    expect(memoryCache.totalCount).to.equal(3);
+    
+    // String literals are never deallocated, so the weak table would bring evicted keys back: only count the strong entries
+    [memoryCache setObject:@"E" forKey:@"e" cost:20];
+    expect(memoryCache.totalCost).to.equal(30);
+    expect(memoryCache.totalCount).to.equal(2);
+    
+    memoryCache.countLimit = 1;
+    expect(memoryCache.totalCount).to.equal(1);
+    expect(memoryCache.totalCost).to.equal(20);
+    [memoryCache trimToAge:0];
+    expect(memoryCache.totalCount).to.equal(0);
+    [memoryCache removeAllObjects];
+    expect([memoryCache objectForKey:@"e"]).to.beNil();
+}
+
+- (void)test59SegmentedMemoryCacheHoldsItsLimits {
+    SDMemoryCache<NSString *, NSNumber *> *memoryCache = [[SDMemoryCache alloc] initWithSegmentCount:4];
+    expect(memoryCache.segmentCount).to.equal(4);
+    memoryCache.countLimit = 20;
+    memoryCache.totalCostLimit = 200;
+    for (NSUInteger i = 0; i < 100; i++) {
+        [memoryCache setObject:@(i) forKey:[NSString stringWithFormat:@"key%lu", (unsigned long)i] cost:5];
+    }
+    expect(memoryCache.totalCount).to.beLessThanOrEqualTo(20);
+    expect(memoryCache.totalCost).to.beLessThanOrEqualTo(200);
+    expect([memoryCache objectForKey:@"key99"]).to.equal(@99);
+    [memoryCache trimToCount:0];
+    expect(memoryCache.totalCount).to.equal(0);
+}
+
+- (void)test60SingleLockMemoryCacheContention {
+    [self measureMemoryCacheContentionWithSegmentCount:1 totalCostLimit:0];
+}
+
+- (void)test61StripedMemoryCacheContention {
+    [self measureMemoryCacheContentionWithSegmentCount:8 totalCostLimit:0];
+}
+
+- (void)test62MemoryCostIsTheBytesOfTheDecodedFrames {
+    UIImage *image = [self imageForTesting];
+    NSUInteger frameCost = CGImageGetBytesPerRow(image.CGImage) * CGImageGetHeight(image.CGImage);
+    expect(SDCacheCostForImage(image)).to.equal(frameCost);
+    // A frame repeated to hold it longer shares its backing store
+    UIImage *otherFrame = [UIImage imageWithContentsOfFile:[self testImagePath]];
+    UIImage *animatedImage = [UIImage animatedImageWithImages:@[image, image, image, otherFrame] duration:1];
+    expect(SDCacheCostForImage(animatedImage)).to.equal(frameCost * 2);
+    
+    SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"TestMemoryCost"];
+    [cache storeImage:image forKey:@"TestMemoryCostKey" toDisk:NO completion:nil];
+    [cache storeImage:animatedImage forKey:@"TestMemoryCostAnimatedKey" toDisk:NO completion:nil];
+    expect([cache getMemoryCount]).to.equal(2);
+    expect([cache getMemorySize]).to.equal(frameCost * 3);
+    [cache clearMemory];
+    expect([cache getMemorySize]).to.equal(0);
+}
+
+- (void)test63TinyLFUResistsScans {
+    NSUInteger lruHits = [self memoryCacheHitsReplayingScanTraceWithAdmissionPolicy:SDMemoryCacheAdmissionPolicyLRU];
+    NSUInteger tinyLFUHits = [self memoryCacheHitsReplayingScanTraceWithAdmissionPolicy:SDMemoryCacheAdmissionPolicyTinyLFU];
+    NSLog(@"Scan trace hits, LRU: %lu, TinyLFU: %lu", (unsigned long)lruHits, (unsigned long)tinyLFUHits);
+    expect(tinyLFUHits).to.beGreaterThan(lruHits * 2);
+}
+
+- (void)test64EncodedDataTierServesDataAndFallback {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Encoded data tier"];
+    SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"TestMemoryDataCache"];
+    cache.config.shouldCacheImageDataInMemory = YES;
+    NSString *key = @"TestMemoryDataCacheKey.jpg";
+    NSData *imageData = [NSData dataWithContentsOfFile:[self testImagePath]];
+    
+    // Memory only, so any data found below comes from the encoded tier. Only the cache retains the image, so the weak cache does not keep it
+    @autoreleasepool {
+        [cache storeImage:[UIImage imageWithData:imageData] imageData:imageData forKey:key toDisk:NO completion:nil];
+    }
+    __block NSData *memoryData;
+    __block SDImageCacheType memoryCacheType = SDImageCacheTypeNone;
+    NSOperation *operation = [cache queryCacheOperationForKey:key options:SDImageCacheQueryDataWhenInMemory done:^(UIImage * _Nullable image, NSData * _Nullable data, SDImageCacheType cacheType) {
+        memoryData = data;
+        memoryCacheType = cacheType;
+    }];
+    expect(operation).to.beNil();
+    expect(memoryData).to.equal(imageData);
+    expect(memoryCacheType).to.equal(SDImageCacheTypeMemory);
+    
+    // The warning purges the decoded tier only
+    @autoreleasepool {
+        [[NSNotificationCenter defaultCenter] postNotificationName:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+    }
+    expect([cache imageFromMemoryCacheForKey:key]).to.beNil();
+    [cache queryCacheOperationForKey:key done:^(UIImage * _Nullable image, NSData * _Nullable data, SDImageCacheType cacheType) {
+        expect(image).toNot.beNil();
+        expect(cacheType).to.equal(SDImageCacheTypeDisk);
+        expect(data).to.equal(imageData);
+        [cache clearMemory];
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithCommonTimeout];
+}
+
+- (void)test65MemoryPressureTrimsGradually {
+    SDMemoryCache<NSString *, NSObject *> *memoryCache = [SDMemoryCache new];
+    NSObject *shownObject = [NSObject new];
+    @autoreleasepool {
+        for (NSUInteger i = 0; i < 10; i++) {
+            [memoryCache setObject:[NSObject new] forKey:[NSString stringWithFormat:@"key%lu", (unsigned long)i] cost:10];
+        }
+        [memoryCache setObject:shownObject forKey:@"shown" cost:10];
+        
+        // The least recently used half goes first
+        expect([memoryCache trimForMemoryPressureLevel:SDMemoryCachePressureLevelModerate]).to.equal(60);
+        expect(memoryCache.totalCost).to.equal(50);
+        expect(memoryCache.lastPressureTrimReleasedCost).to.equal(60);
+        expect([memoryCache trimForMemoryPressureLevel:SDMemoryCachePressureLevelCritical]).to.equal(50);
+    }
+    expect(memoryCache.totalCount).to.equal(0);
+    expect(memoryCache.pressureTrimCount).to.equal(2);
+    expect(memoryCache.pressureTrimReleasedCost).to.equal(110);
+    
+    // Still retained, so it comes back from the weak table without a decode
+    expect([memoryCache objectForKey:@"shown"]).to.equal(shownObject);
+    expect(memoryCache.pressureTrimRedecodedCost).to.equal(0);
+    [memoryCache setObject:[NSObject new] forKey:@"key9" cost:10];
+    expect(memoryCache.pressureTrimRedecodedCost).to.equal(10);
+}
+
+- (void)test66SizeVariantsAreCachedInMemory {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Size variants"];
+    SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"TestSizeVariants"];
+    NSString *key = @"TestSizeVariantsKey.jpg";
+    UIImage *fullImage = [UIImage imageWithContentsOfFile:[self testImagePath]];
+    CGSize pixelSize = CGSizeMake(20, 20);
+    CGSize diskPixelSize = CGSizeMake(10, 10);
+    [cache storeImage:fullImage forKey:key completion:^{
+        // Scaled down from the full image in memory
+        [cache queryCacheOperationForKey:key pixelSize:pixelSize done:^(UIImage * _Nullable image, NSData * _Nullable data, SDImageCacheType cacheType) {
+            expect(cacheType).to.equal(SDImageCacheTypeMemory);
+            expect(CGImageGetWidth(image.CGImage)).to.beLessThan(CGImageGetWidth(fullImage.CGImage));
+            expect(MIN(CGImageGetWidth(image.CGImage), CGImageGetHeight(image.CGImage))).to.equal(20);
+            // The variant is served at once now
+            __block UIImage *variant;
+            NSOperation *operation = [cache queryCacheOperationForKey:key pixelSize:pixelSize done:^(UIImage * _Nullable image, NSData * _Nullable data, SDImageCacheType cacheType) {
+                variant = image;
+            }];
+            expect(operation).to.beNil();
+            expect(variant).to.equal(image);
+            expect([cache imageFromMemoryCacheForKey:key pixelSize:diskPixelSize]).to.equal(image);
+            
+            // Decoded from disk at the target size
+            [cache clearMemory];
+            [cache queryCacheOperationForKey:key pixelSize:diskPixelSize done:^(UIImage * _Nullable image, NSData * _Nullable data, SDImageCacheType cacheType) {
+                expect(cacheType).to.equal(SDImageCacheTypeDisk);
+                expect(MIN(CGImageGetWidth(image.CGImage), CGImageGetHeight(image.CGImage))).to.equal(10);
+                expect([cache imageFromMemoryCacheForKey:key]).to.beNil();
+                [cache removeImageForKey:key withCompletion:^{
+                    expect([cache imageFromMemoryCacheForKey:key pixelSize:diskPixelSize]).to.beNil();
+                    [expectation fulfill];
+                }];
+            }];
+        }];
+    }];
+    [self waitForExpectationsWithCommonTimeout];
+}
+
+- (void)test67DownloadedFileIsMovedIntoTheDiskCache {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Downloaded file is moved"];
+    SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"TestDownloadedFile"];
+    // Moved as a file, not appended to the pack store
+    cache.config.shouldUseDiskPackStore = NO;
+    NSString *key = @"TestDownloadedFileKey.jpg";
+    NSData *imageData = [NSData dataWithContentsOfFile:[self testImagePath]];
+    NSString *path = [cache.temporaryDirectoryPath stringByAppendingPathComponent:@"download"];
+    [[NSFileManager defaultManager] createDirectoryAtPath:cache.temporaryDirectoryPath withIntermediateDirectories:YES attributes:nil error:nil];
+    [imageData writeToFile:path atomically:YES];
+    [cache storeImage:nil imageFileAtPath:path forKey:key completion:^{
+        expect([[NSFileManager defaultManager] fileExistsAtPath:path]).to.beFalsy();
+        expect([NSData dataWithContentsOfFile:[cache defaultCachePathForKey:key]]).to.equal(imageData);
+        expect([cache imageFromMemoryCacheForKey:key]).to.beNil();
+        [cache diskImageExistsWithKey:key completion:^(BOOL isInCache) {
+            expect(isInCache).to.beTruthy();
+            expect([cache imageFromDiskCacheForKey:key]).toNot.beNil();
+            [cache clearDiskOnCompletion:^{
+                [expectation fulfill];
+            }];
+        }];
+    }];
+    [self waitForExpectationsWithCommonTimeout];
+}
+
+- (void)test68EvictedPackSegmentsDoNotResurrectEntries {
+    NSString *directory = [NSTemporaryDirectory() stringByAppendingPathComponent:@"TestPackStoreEviction"];
+    [[NSFileManager defaultManager] removeItemAtPath:directory error:nil];
+    // Every record seals its segment
+    SDImageCachePackStore *store = [[SDImageCachePackStore alloc] initWithDirectory:directory segmentSize:1];
+    NSData *oldData = [@"old" dataUsingEncoding:NSUTF8StringEncoding];
+    NSData *newData = [@"new" dataUsingEncoding:NSUTF8StringEncoding];
+    [store storeData:oldData forName:@"replaced"];
+    [store storeData:newData forName:@"replaced"];
+    [store storeData:oldData forName:@"removed"];
+    [store removeDataForName:@"removed"];
+    NSArray<NSURL *> *segmentURLs = [store segmentURLs];
+    expect(segmentURLs.count).to.equal(4);
+    
+    // Evict the replacement record and the tombstone, the older records stay on disk
+    [store removeSegmentAtURL:segmentURLs[1]];
+    [store removeSegmentAtURL:segmentURLs[3]];
+    expect([store containsDataForName:@"replaced"]).to.beFalsy();
+    expect([store containsDataForName:@"removed"]).to.beFalsy();
+    
+    SDImageCachePackStore *relaunchedStore = [[SDImageCachePackStore alloc] initWithDirectory:directory segmentSize:1];
+    expect([relaunchedStore containsDataForName:@"replaced"]).to.beFalsy();
+    expect([relaunchedStore containsDataForName:@"removed"]).to.beFalsy();
+    expect(relaunchedStore.entryCount).to.equal(0);
+    [relaunchedStore removeAllData];
+}
+
+- (void)test69SegmentedMemoryCacheHoldsTheLimitsOfTheWholeCache {
+    SDMemoryCache<NSString *, NSNumber *> *countCache = [[SDMemoryCache alloc] initWithSegmentCount:8];
+    countCache.countLimit = 1;
+    for (NSUInteger i = 0; i < 16; i++) {
+        [countCache setObject:@(i) forKey:[NSString stringWithFormat:@"key%lu", (unsigned long)i] cost:1];
+    }
+    expect(countCache.totalCount).to.equal(1);
+    expect([countCache objectForKey:@"key15"]).to.equal(@15);
+    
+    // An object costing more than an even share of the limit still fits
+    SDMemoryCache<NSString *, NSNumber *> *costCache = [[SDMemoryCache alloc] initWithSegmentCount:8];
+    costCache.totalCostLimit = 1000;
+    [costCache setObject:@1 forKey:@"large" cost:900];
+    expect([costCache objectForKey:@"large"]).to.equal(@1);
+    expect(costCache.totalCost).to.equal(900);
+    // Going over the limit evicts from the segments holding more than their slice, never the object just stored
+    [costCache setObject:@2 forKey:@"small" cost:100];
+    [costCache setObject:@3 forKey:@"other" cost:100];
+    expect(costCache.totalCost).to.beLessThanOrEqualTo(1000);
+    expect(costCache.totalCount).to.beLessThan(3);
+    expect([costCache objectForKey:@"other"]).to.equal(@3);
+}
+
+- (void)test70RemovedDiskFilesLeaveTheEncodedDataTier {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Data tier follows the disk"];
+    SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"TestMemoryDataCacheRemoval"];
+    cache.config.shouldCacheImageDataInMemory = YES;
+    NSString *clearedKey = @"TestClearedDataKey.jpg";
+    NSString *expiredKey = @"TestExpiredDataKey.jpg";
+    NSData *imageData = [NSData dataWithContentsOfFile:[self testImagePath]];
+    UIImage *image = [UIImage imageWithData:imageData];
+    
+    [cache storeImage:image imageData:imageData forKey:clearedKey toDisk:YES completion:^{
+        [cache clearDiskOnCompletion:^{
+            // The decoded image is still in memory, but its data is not served any more
+            [cache queryCacheOperationForKey:clearedKey options:SDImageCacheQueryDataWhenInMemory done:^(UIImage * _Nullable cachedImage, NSData * _Nullable data, SDImageCacheType cacheType) {
+                expect(cachedImage).toNot.beNil();
+                expect(data).to.beNil();
+                
+                [cache storeImage:image imageData:imageData forKey:expiredKey toDisk:YES completion:^{
+                    // Everything is expired
+                    cache.config.maxCacheAge = -60;
+                    [cache deleteOldFilesWithCompletionBlock:^{
+                        [cache queryCacheOperationForKey:expiredKey options:SDImageCacheQueryDataWhenInMemory done:^(UIImage * _Nullable expiredImage, NSData * _Nullable expiredData, SDImageCacheType expiredCacheType) {
+                            expect(expiredImage).toNot.beNil();
+                            expect(expiredData).to.beNil();
+                            [cache clearMemory];
+                            [expectation fulfill];
+                        }];
+                    }];
+                }];
+            }];
+        }];
+    }];
+    [self waitForExpectationsWithCommonTimeout];
+}
+
+- (void)test71ClearDiskKeepsTheDownloadsInFlight {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Clear disk keeps the temporary directory"];
+    SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"TestClearDiskDownloads"];
+    NSString *downloadPath = [cache.temporaryDirectoryPath stringByAppendingPathComponent:@"TestDownload"];
+    [[NSFileManager defaultManager] createDirectoryAtPath:cache.temporaryDirectoryPath withIntermediateDirectories:YES attributes:nil error:nil];
+    [[NSData dataWithContentsOfFile:[self testImagePath]] writeToFile:downloadPath atomically:YES];
+    [cache storeImageDataToDisk:[NSData dataWithContentsOfFile:[self testImagePath]] forKey:kImageTestKey];
+    
+    [cache clearDiskOnCompletion:^{
+        expect([cache diskImageDataExistsWithKey:kImageTestKey]).to.beFalsy();
+        expect([[NSFileManager defaultManager] fileExistsAtPath:downloadPath]).to.beTruthy();
+        [[NSFileManager defaultManager] removeItemAtPath:downloadPath error:nil];
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithCommonTimeout];
+}
+
+- (void)test72ReadOnlyPathsAreSearchedUnderTheNamesTheyHold {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Read-only path lookup"];
+    NSString *key = @"TestReadOnlyLegacyNameKey.jpg";
+    SDImageCache *md5Cache = [[SDImageCache alloc] initWithNamespace:@"TestReadOnlyLegacyNameSeed"];
+    md5Cache.config.diskCacheFileNameHashType = SDImageCacheConfigFileNameHashTypeMD5;
+    NSString *readOnlyPath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"TestReadOnlyLegacyNames"];
+    [[NSFileManager defaultManager] createDirectoryAtPath:readOnlyPath withIntermediateDirectories:YES attributes:nil error:nil];
+    NSString *legacyFilePath = [readOnlyPath stringByAppendingPathComponent:[md5Cache defaultCachePathForKey:key].lastPathComponent];
+    [[NSData dataWithContentsOfFile:[self testImagePath]] writeToFile:legacyFilePath atomically:YES];
+    
+    SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"TestReadOnlyLegacyNames"];
+    cache.config.diskCacheFileNameHashType = SDImageCacheConfigFileNameHashTypeFast;
+    [cache clearDiskOnCompletion:^{
+        [cache addReadOnlyCachePath:readOnlyPath];
+        // The query runs after the directory is listed
+        [cache queryCacheOperationForKey:key done:^(UIImage * _Nullable image, NSData * _Nullable data, SDImageCacheType cacheType) {
+            expect(image).toNot.beNil();
+            expect(cacheType).to.equal(SDImageCacheTypeDisk);
+            [cache queryCacheOperationForKey:@"TestReadOnlyMissingKey.jpg" done:^(UIImage * _Nullable missingImage, NSData * _Nullable missingData, SDImageCacheType missingCacheType) {
+                expect(missingImage).to.beNil();
+                [[NSFileManager defaultManager] removeItemAtPath:readOnlyPath error:nil];
+                [cache clearMemory];
+                [expectation fulfill];
+            }];
+        }];
+    }];
+    [self waitForExpectationsWithCommonTimeout];
+}
+
+- (void)test73SingleLockMemoryCacheContentionWithCostLimit {
+    // Half of the keys fit, so the stores evict
+    [self measureMemoryCacheContentionWithSegmentCount:1 totalCostLimit:512];
+}
+
+- (void)test74StripedMemoryCacheContentionWithCostLimit {
+    [self measureMemoryCacheContentionWithSegmentCount:8 totalCostLimit:512];
+}
+
+- (void)test75ArchiveOfACacheHoldsThePackedAndBufferedEntries {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Archive of a cache"];
+    SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"TestCacheArchive"];
+    NSData *imageData = [NSData dataWithContentsOfFile:[self testImagePath]];
+    cache.config.shouldUseDiskPackStore = YES;
+    cache.config.diskPackStoreMaxEntrySize = imageData.length;
+    cache.config.diskWritePolicy = SDImageCacheConfigDiskWritePolicyBatched;
+    // Only the archive writes the buffer in this test
+    cache.config.diskWriteBatchDelay = 60;
+    NSArray<NSString *> *keys = @[@"TestCacheArchiveKey1.jpg", @"TestCacheArchiveKey2.jpg"];
+    NSString *archivePath = [NSTemporaryDirectory() stringByAppendingPathComponent:[@"TestCacheArchive" stringByAppendingPathExtension:SDImageCacheArchivePathExtension]];
+    
+    [cache clearDiskOnCompletion:^{
+        for (NSString *key in keys) {
+            [cache storeImage:[self imageForTesting] imageData:imageData forKey:key toDisk:YES completion:nil];
+        }
+        [cache writeArchiveToFile:archivePath completion:^(NSError * _Nullable error) {
+            expect(error).to.beNil();
+            SDImageCacheArchive *archive = [SDImageCacheArchive archiveWithContentsOfFile:archivePath];
+            expect(archive.count).to.equal(keys.count);
+            for (NSString *key in keys) {
+                expect([archive dataForName:[cache defaultCachePathForKey:key].lastPathComponent]).to.equal(imageData);
+            }
+            // The directory alone would miss the packed entries
+            NSError *directoryError;
+            expect([SDImageCacheArchive writeArchiveToFile:archivePath fromDirectory:cache.diskCachePath error:&directoryError]).to.beFalsy();
+            expect(directoryError).toNot.beNil();
+            [[NSFileManager defaultManager] removeItemAtPath:archivePath error:nil];
+            [cache clearDiskOnCompletion:^{
+                [expectation fulfill];
+            }];
+        }];
+    }];
+    [self waitForExpectationsWithCommonTimeout];
+}
+
+- (void)test76SizeVariantsDoNotShareTheKeysOfTheCache {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Size variant keys"];
+    SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"TestSizeVariantKeys"];
+    NSString *key = @"http://www.example.com/TestSizeVariantKeys.jpg";
+    // A real key which looks like the one of the 20x20 variant of the key above
+    NSString *fragmentKey = [key stringByAppendingString:@"#20x20"];
+    UIImage *fullImage = [UIImage imageWithContentsOfFile:[self testImagePath]];
+    [cache storeImage:fullImage forKey:key toDisk:NO completion:^{
+        [cache queryCacheOperationForKey:key pixelSize:CGSizeMake(20, 20) done:^(UIImage * _Nullable variant, NSData * _Nullable data, SDImageCacheType cacheType) {
+            expect(variant).toNot.beNil();
+            expect([cache imageFromMemoryCacheForKey:fragmentKey]).to.beNil();
+            UIImage *otherImage = [[UIImage alloc] initWithCGImage:fullImage.CGImage];
+            [cache storeImage:otherImage forKey:fragmentKey toDisk:NO completion:^{
+                expect([cache imageFromMemoryCacheForKey:fragmentKey]).to.equal(otherImage);
+                expect([cache imageFromMemoryCacheForKey:key pixelSize:CGSizeMake(20, 20)]).to.equal(variant);
+                [cache clearMemory];
+                [expectation fulfill];
+            }];
+        }];
+    }];
+    [self waitForExpectationsWithCommonTimeout];
+    
+    // The removal block follows the evictions too, so the sizes of evicted variants are forgotten
+    SDMemoryCache<NSString *, NSNumber *> *memoryCache = [[SDMemoryCache alloc] initWithSegmentCount:4];
+    NSMutableArray<NSString *> *removedKeys = [NSMutableArray array];
+    memoryCache.removalBlock = ^(NSString * _Nonnull removedKey) {
+        @synchronized (removedKeys) {
+            [removedKeys addObject:removedKey];
+        }
+    };
+    memoryCache.countLimit = 1;
+    [memoryCache setObject:@1 forKey:@"key1"];
+    [memoryCache setObject:@2 forKey:@"key2"];
+    [memoryCache removeObjectForKey:@"key2"];
+    expect(removedKeys).to.equal((@[@"key1", @"key2"]));
+}
+
+- (void)test77PackSegmentsFullOfDeadRecordsAreCompacted {
+    NSString *directory = [NSTemporaryDirectory() stringByAppendingPathComponent:@"TestPackStoreCompaction"];
+    [[NSFileManager defaultManager] removeItemAtPath:directory error:nil];
+    // A record of a one letter name and a three byte payload takes 20 bytes, so a segment holds two
+    SDImageCachePackStore *store = [[SDImageCachePackStore alloc] initWithDirectory:directory segmentSize:40];
+    NSData *oldData = [@"old" dataUsingEncoding:NSUTF8StringEncoding];
+    NSData *newData = [@"new" dataUsingEncoding:NSUTF8StringEncoding];
+    [store storeData:oldData forName:@"a"];
+    [store storeData:oldData forName:@"b"];
+    [store storeData:newData forName:@"b"];
+    [store storeData:oldData forName:@"c"];
+    [store storeData:newData forName:@"z"];
+    expect([store segmentURLs].count).to.equal(3);
+    expect(store.totalSize).to.equal(100);
+
+    // Half of the first segment is the replaced record, its live record moves to the current segment
+    expect([store compactSegmentsWithDeadRatio:0.5]).to.equal(1);
+    expect([store segmentURLs].count).to.equal(2);
+    expect(store.totalSize).to.equal(80);
+    expect([store dataForName:@"a"]).to.equal(oldData);
+    // The removal seals the current segment, then half of the second one is dead
+    [store removeDataForName:@"c"];
+    expect([store compactSegmentsWithDeadRatio:0.5]).to.equal(1);
+    expect([store dataForName:@"b"]).to.equal(newData);
+
+    SDImageCachePackStore *relaunchedStore = [[SDImageCachePackStore alloc] initWithDirectory:directory segmentSize:40];
+    expect(relaunchedStore.entryCount).to.equal(3);
+    expect([relaunchedStore dataForName:@"a"]).to.equal(oldData);
+    expect([relaunchedStore dataForName:@"b"]).to.equal(newData);
+    expect([relaunchedStore dataForName:@"z"]).to.equal(newData);
+    expect([relaunchedStore containsDataForName:@"c"]).to.beFalsy();
+    [relaunchedStore removeAllData];
+}
+
+- (void)test78PackSegmentAccessDatesSurviveARelaunch {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Pack segment access dates"];
+    NSString *key = @"TestPackAccessDatesKey.jpg";
+    NSData *imageData = [NSData dataWithContentsOfFile:[self testImagePath]];
+    SDImageCache *(^makeCache)(void) = ^SDImageCache *{
+        SDImageCache *cache = [[SDImageCache alloc] initWithNamespace:@"TestPackAccessDates"];
+        cache.config.shouldUseDiskPackStore = YES;
+        cache.config.diskPackStoreMaxEntrySize = imageData.length;
+        cache.config.diskCacheExpireType = SDImageCacheConfigExpireTypeAccessDate;
+        cache.config.maxCacheAge = 60 * 60 * 24;
+        return cache;
+    };
+    SDImageCache *cache = makeCache();
+    [cache clearDiskOnCompletion:^{
+        [cache storeImage:[self imageForTesting] imageData:imageData forKey:key toDisk:YES completion:^{
+            expect([cache imageFromDiskCacheForKey:key]).toNot.beNil();
+            // Written long ago, but read just now
+            NSString *packPath = [cache.diskCachePath stringByAppendingPathComponent:@".pack"];
+            for (NSString *segmentName in [[NSFileManager defaultManager] contentsOfDirectoryAtPath:packPath error:nil]) {
+                [[NSFileManager defaultManager] setAttributes:@{NSFileModificationDate: [NSDate dateWithTimeIntervalSinceNow:-60 * 60 * 48]}
+                                                 ofItemAtPath:[packPath stringByAppendingPathComponent:segmentName]
+                                                        error:nil];
+            }
+            [cache deleteOldFilesWithCompletionBlock:^{
+                // Only the disk index remembers the read after a relaunch
+                SDImageCache *relaunchedCache = makeCache();
+                [relaunchedCache deleteOldFilesWithCompletionBlock:^{
+                    expect([relaunchedCache diskImageDataExistsWithKey:key]).to.beTruthy();
+                    [relaunchedCache clearDiskOnCompletion:^{
+                        [expectation fulfill];
+                    }];
+                }];
+            }];
+        }];
+    }];
+    [self waitForExpectationsWithCommonTimeout];
+}
+
 #pragma mark Helper methods
 
+// A screen of 40 images shown again and again, while a prefetch goes through 2000 images seen once. The cache holds 100 images
+- (NSUInteger)memoryCacheHitsReplayingScanTraceWithAdmissionPolicy:(SDMemoryCacheAdmissionPolicy)admissionPolicy {
+    SDMemoryCache<NSString *, NSObject *> *memoryCache = [SDMemoryCache new];
+    memoryCache.countLimit = 100;
+    memoryCache.admissionPolicy = admissionPolicy;
+    NSUInteger hits = 0;
+    for (NSUInteger i = 0; i < 2000; i++) {
+        // Evicted objects must be deallocated, or the weak cache would bring them back
+        @autoreleasepool {
+            NSString *key = (i % 4 == 0) ? [NSString stringWithFormat:@"screen%lu", (unsigned long)(i / 4 % 40)] : [NSString stringWithFormat:@"prefetch%lu", (unsigned long)i];
+            if ([memoryCache objectForKey:key]) {
+                hits++;
+            } else {
+                [memoryCache setObject:[NSObject new] forKey:key];
+            }
+        }
+    }
+    return hits;
+}
+
+// Log the throughput at 1 to 16 threads, then measure the 16 threads case
+- (void)measureMemoryCacheContentionWithSegmentCount:(NSUInteger)segmentCount totalCostLimit:(NSUInteger)totalCostLimit {
+    SDMemoryCache<NSString *, NSNumber *> *memoryCache = [[SDMemoryCache alloc] initWithSegmentCount:segmentCount];
+    memoryCache.totalCostLimit = totalCostLimit;
+    NSUInteger keyCount = 1024;
+    NSUInteger operationCount = 20000;
+    NSMutableArray<NSString *> *keys = [NSMutableArray arrayWithCapacity:keyCount];
+    for (NSUInteger i = 0; i < keyCount; i++) {
+        [keys addObject:[NSString stringWithFormat:@"http://www.example.com/image%lu.jpg", (unsigned long)i]];
+    }
+    // Mostly reads, as in a scrolling list
+    void (^runThreads)(NSUInteger) = ^(NSUInteger threadCount) {
+        dispatch_apply(threadCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t thread) {
+            for (NSUInteger i = 0; i < operationCount; i++) {
+                NSString *key = keys[(i * 31 + thread * 7) % keyCount];
+                if (i % 8 == 0) {
+                    [memoryCache setObject:@(i) forKey:key cost:1];
+                } else {
+                    [memoryCache objectForKey:key];
+                }
+            }
+        });
+    };
+    for (NSUInteger threadCount = 1; threadCount <= 16; threadCount *= 2) {
+        CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+        runThreads(threadCount);
+        CFAbsoluteTime duration = CFAbsoluteTimeGetCurrent() - start;
+        NSLog(@"%lu segment(s), cost limit %lu, %2lu threads: %.0f operations/s", (unsigned long)segmentCount, (unsigned long)totalCostLimit, (unsigned long)threadCount, threadCount * operationCount / duration);
+    }
+    [self measureBlock:^{
+        runThreads(16);
+    }];
+}
+
 - (UIImage *)imageForTesting{
     static UIImage *reusableImage = nil;
     if (!reusableImage) {
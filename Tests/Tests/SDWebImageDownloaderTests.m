@@ -11,6 +11,7 @@
 #import <SDWebImage/SDWebImageDownloader.h>
 #import <SDWebImage/SDWebImageDownloaderOperation.h>
 #import <SDWebImage/SDWebImageCodersManager.h>
+#import <SDWebImage/SDWebImageDownloaderBuffer.h>
 #import "SDWebImageTestDecoder.h"
 
 /**
@@ -26,6 +27,10 @@
                                            createCallback:(SDWebImageDownloaderOperation *(^)(void))createCallback;
 @end
 
+@interface SDWebImageDownloadToken ()
+@property (nonatomic, weak, nullable) NSOperation<SDWebImageDownloaderOperationInterface> *downloadOperation;
+@end
+
 /**
  *  A class that fits the NSOperation+SDWebImageDownloaderOperationInterface requirement so we can test
  */
@@ -385,4 +390,280 @@
     [downloader invalidateSessionAndCancel:YES];
 }
 
+- (void)test23ThatDownloadPriorityCanBeChangedWhileQueued {
+    SDWebImageDownloader *downloader = [[SDWebImageDownloader alloc] init];
+    downloader.executionOrder = SDWebImageDownloaderLIFOExecutionOrder;
+    [downloader setSuspended:YES];
+    NSURL *imageURL = [NSURL URLWithString:kTestJpegURL];
+    NSURL *otherImageURL = [NSURL URLWithString:kTestPNGURL];
+    
+    SDWebImageDownloadToken *prefetchToken = [downloader downloadImageWithURL:imageURL options:SDWebImageDownloaderLowPriority progress:nil completed:nil];
+    [downloader downloadImageWithURL:otherImageURL options:0 progress:nil completed:nil];
+    NSOperation *operation = prefetchToken.downloadOperation;
+    expect(prefetchToken.priority).to.equal(SDWebImageDownloaderPriorityLow);
+    expect(operation.queuePriority).to.equal(NSOperationQueuePriorityLow);
+    
+    // Another caller shares the download and raises it
+    SDWebImageDownloadToken *visibleToken = [downloader downloadImageWithURL:imageURL options:0 progress:nil completed:nil];
+    visibleToken.priority = SDWebImageDownloaderPriorityVisible;
+    expect(visibleToken.downloadOperation).to.equal(operation);
+    expect(operation.queuePriority).to.equal(NSOperationQueuePriorityVeryHigh);
+    
+    // It goes back to the highest priority left when that caller is gone
+    [downloader cancel:visibleToken];
+    expect(operation.isCancelled).to.beFalsy();
+    expect(operation.queuePriority).to.equal(NSOperationQueuePriorityLow);
+    prefetchToken.priority = SDWebImageDownloaderPriorityPrefetch;
+    expect(operation.queuePriority).to.equal(NSOperationQueuePriorityVeryLow);
+    
+    [downloader cancelAllDownloads];
+    [downloader invalidateSessionAndCancel:YES];
+}
+
+- (void)test24ThatConcurrencyControllerFindsTheWindowOfAShapedLink {
+    SDWebImageDownloaderConcurrencyController *controller = [SDWebImageDownloaderConcurrencyController new];
+    expect(controller.window).to.equal(6);
+    
+    // A 1MB/s link with a 50ms round trip, which queues the requests beyond 4 at once, downloading 100KB images
+    double capacity = 1000 * 1000;
+    int64_t imageBytes = 100 * 1000;
+    NSUInteger smallestWindow = NSUIntegerMax;
+    NSUInteger largestWindow = 0;
+    for (NSUInteger i = 0; i < 500; i++) {
+        NSUInteger window = controller.window;
+        smallestWindow = MIN(smallestWindow, window);
+        largestWindow = MAX(largestWindow, window);
+        NSTimeInterval timeToFirstByte = 0.05 * MAX(1, window / 4.0);
+        NSTimeInterval duration = timeToFirstByte + imageBytes * window / capacity;
+        [controller recordDownloadWithReceivedBytes:imageBytes timeToFirstByte:timeToFirstByte duration:duration error:nil downloadCount:window];
+    }
+    // It grows until the time to first byte doubles, then backs off by half
+    expect(largestWindow).to.equal(13);
+    expect(smallestWindow).to.equal(6);
+    expect(controller.throughput).to.beGreaterThan(capacity * 0.8);
+    expect(controller.minimumTimeToFirstByte).to.beCloseToWithin(0.075, 0.001);
+    expect(controller.sampleCount).to.equal(500);
+    
+    // A link without queueing lets it grow to its bound, when the downloads fill the window
+    SDWebImageDownloaderConcurrencyController *boundedController = [[SDWebImageDownloaderConcurrencyController alloc] initWithMinimumWindow:2 maximumWindow:10];
+    for (NSUInteger i = 0; i < 200; i++) {
+        [boundedController recordDownloadWithReceivedBytes:imageBytes timeToFirstByte:0.05 duration:0.15 error:nil downloadCount:1];
+    }
+    expect(boundedController.window).to.equal(6);
+    for (NSUInteger i = 0; i < 200; i++) {
+        [boundedController recordDownloadWithReceivedBytes:imageBytes timeToFirstByte:0.05 duration:0.15 error:nil downloadCount:boundedController.window];
+    }
+    expect(boundedController.window).to.equal(10);
+    
+    // Timeouts halve it once per round, down to the lower bound
+    NSError *timeout = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorTimedOut userInfo:nil];
+    [boundedController recordDownloadWithReceivedBytes:0 timeToFirstByte:0 duration:15 error:timeout downloadCount:10];
+    [boundedController recordDownloadWithReceivedBytes:0 timeToFirstByte:0 duration:15 error:timeout downloadCount:10];
+    expect(boundedController.window).to.equal(5);
+    for (NSUInteger i = 0; i < 5; i++) {
+        [boundedController recordDownloadWithReceivedBytes:imageBytes timeToFirstByte:0.05 duration:0.15 error:nil downloadCount:1];
+        [boundedController recordDownloadWithReceivedBytes:0 timeToFirstByte:0 duration:15 error:timeout downloadCount:10];
+    }
+    expect(boundedController.window).to.equal(2);
+    
+    // Applied to the download queue
+    SDWebImageDownloader *downloader = [[SDWebImageDownloader alloc] init];
+    downloader.concurrencyController = boundedController;
+    expect(downloader.maxConcurrentDownloads).to.equal(2);
+    [downloader invalidateSessionAndCancel:YES];
+}
+
+- (void)test25ThatHostsTakeTurnsWithinTheirBudgets {
+    SDWebImageDownloader *downloader = [[SDWebImageDownloader alloc] init];
+    [downloader setSuspended:YES];
+    downloader.maxConcurrentDownloads = 0;
+    for (NSUInteger i = 0; i < 3; i++) {
+        [downloader downloadImageWithURL:[NSURL URLWithString:[NSString stringWithFormat:@"http://slow.example.com/%lu.jpg", (unsigned long)i]] options:0 progress:nil completed:nil];
+        [downloader downloadImageWithURL:[NSURL URLWithString:[NSString stringWithFormat:@"http://CDN.example.com/%lu.jpg", (unsigned long)i]] options:0 progress:nil completed:nil];
+    }
+    expect(downloader.currentDownloadCount).to.equal(6);
+    expect([downloader statisticsForHost:@"slow.example.com"].queuedCount).to.equal(3);
+    
+    // The free slots go to each host in turn
+    downloader.maxConcurrentDownloads = 4;
+    expect([downloader statisticsForHost:@"slow.example.com"].inFlightCount).to.equal(2);
+    expect([downloader statisticsForHost:@"cdn.example.com"].inFlightCount).to.equal(2);
+    
+    // A host at its budget leaves the slots to the others
+    [downloader setMaxConcurrentDownloads:2 forHost:@"slow.example.com"];
+    downloader.maxConcurrentDownloads = 5;
+    SDWebImageDownloaderHostStatistics *slowStatistics = [downloader statisticsForHost:@"slow.example.com"];
+    expect(slowStatistics.inFlightCount).to.equal(2);
+    expect(slowStatistics.queuedCount).to.equal(1);
+    expect(slowStatistics.maxConcurrentDownloads).to.equal(2);
+    SDWebImageDownloaderHostStatistics *cdnStatistics = [downloader statisticsForHost:@"cdn.example.com"];
+    expect(cdnStatistics.inFlightCount).to.equal(3);
+    expect(cdnStatistics.queuedCount).to.equal(0);
+    expect(cdnStatistics.maxConcurrentDownloads).to.equal(0);
+    expect([downloader hostStatistics].count).to.equal(2);
+    expect([downloader statisticsForHost:@"other.example.com"]).to.beNil();
+    
+    [downloader cancelAllDownloads];
+    [downloader invalidateSessionAndCancel:YES];
+}
+
+- (void)test26ThatDownloadCanBeStreamedToFile {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Download streamed to file"];
+    SDWebImageDownloader *downloader = [[SDWebImageDownloader alloc] init];
+    NSString *directory = [NSTemporaryDirectory() stringByAppendingPathComponent:@"TestStreamToFile"];
+    downloader.downloadDirectory = directory;
+    NSURL *imageURL = [NSURL URLWithString:kTestJpegURL];
+    __block SDWebImageDownloadToken *token;
+    token = [downloader downloadImageWithURL:imageURL options:SDWebImageDownloaderStreamToFile progress:nil completed:^(UIImage * _Nullable image, NSData * _Nullable data, NSError * _Nullable error, BOOL finished) {
+        expect(image).toNot.beNil();
+        expect(error).to.beNil();
+        NSString *path = token.downloadedFilePath;
+        expect([path stringByDeletingLastPathComponent]).to.equal(directory);
+        // The data is mapped from the file
+        expect([NSData dataWithContentsOfFile:path]).to.equal(data);
+        [expectation fulfill];
+    }];
+    expect(token).toNot.beNil();
+    [self waitForExpectationsWithCommonTimeout];
+    [downloader invalidateSessionAndCancel:YES];
+}
+
+- (void)test27ThatProgressiveSnapshotsShareTheBuffer {
+    // 1MB received in chunks of 16KB, with a snapshot for the progressive decoding after each chunk
+    NSUInteger totalLength = 1024 * 1024;
+    NSUInteger chunkLength = 16 * 1024;
+    NSMutableData *payload = [NSMutableData dataWithLength:totalLength];
+    arc4random_buf(payload.mutableBytes, totalLength);
+    
+    // Before: the received data was appended to a mutable data, copied for each snapshot
+    NSUInteger mutableDataCopiedLength = 0;
+    NSMutableData *mutableData = [NSMutableData dataWithCapacity:totalLength];
+    for (NSUInteger offset = 0; offset < totalLength; offset += chunkLength) {
+        [mutableData appendData:[payload subdataWithRange:NSMakeRange(offset, chunkLength)]];
+        mutableDataCopiedLength += chunkLength;
+        NSData *snapshot = [mutableData copy];
+        mutableDataCopiedLength += snapshot.length;
+    }
+    
+    SDWebImageDownloaderBuffer *buffer = [[SDWebImageDownloaderBuffer alloc] initWithCapacity:totalLength];
+    NSData *firstSnapshot = nil;
+    NSData *snapshot = nil;
+    for (NSUInteger offset = 0; offset < totalLength; offset += chunkLength) {
+        [buffer appendData:[payload subdataWithRange:NSMakeRange(offset, chunkLength)]];
+        snapshot = [buffer snapshot];
+        if (!firstSnapshot) {
+            firstSnapshot = snapshot;
+        }
+    }
+    // Without the expected size, the storage doubles as it fills
+    SDWebImageDownloaderBuffer *unknownSizeBuffer = [[SDWebImageDownloaderBuffer alloc] initWithCapacity:0];
+    for (NSUInteger offset = 0; offset < totalLength; offset += chunkLength) {
+        [unknownSizeBuffer appendData:[payload subdataWithRange:NSMakeRange(offset, chunkLength)]];
+        [unknownSizeBuffer snapshot];
+    }
+    NSLog(@"Bytes copied per MB downloaded, mutable data: %lu, buffer: %lu, buffer of unknown size: %lu", (unsigned long)mutableDataCopiedLength, (unsigned long)buffer.copiedLength, (unsigned long)unknownSizeBuffer.copiedLength);
+    
+    expect(mutableDataCopiedLength).to.beGreaterThan(totalLength * 32);
+    expect(buffer.copiedLength).to.equal(totalLength);
+    expect(unknownSizeBuffer.copiedLength).to.beLessThan(totalLength * 2);
+    expect(snapshot).to.equal(payload);
+    expect([unknownSizeBuffer snapshot]).to.equal(payload);
+    // The snapshots point into the same storage, and the first one did not see the later chunks
+    expect(snapshot.bytes == firstSnapshot.bytes).to.beTruthy();
+    expect(firstSnapshot).to.equal([payload subdataWithRange:NSMakeRange(0, chunkLength)]);
+}
+
+- (void)test28ThatCancellingAQueuedDownloadReleasesItsURL {
+    SDWebImageDownloader *downloader = [[SDWebImageDownloader alloc] init];
+    [downloader setSuspended:YES];
+    downloader.maxConcurrentDownloads = 0;
+    NSURL *imageURL = [NSURL URLWithString:@"http://www.example.com/queued.jpg"];
+    SDWebImageDownloadToken *token = [downloader downloadImageWithURL:imageURL options:0 progress:nil completed:nil];
+    NSOperation *operation = token.downloadOperation;
+    expect([downloader statisticsForHost:@"www.example.com"].queuedCount).to.equal(1);
+    
+    // Cancelled through the token, the queued operation is handed to the queue to finish
+    [token cancel];
+    expect(operation.isCancelled).to.beTruthy();
+    expect([downloader statisticsForHost:@"www.example.com"].queuedCount).to.equal(0);
+    
+    // A new request does not attach to the cancelled operation
+    SDWebImageDownloadToken *newToken = [downloader downloadImageWithURL:imageURL options:0 progress:nil completed:nil];
+    expect(newToken.downloadOperation).toNot.equal(operation);
+    expect(newToken.downloadOperation.isCancelled).to.beFalsy();
+    
+    [downloader cancelAllDownloads];
+    [downloader invalidateSessionAndCancel:YES];
+}
+
+- (void)test29ThatQueuedDownloadsFollowTheirPriorityAndIdleHostsAreForgotten {
+    SDWebImageDownloader *downloader = [[SDWebImageDownloader alloc] init];
+    [downloader setSuspended:YES];
+    downloader.maxConcurrentDownloads = 0;
+    SDWebImageDownloadToken *firstToken = [downloader downloadImageWithURL:[NSURL URLWithString:@"http://www.example.com/1.jpg"] options:0 progress:nil completed:nil];
+    SDWebImageDownloadToken *secondToken = [downloader downloadImageWithURL:[NSURL URLWithString:@"http://www.example.com/2.jpg"] options:0 progress:nil completed:nil];
+    
+    // Raised while queued, the second download takes the first slot
+    secondToken.priority = SDWebImageDownloaderPriorityVisible;
+    downloader.maxConcurrentDownloads = 1;
+    expect([downloader.downloadQueue.operations containsObject:secondToken.downloadOperation]).to.beTruthy();
+    expect([downloader.downloadQueue.operations containsObject:firstToken.downloadOperation]).to.beFalsy();
+    
+    // A budget keeps a host, an idle host without one is dropped
+    [downloader setMaxConcurrentDownloads:2 forHost:@"idle.example.com"];
+    expect([downloader statisticsForHost:@"idle.example.com"]).toNot.beNil();
+    [downloader setMaxConcurrentDownloads:0 forHost:@"idle.example.com"];
+    expect([downloader statisticsForHost:@"idle.example.com"]).to.beNil();
+    
+    [downloader cancelAllDownloads];
+    [downloader invalidateSessionAndCancel:YES];
+}
+
+- (void)test30ThatOnlyTheSameConditionalRequestsShareADownload {
+    SDWebImageDownloader *downloader = [[SDWebImageDownloader alloc] init];
+    [downloader setSuspended:YES];
+    downloader.maxConcurrentDownloads = 0;
+    NSURL *imageURL = [NSURL URLWithString:@"http://www.example.com/conditional.jpg"];
+    SDHTTPHeadersDictionary *validators = @{@"If-None-Match" : @"\"v1\""};
+    SDWebImageDownloadToken *conditionalToken = [downloader downloadImageWithURL:imageURL options:0 HTTPHeaders:validators progress:nil completed:nil];
+    
+    // A caller without validators must not get the 304 of the conditional request
+    SDWebImageDownloadToken *plainToken = [downloader downloadImageWithURL:imageURL options:0 progress:nil completed:nil];
+    expect(plainToken.downloadOperation).toNot.equal(conditionalToken.downloadOperation);
+    
+    // The same validators share the download
+    SDWebImageDownloadToken *sameToken = [downloader downloadImageWithURL:imageURL options:0 HTTPHeaders:validators progress:nil completed:nil];
+    expect(sameToken.downloadOperation).to.equal(conditionalToken.downloadOperation);
+    
+    [downloader cancelAllDownloads];
+    [downloader invalidateSessionAndCancel:YES];
+}
+
+- (void)test31ThatABogusExpectedSizeDoesNotAllocateTheBuffer {
+    // A Content-Length no allocation can satisfy
+    SDWebImageDownloaderBuffer *buffer = [[SDWebImageDownloaderBuffer alloc] initWithCapacity:NSUIntegerMax / 2];
+    NSData *data = [@"image bytes" dataUsingEncoding:NSUTF8StringEncoding];
+    expect([buffer appendData:data]).to.beTruthy();
+    expect(buffer.length).to.equal(data.length);
+    expect([buffer snapshot]).to.equal(data);
+}
+
+- (void)test32ThatPrefetchDownloadsWaitForTheLowPriorityOnes {
+    SDWebImageDownloader *downloader = [[SDWebImageDownloader alloc] init];
+    [downloader setSuspended:YES];
+    downloader.maxConcurrentDownloads = 0;
+    // As the prefetcher asks, with its default options
+    SDWebImageDownloadToken *prefetchToken = [downloader downloadImageWithURL:[NSURL URLWithString:@"http://www.example.com/prefetch.jpg"] options:SDWebImageDownloaderLowPriority | SDWebImageDownloaderPrefetchPriority progress:nil completed:nil];
+    SDWebImageDownloadToken *lowToken = [downloader downloadImageWithURL:[NSURL URLWithString:@"http://www.example.com/low.jpg"] options:SDWebImageDownloaderLowPriority progress:nil completed:nil];
+    expect(prefetchToken.priority).to.equal(SDWebImageDownloaderPriorityPrefetch);
+    expect(lowToken.priority).to.equal(SDWebImageDownloaderPriorityLow);
+    
+    downloader.maxConcurrentDownloads = 1;
+    expect([downloader.downloadQueue.operations containsObject:lowToken.downloadOperation]).to.beTruthy();
+    expect([downloader.downloadQueue.operations containsObject:prefetchToken.downloadOperation]).to.beFalsy();
+    
+    [downloader cancelAllDownloads];
+    [downloader invalidateSessionAndCancel:YES];
+}
+
 @end
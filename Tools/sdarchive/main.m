@@ -0,0 +1,66 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+/*
+ * sdarchive - build and inspect the read-only cache archives opened by `-[SDImageCache addReadOnlyCachePath:]`.
+ *
+ * Usage:
+ *   sdarchive create <archive.sdarchive> <cache directory>
+ *   sdarchive list <archive.sdarchive>
+ *
+ * The cache directory is the `diskCachePath` of an `SDImageCache` filled with the images to ship, so the file names match the keys.
+ * Fill it with the pack store off and flush the buffered stores first: the tool only reads the cache files, and fails on a directory holding packed entries.
+ * Otherwise write the archive from the app with `-[SDImageCache writeArchiveToFile:completion:]`.
+ * Build on macOS with:
+ *   clang -fobjc-arc -framework Foundation -framework AppKit -I SDWebImage Tools/sdarchive/main.m SDWebImage/SDImageCacheArchive.m -o sdarchive
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDImageCacheArchive.h"
+
+// The tool only links the archive, not the rest of the library
+NSString * const SDWebImageErrorDomain = @"SDWebImageErrorDomain";
+
+static void SDArchivePrintUsage(void) {
+    fprintf(stderr, "usage: sdarchive create <archive.%s> <cache directory>\n", SDImageCacheArchivePathExtension.UTF8String);
+    fprintf(stderr, "       sdarchive list <archive.%s>\n", SDImageCacheArchivePathExtension.UTF8String);
+}
+
+int main(int argc, const char * argv[]) {
+    @autoreleasepool {
+        if (argc < 3) {
+            SDArchivePrintUsage();
+            return 1;
+        }
+        NSString *command = @(argv[1]);
+        NSString *archivePath = @(argv[2]);
+        if ([command isEqualToString:@"create"] && argc == 4) {
+            NSError *error;
+            if (![SDImageCacheArchive writeArchiveToFile:archivePath fromDirectory:@(argv[3]) error:&error]) {
+                fprintf(stderr, "sdarchive: %s\n", error.localizedDescription.UTF8String);
+                return 1;
+            }
+            SDImageCacheArchive *archive = [SDImageCacheArchive archiveWithContentsOfFile:archivePath];
+            printf("%lu entries written to %s\n", (unsigned long)archive.count, archivePath.UTF8String);
+            return 0;
+        }
+        if ([command isEqualToString:@"list"] && argc == 3) {
+            SDImageCacheArchive *archive = [SDImageCacheArchive archiveWithContentsOfFile:archivePath];
+            if (!archive) {
+                fprintf(stderr, "sdarchive: %s is not a valid archive\n", archivePath.UTF8String);
+                return 1;
+            }
+            for (NSString *name in [[archive allNames] sortedArrayUsingSelector:@selector(compare:)]) {
+                printf("%10lu  %s\n", (unsigned long)[archive dataForName:name].length, name.UTF8String);
+            }
+            return 0;
+        }
+        SDArchivePrintUsage();
+        return 1;
+    }
+}